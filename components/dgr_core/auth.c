@@ -0,0 +1,65 @@
+#include <string.h>
+#include "auth.h"
+
+/**
+ * Derives the AES key from the serial number of the transmitter, "00" and the
+ * serial number twice.
+ *
+ * @param transmitter_id    Serial number of AUTH_ID_LENGTH characters
+ * @param key               Output
+ */
+void
+dgr_auth_make_key(const char *transmitter_id, uint8_t key[AUTH_KEY_SIZE]) {
+    key[0] = '0';
+    key[1] = '0';
+    memcpy(&key[2], transmitter_id, AUTH_ID_LENGTH);
+    memcpy(&key[AUTH_KEY_SIZE / 2], key, AUTH_KEY_SIZE / 2);
+}
+
+/**
+ * Draws a new token for AuthRequestTx.
+ */
+void
+dgr_auth_new_token(uint8_t token[AUTH_TOKEN_SIZE]) {
+    dgr_platform_random(token, AUTH_TOKEN_SIZE);
+}
+
+/**
+ * Hashes a token or challenge with the key set by dgr_platform_aes_set_key.
+ *
+ * @param in                Token or challenge
+ * @param out               Output of the hash
+ * @return                  false if the encryption failed
+ */
+bool
+dgr_auth_hash(const uint8_t in[AUTH_TOKEN_SIZE], uint8_t out[AUTH_TOKEN_SIZE]) {
+    uint8_t block[PLATFORM_AES_BLOCK];
+    uint8_t encrypted[PLATFORM_AES_BLOCK];
+
+    memcpy(block, in, AUTH_TOKEN_SIZE);
+    memcpy(&block[AUTH_TOKEN_SIZE], in, AUTH_TOKEN_SIZE);
+    if(!dgr_platform_aes_encrypt(block, encrypted)) {
+        return false;
+    }
+
+    memcpy(out, encrypted, AUTH_TOKEN_SIZE);
+    return true;
+}
+
+/**
+ * Draws and hashes the token for the next AuthRequestTx unless one is already
+ * staged. A staged token is only dropped by the caller once it was sent.
+ *
+ * @param next              Staged token
+ * @return                  false if the encryption failed
+ */
+bool
+dgr_auth_stage_token(auth_token *next) {
+    if(next->ready) {
+        return true;
+    }
+
+    dgr_auth_new_token(next->token);
+    next->ready = dgr_auth_hash(next->token, next->hash);
+    return next->ready;
+}
@@ -0,0 +1,32 @@
+#ifndef DGR_AUTH_H
+#define DGR_AUTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dgr_platform.h"
+
+/* Authentication with the transmitter. The reader sends a random token, the
+ * transmitter answers with the hash of the token and a challenge, the reader
+ * returns the hash of the challenge. The hash is the first half of the AES-128
+ * encryption of the value written twice, the key is derived from the serial
+ * number of the transmitter.
+ */
+
+#define AUTH_KEY_SIZE               16
+#define AUTH_TOKEN_SIZE             8
+#define AUTH_ID_LENGTH              6 // serial number of the transmitter
+
+// token for the next AuthRequestTx, drawn and hashed before the connection is up
+typedef struct auth_token {
+    bool ready;
+    uint8_t token[AUTH_TOKEN_SIZE];
+    uint8_t hash[AUTH_TOKEN_SIZE];
+} auth_token;
+
+void dgr_auth_make_key(const char *transmitter_id, uint8_t key[AUTH_KEY_SIZE]);
+void dgr_auth_new_token(uint8_t token[AUTH_TOKEN_SIZE]);
+bool dgr_auth_hash(const uint8_t in[AUTH_TOKEN_SIZE], uint8_t out[AUTH_TOKEN_SIZE]);
+bool dgr_auth_stage_token(auth_token *next);
+
+#endif
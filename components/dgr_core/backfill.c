@@ -0,0 +1,149 @@
+#include <string.h>
+#include "backfill.h"
+
+static void
+dgr_backfill_decode(const uint8_t *record, reading *r) {
+    r->timestamp = record[0] | (uint32_t) record[1] << 8U | (uint32_t) record[2] << 16U |
+                   (uint32_t) record[3] << 24U;
+    r->glucose = record[4] | (uint16_t) record[5] << 8U;
+    r->calibration_state = record[6];
+    r->trend = record[7];
+}
+
+static void
+dgr_backfill_pass(backfill_parser *parser, const uint8_t *record, backfill_record_cb cb, void *arg) {
+    reading r;
+
+    dgr_backfill_decode(record, &r);
+    parser->records++;
+    parser->last_timestamp = r.timestamp;
+    cb(&r, arg);
+}
+
+/**
+ * Parses the records of the notification with the expected sequence number.
+ */
+static void
+dgr_backfill_parse(backfill_parser *parser, const uint8_t *data, size_t length, backfill_record_cb cb, void *arg) {
+    size_t pos = data[0] == 1 ? BACKFILL_FIRST_HEADER : BACKFILL_HEADER;
+
+    parser->next_sequence++;
+    if(data[0] == 1) {
+        parser->request_counter = data[2] | (uint16_t) data[3] << 8U;
+    }
+
+    // complete the record split by the previous notification
+    if(parser->carried > 0) {
+        size_t missing = BACKFILL_RECORD_SIZE - parser->carried;
+
+        if(length - pos < missing) {
+            memcpy(&parser->carry[parser->carried], &data[pos], length - pos);
+            parser->carried += length - pos;
+            return;
+        }
+
+        memcpy(&parser->carry[parser->carried], &data[pos], missing);
+        pos += missing;
+        parser->carried = 0;
+        dgr_backfill_pass(parser, parser->carry, cb, arg);
+    }
+
+    for(; length - pos >= BACKFILL_RECORD_SIZE; pos += BACKFILL_RECORD_SIZE) {
+        dgr_backfill_pass(parser, &data[pos], cb, arg);
+    }
+
+    memcpy(parser->carry, &data[pos], length - pos);
+    parser->carried = length - pos;
+}
+
+/**
+ * Prepares the parser for the first backfill request of a connection.
+ * Notifications are dropped until dgr_backfill_resume is called.
+ */
+void
+dgr_backfill_init(backfill_parser *parser) {
+    memset(parser, 0, sizeof *parser);
+    parser->next_sequence = 1;
+    parser->stale = true;
+}
+
+/**
+ * Prepares the parser for a repeated request after a gap. The buffered
+ * notifications and the split record are dropped, the counters are kept.
+ * Notifications are dropped until dgr_backfill_resume is called.
+ */
+void
+dgr_backfill_restart(backfill_parser *parser) {
+    parser->next_sequence = 1;
+    parser->carried = 0;
+    parser->pending = 0;
+    parser->stale = true;
+    memset(parser->window_length, 0, sizeof parser->window_length);
+}
+
+/**
+ * Accepts notifications again after the transmitter confirmed a repeated request.
+ */
+void
+dgr_backfill_resume(backfill_parser *parser) {
+    parser->stale = false;
+}
+
+/**
+ * Parses a backfill notification and passes every completed record on.
+ *
+ * @param parser            Parser
+ * @param data              Notification
+ * @param length            Length of the notification
+ * @param cb                Function called for every record
+ * @param arg               Argument of the function
+ * @return                  What happened to the notification, see backfill_result
+ */
+backfill_result
+dgr_backfill_feed(backfill_parser *parser, const uint8_t *data, size_t length, backfill_record_cb cb, void *arg) {
+    uint8_t ahead;
+    uint8_t slot;
+
+    if(length < 1 || length < (data[0] == 1 ? BACKFILL_FIRST_HEADER : BACKFILL_HEADER)) {
+        return backfill_bad_length;
+    }
+    if(parser->stale) {
+        return backfill_stale;
+    }
+
+    // sequence numbers wrap around, anything up to half the range behind is old
+    ahead = data[0] - parser->next_sequence;
+    if(ahead >= 0x80) {
+        return backfill_duplicate;
+    }
+    if(ahead > BACKFILL_WINDOW) {
+        return backfill_gap;
+    }
+
+    if(ahead > 0) {
+        slot = data[0] % BACKFILL_WINDOW;
+        if(parser->window_length[slot] != 0) {
+            return backfill_duplicate;
+        }
+        if(length > BACKFILL_MAX_PACKET) {
+            return backfill_bad_length;
+        }
+        memcpy(parser->window[slot], data, length);
+        parser->window_length[slot] = length;
+        parser->pending++;
+        return backfill_buffered;
+    }
+
+    dgr_backfill_parse(parser, data, length, cb, arg);
+
+    // the notification may have closed a hole in the window
+    slot = parser->next_sequence % BACKFILL_WINDOW;
+    while(parser->window_length[slot] != 0) {
+        dgr_backfill_parse(parser, parser->window[slot], parser->window_length[slot], cb, arg);
+        parser->window_length[slot] = 0;
+        parser->pending--;
+        slot = parser->next_sequence % BACKFILL_WINDOW;
+    }
+
+    return backfill_ok;
+}
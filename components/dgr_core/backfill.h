@@ -0,0 +1,62 @@
+#ifndef DGR_BACKFILL_H
+#define DGR_BACKFILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reading_log.h"
+
+/* Streaming parser of the backfill notifications. Every notification starts
+ * with a sequence number and an identifier, the first one continues with a
+ * request counter and two unknown bytes. The rest is a stream of 8 byte
+ * records (timestamp u32, glucose u16, calibration state u8, trend u8) that
+ * can be split across notifications. Complete records are passed on right
+ * away, the bytes of a split record are carried to the next notification, so
+ * the memory use does not depend on the length of the backfill.
+ *
+ * Notifications that arrive ahead of the expected sequence number wait in a
+ * window of BACKFILL_WINDOW slots, keyed by the sequence number, until the
+ * missing ones arrive. One that does not fit into the window is a real gap:
+ * the caller requests the readings after the last passed record again.
+ * Notifications of the old request can still arrive after that, they are
+ * dropped until the transmitter confirmed the new request.
+ */
+
+#define BACKFILL_RECORD_SIZE        8
+#define BACKFILL_FIRST_HEADER       6
+#define BACKFILL_HEADER             2
+#define BACKFILL_WINDOW             4 // power of two, the slot of a notification is its sequence number modulo the size
+#define BACKFILL_MAX_PACKET         20 // notifications of the default ATT MTU
+
+typedef enum {
+    backfill_ok,                    // parsed, together with the buffered notifications that followed it
+    backfill_buffered,              // ahead of the expected sequence number, kept in the window
+    backfill_duplicate,             // already parsed or buffered
+    backfill_stale,                 // left over from the request before the last restart
+    backfill_gap,                   // too far ahead for the window, nothing was parsed
+    backfill_bad_length             // shorter than its header or too long for the window
+} backfill_result;
+
+typedef void (*backfill_record_cb)(const reading *r, void *arg);
+
+typedef struct backfill_parser {
+    uint8_t next_sequence;
+    uint8_t carried;                // bytes of a split record
+    uint8_t carry[BACKFILL_RECORD_SIZE];
+    uint16_t request_counter;
+    bool stale;                     // drop everything until the new request was confirmed
+    uint8_t pending;                // buffered notifications
+    uint8_t window_length[BACKFILL_WINDOW]; // 0 for a free slot
+    uint8_t window[BACKFILL_WINDOW][BACKFILL_MAX_PACKET];
+    uint32_t records;               // records passed on
+    uint32_t last_timestamp;        // of the last passed record
+} backfill_parser;
+
+void dgr_backfill_init(backfill_parser *parser);
+void dgr_backfill_restart(backfill_parser *parser);
+void dgr_backfill_resume(backfill_parser *parser);
+backfill_result dgr_backfill_feed(backfill_parser *parser, const uint8_t *data, size_t length,
+                                  backfill_record_cb cb, void *arg);
+
+#endif
@@ -0,0 +1,187 @@
+#include <string.h>
+#include "codec.h"
+#include "crc16.h"
+
+// messages without fields are sent from constant frames, the CRC is computed by the compiler
+#define MSG_CONST_FRAME(name)       {name##_OPCODE, CRC16_CONST_BYTE(name##_OPCODE) & 0xffU, \
+                                     CRC16_CONST_BYTE(name##_OPCODE) >> 8U}
+
+#define MSG_DESC(name, opcode, chr, length, flags, handler) \
+    {#name, (opcode), (chr), (length), (flags)},
+const msg_desc dgr_msg_descs[] = { DGR_MESSAGES(MSG_DESC) };
+#undef MSG_DESC
+const size_t dgr_msg_count = sizeof dgr_msg_descs / sizeof dgr_msg_descs[0];
+
+const uint8_t dgr_glucose_tx_frame[GLUCOSE_TX_LENGTH] = MSG_CONST_FRAME(GLUCOSE_TX);
+const uint8_t dgr_time_tx_frame[TIME_TX_LENGTH] = MSG_CONST_FRAME(TIME_TX);
+const uint8_t dgr_bond_request_tx_frame[BOND_REQUEST_TX_LENGTH] = {BOND_REQUEST_TX_OPCODE};
+const uint8_t dgr_disconnect_tx_frame[DISCONNECT_TX_LENGTH] = {DISCONNECT_TX_OPCODE};
+
+static uint32_t
+dgr_codec_get_u32(const uint8_t *pos) {
+    return pos[0] | (uint32_t) pos[1] << 8U | (uint32_t) pos[2] << 16U | (uint32_t) pos[3] << 24U;
+}
+
+static void
+dgr_codec_put_u32(uint8_t *pos, uint32_t value) {
+    pos[0] = value;
+    pos[1] = value >> 8U;
+    pos[2] = value >> 16U;
+    pos[3] = value >> 24U;
+}
+
+/**
+ * Zeroes a message and writes its opcode.
+ */
+static void
+dgr_codec_begin(uint8_t *msg, uint8_t opcode, uint8_t length) {
+    memset(msg, 0, length);
+    msg[0] = opcode;
+}
+
+/**
+ * Writes the CRC over the message into its last two bytes.
+ */
+static void
+dgr_codec_finish(uint8_t *msg, uint8_t length) {
+    uint16_t crc = dgr_crc16(msg, length - 2);
+
+    msg[length - 2] = crc;
+    msg[length - 1] = crc >> 8U;
+}
+
+/**
+ * Looks up a message by the characteristic that sent it and its opcode.
+ *
+ * @param chr               Characteristic
+ * @param opcode            First byte of the message
+ * @return                  Description of the message, NULL if it is unknown
+ */
+const msg_desc*
+dgr_msg_find(msg_characteristic chr, uint8_t opcode) {
+    for(size_t i = 0; i < dgr_msg_count; i++) {
+        if(dgr_msg_descs[i].chr == chr && dgr_msg_descs[i].opcode == opcode) {
+            return &dgr_msg_descs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @param desc              Description of the message
+ * @param length            Length of the received message
+ * @return                  true if the message has the length of the table
+ */
+bool
+dgr_msg_length_ok(const msg_desc *desc, uint8_t length) {
+    return length == desc->length || (length > desc->length && (desc->flags & MSG_LONGER));
+}
+
+/**
+ * @param msg               Output of AUTH_REQUEST_TX_LENGTH bytes
+ * @param token             Random token of AUTH_REQUEST_TX_TOKEN_SIZE bytes
+ */
+void
+dgr_encode_auth_request(uint8_t *msg, const uint8_t *token) {
+    dgr_codec_begin(msg, AUTH_REQUEST_TX_OPCODE, AUTH_REQUEST_TX_LENGTH);
+    memcpy(&msg[AUTH_REQUEST_TX_TOKEN], token, AUTH_REQUEST_TX_TOKEN_SIZE);
+    // alt bt channel, 0x2 for the std bt channel
+    msg[AUTH_REQUEST_TX_CHANNEL] = 0x1;
+}
+
+/**
+ * @param msg               Output of AUTH_CHALLENGE_TX_LENGTH bytes
+ * @param challenge_hash    Encrypted challenge of the transmitter
+ */
+void
+dgr_encode_auth_challenge(uint8_t *msg, const uint8_t *challenge_hash) {
+    dgr_codec_begin(msg, AUTH_CHALLENGE_TX_OPCODE, AUTH_CHALLENGE_TX_LENGTH);
+    memcpy(&msg[AUTH_CHALLENGE_TX_CHALLENGE_HASH], challenge_hash, AUTH_CHALLENGE_TX_CHALLENGE_HASH_SIZE);
+}
+
+/**
+ * @param msg               Output of KEEP_ALIVE_TX_LENGTH bytes
+ * @param time              Seconds the transmitter keeps the connection
+ */
+void
+dgr_encode_keep_alive(uint8_t *msg, uint8_t time) {
+    dgr_codec_begin(msg, KEEP_ALIVE_TX_OPCODE, KEEP_ALIVE_TX_LENGTH);
+    msg[KEEP_ALIVE_TX_TIME] = time;
+}
+
+/**
+ * @param msg               Output of BACKFILL_TX_LENGTH bytes
+ * @param start_time        Transmitter time of the first wanted reading
+ * @param end_time          Transmitter time of the last wanted reading
+ */
+void
+dgr_encode_backfill_tx(uint8_t *msg, uint32_t start_time, uint32_t end_time) {
+    dgr_codec_begin(msg, BACKFILL_TX_OPCODE, BACKFILL_TX_LENGTH);
+    msg[BACKFILL_TX_TYPE] = 0x5;
+    msg[BACKFILL_TX_TYPE + 1] = 0x2;
+    msg[BACKFILL_TX_TYPE + 2] = 0x0;
+    dgr_codec_put_u32(&msg[BACKFILL_TX_START_TIME], start_time);
+    dgr_codec_put_u32(&msg[BACKFILL_TX_END_TIME], end_time);
+    dgr_codec_finish(msg, BACKFILL_TX_LENGTH);
+}
+
+/**
+ * @param data              AuthChallengeRx message
+ * @param token_hash        Output of the encrypted token the transmitter computed
+ * @param challenge         Output of the challenge for the reader
+ */
+void
+dgr_decode_auth_challenge(const uint8_t *data, uint8_t *token_hash, uint8_t *challenge) {
+    memcpy(token_hash, &data[AUTH_CHALLENGE_RX_TOKEN_HASH], AUTH_CHALLENGE_RX_TOKEN_HASH_SIZE);
+    memcpy(challenge, &data[AUTH_CHALLENGE_RX_CHALLENGE], AUTH_CHALLENGE_RX_CHALLENGE_SIZE);
+}
+
+void
+dgr_decode_glucose_rx(const uint8_t *data, glucose_rx *rx) {
+    rx->transmitter_state = data[GLUCOSE_RX_STATE];
+    rx->sequence = dgr_codec_get_u32(&data[GLUCOSE_RX_SEQUENCE]);
+    rx->timestamp = dgr_codec_get_u32(&data[GLUCOSE_RX_TIMESTAMP]);
+    rx->glucose = (data[GLUCOSE_RX_GLUCOSE] | (uint16_t) data[GLUCOSE_RX_GLUCOSE + 1] << 8U) & 0xfffU;
+    rx->calibration_state = data[GLUCOSE_RX_CALIBRATION_STATE];
+    rx->trend = data[GLUCOSE_RX_TREND];
+}
+
+void
+dgr_decode_time_rx(const uint8_t *data, time_rx *rx) {
+    rx->state = data[TIME_RX_STATE];
+    rx->current_time = dgr_codec_get_u32(&data[TIME_RX_CURRENT_TIME]);
+    rx->session_start = dgr_codec_get_u32(&data[TIME_RX_SESSION_START]);
+}
+
+void
+dgr_decode_backfill_rx(const uint8_t *data, backfill_rx *rx) {
+    rx->status = data[BACKFILL_RX_STATUS];
+    rx->start_time = dgr_codec_get_u32(&data[BACKFILL_RX_START_TIME]);
+    rx->end_time = dgr_codec_get_u32(&data[BACKFILL_RX_END_TIME]);
+}
+
+/**
+ * Checks a reading from GlucoseRx before it is stored, in the order the
+ * firmware reports the problems. A stored reading with the same timestamp,
+ * e.g. a backfilled one, is no problem, the reading log replaces it.
+ *
+ * @param rx                Decoded GlucoseRx message
+ * @param last_sequence     Sequence number of the last stored reading
+ * @param crc_ok            true if the CRC of the message matched
+ * @return                  reading_valid or the first problem
+ */
+reading_status
+dgr_check_glucose_rx(const glucose_rx *rx, uint32_t last_sequence, bool crc_ok) {
+    if(last_sequence == rx->sequence) {
+        return reading_duplicate;
+    } else if(rx->sequence < last_sequence) {
+        return reading_out_of_band;
+    } else if(!crc_ok) {
+        return reading_bad_crc;
+    } else if(rx->calibration_state != CALIB_STATE_OK) {
+        return reading_not_calibrated;
+    }
+
+    return reading_valid;
+}
@@ -0,0 +1,86 @@
+#ifndef DGR_CODEC_H
+#define DGR_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "msg_table.h"
+
+/* Encoding and decoding of the transmitter messages on flat buffers after the
+ * layout of msg_table.h. The encoders write a whole message including its CRC,
+ * the caller reserves <NAME>_LENGTH bytes, e.g. in an mbuf. The decoders
+ * expect a message whose length was checked with dgr_msg_length_ok.
+ */
+
+typedef struct msg_desc {
+    const char *name;
+    uint8_t opcode;
+    msg_characteristic chr;
+    uint8_t length;
+    uint8_t flags;
+} msg_desc;
+
+typedef struct glucose_rx {
+    uint8_t transmitter_state;
+    uint32_t sequence;
+    uint32_t timestamp;
+    uint16_t glucose;
+    uint8_t calibration_state;
+    uint8_t trend;
+} glucose_rx;
+
+typedef struct time_rx {
+    uint8_t state;
+    uint32_t current_time;          // seconds since transmitter start
+    uint32_t session_start;         // seconds since transmitter start
+} time_rx;
+
+typedef struct backfill_rx {
+    uint8_t status;
+    uint32_t start_time;
+    uint32_t end_time;
+} backfill_rx;
+
+typedef enum {
+    reading_valid,
+    reading_duplicate,              // same sequence number as the last reading
+    reading_out_of_band,            // older sequence number than the last reading
+    reading_bad_crc,
+    reading_not_calibrated          // calibration state is not CALIB_STATE_OK
+} reading_status;
+
+// values for the calibration state
+#define CALIB_STATE_STOPPED                     0x01
+#define CALIB_STATE_WARMUP                      0x02
+#define CALIB_STATE_OK                          0x06
+#define CALIB_STATE_NEED_CALIBRATION            0x07
+#define CALIB_STATE_NEED_FIRST_CALIBRATION      0x04
+#define CALIB_STATE_NEED_SECOND_CALIBRATION     0x05
+#define CALIB_STATE_SENSOR_FAILED               0x0b
+
+// values for the transmitter state
+#define TRANSMITTER_STATE_OK                    0x0
+#define TRANSMITTER_STATE_BATT_LOW              0x81
+#define TRANSMITTER_STATE_BRICKED               0x83
+
+extern const msg_desc dgr_msg_descs[];
+extern const size_t dgr_msg_count;
+extern const uint8_t dgr_glucose_tx_frame[GLUCOSE_TX_LENGTH];
+extern const uint8_t dgr_time_tx_frame[TIME_TX_LENGTH];
+extern const uint8_t dgr_bond_request_tx_frame[BOND_REQUEST_TX_LENGTH];
+extern const uint8_t dgr_disconnect_tx_frame[DISCONNECT_TX_LENGTH];
+
+const msg_desc* dgr_msg_find(msg_characteristic chr, uint8_t opcode);
+bool dgr_msg_length_ok(const msg_desc *desc, uint8_t length);
+void dgr_encode_auth_request(uint8_t *msg, const uint8_t *token);
+void dgr_encode_auth_challenge(uint8_t *msg, const uint8_t *challenge_hash);
+void dgr_encode_keep_alive(uint8_t *msg, uint8_t time);
+void dgr_encode_backfill_tx(uint8_t *msg, uint32_t start_time, uint32_t end_time);
+void dgr_decode_auth_challenge(const uint8_t *data, uint8_t *token_hash, uint8_t *challenge);
+void dgr_decode_glucose_rx(const uint8_t *data, glucose_rx *rx);
+void dgr_decode_time_rx(const uint8_t *data, time_rx *rx);
+void dgr_decode_backfill_rx(const uint8_t *data, backfill_rx *rx);
+reading_status dgr_check_glucose_rx(const glucose_rx *rx, uint32_t last_sequence, bool crc_ok);
+
+#endif
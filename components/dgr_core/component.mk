@@ -0,0 +1,5 @@
+#
+# Protocol and data logic without hardware dependencies, see CMakeLists.txt
+# for the host build.
+#
+COMPONENT_ADD_INCLUDEDIRS := .
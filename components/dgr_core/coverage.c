@@ -0,0 +1,226 @@
+#include <string.h>
+#include "coverage.h"
+
+static uint32_t
+dgr_coverage_slot(const coverage_map *map, uint32_t timestamp) {
+    uint32_t shifted = timestamp + READING_INTERVAL / 2;
+
+    return shifted > map->phase ? (shifted - map->phase) / READING_INTERVAL : 0;
+}
+
+static uint32_t
+dgr_coverage_slot_start(const coverage_map *map, uint32_t slot) {
+    uint32_t center = map->phase + slot * READING_INTERVAL;
+
+    return center > READING_INTERVAL / 2 ? center - READING_INTERVAL / 2 : 0;
+}
+
+static bool
+dgr_coverage_bit(const coverage_map *map, uint32_t slot) {
+    uint32_t index = slot % COVERAGE_SLOTS;
+
+    return slot <= map->newest && slot + COVERAGE_SLOTS > map->newest &&
+           (map->bits[index / 8] & 1U << (index % 8)) != 0;
+}
+
+/**
+ * Moves the newest slot of the ring forward and clears the slots it passes.
+ */
+static void
+dgr_coverage_advance(coverage_map *map, uint32_t slot) {
+    if(slot - map->newest >= COVERAGE_SLOTS) {
+        memset(map->bits, 0, sizeof map->bits);
+    } else {
+        for(uint32_t s = map->newest + 1; s <= slot; s++) {
+            map->bits[s % COVERAGE_SLOTS / 8] &= ~(1U << (s % COVERAGE_SLOTS % 8));
+        }
+    }
+    map->newest = slot;
+}
+
+static void
+dgr_coverage_set(coverage_map *map, uint32_t slot) {
+    if(slot > map->newest) {
+        dgr_coverage_advance(map, slot);
+    } else if(slot + COVERAGE_SLOTS <= map->newest) {
+        // outside the horizon
+        return;
+    }
+    map->bits[slot % COVERAGE_SLOTS / 8] |= 1U << (slot % COVERAGE_SLOTS % 8);
+}
+
+/**
+ * Initializes an empty map, the slots are aligned to the first marked reading.
+ *
+ * @param map               Map
+ */
+void
+dgr_coverage_init(coverage_map *map) {
+    memset(map, 0, sizeof *map);
+    map->magic = COVERAGE_MAGIC;
+}
+
+/**
+ * Checks a map that survived a deep sleep.
+ *
+ * @param map               Map
+ * @return                  true if the map can be used without initialization
+ */
+bool
+dgr_coverage_valid(const coverage_map *map) {
+    return map->magic == COVERAGE_MAGIC && map->phase < READING_INTERVAL;
+}
+
+/**
+ * Marks the slot of a stored reading.
+ *
+ * @param map               Map
+ * @param timestamp         Timestamp of the reading
+ */
+void
+dgr_coverage_mark(coverage_map *map, uint32_t timestamp) {
+    if(!map->anchored) {
+        map->anchored = true;
+        map->phase = timestamp % READING_INTERVAL;
+        map->newest = dgr_coverage_slot(map, timestamp);
+    }
+
+    dgr_coverage_set(map, dgr_coverage_slot(map, timestamp));
+}
+
+/**
+ * Marks all slots of a time range, e.g. after the transmitter sent all it had.
+ *
+ * @param map               Map
+ * @param range             Time range
+ */
+void
+dgr_coverage_mark_range(coverage_map *map, const coverage_range *range) {
+    uint32_t first;
+    uint32_t last;
+
+    if(!map->anchored) {
+        return;
+    }
+
+    first = dgr_coverage_slot(map, range->start);
+    last = dgr_coverage_slot(map, range->end);
+    if(first + COVERAGE_SLOTS <= last) {
+        first = last - COVERAGE_SLOTS + 1;
+    }
+    for(uint32_t slot = first; slot <= last; slot++) {
+        dgr_coverage_set(map, slot);
+    }
+}
+
+/**
+ * Checks if the slot of a timestamp is marked.
+ *
+ * @param map               Map
+ * @param timestamp         Timestamp
+ */
+bool
+dgr_coverage_covered(const coverage_map *map, uint32_t timestamp) {
+    return map->anchored && dgr_coverage_bit(map, dgr_coverage_slot(map, timestamp));
+}
+
+/**
+ * Counts the marked slots.
+ *
+ * @param map               Map
+ * @return                  Number of marked slots within the horizon
+ */
+uint16_t
+dgr_coverage_count(const coverage_map *map) {
+    uint16_t count = 0;
+
+    for(size_t i = 0; i < sizeof map->bits; i++) {
+        count += __builtin_popcount(map->bits[i]);
+    }
+
+    return count;
+}
+
+/**
+ * Finds the unmarked parts of a time range, oldest first. Adjacent unmarked
+ * slots are joined into one range. Slots older than the horizon before the
+ * end of the range are skipped.
+ *
+ * @param map               Map
+ * @param from              First timestamp of the range
+ * @param to                Last timestamp of the range
+ * @param holes             Output of the unmarked ranges
+ * @param max               Size of the output
+ * @return                  Number of unmarked ranges, at most max
+ */
+uint8_t
+dgr_coverage_holes(const coverage_map *map, uint32_t from, uint32_t to, coverage_range *holes, uint8_t max) {
+    uint32_t first;
+    uint32_t last;
+    uint32_t end;
+    uint8_t count = 0;
+    bool open = false;
+
+    if(from > to || max == 0) {
+        return 0;
+    }
+    if(!map->anchored) {
+        // nothing is known, everything is missing
+        holes[0].start = from;
+        holes[0].end = to;
+        return 1;
+    }
+
+    first = dgr_coverage_slot(map, from);
+    last = dgr_coverage_slot(map, to);
+    end = last > map->newest ? last : map->newest;
+    if(first + COVERAGE_SLOTS <= end) {
+        first = end - COVERAGE_SLOTS + 1;
+    }
+
+    for(uint32_t slot = first; slot <= last; slot++) {
+        if(dgr_coverage_bit(map, slot)) {
+            if(open) {
+                open = false;
+                if(++count == max) {
+                    return count;
+                }
+            }
+        } else if(open) {
+            holes[count].end = slot == last ? to : dgr_coverage_slot_start(map, slot + 1) - 1;
+        } else {
+            open = true;
+            holes[count].start = slot == first && from > dgr_coverage_slot_start(map, slot) ?
+                                 from : dgr_coverage_slot_start(map, slot);
+            holes[count].end = slot == last ? to : dgr_coverage_slot_start(map, slot + 1) - 1;
+        }
+    }
+
+    return open ? count + 1 : count;
+}
+
+/**
+ * Finds the oldest hole of a time range and cuts it to a number of readings,
+ * so a long hole is transferred by several shorter requests.
+ *
+ * @param map               Map
+ * @param from              First timestamp of the range
+ * @param to                Last timestamp of the range
+ * @param max_readings      Maximum number of readings of the chunk
+ * @param chunk             Output of the chunk
+ * @return                  false if the range has no hole
+ */
+bool
+dgr_coverage_next_chunk(const coverage_map *map, uint32_t from, uint32_t to, uint16_t max_readings,
+                        coverage_range *chunk) {
+    uint32_t length = (uint32_t) max_readings * READING_INTERVAL;
+
+    if(dgr_coverage_holes(map, from, to, chunk, 1) == 0) {
+        return false;
+    }
+    if(chunk->end - chunk->start >= length) {
+        chunk->end = chunk->start + length - 1;
+    }
+
+    return true;
+}
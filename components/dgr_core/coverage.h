@@ -0,0 +1,48 @@
+#ifndef DGR_COVERAGE_H
+#define DGR_COVERAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scheduler.h"
+
+/* Coverage of the transmitter timeline by the stored readings. The timeline
+ * is cut into slots of READING_INTERVAL seconds, each centered on a reading
+ * of the transmitter, so one reading falls into one slot even with a few
+ * seconds of jitter. The newest COVERAGE_SLOTS slots are kept in a ring
+ * bitmap, older slots are outside the horizon of the backfill.
+ *
+ * A slot is set when a reading of it was stored or when the transmitter
+ * answered a backfill request for it without a reading. The clear slots in
+ * a time range are the readings that are still worth requesting, adjacent
+ * clear slots form a single request.
+ */
+
+#define COVERAGE_SLOTS              288 // 24 h of readings
+#define COVERAGE_HORIZON            (COVERAGE_SLOTS * READING_INTERVAL) // in seconds
+#define COVERAGE_MAGIC              0x56434744 // "DGCV"
+
+typedef struct coverage_range {
+    uint32_t start;                 // inclusive transmitter timestamps
+    uint32_t end;
+} coverage_range;
+
+typedef struct coverage_map {
+    uint32_t magic;
+    bool anchored;                  // the phase is known from a reading
+    uint16_t phase;                 // timestamps of the readings modulo READING_INTERVAL
+    uint32_t newest;                // number of the newest slot in the bitmap
+    uint8_t bits[(COVERAGE_SLOTS + 7) / 8];
+} coverage_map;
+
+void dgr_coverage_init(coverage_map *map);
+bool dgr_coverage_valid(const coverage_map *map);
+void dgr_coverage_mark(coverage_map *map, uint32_t timestamp);
+void dgr_coverage_mark_range(coverage_map *map, const coverage_range *range);
+bool dgr_coverage_covered(const coverage_map *map, uint32_t timestamp);
+uint16_t dgr_coverage_count(const coverage_map *map);
+uint8_t dgr_coverage_holes(const coverage_map *map, uint32_t from, uint32_t to, coverage_range *holes, uint8_t max);
+bool dgr_coverage_next_chunk(const coverage_map *map, uint32_t from, uint32_t to, uint16_t max_readings,
+                             coverage_range *chunk);
+
+#endif
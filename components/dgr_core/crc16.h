@@ -0,0 +1,70 @@
+#ifndef DGR_CRC16_H
+#define DGR_CRC16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-16/XMODEM (polynomial 0x1021, initial value 0, no reflection), the
+ * checksum of the transmitter messages. It is the same as the ESP32 ROM call
+ * ~crc16_be(~0, data, len). The CRC can be updated piece by piece, e.g. over
+ * the segments of an mbuf chain.
+ *
+ * DGR_CRC16_IMPL selects the variant behind dgr_crc16_update at build time:
+ *
+ *  DGR_CRC16_BYTEWISE  bit by bit, no table
+ *  DGR_CRC16_TABLE     one byte per step, 512 byte table
+ *  DGR_CRC16_SLICE4    four bytes per step, 2 KB of tables
+ *  DGR_CRC16_SLICE8    eight bytes per step, 4 KB of tables
+ *
+ * With DGR_CRC16_ALL every variant is built, e.g. for a benchmark.
+ */
+
+#define DGR_CRC16_BYTEWISE          1
+#define DGR_CRC16_TABLE             2
+#define DGR_CRC16_SLICE4            3
+#define DGR_CRC16_SLICE8            4
+
+#ifndef DGR_CRC16_IMPL
+#define DGR_CRC16_IMPL              DGR_CRC16_TABLE // the messages are short, larger tables do not pay off
+#endif
+
+#if defined(DGR_CRC16_ALL) || DGR_CRC16_IMPL == DGR_CRC16_SLICE8
+#define CRC16_TABLES                8
+#elif DGR_CRC16_IMPL == DGR_CRC16_SLICE4
+#define CRC16_TABLES                4
+#elif DGR_CRC16_IMPL == DGR_CRC16_TABLE
+#define CRC16_TABLES                1
+#else
+#define CRC16_TABLES                0
+#endif
+
+#define CRC16_INIT                  0x0000
+
+// CRC of a single byte as constant expression, for frames that are built at compile time
+#define CRC16_STEP(crc)             ((((crc) << 1U) ^ ((crc) & 0x8000U ? 0x1021U : 0)) & 0xffffU)
+#define CRC16_CONST_BYTE(byte)      CRC16_STEP(CRC16_STEP(CRC16_STEP(CRC16_STEP( \
+                                    CRC16_STEP(CRC16_STEP(CRC16_STEP(CRC16_STEP((unsigned) (byte) << 8U))))))))
+
+uint16_t dgr_crc16_bytewise(uint16_t crc, const uint8_t *data, size_t len);
+#if CRC16_TABLES >= 1
+uint16_t dgr_crc16_table(uint16_t crc, const uint8_t *data, size_t len);
+#endif
+#if CRC16_TABLES >= 4
+uint16_t dgr_crc16_slice4(uint16_t crc, const uint8_t *data, size_t len);
+#endif
+#if CRC16_TABLES >= 8
+uint16_t dgr_crc16_slice8(uint16_t crc, const uint8_t *data, size_t len);
+#endif
+uint16_t dgr_crc16_update(uint16_t crc, const uint8_t *data, size_t len);
+
+// returns the data of a segment of a chain, e.g. an mbuf, and the next segment or NULL
+typedef const void* (*crc16_segment_cb)(const void *segment, const uint8_t **data, uint16_t *len);
+
+uint16_t dgr_crc16_chain(uint16_t crc, const void *first, crc16_segment_cb segment, uint16_t off, uint16_t len);
+
+static inline uint16_t
+dgr_crc16(const uint8_t *data, size_t len) {
+    return dgr_crc16_update(CRC16_INIT, data, len);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef DGR_PLATFORM_H
+#define DGR_PLATFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Services the core library needs from the platform. The firmware implements
+ * them in main/platform.c, a host program that uses the authentication brings
+ * its own.
+ */
+
+#define PLATFORM_AES_BLOCK          16
+
+void dgr_platform_random(uint8_t *data, size_t len);
+bool dgr_platform_aes_set_key(const uint8_t key[PLATFORM_AES_BLOCK]);
+bool dgr_platform_aes_encrypt(const uint8_t in[PLATFORM_AES_BLOCK], uint8_t out[PLATFORM_AES_BLOCK]);
+
+#endif
@@ -0,0 +1,118 @@
+#include <string.h>
+#include "energy.h"
+
+static const char *state_names[ENERGY_STATE_COUNT] = {
+    "cpu", "scan", "connected", "sleep"
+};
+
+void
+dgr_energy_reset(dgr_energy *energy) {
+    memset(energy, 0, sizeof *energy);
+}
+
+/**
+ * Starts the accounting of a wake cycle. The time from the wakeup to the
+ * start of the application is booked as cpu time.
+ *
+ * @param energy            Energy accounting
+ * @param boot_time         Time since boot in milliseconds
+ */
+void
+dgr_energy_begin_cycle(dgr_energy *energy, uint32_t boot_time) {
+    memset(energy->cycle_time, 0, sizeof energy->cycle_time);
+    energy->cycle_time[energy_cpu] = boot_time;
+    energy->state = energy_cpu;
+    energy->state_entered = boot_time;
+}
+
+/**
+ * Books the time since the last change to the previous state and switches to the new one.
+ *
+ * @param energy            Energy accounting
+ * @param state             New power state
+ * @param now               Time since boot in milliseconds
+ */
+void
+dgr_energy_enter(dgr_energy *energy, energy_state state, uint32_t now) {
+    if(now > energy->state_entered) {
+        energy->cycle_time[energy->state] += now - energy->state_entered;
+    }
+
+    energy->state = state;
+    energy->state_entered = now;
+}
+
+/**
+ * Returns the charge of the running cycle.
+ *
+ * @param energy            Energy accounting
+ * @param profile           Currents of the power states
+ * @return                  Charge in uA * ms
+ */
+uint64_t
+dgr_energy_cycle_charge(const dgr_energy *energy, const energy_profile *profile) {
+    uint64_t charge = 0;
+
+    for(int i = 0; i < ENERGY_STATE_COUNT; i++) {
+        charge += (uint64_t) energy->cycle_time[i] * profile->current[i];
+    }
+
+    return charge;
+}
+
+/**
+ * Ends the cycle with the following deep sleep and adds its charge to the totals.
+ *
+ * @param energy            Energy accounting
+ * @param profile           Currents of the power states
+ * @param now               Time since boot in milliseconds when going to sleep
+ * @param sleep_time        Duration of the following deep sleep in milliseconds
+ */
+void
+dgr_energy_end_cycle(dgr_energy *energy, const energy_profile *profile, uint32_t now, uint32_t sleep_time) {
+    uint32_t cycle_length;
+    uint64_t charge;
+
+    dgr_energy_enter(energy, energy_sleep, now);
+    energy->cycle_time[energy_sleep] = sleep_time;
+
+    cycle_length = 0;
+    for(int i = 0; i < ENERGY_STATE_COUNT; i++) {
+        energy->total_charge[i] += (uint64_t) energy->cycle_time[i] * profile->current[i];
+        cycle_length += energy->cycle_time[i];
+    }
+    charge = dgr_energy_cycle_charge(energy, profile);
+    energy->total_time += cycle_length;
+
+    // the cycle ending a day is counted completely for this day
+    energy->day_charge += charge;
+    energy->day_time += cycle_length;
+    if(energy->day_time >= ENERGY_DAY) {
+        energy->last_day_uah = energy->day_charge / ENERGY_UAMS_PER_UAH * ENERGY_DAY / energy->day_time;
+        energy->day_charge = 0;
+        energy->day_time = 0;
+    }
+}
+
+/**
+ * Returns the consumption per day. It is extrapolated from the running day
+ * until the first day is complete.
+ *
+ * @param energy            Energy accounting
+ * @return                  Charge per day in uAh, 0 if unknown
+ */
+uint32_t
+dgr_energy_uah_per_day(const dgr_energy *energy) {
+    if(energy->last_day_uah != 0) {
+        return energy->last_day_uah;
+    } else if(energy->day_time == 0) {
+        return 0;
+    }
+
+    return energy->day_charge / ENERGY_UAMS_PER_UAH * ENERGY_DAY / energy->day_time;
+}
+
+const char*
+dgr_energy_state_name(energy_state state) {
+    return state < ENERGY_STATE_COUNT ? state_names[state] : "unknown";
+}
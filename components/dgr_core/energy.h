@@ -0,0 +1,49 @@
+#ifndef DGR_ENERGY_H
+#define DGR_ENERGY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Energy accounting. The time of a wake cycle is attributed to the power
+ * states of the ESP, the charge of every state is its time multiplied with the
+ * current given in the profile. Charges are kept in uA * ms, which avoids
+ * floating point math and still holds years in 64 bits. Like the scheduler,
+ * the module only works on the given times and does not depend on the ESP-IDF.
+ */
+
+#define ENERGY_DAY                  86400000 // in milliseconds
+#define ENERGY_UAMS_PER_UAH         3600000ULL
+
+typedef enum {
+    energy_cpu,                     // cpu active, radio off
+    energy_scan,                    // radio receiving advertisements or initiating a connection
+    energy_connected,               // radio in a connection
+    energy_sleep,                   // deep sleep with rtc timer and rtc memory
+    ENERGY_STATE_COUNT
+} energy_state;
+
+typedef struct energy_profile {
+    uint32_t current[ENERGY_STATE_COUNT]; // in uA
+} energy_profile;
+
+typedef struct dgr_energy {
+    energy_state state;             // state of the running cycle
+    uint32_t state_entered;         // in ms since boot
+    uint32_t cycle_time[ENERGY_STATE_COUNT]; // of the running cycle, in milliseconds
+    uint64_t total_charge[ENERGY_STATE_COUNT]; // in uA * ms
+    uint64_t total_time;            // in milliseconds
+    uint64_t day_charge;            // of the running day, in uA * ms
+    uint32_t day_time;              // elapsed time of the running day in milliseconds
+    uint32_t last_day_uah;          // charge of the last full day in uAh, 0 if there was none
+} dgr_energy;
+
+void dgr_energy_reset(dgr_energy *energy);
+void dgr_energy_begin_cycle(dgr_energy *energy, uint32_t boot_time);
+void dgr_energy_enter(dgr_energy *energy, energy_state state, uint32_t now);
+void dgr_energy_end_cycle(dgr_energy *energy, const energy_profile *profile, uint32_t now,
+                          uint32_t sleep_time);
+uint64_t dgr_energy_cycle_charge(const dgr_energy *energy, const energy_profile *profile);
+uint32_t dgr_energy_uah_per_day(const dgr_energy *energy);
+const char* dgr_energy_state_name(energy_state state);
+
+#endif
@@ -0,0 +1,204 @@
+#include <string.h>
+#include "export.h"
+#include "crc16.h"
+
+#define EXPORT_HEADER_SIZE          6
+#define EXPORT_GET_SIZE             7 // without crc
+
+static void
+dgr_export_put_u32(uint8_t *pos, uint32_t value) {
+    pos[0] = value;
+    pos[1] = value >> 8U;
+    pos[2] = value >> 16U;
+    pos[3] = value >> 24U;
+}
+
+/**
+ * Appends the CRC to a payload and writes it as a delimited COBS frame.
+ *
+ * @return                  Length of the frame
+ */
+static size_t
+dgr_export_frame(uint8_t *payload, size_t len, uint8_t *frame) {
+    uint16_t crc = dgr_crc16(payload, len);
+    size_t encoded;
+
+    payload[len] = crc;
+    payload[len + 1] = crc >> 8U;
+
+    frame[0] = 0;
+    encoded = dgr_cobs_encode(payload, len + 2, &frame[1]);
+    frame[encoded + 1] = 0;
+    return encoded + 2;
+}
+
+/**
+ * Encodes data with consistent overhead byte stuffing, the result contains
+ * no zero bytes.
+ *
+ * @param src               Data
+ * @param len               Length of the data
+ * @param dst               Output of at least len + len / 254 + 1 bytes
+ * @return                  Length of the encoded data
+ */
+size_t
+dgr_cobs_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for(size_t i = 0; i < len; i++) {
+        if(src[i] == 0) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        } else {
+            dst[out++] = src[i];
+            code++;
+            if(code == 0xff) {
+                dst[code_pos] = code;
+                code_pos = out++;
+                code = 1;
+            }
+        }
+    }
+    dst[code_pos] = code;
+
+    return out;
+}
+
+/**
+ * Decodes COBS encoded data without the delimiters.
+ *
+ * @param src               Encoded data
+ * @param len               Length of the encoded data
+ * @param dst               Output of at least len bytes
+ * @return                  Length of the decoded data, 0 if the encoding is invalid
+ */
+size_t
+dgr_cobs_decode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while(in < len) {
+        uint8_t code = src[in++];
+
+        if(code == 0 || in + code - 1 > len) {
+            return 0;
+        }
+        for(uint8_t i = 1; i < code; i++) {
+            if(src[in] == 0) {
+                return 0;
+            }
+            dst[out++] = src[in++];
+        }
+        if(code != 0xff && in < len) {
+            dst[out++] = 0;
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Starts an export.
+ *
+ * @param batch             Batch of readings for the next frame
+ * @param from              Timestamp the host requested
+ */
+void
+dgr_export_begin(export_batch *batch, uint32_t from) {
+    batch->count = 0;
+    batch->next = from;
+    batch->sent = 0;
+}
+
+/**
+ * Adds a reading to the batch in the layout of the storage.
+ *
+ * @param batch             Batch
+ * @param r                 Reading
+ * @return                  true if the batch is full and has to be sent
+ */
+bool
+dgr_export_add(export_batch *batch, const reading *r) {
+    uint8_t *record = &batch->payload[EXPORT_HEADER_SIZE + batch->count * EXPORT_RECORD_SIZE];
+
+    dgr_export_put_u32(record, r->timestamp);
+    record[4] = r->glucose;
+    record[5] = r->glucose >> 8U;
+    record[6] = r->calibration_state;
+    record[7] = r->trend;
+    batch->count++;
+    batch->next = r->timestamp + 1;
+
+    return batch->count == EXPORT_FRAME_READINGS;
+}
+
+/**
+ * Writes the batched readings as DATA frame and empties the batch.
+ *
+ * @param batch             Batch
+ * @param frame             Output of EXPORT_MAX_FRAME bytes
+ * @return                  Length of the frame, 0 if the batch is empty
+ */
+size_t
+dgr_export_data_frame(export_batch *batch, uint8_t *frame) {
+    size_t len = EXPORT_HEADER_SIZE + batch->count * EXPORT_RECORD_SIZE;
+
+    if(batch->count == 0) {
+        return 0;
+    }
+
+    batch->payload[0] = EXPORT_DATA;
+    batch->payload[1] = batch->count;
+    dgr_export_put_u32(&batch->payload[2], batch->next);
+    batch->sent += batch->count;
+    batch->count = 0;
+
+    return dgr_export_frame(batch->payload, len, frame);
+}
+
+/**
+ * Writes the END frame of an export.
+ *
+ * @param batch             Batch of the export
+ * @param frame             Output of EXPORT_MAX_FRAME bytes
+ * @return                  Length of the frame
+ */
+size_t
+dgr_export_end_frame(const export_batch *batch, uint8_t *frame) {
+    uint8_t payload[11];
+
+    payload[0] = EXPORT_END;
+    dgr_export_put_u32(&payload[1], batch->next);
+    dgr_export_put_u32(&payload[5], batch->sent);
+
+    return dgr_export_frame(payload, 9, frame);
+}
+
+/**
+ * Parses a GET frame.
+ *
+ * @param encoded           COBS encoded frame without delimiters
+ * @param len               Length of the encoded frame
+ * @param from              Requested first timestamp
+ * @param max               Requested maximum number of readings, 0 for all
+ * @return                  true if the frame is a valid GET frame
+ */
+bool
+dgr_export_parse_get(const uint8_t *encoded, size_t len, uint32_t *from, uint16_t *max) {
+    uint8_t payload[16];
+
+    if(len > sizeof payload || dgr_cobs_decode(encoded, len, payload) != EXPORT_GET_SIZE + 2) {
+        return false;
+    }
+    if(payload[0] != EXPORT_GET ||
+       dgr_crc16(payload, EXPORT_GET_SIZE) != (payload[7] | (uint16_t) payload[8] << 8U)) {
+        return false;
+    }
+
+    *from = payload[1] | (uint32_t) payload[2] << 8U | (uint32_t) payload[3] << 16U | (uint32_t) payload[4] << 24U;
+    *max = payload[5] | (uint16_t) payload[6] << 8U;
+    return true;
+}
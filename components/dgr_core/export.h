@@ -0,0 +1,48 @@
+#ifndef DGR_EXPORT_H
+#define DGR_EXPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reading_log.h"
+
+/* Binary export of the stored readings over a serial line. Frames are COBS
+ * encoded and delimited by a zero byte before and after them, so log output
+ * between frames is skipped by the receiver. Before encoding, every frame is
+ * a type byte, its fields and a CRC-16/XMODEM over both, all little-endian:
+ *
+ *  GET   (host)    0x01, from timestamp (u32), maximum number of readings (u16, 0 for all)
+ *  DATA  (device)  0x81, reading count (u8), next timestamp (u32),
+ *                  readings (timestamp u32, glucose u16, calibration state u8, trend u8)
+ *  END   (device)  0x82, next timestamp (u32), number of sent readings (u32)
+ *
+ * The next timestamp is the cursor: a host that requests from it later gets
+ * only the readings it has not seen.
+ */
+
+#define EXPORT_GET                  0x01
+#define EXPORT_DATA                 0x81
+#define EXPORT_END                  0x82
+#define EXPORT_RECORD_SIZE          8
+#define EXPORT_FRAME_READINGS       32
+#define EXPORT_MAX_PAYLOAD          (6 + EXPORT_FRAME_READINGS * EXPORT_RECORD_SIZE + 2)
+// COBS adds one byte per 254 bytes, plus both delimiters
+#define EXPORT_MAX_FRAME            (EXPORT_MAX_PAYLOAD + EXPORT_MAX_PAYLOAD / 254 + 1 + 2)
+
+typedef struct export_batch {
+    uint8_t payload[EXPORT_MAX_PAYLOAD];
+    uint8_t count;
+    uint32_t next;                  // timestamp after the last added reading
+    uint32_t sent;                  // readings in the sent frames
+} export_batch;
+
+size_t dgr_cobs_encode(const uint8_t *src, size_t len, uint8_t *dst);
+size_t dgr_cobs_decode(const uint8_t *src, size_t len, uint8_t *dst);
+void dgr_export_begin(export_batch *batch, uint32_t from);
+bool dgr_export_add(export_batch *batch, const reading *r);
+size_t dgr_export_data_frame(export_batch *batch, uint8_t *frame);
+size_t dgr_export_end_frame(const export_batch *batch, uint8_t *frame);
+bool dgr_export_parse_get(const uint8_t *encoded, size_t len, uint32_t *from, uint16_t *max);
+
+#endif
@@ -0,0 +1,276 @@
+#include <string.h>
+#include "journal.h"
+#include "crc16.h"
+
+#define JOURNAL_ERR_RANGE           (-100) // no such page
+#define JOURNAL_ERR_CORRUPT         (-101) // page with a wrong magic, count or crc
+
+static void
+dgr_journal_put_u32(uint8_t *pos, uint32_t value) {
+    pos[0] = value;
+    pos[1] = value >> 8U;
+    pos[2] = value >> 16U;
+    pos[3] = value >> 24U;
+}
+
+static uint32_t
+dgr_journal_get_u32(const uint8_t *pos) {
+    return pos[0] | (uint32_t) pos[1] << 8U | (uint32_t) pos[2] << 16U | (uint32_t) pos[3] << 24U;
+}
+
+static uint32_t
+dgr_journal_pages_per_sector(const journal *j) {
+    return j->flash->sector_size / JOURNAL_PAGE_SIZE;
+}
+
+/**
+ * Reads the header of a page.
+ *
+ * @param j                 Journal
+ * @param page              Page index in the flash
+ * @param sequence          Sequence number of the page
+ * @return                  true if the page holds a header
+ */
+static bool
+dgr_journal_read_header(journal *j, uint32_t page, uint32_t *sequence) {
+    uint8_t header[JOURNAL_HEADER_SIZE];
+
+    j->recovery_reads++;
+    if(j->flash->read(j->flash->ctx, page * JOURNAL_PAGE_SIZE, header, sizeof header) != 0) {
+        return false;
+    }
+    if(dgr_journal_get_u32(header) != JOURNAL_MAGIC || header[8] == 0 || header[8] > JOURNAL_PAGE_READINGS) {
+        return false;
+    }
+
+    *sequence = dgr_journal_get_u32(&header[4]);
+    return true;
+}
+
+/**
+ * Initializes an empty journal, the flash is not touched.
+ *
+ * @param j                 Journal
+ * @param flash             Flash of at least two sectors
+ */
+void
+dgr_journal_init(journal *j, const flash_ops *flash) {
+    memset(j, 0, sizeof *j);
+    j->flash = flash;
+    j->pages = flash->size / JOURNAL_PAGE_SIZE;
+}
+
+/**
+ * Checks the management data of a journal that survived a deep sleep.
+ */
+bool
+dgr_journal_valid(const journal *j, const flash_ops *flash) {
+    return j->flash == flash && j->pages == flash->size / JOURNAL_PAGE_SIZE && j->head < j->pages &&
+           j->tail < j->pages && j->stored <= j->pages && j->staged <= JOURNAL_PAGE_READINGS;
+}
+
+/**
+ * Finds the end of the journal in the flash. The pages from the start of the
+ * flash to the end of the journal carry consecutive sequence numbers, which
+ * allows a binary search. The oldest page is the first written page of the
+ * following sectors. Only if the first page is missing, because the power was
+ * lost right after its sector was erased, all page headers are read.
+ *
+ * @param j                 Journal, staged readings are discarded
+ * @param flash             Flash
+ * @return                  0 on success
+ */
+int
+dgr_journal_recover(journal *j, const flash_ops *flash) {
+    uint32_t pages_per_sector;
+    uint32_t first_sequence;
+    uint32_t sequence;
+    uint32_t last = 0;
+
+    dgr_journal_init(j, flash);
+    pages_per_sector = dgr_journal_pages_per_sector(j);
+
+    if(dgr_journal_read_header(j, 0, &first_sequence)) {
+        uint32_t lo = 0;
+        uint32_t hi = j->pages;
+
+        // page lo continues the sequence of page 0, page hi does not
+        while(hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+
+            if(dgr_journal_read_header(j, mid, &sequence) && sequence == first_sequence + mid) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        last = lo;
+        j->sequence = first_sequence + lo + 1;
+    } else {
+        bool found = false;
+
+        for(uint32_t page = 1; page < j->pages; page++) {
+            if(dgr_journal_read_header(j, page, &sequence) && (!found || sequence >= j->sequence)) {
+                found = true;
+                last = page;
+                j->sequence = sequence + 1;
+            }
+        }
+        if(!found) {
+            return 0; // empty
+        }
+    }
+
+    j->head = last + 1 == j->pages ? 0 : last + 1;
+
+    // the oldest page starts the first written sector after the head
+    j->tail = last / pages_per_sector * pages_per_sector;
+    for(uint32_t page = (j->head + pages_per_sector - 1) / pages_per_sector * pages_per_sector;
+        page % j->pages != j->tail; page += pages_per_sector) {
+        if(dgr_journal_read_header(j, page % j->pages, &sequence) && sequence < j->sequence) {
+            j->tail = page % j->pages;
+            break;
+        }
+    }
+    j->stored = j->head > j->tail ? j->head - j->tail : j->head + j->pages - j->tail;
+
+    return 0;
+}
+
+/**
+ * Writes the staged readings to the next page, even if it is not full. The
+ * sector of the page is erased first if the page is its first one.
+ *
+ * @param j                 Journal
+ * @return                  0 on success, the readings stay staged on errors
+ */
+int
+dgr_journal_flush(journal *j) {
+    uint8_t page[JOURNAL_PAGE_SIZE];
+    uint32_t pages_per_sector = dgr_journal_pages_per_sector(j);
+    uint32_t len = JOURNAL_HEADER_SIZE + j->staged * JOURNAL_RECORD_SIZE;
+    uint16_t crc;
+    int rc;
+
+    if(j->staged == 0) {
+        return 0;
+    }
+
+    if(j->head % pages_per_sector == 0) {
+        rc = j->flash->erase(j->flash->ctx, j->head * JOURNAL_PAGE_SIZE, j->flash->sector_size);
+        if(rc != 0) {
+            return rc;
+        }
+        j->sectors_erased++;
+
+        // a full journal loses its oldest sector
+        if(j->stored > 0 && j->tail == j->head) {
+            j->tail = j->tail + pages_per_sector >= j->pages ? 0 : j->tail + pages_per_sector;
+            j->stored -= pages_per_sector;
+        }
+    }
+
+    dgr_journal_put_u32(page, JOURNAL_MAGIC);
+    dgr_journal_put_u32(&page[4], j->sequence);
+    page[8] = j->staged;
+    page[9] = 0xff;
+    for(int i = 0; i < j->staged; i++) {
+        uint8_t *record = &page[JOURNAL_HEADER_SIZE + i * JOURNAL_RECORD_SIZE];
+
+        dgr_journal_put_u32(record, j->stage[i].timestamp);
+        record[4] = j->stage[i].glucose;
+        record[5] = j->stage[i].glucose >> 8U;
+        record[6] = j->stage[i].calibration_state;
+        record[7] = j->stage[i].trend;
+    }
+    crc = dgr_crc16(page, 10);
+    crc = dgr_crc16_update(crc, &page[JOURNAL_HEADER_SIZE], len - JOURNAL_HEADER_SIZE);
+    page[10] = crc;
+    page[11] = crc >> 8U;
+
+    // only the used part of the page is programmed
+    rc = j->flash->write(j->flash->ctx, j->head * JOURNAL_PAGE_SIZE, page, len);
+    if(rc != 0) {
+        return rc;
+    }
+
+    j->staged = 0;
+    j->head = j->head + 1 == j->pages ? 0 : j->head + 1;
+    j->sequence++;
+    j->stored++;
+    j->pages_written++;
+    return 0;
+}
+
+/**
+ * Stages a reading and writes the page once it is full.
+ *
+ * @param j                 Journal
+ * @param r                 Reading
+ * @return                  0 on success, the reading is not staged if a full page can not be written
+ */
+int
+dgr_journal_append(journal *j, const reading *r) {
+    int rc;
+
+    if(j->staged == JOURNAL_PAGE_READINGS) {
+        rc = dgr_journal_flush(j);
+        if(rc != 0) {
+            return rc;
+        }
+    }
+
+    j->stage[j->staged++] = *r;
+    return j->staged == JOURNAL_PAGE_READINGS ? dgr_journal_flush(j) : 0;
+}
+
+/**
+ * Reads the readings of a stored page. Staged readings are not included.
+ *
+ * @param j                 Journal
+ * @param index             0 for the oldest page
+ * @param out               Array of at least JOURNAL_PAGE_READINGS readings
+ * @param count             Number of readings in the page
+ * @return                  0 on success
+ */
+int
+dgr_journal_read_page(const journal *j, uint32_t index, reading *out, uint8_t *count) {
+    uint8_t page[JOURNAL_PAGE_SIZE];
+    uint32_t pos;
+    uint16_t crc;
+    int rc;
+
+    if(index >= j->stored) {
+        return JOURNAL_ERR_RANGE;
+    }
+
+    pos = j->tail + index;
+    if(pos >= j->pages) {
+        pos -= j->pages;
+    }
+    rc = j->flash->read(j->flash->ctx, pos * JOURNAL_PAGE_SIZE, page, sizeof page);
+    if(rc != 0) {
+        return rc;
+    }
+    if(dgr_journal_get_u32(page) != JOURNAL_MAGIC || page[8] == 0 || page[8] > JOURNAL_PAGE_READINGS) {
+        return JOURNAL_ERR_CORRUPT;
+    }
+
+    crc = dgr_crc16(page, 10);
+    crc = dgr_crc16_update(crc, &page[JOURNAL_HEADER_SIZE], page[8] * JOURNAL_RECORD_SIZE);
+    if(crc != (page[10] | (uint16_t) page[11] << 8U)) {
+        return JOURNAL_ERR_CORRUPT;
+    }
+
+    *count = page[8];
+    for(int i = 0; i < page[8]; i++) {
+        const uint8_t *record = &page[JOURNAL_HEADER_SIZE + i * JOURNAL_RECORD_SIZE];
+
+        out[i].timestamp = dgr_journal_get_u32(record);
+        out[i].glucose = record[4] | (uint16_t) record[5] << 8U;
+        out[i].calibration_state = record[6];
+        out[i].trend = record[7];
+    }
+
+    return 0;
+}
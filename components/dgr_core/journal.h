@@ -0,0 +1,70 @@
+#ifndef DGR_JOURNAL_H
+#define DGR_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reading_log.h"
+
+/* Append-only journal of readings in flash. The flash is used as a ring of
+ * pages, every page is programmed once and holds a header and a batch of
+ * readings:
+ *
+ *  magic (u32), sequence (u32), reading count (u8), reserved (u8), crc16 (u16),
+ *  readings (timestamp u32, glucose u16, calibration state u8, trend u8), little-endian
+ *
+ * The CRC covers the header up to the CRC and the readings. Readings are staged
+ * in the journal structure, which can be placed in RTC memory, and written when
+ * a page is full or on request. A sector is erased right before its first page
+ * is written, which drops the oldest sector of a full journal. The sequence
+ * numbers of the pages increase along the ring, so the end of the journal is
+ * found by a binary search at boot.
+ *
+ * The flash is accessed through flash_ops, the module itself does not depend
+ * on the ESP-IDF.
+ */
+
+#define JOURNAL_MAGIC               0x4a524744 // "DGRJ"
+#define JOURNAL_PAGE_SIZE           256 // in bytes, the program page size of the flash
+#define JOURNAL_HEADER_SIZE         12
+#define JOURNAL_RECORD_SIZE         8
+#define JOURNAL_PAGE_READINGS       ((JOURNAL_PAGE_SIZE - JOURNAL_HEADER_SIZE) / JOURNAL_RECORD_SIZE)
+
+// functions return 0 on success, offsets and lengths are in bytes
+typedef struct flash_ops {
+    int (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    int (*erase)(void *ctx, uint32_t offset, size_t len);
+    void *ctx;
+    uint32_t size;                  // multiple of the sector size
+    uint32_t sector_size;           // multiple of JOURNAL_PAGE_SIZE
+} flash_ops;
+
+typedef struct journal {
+    const flash_ops *flash;
+    uint32_t pages;
+    uint32_t head;                  // next page to write
+    uint32_t tail;                  // oldest stored page
+    uint32_t stored;                // number of stored pages
+    uint32_t sequence;              // sequence number of the next page
+    uint8_t staged;
+    reading stage[JOURNAL_PAGE_READINGS];
+    uint32_t pages_written;
+    uint32_t sectors_erased;
+    uint32_t recovery_reads;        // page headers read by the last recovery
+} journal;
+
+void dgr_journal_init(journal *j, const flash_ops *flash);
+bool dgr_journal_valid(const journal *j, const flash_ops *flash);
+int dgr_journal_recover(journal *j, const flash_ops *flash);
+int dgr_journal_append(journal *j, const reading *r);
+int dgr_journal_flush(journal *j);
+int dgr_journal_read_page(const journal *j, uint32_t index, reading *out, uint8_t *count);
+
+static inline uint32_t
+dgr_journal_pages(const journal *j) {
+    return j->stored;
+}
+
+#endif
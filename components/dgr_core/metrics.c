@@ -0,0 +1,249 @@
+#include <string.h>
+#include "metrics.h"
+
+static const char *phase_names[METRICS_PHASE_COUNT] = {
+    "boot", "sync", "first_adv", "connected", "handles_known", "authenticated",
+    "encrypted", "glucose_rx", "backfill_done", "sleep", "awake"
+};
+
+void
+dgr_metrics_reset(dgr_metrics *metrics) {
+    memset(metrics, 0, sizeof *metrics);
+}
+
+/**
+ * Starts a new wake cycle. All milestones except the boot are cleared.
+ *
+ * @param metrics           Metrics
+ * @param boot_time         Time from the wakeup to the start of the application in milliseconds
+ */
+void
+dgr_metrics_begin_cycle(dgr_metrics *metrics, uint32_t boot_time) {
+    for(int i = 0; i < METRICS_MILESTONE_COUNT; i++) {
+        metrics->milestones[i] = METRICS_NOT_REACHED;
+    }
+
+    metrics->milestones[metrics_boot] = boot_time;
+    metrics->previous_closed_link = metrics->closed_link;
+    metrics->closed_link = false;
+    metrics->bonded_reconnect = false;
+    metrics->cycles++;
+}
+
+/**
+ * Records the first time a milestone is reached in the current cycle.
+ *
+ * @param metrics           Metrics
+ * @param milestone         Reached milestone
+ * @param now               Time since boot in milliseconds
+ */
+void
+dgr_metrics_milestone(dgr_metrics *metrics, metrics_milestone milestone, uint32_t now) {
+    if(milestone < METRICS_MILESTONE_COUNT && metrics->milestones[milestone] == METRICS_NOT_REACHED) {
+        metrics->milestones[milestone] = now;
+    }
+}
+
+static void
+dgr_metrics_add(metrics_histogram *histogram, uint32_t duration) {
+    uint8_t bucket = dgr_metrics_bucket(duration);
+
+    // saturate instead of wrapping around, the histograms are never reset
+    if(histogram->count < UINT16_MAX) {
+        histogram->count++;
+    }
+    if(histogram->buckets[bucket] < UINT16_MAX) {
+        histogram->buckets[bucket]++;
+    }
+    histogram->sum = UINT32_MAX - histogram->sum > duration ? histogram->sum + duration : UINT32_MAX;
+    if(duration > histogram->max) {
+        histogram->max = duration;
+    }
+}
+
+/**
+ * Ends the current cycle and adds the durations of its phases to the histograms.
+ * A phase lasts from the last reached milestone to the milestone ending the phase,
+ * phases of milestones that were not reached are skipped.
+ *
+ * @param metrics           Metrics
+ * @param now               Time since boot in milliseconds when going to sleep
+ * @param completed         true if the cycle reached the done state
+ */
+void
+dgr_metrics_end_cycle(dgr_metrics *metrics, uint32_t now, bool completed) {
+    uint32_t last;
+
+    metrics->milestones[metrics_sleep] = now;
+    last = metrics->milestones[metrics_boot];
+    dgr_metrics_add(&metrics->phases[metrics_boot], last);
+
+    for(int i = metrics_boot + 1; i < METRICS_MILESTONE_COUNT; i++) {
+        uint32_t reached = metrics->milestones[i];
+
+        if(reached != METRICS_NOT_REACHED && reached >= last) {
+            dgr_metrics_add(&metrics->phases[i], reached - last);
+            last = reached;
+        }
+    }
+
+    dgr_metrics_add(&metrics->phases[METRICS_AWAKE], now);
+    if(metrics->cycles > 1 && metrics->milestones[metrics_connected] != METRICS_NOT_REACHED &&
+       metrics->milestones[metrics_sync] != METRICS_NOT_REACHED) {
+        dgr_metrics_add(&metrics->connect_after[metrics->previous_closed_link],
+                        metrics->milestones[metrics_connected] - metrics->milestones[metrics_sync]);
+    }
+    if(metrics->milestones[metrics_connected] != METRICS_NOT_REACHED &&
+       metrics->milestones[metrics_glucose_rx] != METRICS_NOT_REACHED) {
+        dgr_metrics_add(&metrics->connect_to_glucose[metrics->bonded_reconnect],
+                        metrics->milestones[metrics_glucose_rx] - metrics->milestones[metrics_connected]);
+    }
+    if(!metrics->closed_link) {
+        metrics->counters[metrics_links_left_open]++;
+    }
+    if(completed) {
+        metrics->completed_cycles++;
+    }
+}
+
+void
+dgr_metrics_count(dgr_metrics *metrics, metrics_counter counter, uint32_t amount) {
+    if(counter < METRICS_COUNTER_COUNT) {
+        metrics->counters[counter] += amount;
+    }
+}
+
+/**
+ * Records how the connection of the current cycle ended. The effect on the next
+ * cycle shows in its time to connect.
+ *
+ * @param metrics           Metrics
+ * @param closed_link       true if the link was closed before going to sleep
+ */
+void
+dgr_metrics_teardown(dgr_metrics *metrics, bool closed_link) {
+    metrics->closed_link = closed_link;
+}
+
+/**
+ * Marks the current cycle as a reconnect that encrypts the link with a stored bond.
+ *
+ * @param metrics           Metrics
+ */
+void
+dgr_metrics_bonded_reconnect(dgr_metrics *metrics) {
+    metrics->bonded_reconnect = true;
+}
+
+void
+dgr_metrics_error(dgr_metrics *metrics, session_state state) {
+    if(state < SESSION_STATE_COUNT && metrics->errors[state] < UINT16_MAX) {
+        metrics->errors[state]++;
+    }
+}
+
+/**
+ * Returns the histogram bucket of a duration.
+ *
+ * @param duration          Duration in milliseconds
+ * @return                  0 for durations below 1 ms, k for durations in [2^(k-1), 2^k) ms
+ */
+uint8_t
+dgr_metrics_bucket(uint32_t duration) {
+    uint8_t bucket = 0;
+
+    while(duration > 0 && bucket < METRICS_BUCKETS - 1) {
+        duration >>= 1U;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static uint8_t*
+dgr_metrics_put_u16(uint8_t *pos, uint16_t value) {
+    pos[0] = value;
+    pos[1] = value >> 8U;
+    return pos + 2;
+}
+
+static uint8_t*
+dgr_metrics_put_u32(uint8_t *pos, uint32_t value) {
+    pos[0] = value;
+    pos[1] = value >> 8U;
+    pos[2] = value >> 16U;
+    pos[3] = value >> 24U;
+    return pos + 4;
+}
+
+static uint8_t*
+dgr_metrics_put_histogram(uint8_t *pos, const metrics_histogram *histogram) {
+    pos = dgr_metrics_put_u16(pos, histogram->count);
+    pos = dgr_metrics_put_u32(pos, histogram->sum);
+    pos = dgr_metrics_put_u32(pos, histogram->max);
+    for(int j = 0; j < METRICS_BUCKETS; j++) {
+        pos = dgr_metrics_put_u16(pos, histogram->buckets[j]);
+    }
+
+    return pos;
+}
+
+/**
+ * Writes the metrics in a compact little-endian format:
+ *
+ *  "DGRM", version, milestone count, state count, counter count, phase count, bucket count, 2 reserved bytes,
+ *  cycles (u32), completed cycles (u32), counters (u32 each), errors by state (u16 each),
+ *  milestones of the last cycle (u32 each), phases (count u16, sum u32, max u32, buckets u16 each),
+ *  time to connect after a cycle that left the link up and after one that closed it (same as phases),
+ *  time from connected to GlucoseRx with authentication exchange and with stored bond (same as phases)
+ *
+ * @param metrics           Metrics
+ * @param buf               Output buffer
+ * @param size              Size of the output buffer
+ * @return                  Number of written bytes, 0 if the buffer is smaller than METRICS_DUMP_SIZE
+ */
+size_t
+dgr_metrics_serialize(const dgr_metrics *metrics, uint8_t *buf, size_t size) {
+    uint8_t *pos = buf;
+
+    if(size < METRICS_DUMP_SIZE) {
+        return 0;
+    }
+
+    memcpy(pos, "DGRM", 4);
+    pos[4] = METRICS_VERSION;
+    pos[5] = METRICS_MILESTONE_COUNT;
+    pos[6] = SESSION_STATE_COUNT;
+    pos[7] = METRICS_COUNTER_COUNT;
+    pos[8] = METRICS_PHASE_COUNT;
+    pos[9] = METRICS_BUCKETS;
+    pos[10] = 0;
+    pos[11] = 0;
+    pos += 12;
+
+    pos = dgr_metrics_put_u32(pos, metrics->cycles);
+    pos = dgr_metrics_put_u32(pos, metrics->completed_cycles);
+    for(int i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        pos = dgr_metrics_put_u32(pos, metrics->counters[i]);
+    }
+    for(int i = 0; i < SESSION_STATE_COUNT; i++) {
+        pos = dgr_metrics_put_u16(pos, metrics->errors[i]);
+    }
+    for(int i = 0; i < METRICS_MILESTONE_COUNT; i++) {
+        pos = dgr_metrics_put_u32(pos, metrics->milestones[i]);
+    }
+    for(int i = 0; i < METRICS_PHASE_COUNT; i++) {
+        pos = dgr_metrics_put_histogram(pos, &metrics->phases[i]);
+    }
+    pos = dgr_metrics_put_histogram(pos, &metrics->connect_after[0]);
+    pos = dgr_metrics_put_histogram(pos, &metrics->connect_after[1]);
+    pos = dgr_metrics_put_histogram(pos, &metrics->connect_to_glucose[0]);
+    pos = dgr_metrics_put_histogram(pos, &metrics->connect_to_glucose[1]);
+
+    return pos - buf;
+}
+
+const char*
+dgr_metrics_phase_name(unsigned int phase) {
+    return phase < METRICS_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
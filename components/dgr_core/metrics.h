@@ -0,0 +1,93 @@
+#ifndef DGR_METRICS_H
+#define DGR_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "session.h"
+
+/* Metrics of the wake cycles. Every cycle records the time of its milestones,
+ * the time between two reached milestones is added to the histogram of the
+ * phase ending at the later one. The histograms use log2 buckets, bucket 0
+ * counts durations below 1 ms and bucket k durations in [2^(k-1), 2^k) ms.
+ * The metrics are kept in RTC memory by the caller and serialized with
+ * dgr_metrics_serialize, tools/dgr_metrics.py decodes the dump.
+ */
+
+#define METRICS_VERSION             4
+#define METRICS_BUCKETS             20 // the last bucket counts everything from 2^18 ms (262 s)
+#define METRICS_NOT_REACHED         UINT32_MAX
+
+typedef enum {
+    metrics_boot,
+    metrics_sync,                   // host and controller synced
+    metrics_first_adv,              // on a direct connection the advertisement it was made on
+    metrics_connected,
+    metrics_handles_known,
+    metrics_authenticated,          // authenticated and bonded
+    metrics_encrypted,
+    metrics_glucose_rx,
+    metrics_backfill_done,
+    metrics_sleep,
+    METRICS_MILESTONE_COUNT
+} metrics_milestone;
+
+// one phase per milestone after boot, the last one is the awake time of the whole cycle
+#define METRICS_AWAKE               METRICS_MILESTONE_COUNT
+#define METRICS_PHASE_COUNT         (METRICS_MILESTONE_COUNT + 1)
+
+typedef enum {
+    metrics_packets_rx,             // notifications received from the transmitter
+    metrics_bytes_rx,
+    metrics_crc_mismatches,
+    metrics_duplicate_readings,
+    metrics_out_of_band_readings,
+    metrics_timeouts,               // missed deadlines of session states
+    metrics_links_left_open,        // cycles that went to sleep with the link still up
+    metrics_backfill_reordered,     // backfill notifications that arrived ahead of their turn
+    metrics_backfill_gaps,          // repeated backfill requests after a missing notification
+    METRICS_COUNTER_COUNT
+} metrics_counter;
+
+// size of the dump, see dgr_metrics_serialize for the layout
+#define METRICS_DUMP_SIZE           (20 + 4 * METRICS_COUNTER_COUNT + 2 * SESSION_STATE_COUNT + \
+                                     4 * METRICS_MILESTONE_COUNT + \
+                                     (METRICS_PHASE_COUNT + 4) * (10 + 2 * METRICS_BUCKETS))
+
+typedef struct metrics_histogram {
+    uint16_t count;
+    uint32_t sum;                   // in milliseconds
+    uint32_t max;                   // in milliseconds
+    uint16_t buckets[METRICS_BUCKETS];
+} metrics_histogram;
+
+typedef struct dgr_metrics {
+    uint32_t cycles;
+    uint32_t completed_cycles;      // cycles that reached the done state
+    uint32_t counters[METRICS_COUNTER_COUNT];
+    uint16_t errors[SESSION_STATE_COUNT]; // errors by session state at the time of the error
+    uint32_t milestones[METRICS_MILESTONE_COUNT]; // of the current cycle, in ms since boot
+    metrics_histogram phases[METRICS_PHASE_COUNT];
+    bool closed_link;               // the current cycle closed the link before sleeping
+    bool previous_closed_link;
+    // time from sync to connected, split by whether the previous cycle closed the link
+    metrics_histogram connect_after[2];
+    bool bonded_reconnect;          // the current cycle encrypted the link with a stored bond
+    // time from connected to GlucoseRx, split by whether a stored bond was used
+    metrics_histogram connect_to_glucose[2];
+} dgr_metrics;
+
+void dgr_metrics_reset(dgr_metrics *metrics);
+void dgr_metrics_begin_cycle(dgr_metrics *metrics, uint32_t boot_time);
+void dgr_metrics_milestone(dgr_metrics *metrics, metrics_milestone milestone, uint32_t now);
+void dgr_metrics_end_cycle(dgr_metrics *metrics, uint32_t now, bool completed);
+void dgr_metrics_count(dgr_metrics *metrics, metrics_counter counter, uint32_t amount);
+void dgr_metrics_teardown(dgr_metrics *metrics, bool closed_link);
+void dgr_metrics_bonded_reconnect(dgr_metrics *metrics);
+void dgr_metrics_error(dgr_metrics *metrics, session_state state);
+uint8_t dgr_metrics_bucket(uint32_t duration);
+size_t dgr_metrics_serialize(const dgr_metrics *metrics, uint8_t *buf, size_t size);
+const char* dgr_metrics_phase_name(unsigned int phase);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef DGR_MSG_TABLE_H
+#define DGR_MSG_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Layout of the transmitter messages. Every message starts with its opcode,
+ * the ones marked with MSG_CRC end with a CRC-16 (little-endian) over the
+ * bytes before it. The characteristic and the opcode identify a received
+ * message, backfill data has no opcode. The tables are expanded into the
+ * constants below and into the codec in messages.c.
+ *
+ * Message:   name, opcode, characteristic, length with CRC, flags, handler of the notification
+ * Field:     message, name, offset, size in bytes
+ */
+
+#define MSG_CRC                     0x1 // ends with a CRC
+#define MSG_LONGER                  0x2 // may be longer than its length, the CRC is always at the end
+#define MSG_MAX_LENGTH              20 // notifications of the default ATT MTU
+
+#define DGR_MESSAGES(X) \
+    X(AUTH_REQUEST_TX,      0x01, msg_auth,     10, 0,                   NULL) \
+    X(AUTH_CHALLENGE_RX,    0x03, msg_auth,     17, 0,                   NULL) \
+    X(AUTH_CHALLENGE_TX,    0x04, msg_auth,     9,  0,                   NULL) \
+    X(AUTH_STATUS_RX,       0x05, msg_auth,     3,  0,                   NULL) \
+    X(KEEP_ALIVE_TX,        0x06, msg_auth,     2,  0,                   NULL) \
+    X(BOND_REQUEST_TX,      0x07, msg_auth,     1,  0,                   NULL) \
+    X(BOND_REQUEST_RX,      0x08, msg_auth,     1,  MSG_LONGER,          NULL) \
+    X(DISCONNECT_TX,        0x09, msg_control,  1,  0,                   NULL) \
+    X(TIME_TX,              0x24, msg_control,  3,  MSG_CRC,             NULL) \
+    X(TIME_RX,              0x25, msg_control,  16, MSG_CRC,             dgr_parse_time_msg) \
+    X(GLUCOSE_TX,           0x4e, msg_control,  3,  MSG_CRC,             NULL) \
+    X(GLUCOSE_RX,           0x4f, msg_control,  16, MSG_CRC | MSG_LONGER, dgr_parse_glucose_msg) \
+    X(BACKFILL_TX,          0x50, msg_control,  20, MSG_CRC,             NULL) \
+    X(BACKFILL_RX,          0x51, msg_control,  20, MSG_CRC,             dgr_parse_backfill_status_msg)
+
+#define DGR_MESSAGE_FIELDS(F) \
+    F(AUTH_REQUEST_TX,      TOKEN,              1,  8) \
+    F(AUTH_REQUEST_TX,      CHANNEL,            9,  1) \
+    F(AUTH_CHALLENGE_RX,    TOKEN_HASH,         1,  8) \
+    F(AUTH_CHALLENGE_RX,    CHALLENGE,          9,  8) \
+    F(AUTH_CHALLENGE_TX,    CHALLENGE_HASH,     1,  8) \
+    F(AUTH_STATUS_RX,       AUTHENTICATED,      1,  1) \
+    F(AUTH_STATUS_RX,       BONDED,             2,  1) \
+    F(KEEP_ALIVE_TX,        TIME,               1,  1) \
+    F(TIME_RX,              STATE,              1,  1) \
+    F(TIME_RX,              CURRENT_TIME,       2,  4) \
+    F(TIME_RX,              SESSION_START,      6,  4) \
+    F(GLUCOSE_RX,           STATE,              1,  1) \
+    F(GLUCOSE_RX,           SEQUENCE,           2,  4) \
+    F(GLUCOSE_RX,           TIMESTAMP,          6,  4) \
+    F(GLUCOSE_RX,           GLUCOSE,            10, 2) \
+    F(GLUCOSE_RX,           CALIBRATION_STATE,  12, 1) \
+    F(GLUCOSE_RX,           TREND,              13, 1) \
+    F(BACKFILL_TX,          TYPE,               1,  3) \
+    F(BACKFILL_TX,          START_TIME,         4,  4) \
+    F(BACKFILL_TX,          END_TIME,           8,  4) \
+    F(BACKFILL_RX,          STATUS,             1,  1) \
+    F(BACKFILL_RX,          START_TIME,         4,  4) \
+    F(BACKFILL_RX,          END_TIME,           8,  4)
+
+// a received message, in its mbuf or copied from a chain of mbufs
+typedef struct msg_view {
+    const uint8_t *data;
+    uint8_t length;
+    bool crc_ok;                    // true for messages without CRC
+} msg_view;
+
+typedef void (*msg_handler)(const msg_view *msg, uint16_t conn_handle);
+
+typedef enum {
+    msg_auth,
+    msg_control,
+    msg_backfill,
+    msg_unknown
+} msg_characteristic;
+
+// e.g. GLUCOSE_RX_OPCODE, GLUCOSE_RX_LENGTH and GLUCOSE_RX_FLAGS
+#define MSG_CONSTANTS(name, opcode, chr, length, flags, handler) \
+    name##_OPCODE = (opcode), \
+    name##_LENGTH = (length), \
+    name##_FLAGS = (flags),
+enum { DGR_MESSAGES(MSG_CONSTANTS) };
+#undef MSG_CONSTANTS
+
+// e.g. GLUCOSE_RX_SEQUENCE and GLUCOSE_RX_SEQUENCE_SIZE for the sequence number in GlucoseRx
+#define MSG_FIELD_OFFSETS(msg, name, offset, size) \
+    msg##_##name = (offset), \
+    msg##_##name##_SIZE = (size),
+enum { DGR_MESSAGE_FIELDS(MSG_FIELD_OFFSETS) };
+#undef MSG_FIELD_OFFSETS
+
+// every field lies between the opcode and the CRC
+#define MSG_FIELD_CHECKS(msg, name, offset, size) \
+    _Static_assert((offset) >= 1 && (offset) + (size) <= msg##_LENGTH - (msg##_FLAGS & MSG_CRC ? 2 : 0), \
+                   #msg "_" #name " is outside of the message");
+DGR_MESSAGE_FIELDS(MSG_FIELD_CHECKS)
+#undef MSG_FIELD_CHECKS
+
+#endif
@@ -0,0 +1,200 @@
+#include <stddef.h>
+#include "query.h"
+
+/**
+ * Finds the archive block that can contain a timestamp by the start
+ * timestamps of the blocks.
+ *
+ * @return                  Last block starting before or at the timestamp, 0 if there is none
+ */
+static uint16_t
+dgr_query_find_block(const ts_archive *archive, uint32_t timestamp) {
+    uint16_t lo = 0;
+    uint16_t hi = dgr_ts_archive_blocks(archive);
+
+    // blocks before lo start before or at the timestamp
+    while(lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+
+        if(dgr_ts_archive_block_start(archive, mid) <= timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo > 0 ? lo - 1 : 0;
+}
+
+/**
+ * Starts a query for all readings in a time range, oldest first.
+ *
+ * @param cursor            Cursor
+ * @param log               Reading log with the newer readings
+ * @param archive           Archive with the older readings
+ * @param from              First timestamp of the range
+ * @param to                Last timestamp of the range
+ */
+void
+dgr_query_range(reading_cursor *cursor, const reading_log *log, const ts_archive *archive,
+                uint32_t from, uint32_t to) {
+    cursor->log = log;
+    cursor->archive = archive;
+    cursor->from = from;
+    cursor->to = to;
+    cursor->index = dgr_reading_log_lower_bound(log, from);
+    cursor->in_archive = false;
+
+    if(dgr_ts_archive_blocks(archive) > 0 && from <= archive->last.timestamp) {
+        cursor->block = dgr_query_find_block(archive, from);
+        cursor->in_archive = dgr_ts_decoder_init(&cursor->decoder, archive, cursor->block);
+    }
+}
+
+/**
+ * Starts a query for the newest readings, oldest first.
+ *
+ * @param cursor            Cursor
+ * @param log               Reading log with the newer readings
+ * @param archive           Archive with the older readings
+ * @param n                 Number of readings
+ */
+void
+dgr_query_latest(reading_cursor *cursor, const reading_log *log, const ts_archive *archive, uint32_t n) {
+    uint16_t count = dgr_reading_log_count(log);
+    uint32_t archived;
+    uint32_t skip;
+    uint16_t block;
+
+    cursor->log = log;
+    cursor->archive = archive;
+    cursor->from = 0;
+    cursor->to = UINT32_MAX;
+    cursor->in_archive = false;
+
+    if(n <= count) {
+        cursor->index = count - n;
+        return;
+    }
+    cursor->index = 0;
+
+    // skip the older archived readings by the reading counts of the blocks
+    archived = dgr_ts_archive_readings(archive);
+    skip = archived > n - count ? archived - (n - count) : 0;
+    for(block = 0; block < dgr_ts_archive_blocks(archive); block++) {
+        uint8_t readings = dgr_ts_archive_block_readings(archive, block);
+
+        if(skip < readings) {
+            break;
+        }
+        skip -= readings;
+    }
+
+    if(dgr_ts_decoder_init(&cursor->decoder, archive, block)) {
+        cursor->block = block;
+        cursor->in_archive = true;
+        while(skip-- > 0) {
+            dgr_ts_decoder_next(&cursor->decoder, &cursor->decoded);
+        }
+    }
+}
+
+/**
+ * Returns the next reading of a query.
+ *
+ * @param cursor            Cursor
+ * @return                  The reading, NULL at the end of the query. The reading is
+ *                          valid until the next call or until the stores are changed.
+ */
+const reading*
+dgr_query_next(reading_cursor *cursor) {
+    const reading *r;
+
+    while(cursor->in_archive) {
+        if(!dgr_ts_decoder_next(&cursor->decoder, &cursor->decoded)) {
+            cursor->block++;
+            cursor->in_archive = dgr_ts_decoder_init(&cursor->decoder, cursor->archive, cursor->block);
+        } else if(cursor->decoded.timestamp > cursor->to) {
+            // the log only holds newer readings
+            cursor->in_archive = false;
+            cursor->index = dgr_reading_log_count(cursor->log);
+        } else if(cursor->decoded.timestamp >= cursor->from) {
+            return &cursor->decoded;
+        }
+    }
+
+    r = dgr_reading_log_get(cursor->log, cursor->index);
+    if(r == NULL || r->timestamp > cursor->to) {
+        return NULL;
+    }
+
+    cursor->index++;
+    return r;
+}
+
+/**
+ * Passes all remaining readings of a query to a function.
+ *
+ * @param cursor            Cursor
+ * @param visit             Function called for every reading
+ * @param arg               Argument of the function
+ * @return                  Number of visited readings
+ */
+uint32_t
+dgr_query_visit(reading_cursor *cursor, reading_visitor visit, void *arg) {
+    const reading *r;
+    uint32_t visited = 0;
+
+    while((r = dgr_query_next(cursor)) != NULL) {
+        visited++;
+        if(!visit(r, arg)) {
+            break;
+        }
+    }
+
+    return visited;
+}
+
+/**
+ * Finds the reading closest in time to a timestamp.
+ *
+ * @param log               Reading log with the newer readings
+ * @param archive           Archive with the older readings
+ * @param timestamp         Timestamp
+ * @param out               The reading is written to this variable
+ * @return                  false if there are no readings
+ */
+bool
+dgr_query_nearest(const reading_log *log, const ts_archive *archive, uint32_t timestamp, reading *out) {
+    reading_cursor cursor;
+    const reading *after;
+    reading before;
+    bool found_before = false;
+    uint16_t index = dgr_reading_log_lower_bound(log, timestamp);
+
+    if(index > 0) {
+        before = *dgr_reading_log_get(log, index - 1);
+        found_before = true;
+    } else if(dgr_ts_archive_blocks(archive) > 0 && dgr_ts_archive_block_start(archive, 0) <= timestamp) {
+        ts_decoder decoder;
+        reading r;
+
+        // the last reading before the timestamp is in the block the timestamp falls into
+        dgr_ts_decoder_init(&decoder, archive, dgr_query_find_block(archive, timestamp));
+        while(dgr_ts_decoder_next(&decoder, &r) && r.timestamp <= timestamp) {
+            before = r;
+            found_before = true;
+        }
+    }
+
+    dgr_query_range(&cursor, log, archive, timestamp, UINT32_MAX);
+    after = dgr_query_next(&cursor);
+
+    if(after != NULL && (!found_before || after->timestamp - timestamp < timestamp - before.timestamp)) {
+        *out = *after;
+    } else if(found_before) {
+        *out = before;
+    }
+
+    return after != NULL || found_before;
+}
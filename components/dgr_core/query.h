@@ -0,0 +1,43 @@
+#ifndef DGR_QUERY_H
+#define DGR_QUERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "reading_log.h"
+#include "ts_compress.h"
+
+/* Queries over the readings in RTC memory. The archive holds the older
+ * readings and the reading log the newer ones, both in timestamp order. The
+ * start timestamps of the archive blocks are a sparse index into the archive,
+ * the log is searched directly. A query takes O(log n) to find its start,
+ * at most one archive block to decode up to the start and O(k) for k results.
+ *
+ * A cursor only reads the stores. Readings of the log are returned in place,
+ * readings of the archive are decoded into the cursor. The stores must not be
+ * changed while a cursor is used.
+ */
+
+typedef struct reading_cursor {
+    const reading_log *log;
+    const ts_archive *archive;
+    uint32_t from;                  // inclusive timestamp range
+    uint32_t to;
+    bool in_archive;
+    uint16_t block;                 // archive block of the decoder
+    ts_decoder decoder;
+    reading decoded;                // last reading returned from the archive
+    uint16_t index;                 // next index in the log
+} reading_cursor;
+
+// return false to end the query
+typedef bool (*reading_visitor)(const reading *r, void *arg);
+
+void dgr_query_range(reading_cursor *cursor, const reading_log *log, const ts_archive *archive,
+                     uint32_t from, uint32_t to);
+void dgr_query_latest(reading_cursor *cursor, const reading_log *log, const ts_archive *archive, uint32_t n);
+const reading* dgr_query_next(reading_cursor *cursor);
+uint32_t dgr_query_visit(reading_cursor *cursor, reading_visitor visit, void *arg);
+bool dgr_query_nearest(const reading_log *log, const ts_archive *archive, uint32_t timestamp, reading *out);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stddef.h>
+#include "reading_log.h"
+
+/**
+ * Initializes an empty log.
+ *
+ * @param log               Log
+ * @param records           Storage for the records
+ * @param capacity          Number of records that fit into the storage
+ * @param policy            Behaviour of a full log
+ */
+void
+dgr_reading_log_init(reading_log *log, reading *records, uint16_t capacity, reading_log_policy policy) {
+    log->records = records;
+    log->capacity = capacity;
+    log->policy = policy;
+    dgr_reading_log_clear(log);
+}
+
+/**
+ * Checks the management data of a log that survived a deep sleep.
+ *
+ * @param log               Log
+ * @param records           Expected storage of the records
+ * @param capacity          Expected capacity
+ * @return                  true if the log can be used without initialization
+ */
+bool
+dgr_reading_log_valid(const reading_log *log, const reading *records, uint16_t capacity) {
+    return log->records == records && log->capacity == capacity &&
+           log->head < capacity && log->count <= capacity;
+}
+
+/**
+ * Appends a record. A full log overwrites its oldest record or rejects the
+ * new one, depending on its policy.
+ *
+ * @param log               Log
+ * @param r                 Record to append
+ * @return                  false if the record was rejected
+ */
+bool
+dgr_reading_log_append(reading_log *log, const reading *r) {
+    uint16_t tail;
+
+    if(log->count == log->capacity) {
+        if(log->policy == reading_log_drop_newest || log->capacity == 0) {
+            return false;
+        }
+
+        // the slot of the oldest record becomes the newest one
+        log->records[log->head] = *r;
+        log->head = log->head + 1 == log->capacity ? 0 : log->head + 1;
+        log->overwritten++;
+        return true;
+    }
+
+    tail = log->head + log->count;
+    if(tail >= log->capacity) {
+        tail -= log->capacity;
+    }
+    log->records[tail] = *r;
+    log->count++;
+    return true;
+}
+
+static reading*
+dgr_reading_log_slot(const reading_log *log, uint16_t index) {
+    uint32_t pos = (uint32_t) log->head + index;
+
+    if(pos >= log->capacity) {
+        pos -= log->capacity;
+    }
+    return &log->records[pos];
+}
+
+/**
+ * Inserts a record at the position of its timestamp. A full log drops its
+ * oldest record for a newer one, depending on its policy.
+ *
+ * @param log               Log ordered by timestamp
+ * @param r                 Record to insert
+ * @param conflict          What to do with a stored record of the same timestamp
+ * @param evicted           The dropped record is written to this variable, may be NULL
+ * @return                  What happened to the record
+ */
+reading_log_result
+dgr_reading_log_insert(reading_log *log, const reading *r, reading_conflict_policy conflict, reading *evicted) {
+    uint16_t index = dgr_reading_log_lower_bound(log, r->timestamp);
+    reading_log_result result = reading_log_inserted;
+
+    if(index < log->count) {
+        reading *stored = dgr_reading_log_slot(log, index);
+
+        if(stored->timestamp == r->timestamp) {
+            if(conflict == reading_conflict_keep) {
+                return reading_log_duplicate;
+            }
+            *stored = *r;
+            return reading_log_replaced;
+        }
+    }
+
+    if(log->count == log->capacity) {
+        // a record older than all others would be dropped right away
+        if(log->policy == reading_log_drop_newest || index == 0) {
+            return reading_log_rejected;
+        }
+
+        if(evicted != NULL) {
+            *evicted = log->records[log->head];
+        }
+        log->head = log->head + 1 == log->capacity ? 0 : log->head + 1;
+        log->count--;
+        log->overwritten++;
+        index--;
+        result = reading_log_overwrote;
+    }
+
+    for(uint16_t i = log->count; i > index; i--) {
+        *dgr_reading_log_slot(log, i) = *dgr_reading_log_slot(log, i - 1);
+    }
+    *dgr_reading_log_slot(log, index) = *r;
+    log->count++;
+    return result;
+}
+
+/**
+ * Returns the record with a timestamp.
+ *
+ * @param log               Log ordered by timestamp
+ * @param timestamp         Timestamp
+ * @return                  The record, NULL if there is none
+ */
+const reading*
+dgr_reading_log_find(const reading_log *log, uint32_t timestamp) {
+    const reading *r = dgr_reading_log_get(log, dgr_reading_log_lower_bound(log, timestamp));
+
+    return r != NULL && r->timestamp == timestamp ? r : NULL;
+}
+
+/**
+ * Returns a record without removing it.
+ *
+ * @param log               Log
+ * @param index             0 for the oldest record, count - 1 for the newest
+ * @return                  The record, NULL if the index is out of range
+ */
+const reading*
+dgr_reading_log_get(const reading_log *log, uint16_t index) {
+    if(index >= log->count) {
+        return NULL;
+    }
+
+    return dgr_reading_log_slot(log, index);
+}
+
+/**
+ * Finds the first record that is not older than a timestamp. The records must
+ * be ordered by their timestamps.
+ *
+ * @param log               Log
+ * @param timestamp         Timestamp
+ * @return                  Index of the record, count if all records are older
+ */
+uint16_t
+dgr_reading_log_lower_bound(const reading_log *log, uint32_t timestamp) {
+    uint16_t lo = 0;
+    uint16_t hi = log->count;
+
+    while(lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+
+        if(dgr_reading_log_get(log, mid)->timestamp < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+const reading*
+dgr_reading_log_latest(const reading_log *log) {
+    return log->count > 0 ? dgr_reading_log_get(log, log->count - 1) : NULL;
+}
+
+void
+dgr_reading_log_clear(reading_log *log) {
+    log->head = 0;
+    log->count = 0;
+    log->overwritten = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef DGR_READING_LOG_H
+#define DGR_READING_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Circular log of fixed size reading records. The records are stored without
+ * any per item header, the position of the oldest record and the number of
+ * records are the only management data. Reads are non-destructive and take
+ * constant time. The caller provides the record array, so the log can be
+ * placed in RTC memory.
+ *
+ * Records added with dgr_reading_log_insert are kept in timestamp order
+ * without duplicate timestamps. The position is found by a binary search,
+ * only the newer records are moved, which are few for readings that arrive
+ * roughly in order.
+ */
+
+typedef struct reading {
+    uint32_t timestamp;             // transmitter time in seconds
+    uint16_t glucose;
+    uint8_t calibration_state;
+    uint8_t trend;
+} reading;
+
+typedef enum {
+    reading_log_overwrite_oldest,   // a full log drops its oldest record
+    reading_log_drop_newest         // a full log rejects new records
+} reading_log_policy;
+
+typedef enum {
+    reading_conflict_keep,          // a stored record with the same timestamp stays
+    reading_conflict_replace        // a stored record with the same timestamp is replaced
+} reading_conflict_policy;
+
+typedef enum {
+    reading_log_inserted,
+    reading_log_overwrote,          // inserted, the oldest record was dropped
+    reading_log_replaced,           // replaced the record with the same timestamp
+    reading_log_duplicate,          // kept the record with the same timestamp
+    reading_log_rejected            // log full and the record does not replace the oldest one
+} reading_log_result;
+
+typedef struct reading_log {
+    reading *records;
+    uint16_t capacity;
+    uint16_t head;                  // index of the oldest record
+    uint16_t count;
+    reading_log_policy policy;
+    uint32_t overwritten;           // records lost because the log was full
+} reading_log;
+
+void dgr_reading_log_init(reading_log *log, reading *records, uint16_t capacity, reading_log_policy policy);
+bool dgr_reading_log_valid(const reading_log *log, const reading *records, uint16_t capacity);
+bool dgr_reading_log_append(reading_log *log, const reading *r);
+reading_log_result dgr_reading_log_insert(reading_log *log, const reading *r, reading_conflict_policy conflict,
+                                          reading *evicted);
+const reading* dgr_reading_log_find(const reading_log *log, uint32_t timestamp);
+const reading* dgr_reading_log_get(const reading_log *log, uint16_t index);
+uint16_t dgr_reading_log_lower_bound(const reading_log *log, uint32_t timestamp);
+const reading* dgr_reading_log_latest(const reading_log *log);
+void dgr_reading_log_clear(reading_log *log);
+
+static inline uint16_t
+dgr_reading_log_count(const reading_log *log) {
+    return log->count;
+}
+
+static inline bool
+dgr_reading_log_full(const reading_log *log) {
+    return log->count == log->capacity;
+}
+
+#endif
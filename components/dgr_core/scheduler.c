@@ -0,0 +1,114 @@
+#include <string.h>
+#include "scheduler.h"
+
+void
+dgr_schedule_reset(dgr_schedule *schedule) {
+    memset(schedule, 0, sizeof *schedule);
+}
+
+/**
+ * Records the transmitter time received in a TimeRx message. Two syncs at least
+ * DRIFT_MIN_BASELINE apart update the drift estimate, the resolution of one
+ * second of the transmitter time is too coarse for shorter baselines.
+ *
+ * @param schedule          Scheduler state
+ * @param tx_time           Transmitter time in seconds
+ * @param rtc_time          RTC time at reception in milliseconds
+ */
+void
+dgr_schedule_time_sync(dgr_schedule *schedule, uint32_t tx_time, int64_t rtc_time) {
+    if(!schedule->synced || tx_time < schedule->sync_tx_time || rtc_time < schedule->sync_rtc_time) {
+        // first sync or one of the clocks was restarted
+        bool drift_known = schedule->drift_known;
+        int32_t drift_ppm = schedule->drift_ppm;
+
+        dgr_schedule_reset(schedule);
+        // the drift is a property of the rtc and stays valid
+        schedule->drift_known = drift_known;
+        schedule->drift_ppm = drift_ppm;
+        schedule->anchor_tx_time = tx_time;
+        schedule->anchor_rtc_time = rtc_time;
+    } else if(tx_time - schedule->anchor_tx_time >= DRIFT_MIN_BASELINE) {
+        int64_t tx_elapsed = (int64_t) (tx_time - schedule->anchor_tx_time) * 1000;
+        int64_t rtc_elapsed = rtc_time - schedule->anchor_rtc_time;
+        int64_t measured_ppm = (rtc_elapsed - tx_elapsed) * 1000000 / tx_elapsed;
+
+        if(measured_ppm > -DRIFT_MAX_PPM && measured_ppm < DRIFT_MAX_PPM) {
+            // smooth out the error of the whole-second transmitter time
+            schedule->drift_ppm = schedule->drift_known ?
+                                  (int32_t) ((3 * (int64_t) schedule->drift_ppm + measured_ppm) / 4) :
+                                  (int32_t) measured_ppm;
+            schedule->drift_known = true;
+        }
+
+        schedule->anchor_tx_time = tx_time;
+        schedule->anchor_rtc_time = rtc_time;
+    }
+
+    schedule->sync_tx_time = tx_time;
+    schedule->sync_rtc_time = rtc_time;
+    schedule->synced = true;
+}
+
+/**
+ * Records the transmitter timestamp of a received reading.
+ *
+ * @param schedule          Scheduler state
+ * @param timestamp         Transmitter time of the reading in seconds
+ */
+void
+dgr_schedule_reading(dgr_schedule *schedule, uint32_t timestamp) {
+    if(timestamp > schedule->last_reading) {
+        schedule->last_reading = timestamp;
+    }
+}
+
+/**
+ * Converts a transmitter time to the corresponding RTC time.
+ *
+ * @param schedule          Synced scheduler state
+ * @param tx_time           Transmitter time in seconds
+ * @return                  RTC time in milliseconds
+ */
+int64_t
+dgr_schedule_tx_to_rtc(const dgr_schedule *schedule, uint32_t tx_time) {
+    int64_t tx_delta = (int64_t) tx_time - schedule->sync_tx_time;
+    int64_t rtc_delta = tx_delta * 1000;
+
+    if(schedule->drift_known) {
+        rtc_delta += tx_delta * schedule->drift_ppm / 1000;
+    }
+
+    return schedule->sync_rtc_time + rtc_delta;
+}
+
+/**
+ * Computes how long to sleep until shortly before the next wanted reading.
+ *
+ * @param schedule          Scheduler state
+ * @param now               Current RTC time in milliseconds
+ * @param every_nth         1 to wake up for every reading, n to wake up for every n-th reading
+ * @param lead_time         Time in milliseconds to wake up before the reading
+ * @return                  Sleep time in milliseconds, -1 if the schedule is unknown
+ */
+int64_t
+dgr_schedule_next_wakeup(const dgr_schedule *schedule, int64_t now, uint8_t every_nth, uint32_t lead_time) {
+    uint32_t step = READING_INTERVAL * (every_nth > 0 ? every_nth : 1);
+    uint32_t next_reading;
+    int64_t wakeup;
+
+    if(!schedule->synced || schedule->last_reading == 0) {
+        return -1;
+    }
+
+    next_reading = schedule->last_reading + step;
+    wakeup = dgr_schedule_tx_to_rtc(schedule, next_reading) - lead_time;
+
+    // skip readings that are already missed, e.g. after a long backfill
+    while(wakeup <= now) {
+        next_reading += step;
+        wakeup = dgr_schedule_tx_to_rtc(schedule, next_reading) - lead_time;
+    }
+
+    return wakeup - now;
+}
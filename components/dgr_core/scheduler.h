@@ -0,0 +1,34 @@
+#ifndef DGR_SCHEDULER_H
+#define DGR_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Wake scheduler. It maps the transmitter clock to the RTC of the ESP and
+ * computes the time of the next reading. The functions only work on the
+ * given state and times, so they do not depend on the ESP-IDF.
+ */
+
+#define READING_INTERVAL            300 // in seconds, the transmitter takes a reading every 5 minutes
+#define DRIFT_MIN_BASELINE          3600 // in seconds of transmitter time between two drift measurements
+#define DRIFT_MAX_PPM               2000 // larger measured drifts are treated as clock jumps
+
+typedef struct dgr_schedule {
+    bool synced;
+    uint32_t sync_tx_time;      // transmitter time of the last TimeRx in seconds
+    int64_t sync_rtc_time;      // rtc time of the last TimeRx in milliseconds
+    uint32_t anchor_tx_time;    // start of the current drift measurement
+    int64_t anchor_rtc_time;
+    bool drift_known;
+    int32_t drift_ppm;          // positive if the rtc runs faster than the transmitter clock
+    uint32_t last_reading;      // transmitter timestamp of the last reading, 0 if unknown
+} dgr_schedule;
+
+void dgr_schedule_reset(dgr_schedule *schedule);
+void dgr_schedule_time_sync(dgr_schedule *schedule, uint32_t tx_time, int64_t rtc_time);
+void dgr_schedule_reading(dgr_schedule *schedule, uint32_t timestamp);
+int64_t dgr_schedule_tx_to_rtc(const dgr_schedule *schedule, uint32_t tx_time);
+int64_t dgr_schedule_next_wakeup(const dgr_schedule *schedule, int64_t now, uint8_t every_nth,
+                                 uint32_t lead_time);
+
+#endif
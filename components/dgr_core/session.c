@@ -0,0 +1,236 @@
+#include <stddef.h>
+#include "session.h"
+
+// targets and wildcard of the transition table
+#define SESSION_ANY_STATE       SESSION_STATE_COUNT
+#define SESSION_DEFER           (SESSION_STATE_COUNT + 1) // keep the event for the next state
+
+typedef struct session_transition {
+    unsigned int from;
+    session_event event;
+    unsigned int to;
+} session_transition;
+
+/* The first matching row wins, so the rows for a specific state must come
+ * before the wildcard rows. Events without a matching row are dropped.
+ */
+static const session_transition transitions[] = {
+    {session_idle,          session_ev_start,           session_scan},
+    {session_scan,          session_ev_adv_found,       session_connect},
+    // direct connection to a remembered transmitter
+    {session_scan,          session_ev_connected,       session_discover},
+    {session_connect,       session_ev_connected,       session_discover},
+    {session_discover,      session_ev_handles_known,   session_auth},
+    {session_auth,          session_ev_authenticated,   session_bond},
+    // bonded reconnect, the link was encrypted with the stored bond
+    {session_auth,          session_ev_encrypted,       session_time},
+    // fall back to the authentication exchange
+    {session_auth,          session_ev_bond_rejected,   session_auth},
+    {session_bond,          session_ev_bonded,          session_encrypt},
+    {session_encrypt,       session_ev_encrypted,       session_time},
+    {session_time,          session_ev_time_rx,         session_glucose},
+    {session_time,          session_ev_glucose_rx,      SESSION_DEFER},
+    {session_glucose,       session_ev_glucose_rx,      session_backfill},
+    {session_backfill,      session_ev_backfill_done,   session_teardown},
+    // the transmitter ends the connection after sending all backfill data
+    {session_backfill,      session_ev_disconnected,    session_teardown},
+    // the link is already closed or the transmitter confirmed the DisconnectTx
+    {session_teardown,      session_ev_teardown_done,   session_done},
+    {session_teardown,      session_ev_disconnected,    session_done},
+    // the wait for the disconnect is bounded, a missed deadline is no error
+    {session_teardown,      session_ev_timeout,         session_done},
+    // a cached handle was rejected, the handles are discovered again on the open link
+    {SESSION_ANY_STATE,     session_ev_handles_invalid, session_discover},
+    {SESSION_ANY_STATE,     session_ev_error,           session_failed},
+    {SESSION_ANY_STATE,     session_ev_timeout,         session_failed},
+    {SESSION_ANY_STATE,     session_ev_disconnected,    session_failed},
+};
+
+// in milliseconds, 0 for states without deadline
+static const uint32_t deadlines[SESSION_STATE_COUNT] = {
+    [session_idle]          = 0,
+    [session_scan]          = 330000, // one advertising period of the transmitter
+    [session_connect]       = 5000,
+    [session_discover]      = 5000,
+    [session_auth]          = 5000,
+    [session_bond]          = 10000,
+    [session_encrypt]       = 5000,
+    [session_time]          = 3000,
+    [session_glucose]       = 3000,
+    [session_backfill]      = 20000,
+    [session_teardown]      = 2000,
+    [session_done]          = 0,
+    [session_failed]        = 0,
+};
+
+static const char *state_names[SESSION_STATE_COUNT] = {
+    "idle", "scan", "connect", "discover", "auth", "bond", "encrypt",
+    "time", "glucose", "backfill", "teardown", "done", "failed"
+};
+
+static const char *event_names[SESSION_EVENT_COUNT] = {
+    "start", "adv_found", "connected", "handles_known", "handles_invalid", "authenticated",
+    "bonded", "encrypted", "bond_rejected", "time_rx", "glucose_rx", "backfill_done",
+    "teardown_done", "disconnected", "error", "timeout"
+};
+
+/**
+ * Initializes the state machine in the idle state.
+ *
+ * @param s                 State machine
+ * @param enter             Entry actions indexed by state, entries may be NULL
+ * @param on_transition     Called after every state change, may be NULL
+ * @param arg               Argument for the actions
+ */
+void
+dgr_session_init(session *s, session_action_fn *const *enter, session_transition_fn *on_transition,
+                 void *arg) {
+    s->state = session_idle;
+    s->state_entered = 0;
+    s->deadline = 0;
+    s->queue_head = 0;
+    s->queue_length = 0;
+    s->deferred = 0;
+    s->running = false;
+    s->enter = enter;
+    s->on_transition = on_transition;
+    s->arg = arg;
+}
+
+/**
+ * Appends an event to the queue. It is processed by the next call of dgr_session_run.
+ *
+ * @param s                 State machine
+ * @param event             Event to post
+ * @return                  false if the queue is full
+ */
+bool
+dgr_session_post(session *s, session_event event) {
+    if(s->queue_length >= SESSION_QUEUE_SIZE) {
+        return false;
+    }
+
+    s->queue[(s->queue_head + s->queue_length) % SESSION_QUEUE_SIZE] = event;
+    s->queue_length++;
+    return true;
+}
+
+static const session_transition*
+dgr_session_find(session_state state, session_event event) {
+    bool active = state != session_idle && state != session_done && state != session_failed;
+
+    for(size_t i = 0; i < sizeof transitions / sizeof transitions[0]; i++) {
+        const session_transition *t = &transitions[i];
+
+        if(t->event == event && (t->from == state || (t->from == SESSION_ANY_STATE && active))) {
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+dgr_session_handle(session *s, session_event event, int64_t now) {
+    const session_transition *t = dgr_session_find(s->state, event);
+    session_state from = s->state;
+    uint32_t deferred;
+
+    if(t == NULL) {
+        return;
+    } else if(t->to == SESSION_DEFER) {
+        s->deferred |= 1U << event;
+        return;
+    }
+
+    s->state = (session_state) t->to;
+    s->state_entered = now;
+    s->deadline = deadlines[s->state] != 0 ? now + deadlines[s->state] : 0;
+
+    if(s->on_transition != NULL) {
+        s->on_transition(from, s->state, event, now, s->arg);
+    }
+
+    // events deferred by the previous state follow the events of the entry action
+    deferred = s->deferred;
+    s->deferred = 0;
+
+    if(s->enter != NULL && s->enter[s->state] != NULL) {
+        s->enter[s->state](s->arg);
+    }
+
+    for(int ev = 0; ev < SESSION_EVENT_COUNT; ev++) {
+        if(deferred & (1U << ev)) {
+            dgr_session_post(s, (session_event) ev);
+        }
+    }
+}
+
+/**
+ * Processes all queued events, including the ones posted by entry actions.
+ * Calls from within an entry action return immediately.
+ *
+ * @param s                 State machine
+ * @param now               Current time in milliseconds
+ */
+void
+dgr_session_run(session *s, int64_t now) {
+    if(s->running) {
+        return;
+    }
+
+    s->running = true;
+    while(s->queue_length > 0) {
+        session_event event = s->queue[s->queue_head];
+
+        s->queue_head = (s->queue_head + 1) % SESSION_QUEUE_SIZE;
+        s->queue_length--;
+        dgr_session_handle(s, event, now);
+    }
+    s->running = false;
+}
+
+/**
+ * Posts a timeout event if the deadline of the current state has passed.
+ *
+ * @param s                 State machine
+ * @param now               Current time in milliseconds
+ */
+void
+dgr_session_check_deadline(session *s, int64_t now) {
+    if(s->deadline != 0 && now >= s->deadline) {
+        s->deadline = 0;
+        dgr_session_post(s, session_ev_timeout);
+        dgr_session_run(s, now);
+    }
+}
+
+/**
+ * Moves the deadline of the current state further out, e.g. while a long
+ * transfer makes progress. A state without deadline keeps none.
+ *
+ * @param s                 State machine
+ * @param now               Current time in milliseconds
+ * @param duration          Minimum time from now in milliseconds
+ */
+void
+dgr_session_extend_deadline(session *s, int64_t now, uint32_t duration) {
+    if(s->deadline != 0 && now + duration > s->deadline) {
+        s->deadline = now + duration;
+    }
+}
+
+uint32_t
+dgr_session_deadline_of(session_state state) {
+    return state < SESSION_STATE_COUNT ? deadlines[state] : 0;
+}
+
+const char*
+dgr_session_state_name(session_state state) {
+    return state < SESSION_STATE_COUNT ? state_names[state] : "unknown";
+}
+
+const char*
+dgr_session_event_name(session_event event) {
+    return event < SESSION_EVENT_COUNT ? event_names[event] : "unknown";
+}
@@ -0,0 +1,81 @@
+#ifndef DGR_SESSION_H
+#define DGR_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Session state machine of one wake cycle. The transitions and the deadline of
+ * every state are kept in tables in session.c. Events are queued and processed
+ * in order, so an action that posts an event never re-enters the state machine.
+ * All platform specific work is done by the entry actions, which keeps this
+ * module independent of the ESP-IDF and NimBLE.
+ */
+
+#define SESSION_QUEUE_SIZE          8
+
+typedef enum {
+    session_idle,
+    session_scan,
+    session_connect,
+    session_discover,
+    session_auth,
+    session_bond,
+    session_encrypt,
+    session_time,
+    session_glucose,
+    session_backfill,
+    session_teardown,
+    session_done,
+    session_failed,
+    SESSION_STATE_COUNT
+} session_state;
+
+typedef enum {
+    session_ev_start,               // host and controller synced
+    session_ev_adv_found,           // advertisement of the transmitter received
+    session_ev_connected,
+    session_ev_handles_known,       // discovery finished or handles taken from the cache
+    session_ev_handles_invalid,     // the transmitter rejected a cached handle
+    session_ev_authenticated,
+    session_ev_bonded,
+    session_ev_encrypted,
+    session_ev_bond_rejected,       // encryption with the stored bond failed
+    session_ev_time_rx,
+    session_ev_glucose_rx,
+    session_ev_backfill_done,
+    session_ev_teardown_done,       // teardown found the link already closed
+    session_ev_disconnected,
+    session_ev_error,
+    session_ev_timeout,
+    SESSION_EVENT_COUNT
+} session_event;
+
+typedef void session_action_fn(void *arg);
+typedef void session_transition_fn(session_state from, session_state to, session_event event,
+                                   int64_t now, void *arg);
+
+typedef struct session {
+    session_state state;
+    int64_t state_entered;                      // in milliseconds
+    int64_t deadline;                           // in milliseconds, 0 if the state has none
+    session_event queue[SESSION_QUEUE_SIZE];
+    uint8_t queue_head;
+    uint8_t queue_length;
+    uint32_t deferred;                          // bitmask of events kept for the next state
+    bool running;
+    session_action_fn *const *enter;            // entry actions, indexed by state
+    session_transition_fn *on_transition;       // optional, e.g. for logging
+    void *arg;
+} session;
+
+void dgr_session_init(session *s, session_action_fn *const *enter, session_transition_fn *on_transition,
+                      void *arg);
+bool dgr_session_post(session *s, session_event event);
+void dgr_session_run(session *s, int64_t now);
+void dgr_session_check_deadline(session *s, int64_t now);
+void dgr_session_extend_deadline(session *s, int64_t now, uint32_t duration);
+uint32_t dgr_session_deadline_of(session_state state);
+const char* dgr_session_state_name(session_state state);
+const char* dgr_session_event_name(session_event event);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef DGR_TEST_H
+#define DGR_TEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Minimal checks for the unit tests of the core library. A failed check is
+ * printed with its location and the test goes on, the exit code of the test
+ * program tells ctest whether any check failed.
+ */
+
+#define TEST_CHECK(cond)            test_check((cond), #cond, __FILE__, __LINE__)
+#define TEST_EQUAL(a, b)            test_equal((long long) (a), (long long) (b), #a, #b, __FILE__, __LINE__)
+
+static unsigned test_checks;
+static unsigned test_failures;
+static uint32_t test_seed = 1; // the tests are reproducible
+
+static inline bool
+test_check(bool ok, const char *cond, const char *file, int line) {
+    test_checks++;
+    if(!ok) {
+        printf("%s:%d: check failed: %s\n", file, line, cond);
+        test_failures++;
+    }
+    return ok;
+}
+
+static inline bool
+test_equal(long long a, long long b, const char *a_text, const char *b_text, const char *file, int line) {
+    test_checks++;
+    if(a != b) {
+        printf("%s:%d: %s == %s failed: %lld != %lld\n", file, line, a_text, b_text, a, b);
+        test_failures++;
+    }
+    return a == b;
+}
+
+/**
+ * Returns a pseudo-random number below n, from a linear congruential generator.
+ */
+static inline uint32_t
+test_random(uint32_t n) {
+    test_seed = test_seed * 1103515245 + 12345;
+    return (test_seed >> 8U) % n;
+}
+
+/**
+ * Returns a pseudo-random number in [0, 1) from the same generator.
+ */
+static inline double
+test_random_unit(void) {
+    test_seed = test_seed * 1103515245 + 12345;
+    return (test_seed >> 8U) / (double) (1U << 24U);
+}
+
+/**
+ * Prints the result of a test program.
+ *
+ * @return                  Exit code of the program
+ */
+static inline int
+test_result(const char *name) {
+    printf("%s: %u checks, %u failed\n", name, test_checks, test_failures);
+    return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
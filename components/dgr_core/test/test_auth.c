@@ -0,0 +1,107 @@
+#include <string.h>
+#include "auth.h"
+#include "test.h"
+
+/* The platform services are faked: the random numbers count up and the
+ * "encryption" is a XOR with the key, so the layout of the hashed block can
+ * be checked. The AES itself is checked against FIPS-197 in auth_bench.
+ */
+
+static uint8_t fake_key[PLATFORM_AES_BLOCK];
+static uint8_t fake_last_block[PLATFORM_AES_BLOCK];
+static uint8_t fake_random_next;
+static unsigned fake_encryptions;
+static bool fake_fail;
+
+void
+dgr_platform_random(uint8_t *data, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        data[i] = fake_random_next++;
+    }
+}
+
+bool
+dgr_platform_aes_set_key(const uint8_t key[PLATFORM_AES_BLOCK]) {
+    memcpy(fake_key, key, PLATFORM_AES_BLOCK);
+    return true;
+}
+
+bool
+dgr_platform_aes_encrypt(const uint8_t in[PLATFORM_AES_BLOCK], uint8_t out[PLATFORM_AES_BLOCK]) {
+    fake_encryptions++;
+    memcpy(fake_last_block, in, PLATFORM_AES_BLOCK);
+    for(int i = 0; i < PLATFORM_AES_BLOCK; i++) {
+        out[i] = in[i] ^ fake_key[i];
+    }
+    return !fake_fail;
+}
+
+static void
+test_key(void) {
+    uint8_t key[AUTH_KEY_SIZE];
+
+    dgr_auth_make_key("8GABCD", key);
+    TEST_CHECK(memcmp(key, "008GABCD008GABCD", AUTH_KEY_SIZE) == 0);
+}
+
+static void
+test_hash(void) {
+    const uint8_t in[AUTH_TOKEN_SIZE] = {0x10, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76, 0x87};
+    uint8_t key[AUTH_KEY_SIZE];
+    uint8_t out[AUTH_TOKEN_SIZE];
+
+    dgr_auth_make_key("8GABCD", key);
+    dgr_platform_aes_set_key(key);
+    TEST_CHECK(dgr_auth_hash(in, out));
+
+    // the value is encrypted twice in a row, the hash is the first half
+    TEST_CHECK(memcmp(fake_last_block, in, AUTH_TOKEN_SIZE) == 0);
+    TEST_CHECK(memcmp(&fake_last_block[AUTH_TOKEN_SIZE], in, AUTH_TOKEN_SIZE) == 0);
+    for(int i = 0; i < AUTH_TOKEN_SIZE; i++) {
+        TEST_EQUAL(out[i], in[i] ^ key[i]);
+    }
+
+    fake_fail = true;
+    TEST_CHECK(!dgr_auth_hash(in, out));
+    fake_fail = false;
+}
+
+static void
+test_stage_token(void) {
+    auth_token next = {0};
+    uint8_t hash[AUTH_TOKEN_SIZE];
+    unsigned encryptions;
+
+    fake_random_next = 0x40;
+    TEST_CHECK(dgr_auth_stage_token(&next));
+    TEST_CHECK(next.ready);
+    TEST_EQUAL(next.token[0], 0x40);
+    TEST_EQUAL(next.token[AUTH_TOKEN_SIZE - 1], 0x47);
+    dgr_auth_hash(next.token, hash);
+    TEST_CHECK(memcmp(next.hash, hash, AUTH_TOKEN_SIZE) == 0);
+
+    // a staged token is kept until the caller drops it
+    encryptions = fake_encryptions;
+    TEST_CHECK(dgr_auth_stage_token(&next));
+    TEST_EQUAL(next.token[0], 0x40);
+    TEST_EQUAL(fake_encryptions, encryptions);
+
+    next.ready = false;
+    TEST_CHECK(dgr_auth_stage_token(&next));
+    TEST_EQUAL(next.token[0], 0x48);
+
+    // a failed encryption leaves no token staged
+    next.ready = false;
+    fake_fail = true;
+    TEST_CHECK(!dgr_auth_stage_token(&next));
+    TEST_CHECK(!next.ready);
+    fake_fail = false;
+}
+
+int
+main(void) {
+    test_key();
+    test_hash();
+    test_stage_token();
+    return test_result("auth");
+}
@@ -0,0 +1,302 @@
+#include <string.h>
+#include "backfill.h"
+#include "test.h"
+
+#define TEST_MAX_RECORDS            39
+#define TEST_MAX_PACKETS            (TEST_MAX_RECORDS * BACKFILL_RECORD_SIZE + 1)
+#define TEST_RANDOM_SPLITS          20000
+#define TEST_RANDOM_LINKS           20000
+#define TEST_MAX_REQUESTS           1000
+
+typedef struct test_stream {
+    uint8_t packets[TEST_MAX_PACKETS][BACKFILL_MAX_PACKET];
+    uint8_t lengths[TEST_MAX_PACKETS];
+    uint32_t count;
+} test_stream;
+
+typedef struct test_received {
+    reading records[TEST_MAX_RECORDS];
+    uint32_t count;
+    bool overflow;
+} test_received;
+
+static test_stream stream;
+static reading
+test_reading(uint32_t n) {
+    reading r = {.timestamp = 0x00100000 + n * 300, .glucose = 40 + n * 37 % 360, .calibration_state = 6,
+                 .trend = 0x80 + n % 5 - 2};
+
+    return r;
+}
+
+static void
+test_save(const reading *r, void *arg) {
+    test_received *received = arg;
+
+    if(received->count < TEST_MAX_RECORDS) {
+        received->records[received->count] = *r;
+    } else {
+        received->overflow = true;
+    }
+    received->count++;
+}
+
+/**
+ * Builds the notifications of a backfill the way the transmitter splits the records.
+ *
+ * @param first             Number of the first record
+ * @param count             Number of records
+ * @param random_split      Notifications of random length instead of full ones
+ */
+static void
+test_build(uint32_t first, uint32_t count, bool random_split) {
+    uint8_t bytes[TEST_MAX_RECORDS * BACKFILL_RECORD_SIZE];
+    uint32_t size = count * BACKFILL_RECORD_SIZE;
+    uint32_t pos = 0;
+
+    for(uint32_t i = 0; i < count; i++) {
+        reading r = test_reading(first + i);
+        uint8_t *record = &bytes[i * BACKFILL_RECORD_SIZE];
+
+        record[0] = r.timestamp;
+        record[1] = r.timestamp >> 8U;
+        record[2] = r.timestamp >> 16U;
+        record[3] = r.timestamp >> 24U;
+        record[4] = r.glucose;
+        record[5] = r.glucose >> 8U;
+        record[6] = r.calibration_state;
+        record[7] = r.trend;
+    }
+
+    stream.count = 0;
+    do {
+        uint8_t *packet = stream.packets[stream.count];
+        uint8_t header = stream.count == 0 ? BACKFILL_FIRST_HEADER : BACKFILL_HEADER;
+        uint32_t payload = BACKFILL_MAX_PACKET - header;
+
+        if(random_split) {
+            payload = 1 + test_random(payload);
+        }
+        if(payload > size - pos) {
+            payload = size - pos;
+        }
+
+        memset(packet, 0, header);
+        packet[0] = stream.count + 1;
+        if(stream.count == 0) {
+            packet[2] = 0x34;
+            packet[3] = 0x12;
+        }
+        memcpy(&packet[header], &bytes[pos], payload);
+        stream.lengths[stream.count++] = header + payload;
+        pos += payload;
+    } while(pos < size);
+}
+
+/**
+ * Checks that the records first, first + 1, ... were received in this order.
+ */
+static bool
+test_check_received(const test_received *received, uint32_t first, uint32_t count) {
+    if(!TEST_EQUAL(received->count, count) || !TEST_CHECK(!received->overflow)) {
+        return false;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        reading expected = test_reading(first + i);
+
+        if(!TEST_CHECK(memcmp(&received->records[i], &expected, sizeof expected) == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+test_results(void) {
+    backfill_parser parser;
+    test_received received = {0};
+    uint8_t short_first[BACKFILL_FIRST_HEADER - 1] = {1};
+    uint8_t long_packet[BACKFILL_MAX_PACKET + 1] = {4};
+
+    test_build(0, 10, false);
+    TEST_EQUAL(stream.count, 5);
+
+    // nothing is parsed until the request was confirmed
+    dgr_backfill_init(&parser);
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[0], stream.lengths[0], test_save, &received), backfill_stale);
+    TEST_EQUAL(dgr_backfill_feed(&parser, short_first, sizeof short_first, test_save, &received),
+               backfill_bad_length);
+    TEST_EQUAL(dgr_backfill_feed(&parser, short_first, 0, test_save, &received), backfill_bad_length);
+    dgr_backfill_resume(&parser);
+
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[0], stream.lengths[0], test_save, &received), backfill_ok);
+    TEST_EQUAL(parser.request_counter, 0x1234);
+    TEST_EQUAL(received.count, 1);
+    TEST_EQUAL(parser.carried, 6);
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[0], stream.lengths[0], test_save, &received),
+               backfill_duplicate);
+
+    // a notification ahead waits for the missing one, a second copy of it is dropped
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[2], stream.lengths[2], test_save, &received),
+               backfill_buffered);
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[2], stream.lengths[2], test_save, &received),
+               backfill_duplicate);
+    TEST_EQUAL(dgr_backfill_feed(&parser, long_packet, sizeof long_packet, test_save, &received),
+               backfill_bad_length);
+    TEST_EQUAL(parser.pending, 1);
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[1], stream.lengths[1], test_save, &received), backfill_ok);
+    TEST_EQUAL(parser.pending, 0);
+    TEST_EQUAL(parser.next_sequence, 4);
+
+    // one beyond the window is a gap
+    stream.packets[4][0] = parser.next_sequence + BACKFILL_WINDOW + 1;
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[4], stream.lengths[4], test_save, &received), backfill_gap);
+    stream.packets[4][0] = 5;
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[4], stream.lengths[4], test_save, &received),
+               backfill_buffered);
+    TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[3], stream.lengths[3], test_save, &received), backfill_ok);
+    TEST_CHECK(test_check_received(&received, 0, 10));
+    TEST_EQUAL(parser.records, 10);
+    TEST_EQUAL(parser.last_timestamp, test_reading(9).timestamp);
+    TEST_EQUAL(parser.carried, 0);
+
+    // a restart drops the window and the split record but keeps the counters
+    long_packet[0] = parser.next_sequence;
+    TEST_EQUAL(dgr_backfill_feed(&parser, long_packet, BACKFILL_HEADER + 3, test_save, &received), backfill_ok);
+    TEST_EQUAL(parser.carried, 3);
+    dgr_backfill_restart(&parser);
+    TEST_CHECK(parser.stale && parser.carried == 0 && parser.pending == 0 && parser.next_sequence == 1);
+    TEST_EQUAL(parser.records, 10);
+}
+
+static void
+test_random_splits(void) {
+    for(uint32_t run = 0; run < TEST_RANDOM_SPLITS; run++) {
+        uint32_t count = 1 + test_random(TEST_MAX_RECORDS);
+        uint32_t first = test_random(1000);
+        test_received received = {0};
+        backfill_parser parser;
+
+        test_build(first, count, true);
+        dgr_backfill_init(&parser);
+        dgr_backfill_resume(&parser);
+        for(uint32_t i = 0; i < stream.count; i++) {
+            if(!TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[i], stream.lengths[i], test_save, &received),
+                           backfill_ok) || !TEST_CHECK(parser.carried < BACKFILL_RECORD_SIZE)) {
+                return;
+            }
+        }
+        if(!test_check_received(&received, first, count) || !TEST_EQUAL(parser.carried, 0) ||
+           !TEST_EQUAL(parser.records, count)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Orders the notifications of the stream like a link that reorders them
+ * within the window: none arrives before one sent BACKFILL_WINDOW earlier.
+ */
+static void
+test_shuffle(uint16_t *order) {
+    uint32_t keys[TEST_MAX_PACKETS];
+
+    for(uint32_t i = 0; i < stream.count; i++) {
+        uint32_t key = i + test_random(BACKFILL_WINDOW);
+        uint32_t j = i;
+
+        for(; j > 0 && keys[j - 1] > key; j--) {
+            keys[j] = keys[j - 1];
+            order[j] = order[j - 1];
+        }
+        keys[j] = key;
+        order[j] = i;
+    }
+}
+
+/**
+ * Backfills over a link that reorders and drops notifications. The reader
+ * acts like messages.c: after a gap, or a timeout with buffered
+ * notifications, it requests the readings after the last saved one again,
+ * and notifications of the old request that are still in flight arrive
+ * before the transmitter confirmed the new one. A lost tail is requested
+ * again as the next hole.
+ */
+static void
+test_random_links(void) {
+    uint32_t gaps = 0;
+    uint32_t timeouts = 0;
+    uint32_t buffered = 0;
+    uint32_t stale = 0;
+
+    for(uint32_t run = 0; run < TEST_RANDOM_LINKS; run++) {
+        uint32_t count = 1 + test_random(TEST_MAX_RECORDS);
+        uint32_t first = test_random(1000);
+        uint32_t next = first;
+        uint32_t requests = 0;
+        uint16_t order[TEST_MAX_PACKETS];
+        uint32_t in_flight = 0;
+        uint32_t pos = 0;
+        test_received received = {0};
+        backfill_parser parser;
+
+        dgr_backfill_init(&parser);
+        while(received.count < count && requests++ < TEST_MAX_REQUESTS) {
+            bool gap = false;
+
+            // leftovers of the previous request, up to the confirmation of this one
+            for(in_flight = test_random(in_flight + 1); in_flight > 0 && pos < stream.count; in_flight--, pos++) {
+                stale += TEST_EQUAL(dgr_backfill_feed(&parser, stream.packets[order[pos]], stream.lengths[order[pos]],
+                                                      test_save, &received), backfill_stale);
+            }
+            dgr_backfill_resume(&parser);
+
+            test_build(next, first + count - next, true);
+            test_shuffle(order);
+            for(pos = 0; pos < stream.count && !gap; pos++) {
+                if(test_random(8) == 0) {
+                    continue;
+                }
+                switch(dgr_backfill_feed(&parser, stream.packets[order[pos]], stream.lengths[order[pos]], test_save,
+                                         &received)) {
+                    case backfill_ok:
+                    case backfill_duplicate:
+                        break;
+                    case backfill_buffered:
+                        buffered++;
+                        break;
+                    case backfill_gap:
+                        gap = true;
+                        gaps++;
+                        break;
+                    default:
+                        TEST_CHECK(false);
+                        return;
+                }
+            }
+            in_flight = stream.count - pos;
+            timeouts += !gap && parser.pending > 0;
+
+            // the next request starts after the last saved record
+            dgr_backfill_restart(&parser);
+            if(parser.records > 0) {
+                next = first + (parser.last_timestamp - test_reading(first).timestamp) / 300 + 1;
+            }
+            if(!TEST_CHECK(next <= first + count && received.count <= count)) {
+                return;
+            }
+        }
+        if(!test_check_received(&received, first, count) || !TEST_EQUAL(parser.records, count)) {
+            return;
+        }
+    }
+    TEST_CHECK(gaps > 0 && timeouts > 0 && buffered > 0 && stale > 0);
+}
+
+int
+main(void) {
+    test_results();
+    test_random_splits();
+    test_random_links();
+    return test_result("backfill");
+}
@@ -0,0 +1,116 @@
+#include <string.h>
+#include "codec.h"
+#include "crc16.h"
+#include "test.h"
+
+static uint16_t
+test_crc_of(const uint8_t *msg, uint8_t length) {
+    return msg[length - 2] | (uint16_t) msg[length - 1] << 8U;
+}
+
+static void
+test_lookup(void) {
+    const msg_desc *desc = dgr_msg_find(msg_control, GLUCOSE_RX_OPCODE);
+
+    TEST_CHECK(desc != NULL && strcmp(desc->name, "GLUCOSE_RX") == 0);
+    TEST_CHECK(dgr_msg_find(msg_auth, GLUCOSE_RX_OPCODE) == NULL);
+    TEST_CHECK(dgr_msg_find(msg_control, 0xff) == NULL);
+
+    // only messages marked MSG_LONGER may be longer than their table length
+    TEST_CHECK(dgr_msg_length_ok(desc, GLUCOSE_RX_LENGTH));
+    TEST_CHECK(dgr_msg_length_ok(desc, GLUCOSE_RX_LENGTH + 2));
+    TEST_CHECK(!dgr_msg_length_ok(desc, GLUCOSE_RX_LENGTH - 1));
+    desc = dgr_msg_find(msg_control, TIME_RX_OPCODE);
+    TEST_CHECK(dgr_msg_length_ok(desc, TIME_RX_LENGTH));
+    TEST_CHECK(!dgr_msg_length_ok(desc, TIME_RX_LENGTH + 1));
+}
+
+static void
+test_const_frames(void) {
+    TEST_EQUAL(dgr_glucose_tx_frame[0], GLUCOSE_TX_OPCODE);
+    TEST_EQUAL(test_crc_of(dgr_glucose_tx_frame, GLUCOSE_TX_LENGTH), dgr_crc16(dgr_glucose_tx_frame, 1));
+    TEST_EQUAL(dgr_time_tx_frame[0], TIME_TX_OPCODE);
+    TEST_EQUAL(test_crc_of(dgr_time_tx_frame, TIME_TX_LENGTH), dgr_crc16(dgr_time_tx_frame, 1));
+}
+
+static void
+test_encode(void) {
+    const uint8_t token[AUTH_REQUEST_TX_TOKEN_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t msg[MSG_MAX_LENGTH];
+
+    dgr_encode_auth_request(msg, token);
+    TEST_EQUAL(msg[0], AUTH_REQUEST_TX_OPCODE);
+    TEST_CHECK(memcmp(&msg[AUTH_REQUEST_TX_TOKEN], token, sizeof token) == 0);
+    TEST_EQUAL(msg[AUTH_REQUEST_TX_CHANNEL], 0x1);
+
+    dgr_encode_keep_alive(msg, 25);
+    TEST_EQUAL(msg[0], KEEP_ALIVE_TX_OPCODE);
+    TEST_EQUAL(msg[KEEP_ALIVE_TX_TIME], 25);
+
+    dgr_encode_backfill_tx(msg, 0x01020304, 0x0a0b0c0d);
+    TEST_EQUAL(msg[0], BACKFILL_TX_OPCODE);
+    TEST_EQUAL(msg[BACKFILL_TX_START_TIME], 0x04);
+    TEST_EQUAL(msg[BACKFILL_TX_START_TIME + 3], 0x01);
+    TEST_EQUAL(msg[BACKFILL_TX_END_TIME], 0x0d);
+    TEST_EQUAL(test_crc_of(msg, BACKFILL_TX_LENGTH), dgr_crc16(msg, BACKFILL_TX_LENGTH - 2));
+}
+
+static void
+test_decode(void) {
+    uint8_t msg[GLUCOSE_RX_LENGTH] = {GLUCOSE_RX_OPCODE};
+    glucose_rx rx;
+    time_rx time;
+
+    msg[GLUCOSE_RX_STATE] = TRANSMITTER_STATE_BATT_LOW;
+    msg[GLUCOSE_RX_SEQUENCE] = 0x2a;
+    msg[GLUCOSE_RX_SEQUENCE + 2] = 0x01;
+    msg[GLUCOSE_RX_TIMESTAMP] = 0x10;
+    msg[GLUCOSE_RX_TIMESTAMP + 3] = 0x80;
+    // the upper four bits of the glucose value are flags
+    msg[GLUCOSE_RX_GLUCOSE] = 0x96;
+    msg[GLUCOSE_RX_GLUCOSE + 1] = 0xf0;
+    msg[GLUCOSE_RX_CALIBRATION_STATE] = CALIB_STATE_OK;
+    msg[GLUCOSE_RX_TREND] = 0xfe;
+    dgr_decode_glucose_rx(msg, &rx);
+    TEST_EQUAL(rx.transmitter_state, TRANSMITTER_STATE_BATT_LOW);
+    TEST_EQUAL(rx.sequence, 0x1002a);
+    TEST_EQUAL(rx.timestamp, 0x80000010);
+    TEST_EQUAL(rx.glucose, 0x96);
+    TEST_EQUAL(rx.calibration_state, CALIB_STATE_OK);
+    TEST_EQUAL(rx.trend, 0xfe);
+
+    memset(msg, 0, sizeof msg);
+    msg[TIME_RX_CURRENT_TIME] = 0x78;
+    msg[TIME_RX_CURRENT_TIME + 1] = 0x56;
+    msg[TIME_RX_SESSION_START + 3] = 0x12;
+    dgr_decode_time_rx(msg, &time);
+    TEST_EQUAL(time.current_time, 0x5678);
+    TEST_EQUAL(time.session_start, 0x12000000);
+}
+
+static void
+test_check_reading(void) {
+    glucose_rx rx = {.sequence = 10, .calibration_state = CALIB_STATE_OK};
+
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 9, true), reading_valid);
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 10, true), reading_duplicate);
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 11, true), reading_out_of_band);
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 9, false), reading_bad_crc);
+
+    // the sequence problems are reported before a bad CRC
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 10, false), reading_duplicate);
+
+    rx.calibration_state = CALIB_STATE_WARMUP;
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 9, true), reading_not_calibrated);
+    TEST_EQUAL(dgr_check_glucose_rx(&rx, 9, false), reading_bad_crc);
+}
+
+int
+main(void) {
+    test_lookup();
+    test_const_frames();
+    test_encode();
+    test_decode();
+    test_check_reading();
+    return test_result("codec");
+}
@@ -0,0 +1,205 @@
+#include <string.h>
+#include "coverage.h"
+#include "test.h"
+
+#define TEST_BASE                   1000000
+#define TEST_MAX_READINGS           (2 * COVERAGE_SLOTS)
+#define TEST_RANDOM_TIMELINES       5000
+#define TEST_QUERIES                8
+#define TEST_MAX_HOLES              255
+
+static void
+test_basics(void) {
+    coverage_map map;
+    coverage_range holes[4];
+    coverage_range chunk;
+    coverage_range range;
+
+    // without a reading everything is missing
+    dgr_coverage_init(&map);
+    TEST_CHECK(dgr_coverage_valid(&map));
+    TEST_EQUAL(dgr_coverage_holes(&map, 5000, 9000, holes, 4), 1);
+    TEST_CHECK(holes[0].start == 5000 && holes[0].end == 9000);
+    TEST_EQUAL(dgr_coverage_holes(&map, 9000, 5000, holes, 4), 0);
+    range.start = 5000;
+    range.end = 9000;
+    dgr_coverage_mark_range(&map, &range);
+    TEST_EQUAL(dgr_coverage_count(&map), 0);
+
+    // the slots are centered on the first reading, jitter stays in the slot
+    dgr_coverage_mark(&map, TEST_BASE);
+    TEST_EQUAL(map.phase, TEST_BASE % READING_INTERVAL);
+    TEST_CHECK(dgr_coverage_covered(&map, TEST_BASE - READING_INTERVAL / 2));
+    TEST_CHECK(dgr_coverage_covered(&map, TEST_BASE + READING_INTERVAL / 2 - 1));
+    TEST_CHECK(!dgr_coverage_covered(&map, TEST_BASE + READING_INTERVAL / 2));
+    dgr_coverage_mark(&map, TEST_BASE + 3 * READING_INTERVAL + 40);
+    dgr_coverage_mark(&map, TEST_BASE + 3 * READING_INTERVAL - 40);
+    TEST_EQUAL(dgr_coverage_count(&map), 2);
+
+    // the two readings in between are one hole, the range after the newest one another
+    TEST_EQUAL(dgr_coverage_holes(&map, TEST_BASE, TEST_BASE + 5 * READING_INTERVAL, holes, 4), 2);
+    TEST_EQUAL(holes[0].start, TEST_BASE + READING_INTERVAL / 2);
+    TEST_EQUAL(holes[0].end, TEST_BASE + 5 * READING_INTERVAL / 2 - 1);
+    TEST_EQUAL(holes[1].start, TEST_BASE + 7 * READING_INTERVAL / 2);
+    TEST_EQUAL(holes[1].end, TEST_BASE + 5 * READING_INTERVAL);
+    TEST_EQUAL(dgr_coverage_holes(&map, TEST_BASE, TEST_BASE + 5 * READING_INTERVAL, holes, 1), 1);
+
+    // a long hole is cut into chunks
+    TEST_CHECK(dgr_coverage_next_chunk(&map, TEST_BASE + 3 * READING_INTERVAL, TEST_BASE + 100 * READING_INTERVAL, 12,
+                                       &chunk));
+    TEST_EQUAL(chunk.start, TEST_BASE + 7 * READING_INTERVAL / 2);
+    TEST_EQUAL(chunk.end - chunk.start + 1, 12 * READING_INTERVAL);
+    TEST_CHECK(!dgr_coverage_next_chunk(&map, TEST_BASE, TEST_BASE + 10, 12, &chunk));
+
+    // a reading a horizon later drops all older ones
+    dgr_coverage_mark(&map, TEST_BASE + (3 + COVERAGE_SLOTS) * READING_INTERVAL);
+    TEST_EQUAL(dgr_coverage_count(&map), 1);
+    TEST_CHECK(!dgr_coverage_covered(&map, TEST_BASE + 3 * READING_INTERVAL));
+    dgr_coverage_mark(&map, TEST_BASE + 3 * READING_INTERVAL);
+    TEST_EQUAL(dgr_coverage_count(&map), 1);
+
+    map.magic = 0;
+    TEST_CHECK(!dgr_coverage_valid(&map));
+}
+
+/**
+ * Finds the holes of a range in a flat array of the marked slots.
+ *
+ * @param marked            Marked slots, relative to the slot of the first reading
+ * @param newest            Newest marked slot
+ * @return                  Number of holes
+ */
+static uint8_t
+test_reference_holes(const bool *marked, uint32_t phase, uint32_t anchor, uint32_t newest, uint32_t from,
+                     uint32_t to, coverage_range *holes) {
+    uint32_t first = (from + READING_INTERVAL / 2 - phase) / READING_INTERVAL;
+    uint32_t last = (to + READING_INTERVAL / 2 - phase) / READING_INTERVAL;
+    uint8_t count = 0;
+
+    // slots of the horizon before the newest slot or the end of the range
+    if((last > newest ? last : newest) - COVERAGE_SLOTS + 1 > first) {
+        first = (last > newest ? last : newest) - COVERAGE_SLOTS + 1;
+    }
+
+    for(uint32_t slot = first; slot <= last; slot++) {
+        uint32_t start = phase + slot * READING_INTERVAL - READING_INTERVAL / 2;
+        uint32_t end = start + READING_INTERVAL - 1;
+
+        if(slot >= anchor && slot <= newest && marked[slot - anchor]) {
+            continue;
+        }
+        start = start < from ? from : start;
+        end = end > to ? to : end;
+        if(count > 0 && holes[count - 1].end + 1 == start) {
+            holes[count - 1].end = end;
+        } else {
+            holes[count].start = start;
+            holes[count++].end = end;
+        }
+    }
+    return count;
+}
+
+/**
+ * Marks the holes of a random range like the transmitter answered every request for them.
+ *
+ * @return                  false if a hole is left
+ */
+static bool
+test_resolve(coverage_map *map, uint32_t base, uint32_t span) {
+    coverage_range holes[TEST_MAX_HOLES];
+    uint32_t from = base + test_random(span);
+    uint32_t to = from + test_random(span);
+    uint8_t count = dgr_coverage_holes(map, from, to, holes, TEST_MAX_HOLES);
+
+    for(uint8_t i = 0; i < count; i++) {
+        dgr_coverage_mark_range(map, &holes[i]);
+    }
+    return TEST_EQUAL(dgr_coverage_holes(map, from, to, holes, TEST_MAX_HOLES), 0);
+}
+
+/**
+ * Marks random timelines with jitter, missed readings and backfilled readings
+ * that arrive late, and compares the holes of random ranges with a reference.
+ * Resolving the holes leaves none.
+ */
+static void
+test_random_timelines(void) {
+    for(uint32_t run = 0; run < TEST_RANDOM_TIMELINES; run++) {
+        uint32_t readings = 1 + test_random(TEST_MAX_READINGS);
+        uint32_t base = TEST_BASE + test_random(READING_INTERVAL);
+        uint32_t backfilled[TEST_MAX_READINGS];
+        uint32_t backfill_count = 0;
+        bool marked[TEST_MAX_READINGS + 1] = {false};
+        uint32_t phase = 0;
+        uint32_t anchor = 0;
+        uint32_t newest = 0;
+        bool anchored = false;
+        coverage_map map;
+
+        dgr_coverage_init(&map);
+        for(uint32_t n = 0; n < readings; n++) {
+            uint32_t timestamp = base + n * READING_INTERVAL + test_random(41) - 20;
+
+            if(test_random(8) == 0 && n > 0) {
+                continue;
+            }
+            if(test_random(4) == 0 && n > 0) {
+                backfilled[backfill_count++] = timestamp;
+                continue;
+            }
+            if(!anchored) {
+                anchored = true;
+                phase = timestamp % READING_INTERVAL;
+                anchor = (timestamp + READING_INTERVAL / 2 - phase) / READING_INTERVAL - n;
+            }
+            dgr_coverage_mark(&map, timestamp);
+            marked[n] = true;
+            newest = anchor + n;
+        }
+
+        // backfilled readings in random order, the ones beyond the horizon are lost
+        for(uint32_t i = backfill_count; i > 0; i--) {
+            uint32_t pick = test_random(i);
+            uint32_t timestamp = backfilled[pick];
+            uint32_t n = (timestamp + READING_INTERVAL / 2 - phase) / READING_INTERVAL - anchor;
+
+            backfilled[pick] = backfilled[i - 1];
+            dgr_coverage_mark(&map, timestamp);
+            marked[n] = marked[n] || n + COVERAGE_SLOTS > newest - anchor;
+            newest = anchor + n > newest ? anchor + n : newest;
+        }
+        for(uint32_t n = 0; n + COVERAGE_SLOTS <= newest - anchor; n++) {
+            marked[n] = false;
+        }
+
+        for(uint32_t query = 0; query < TEST_QUERIES; query++) {
+            coverage_range expected[COVERAGE_SLOTS + 2];
+            coverage_range holes[TEST_MAX_HOLES];
+            uint32_t span = (readings + 4) * READING_INTERVAL;
+            uint32_t from = base - 2 * READING_INTERVAL + test_random(span);
+            uint32_t to = from + test_random(span);
+            uint8_t expected_count = test_reference_holes(marked, phase, anchor, newest, from, to, expected);
+            uint8_t count = dgr_coverage_holes(&map, from, to, holes, TEST_MAX_HOLES);
+            uint32_t probe = from + test_random(to - from + 1);
+            uint32_t probe_slot = (probe + READING_INTERVAL / 2 - phase) / READING_INTERVAL;
+
+            if(!TEST_EQUAL(count, expected_count) ||
+               !TEST_CHECK(memcmp(holes, expected, count * sizeof *holes) == 0)) {
+                return;
+            }
+            TEST_EQUAL(dgr_coverage_covered(&map, probe), probe_slot >= anchor && probe_slot <= newest &&
+                                                          marked[probe_slot - anchor]);
+        }
+        if(!test_resolve(&map, base, readings * READING_INTERVAL)) {
+            return;
+        }
+    }
+}
+
+int
+main(void) {
+    test_basics();
+    test_random_timelines();
+    return test_result("coverage");
+}
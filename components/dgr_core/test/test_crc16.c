@@ -0,0 +1,96 @@
+#include <string.h>
+#include "crc16.h"
+#include "test.h"
+
+#define TEST_DATA_SIZE              600
+#define TEST_MAX_SEGMENTS           12
+#define TEST_RANDOM_CHAINS          20000
+
+// a chain of segments like an mbuf chain
+typedef struct test_segment {
+    const uint8_t *data;
+    uint16_t len;
+    const struct test_segment *next;
+} test_segment;
+
+static const void*
+test_next_segment(const void *segment, const uint8_t **data, uint16_t *len) {
+    const test_segment *s = segment;
+
+    *data = s->data;
+    *len = s->len;
+    return s->next;
+}
+
+static void
+test_vectors(void) {
+    static const uint8_t check[] = "123456789";
+    static const uint8_t message[] = {0x31, 0x00, 0x00};
+    uint8_t data[TEST_DATA_SIZE];
+
+    // the check value of CRC-16/XMODEM
+    TEST_EQUAL(dgr_crc16(check, 9), 0x31c3);
+    TEST_EQUAL(dgr_crc16(check, 0), CRC16_INIT);
+    TEST_EQUAL(dgr_crc16_update(dgr_crc16(check, 4), &check[4], 5), 0x31c3);
+    TEST_EQUAL(dgr_crc16(message, 1), CRC16_CONST_BYTE(0x31));
+
+    // all variants agree at every length and alignment
+    for(int i = 0; i < TEST_DATA_SIZE; i++) {
+        data[i] = test_random(256);
+    }
+    for(size_t len = 0; len <= 64; len++) {
+        for(size_t off = 0; off < 8; off++) {
+            uint16_t expected = dgr_crc16_bytewise(0x1d0f, &data[off], len);
+
+            TEST_EQUAL(dgr_crc16_table(0x1d0f, &data[off], len), expected);
+            TEST_EQUAL(dgr_crc16_slice4(0x1d0f, &data[off], len), expected);
+            TEST_EQUAL(dgr_crc16_slice8(0x1d0f, &data[off], len), expected);
+            TEST_EQUAL(dgr_crc16_update(0x1d0f, &data[off], len), expected);
+        }
+    }
+}
+
+/**
+ * Cuts random data into a random chain, with empty segments, and compares
+ * the CRC of a random part of the chain with the CRC of the flat data.
+ */
+static void
+test_random_chains(void) {
+    static uint8_t data[TEST_DATA_SIZE];
+
+    for(uint32_t run = 0; run < TEST_RANDOM_CHAINS; run++) {
+        test_segment segments[TEST_MAX_SEGMENTS];
+        uint32_t count = 1 + test_random(TEST_MAX_SEGMENTS);
+        uint32_t size = 0;
+        uint16_t off;
+        uint16_t len;
+        uint16_t crc = test_random(0x10000);
+        uint16_t expected;
+
+        for(uint32_t i = 0; i < count; i++) {
+            segments[i].data = &data[size];
+            segments[i].len = test_random(4) == 0 ? 0 : test_random(TEST_DATA_SIZE / TEST_MAX_SEGMENTS);
+            segments[i].next = i + 1 < count ? &segments[i + 1] : NULL;
+            size += segments[i].len;
+        }
+        for(uint32_t i = 0; i < size; i++) {
+            data[i] = test_random(256);
+        }
+
+        // the part may reach beyond the chain, only the data in it counts
+        off = test_random(size + 8);
+        len = test_random(size + 8);
+        expected = off < size ? dgr_crc16_update(crc, &data[off], off + len > size ? size - off : len) : crc;
+        if(!TEST_EQUAL(dgr_crc16_chain(crc, segments, test_next_segment, off, len), expected)) {
+            return;
+        }
+    }
+    TEST_EQUAL(dgr_crc16_chain(0x1234, NULL, test_next_segment, 0, 10), 0x1234);
+}
+
+int
+main(void) {
+    test_vectors();
+    test_random_chains();
+    return test_result("crc16");
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+#include "crc16.h"
+#include "export.h"
+#include "test.h"
+
+#define TEST_RANDOM_PAYLOADS        20000
+#define TEST_MAX_ENCODED            (EXPORT_MAX_PAYLOAD + EXPORT_MAX_PAYLOAD / 254 + 1)
+
+/**
+ * Encodes and decodes a payload, the encoding has no zero bytes and stays
+ * within the bound of dgr_cobs_encode.
+ */
+static bool
+test_roundtrip(const uint8_t *payload, size_t len) {
+    uint8_t encoded[TEST_MAX_ENCODED];
+    uint8_t decoded[TEST_MAX_ENCODED];
+    size_t encoded_len = dgr_cobs_encode(payload, len, encoded);
+
+    if(!TEST_CHECK(encoded_len <= len + len / 254 + 1) ||
+       !TEST_CHECK(memchr(encoded, 0, encoded_len) == NULL) ||
+       !TEST_EQUAL(dgr_cobs_decode(encoded, encoded_len, decoded), len)) {
+        return false;
+    }
+    return TEST_CHECK(memcmp(decoded, payload, len) == 0);
+}
+
+static void
+test_cobs_vectors(void) {
+    static const uint8_t zero[] = {0x00};
+    static const uint8_t zero_encoded[] = {0x01, 0x01};
+    static const uint8_t mixed[] = {0x11, 0x22, 0x00, 0x33};
+    static const uint8_t mixed_encoded[] = {0x03, 0x11, 0x22, 0x02, 0x33};
+    static const uint8_t trailing[] = {0x11, 0x00, 0x00, 0x00};
+    static const uint8_t trailing_encoded[] = {0x02, 0x11, 0x01, 0x01, 0x01};
+    uint8_t long_run[255];
+    uint8_t out[TEST_MAX_ENCODED];
+
+    TEST_EQUAL(dgr_cobs_encode(zero, sizeof zero, out), sizeof zero_encoded);
+    TEST_CHECK(memcmp(out, zero_encoded, sizeof zero_encoded) == 0);
+    TEST_EQUAL(dgr_cobs_encode(mixed, sizeof mixed, out), sizeof mixed_encoded);
+    TEST_CHECK(memcmp(out, mixed_encoded, sizeof mixed_encoded) == 0);
+    TEST_EQUAL(dgr_cobs_encode(trailing, sizeof trailing, out), sizeof trailing_encoded);
+    TEST_CHECK(memcmp(out, trailing_encoded, sizeof trailing_encoded) == 0);
+    TEST_EQUAL(dgr_cobs_encode(zero, 0, out), 1);
+    TEST_EQUAL(out[0], 0x01);
+
+    // 254 bytes without a zero fill a 0xff block, without the trailing code of other encoders too
+    for(int i = 0; i < 254; i++) {
+        long_run[i + 1] = i + 1;
+    }
+    long_run[0] = 0xff;
+    TEST_EQUAL(dgr_cobs_decode(long_run, 255, out), 254);
+    TEST_CHECK(memcmp(out, &long_run[1], 254) == 0);
+    TEST_CHECK(test_roundtrip(&long_run[1], 254));
+}
+
+/**
+ * Zero-free runs around the length of a 0xff block, alone, between zeros
+ * and at every offset of a payload of the maximum size.
+ */
+static void
+test_cobs_runs(void) {
+    uint8_t payload[EXPORT_MAX_PAYLOAD];
+
+    for(size_t run = 252; run <= 256; run++) {
+        memset(payload, 0x5a, run);
+        if(!test_roundtrip(payload, run)) {
+            return;
+        }
+        for(size_t start = 0; start + run <= EXPORT_MAX_PAYLOAD; start++) {
+            memset(payload, 0, sizeof payload);
+            memset(&payload[start], 1 + test_random(255), run);
+            for(size_t len = start + run; len <= start + run + 1 && len <= EXPORT_MAX_PAYLOAD; len++) {
+                if(!test_roundtrip(payload, len)) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static void
+test_cobs_random(void) {
+    uint8_t payload[EXPORT_MAX_PAYLOAD];
+
+    for(uint32_t run = 0; run < TEST_RANDOM_PAYLOADS; run++) {
+        size_t len = test_random(EXPORT_MAX_PAYLOAD + 1);
+        uint32_t zeros = test_random(4) == 0 ? 0 : 1 + test_random(64);
+
+        for(size_t i = 0; i < len; i++) {
+            payload[i] = zeros > 0 && test_random(zeros) == 0 ? 0 : test_random(256);
+        }
+        if(!test_roundtrip(payload, len)) {
+            return;
+        }
+    }
+}
+
+static void
+test_cobs_corrupt(void) {
+    static const uint8_t zero_code[] = {0x03, 0x11, 0x22, 0x00, 0x33};
+    static const uint8_t zero_data[] = {0x03, 0x11, 0x00, 0x02, 0x33};
+    static const uint8_t short_block[] = {0x05, 0x11, 0x22, 0x33};
+    static const uint8_t short_ff[] = {0xff, 0x11};
+    uint8_t out[16];
+
+    TEST_EQUAL(dgr_cobs_decode(zero_code, sizeof zero_code, out), 0);
+    TEST_EQUAL(dgr_cobs_decode(zero_data, sizeof zero_data, out), 0);
+    TEST_EQUAL(dgr_cobs_decode(short_block, sizeof short_block, out), 0);
+    TEST_EQUAL(dgr_cobs_decode(short_ff, sizeof short_ff, out), 0);
+    TEST_EQUAL(dgr_cobs_decode(zero_code, 0, out), 0);
+}
+
+/**
+ * Builds a GET frame like tools/dgr_export.py, without the delimiters.
+ */
+static size_t
+test_get_frame(uint32_t from, uint16_t max, uint8_t type, uint8_t *encoded) {
+    uint8_t payload[9] = {type, from, from >> 8U, from >> 16U, from >> 24U, max, max >> 8U};
+    uint16_t crc = dgr_crc16(payload, 7);
+
+    payload[7] = crc;
+    payload[8] = crc >> 8U;
+    return dgr_cobs_encode(payload, sizeof payload, encoded);
+}
+
+static void
+test_frames(void) {
+    export_batch batch;
+    uint8_t frame[EXPORT_MAX_FRAME];
+    uint8_t payload[EXPORT_MAX_FRAME];
+    uint8_t encoded[16];
+    size_t frame_len;
+    size_t len;
+    uint32_t from;
+    uint16_t max;
+
+    // a full batch is one DATA frame with the cursor after the last reading
+    dgr_export_begin(&batch, 1000);
+    TEST_EQUAL(dgr_export_data_frame(&batch, frame), 0);
+    for(uint32_t i = 0; i < EXPORT_FRAME_READINGS; i++) {
+        reading r = {.timestamp = 0x01000000 + i * 300, .glucose = 100 + i, .calibration_state = 6, .trend = 0x80};
+
+        TEST_EQUAL(dgr_export_add(&batch, &r), i + 1 == EXPORT_FRAME_READINGS);
+    }
+    frame_len = dgr_export_data_frame(&batch, frame);
+    TEST_CHECK(frame_len <= EXPORT_MAX_FRAME);
+    TEST_CHECK(frame[0] == 0 && frame[frame_len - 1] == 0);
+    TEST_CHECK(memchr(&frame[1], 0, frame_len - 2) == NULL);
+    len = dgr_cobs_decode(&frame[1], frame_len - 2, payload);
+    TEST_EQUAL(len, EXPORT_MAX_PAYLOAD);
+    TEST_EQUAL(payload[0], EXPORT_DATA);
+    TEST_EQUAL(payload[1], EXPORT_FRAME_READINGS);
+    TEST_EQUAL(payload[2] | payload[3] << 8U | payload[4] << 16U | (uint32_t) payload[5] << 24U,
+               0x01000000 + (EXPORT_FRAME_READINGS - 1) * 300 + 1);
+    TEST_EQUAL(payload[6 + 8 + 4], 101);
+    TEST_EQUAL(dgr_crc16(payload, len - 2), payload[len - 2] | payload[len - 1] << 8U);
+    TEST_EQUAL(batch.sent, EXPORT_FRAME_READINGS);
+
+    frame_len = dgr_export_end_frame(&batch, frame);
+    len = dgr_cobs_decode(&frame[1], frame_len - 2, payload);
+    TEST_EQUAL(len, 11);
+    TEST_EQUAL(payload[0], EXPORT_END);
+    TEST_EQUAL(payload[5], EXPORT_FRAME_READINGS);
+
+    // GET frames, bad ones are rejected
+    len = test_get_frame(0x12345678, 500, EXPORT_GET, encoded);
+    TEST_CHECK(dgr_export_parse_get(encoded, len, &from, &max));
+    TEST_EQUAL(from, 0x12345678);
+    TEST_EQUAL(max, 500);
+    TEST_CHECK(!dgr_export_parse_get(encoded, len - 1, &from, &max));
+    encoded[3] ^= 0x01;
+    TEST_CHECK(!dgr_export_parse_get(encoded, len, &from, &max));
+    len = test_get_frame(0x12345678, 500, EXPORT_DATA, encoded);
+    TEST_CHECK(!dgr_export_parse_get(encoded, len, &from, &max));
+    len = test_get_frame(0, 0, EXPORT_GET, encoded);
+    TEST_CHECK(dgr_export_parse_get(encoded, len, &from, &max) && from == 0 && max == 0);
+}
+
+int
+main(void) {
+    test_cobs_vectors();
+    test_cobs_runs();
+    test_cobs_random();
+    test_cobs_corrupt();
+    test_frames();
+    return test_result("export");
+}
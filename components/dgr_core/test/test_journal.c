@@ -0,0 +1,168 @@
+#include <string.h>
+#include "flash_emu.h"
+#include "test.h"
+
+#define TEST_IMAGE                  "test_journal.img"
+#define TEST_SIZE                   0x4000 // four sectors
+#define TEST_SECTOR_SIZE            4096
+#define TEST_PAGES                  (TEST_SIZE / JOURNAL_PAGE_SIZE)
+#define TEST_PAGES_PER_SECTOR       (TEST_SECTOR_SIZE / JOURNAL_PAGE_SIZE)
+
+static reading
+test_reading(uint32_t n) {
+    reading r = {
+        .timestamp = 5000 + n * 300,
+        .glucose = 40 + n % 360,
+        .calibration_state = 6,
+        .trend = n
+    };
+
+    return r;
+}
+
+/**
+ * Checks that the stored pages hold consecutive readings ending with a reading.
+ *
+ * @param last              Number of the newest flushed reading
+ */
+static void
+test_check_pages(const journal *j, uint32_t last) {
+    reading out[JOURNAL_PAGE_READINGS];
+    uint32_t expected = 0;
+    uint8_t count;
+
+    for(uint32_t page = 0; page < dgr_journal_pages(j); page++) {
+        if(!TEST_EQUAL(dgr_journal_read_page(j, page, out, &count), 0)) {
+            return;
+        }
+        if(page == 0) {
+            expected = out[0].timestamp;
+        }
+        for(uint8_t i = 0; i < count; i++) {
+            TEST_EQUAL(out[i].timestamp, expected);
+            expected += 300;
+        }
+    }
+    TEST_EQUAL(expected - 300, test_reading(last).timestamp);
+}
+
+static void
+test_append(flash_emu *emu) {
+    journal j;
+    journal recovered;
+    reading out[JOURNAL_PAGE_READINGS];
+    uint8_t count;
+    uint32_t n;
+
+    emu->ops.erase(emu->ops.ctx, 0, TEST_SIZE);
+    dgr_journal_init(&j, &emu->ops);
+    TEST_CHECK(dgr_journal_valid(&j, &emu->ops));
+
+    // full pages are written by themselves
+    for(n = 0; n < 2 * JOURNAL_PAGE_READINGS + 5; n++) {
+        reading r = test_reading(n);
+
+        TEST_EQUAL(dgr_journal_append(&j, &r), 0);
+    }
+    TEST_EQUAL(dgr_journal_pages(&j), 2);
+    TEST_EQUAL(j.staged, 5);
+    TEST_CHECK(dgr_journal_read_page(&j, 2, out, &count) != 0);
+
+    // a flush writes the partial page
+    TEST_EQUAL(dgr_journal_flush(&j), 0);
+    TEST_EQUAL(dgr_journal_pages(&j), 3);
+    TEST_EQUAL(dgr_journal_read_page(&j, 2, out, &count), 0);
+    TEST_EQUAL(count, 5);
+    test_check_pages(&j, n - 1);
+    TEST_EQUAL(dgr_journal_flush(&j), 0);
+    TEST_EQUAL(dgr_journal_pages(&j), 3);
+
+    TEST_EQUAL(dgr_journal_recover(&recovered, &emu->ops), 0);
+    TEST_EQUAL(recovered.head, j.head);
+    TEST_EQUAL(recovered.tail, j.tail);
+    TEST_EQUAL(recovered.stored, j.stored);
+    TEST_EQUAL(recovered.sequence, j.sequence);
+}
+
+static void
+test_wrap(flash_emu *emu) {
+    journal j;
+    journal recovered;
+    reading out[JOURNAL_PAGE_READINGS];
+    uint8_t count = 1;
+    uint32_t n;
+
+    emu->ops.erase(emu->ops.ctx, 0, TEST_SIZE);
+    dgr_journal_init(&j, &emu->ops);
+
+    // three and a half rounds through the flash, a full journal drops its oldest sector
+    for(n = 0; n < (TEST_PAGES * 7 / 2) * JOURNAL_PAGE_READINGS; n++) {
+        reading r = test_reading(n);
+
+        TEST_EQUAL(dgr_journal_append(&j, &r), 0);
+        TEST_CHECK(dgr_journal_pages(&j) <= TEST_PAGES);
+        TEST_CHECK(j.sequence <= TEST_PAGES || dgr_journal_pages(&j) >= TEST_PAGES - TEST_PAGES_PER_SECTOR);
+    }
+    TEST_EQUAL(j.head, TEST_PAGES / 2);
+    TEST_EQUAL(j.tail, TEST_PAGES / 2);
+    TEST_EQUAL(dgr_journal_pages(&j), TEST_PAGES);
+    test_check_pages(&j, n - 1);
+
+    TEST_EQUAL(dgr_journal_recover(&recovered, &emu->ops), 0);
+    TEST_EQUAL(recovered.head, j.head);
+    TEST_EQUAL(recovered.tail, j.tail);
+    TEST_EQUAL(recovered.stored, j.stored);
+    TEST_EQUAL(recovered.sequence, j.sequence);
+    test_check_pages(&recovered, n - 1);
+
+    // without the first sector all headers are read, the newest page is still found
+    emu->ops.erase(emu->ops.ctx, 0, TEST_SECTOR_SIZE);
+    TEST_EQUAL(dgr_journal_recover(&recovered, &emu->ops), 0);
+    TEST_EQUAL(recovered.head, j.head);
+    TEST_EQUAL(recovered.sequence, j.sequence);
+    TEST_CHECK(recovered.recovery_reads >= TEST_PAGES);
+    TEST_EQUAL(dgr_journal_read_page(&recovered, recovered.stored - 1, out, &count), 0);
+    TEST_EQUAL(out[count - 1].timestamp, test_reading(n - 1).timestamp);
+}
+
+static void
+test_corrupt(flash_emu *emu) {
+    journal j;
+    reading out[JOURNAL_PAGE_READINGS];
+    uint8_t count;
+    uint8_t zero = 0;
+
+    emu->ops.erase(emu->ops.ctx, 0, TEST_SIZE);
+    dgr_journal_init(&j, &emu->ops);
+    for(uint32_t n = 0; n < JOURNAL_PAGE_READINGS; n++) {
+        reading r = test_reading(n);
+
+        dgr_journal_append(&j, &r);
+    }
+
+    // clearing the bits of a record breaks the CRC of the page
+    emu->ops.write(emu->ops.ctx, JOURNAL_HEADER_SIZE + 4, &zero, 1);
+    TEST_CHECK(dgr_journal_read_page(&j, 0, out, &count) != 0);
+
+    TEST_EQUAL(dgr_journal_recover(&j, &emu->ops), 0);
+    TEST_EQUAL(dgr_journal_pages(&j), 1);
+}
+
+int
+main(void) {
+    flash_emu emu;
+
+    remove(TEST_IMAGE);
+    if(flash_emu_open(&emu, TEST_IMAGE, TEST_SIZE, TEST_SECTOR_SIZE) != 0) {
+        printf("can not open %s\n", TEST_IMAGE);
+        return EXIT_FAILURE;
+    }
+
+    test_append(&emu);
+    test_wrap(&emu);
+    test_corrupt(&emu);
+
+    flash_emu_close(&emu);
+    remove(TEST_IMAGE);
+    return test_result("journal");
+}
@@ -0,0 +1,181 @@
+#include <string.h>
+#include "query.h"
+#include "test.h"
+
+/* Queries over a reading log and an archive filled like the storage of the
+ * firmware fills them, checked against a brute-force search in a flat copy
+ * of all stored readings. The archive is large enough to drop nothing.
+ */
+
+#define TEST_LOG_CAPACITY           32
+#define TEST_ARCHIVE_BLOCKS         48
+#define TEST_READINGS               600
+#define TEST_RUNS                   20
+
+static reading log_records[TEST_LOG_CAPACITY];
+static ts_block archive_blocks[TEST_ARCHIVE_BLOCKS];
+static reading_log log;
+static ts_archive archive;
+static reading all[TEST_READINGS];
+static uint32_t all_count;
+static bool
+test_same(const reading *a, const reading *b) {
+    return a->timestamp == b->timestamp && a->glucose == b->glucose &&
+           a->calibration_state == b->calibration_state && a->trend == b->trend;
+}
+
+/**
+ * Stores a random trace with jitter and gaps, readings evicted from the log go to the archive.
+ */
+static void
+test_fill(void) {
+    uint32_t timestamp = 100000 + test_random(300);
+    uint16_t glucose = 120;
+
+    dgr_reading_log_init(&log, log_records, TEST_LOG_CAPACITY, reading_log_overwrite_oldest);
+    dgr_ts_archive_init(&archive, archive_blocks, TEST_ARCHIVE_BLOCKS);
+    all_count = 0;
+
+    for(int i = 0; i < TEST_READINGS; i++) {
+        reading r = {.calibration_state = 6, .trend = 0x80};
+        reading evicted;
+        int step = (int) test_random(9) - 4;
+
+        timestamp += test_random(10) == 0 ? 300 * (2 + test_random(12)) : 295 + test_random(11);
+        glucose = glucose + step < 40 ? 40 : glucose + step;
+        r.timestamp = timestamp;
+        r.glucose = glucose;
+        r.trend = 0x80 + test_random(3) - 1;
+        if(test_random(50) == 0) {
+            r.calibration_state = 7;
+        }
+
+        if(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted) == reading_log_overwrote) {
+            TEST_CHECK(dgr_ts_archive_append(&archive, &evicted));
+        }
+        all[all_count++] = r;
+    }
+
+    TEST_EQUAL(dgr_ts_archive_readings(&archive) + dgr_reading_log_count(&log), all_count);
+}
+
+static void
+test_range(uint32_t from, uint32_t to) {
+    reading_cursor cursor;
+    const reading *r;
+    uint32_t i = 0;
+
+    while(i < all_count && all[i].timestamp < from) {
+        i++;
+    }
+
+    dgr_query_range(&cursor, &log, &archive, from, to);
+    while((r = dgr_query_next(&cursor)) != NULL) {
+        if(!TEST_CHECK(i < all_count && all[i].timestamp <= to && test_same(r, &all[i]))) {
+            return;
+        }
+        i++;
+    }
+    TEST_CHECK(i == all_count || all[i].timestamp > to);
+}
+
+static void
+test_latest(uint32_t n) {
+    reading_cursor cursor;
+    const reading *r;
+    uint32_t i = n < all_count ? all_count - n : 0;
+
+    dgr_query_latest(&cursor, &log, &archive, n);
+    while((r = dgr_query_next(&cursor)) != NULL) {
+        if(!TEST_CHECK(i < all_count && test_same(r, &all[i]))) {
+            return;
+        }
+        i++;
+    }
+    TEST_EQUAL(i, all_count);
+}
+
+static void
+test_nearest(uint32_t timestamp) {
+    const reading *best = NULL;
+    uint32_t best_distance = UINT32_MAX;
+    reading out;
+
+    // on a tie the older reading wins
+    for(uint32_t i = 0; i < all_count; i++) {
+        uint32_t distance = all[i].timestamp > timestamp ? all[i].timestamp - timestamp
+                                                         : timestamp - all[i].timestamp;
+
+        if(distance < best_distance) {
+            best = &all[i];
+            best_distance = distance;
+        }
+    }
+
+    TEST_CHECK(dgr_query_nearest(&log, &archive, timestamp, &out));
+    TEST_CHECK(test_same(&out, best));
+}
+
+static bool
+test_count_visit(const reading *r, void *arg) {
+    (void) r;
+    return --*(uint32_t*) arg > 0;
+}
+
+static void
+test_empty(void) {
+    reading_cursor cursor;
+    reading out;
+
+    dgr_reading_log_init(&log, log_records, TEST_LOG_CAPACITY, reading_log_overwrite_oldest);
+    dgr_ts_archive_init(&archive, archive_blocks, TEST_ARCHIVE_BLOCKS);
+    dgr_query_range(&cursor, &log, &archive, 0, UINT32_MAX);
+    TEST_CHECK(dgr_query_next(&cursor) == NULL);
+    dgr_query_latest(&cursor, &log, &archive, 10);
+    TEST_CHECK(dgr_query_next(&cursor) == NULL);
+    TEST_CHECK(!dgr_query_nearest(&log, &archive, 1000, &out));
+}
+
+int
+main(void) {
+    reading_cursor cursor;
+    uint32_t limit = 7;
+
+    test_empty();
+
+    for(int run = 0; run < TEST_RUNS; run++) {
+        uint32_t first;
+        uint32_t last;
+
+        test_fill();
+        first = all[0].timestamp;
+        last = all[all_count - 1].timestamp;
+
+        test_range(0, UINT32_MAX);
+        test_range(first, last);
+        test_range(last + 1, UINT32_MAX);
+        test_range(0, first - 1);
+        test_range(log_records[log.head].timestamp, log_records[log.head].timestamp);
+        test_latest(0);
+        test_latest(all_count + 5);
+        test_latest(dgr_reading_log_count(&log));
+        test_latest(dgr_reading_log_count(&log) + 1);
+        test_nearest(0);
+        test_nearest(UINT32_MAX);
+
+        for(int i = 0; i < 50; i++) {
+            uint32_t from = first - 600 + test_random(last - first + 1200);
+
+            test_range(from, from + test_random(20000));
+            test_latest(test_random(all_count));
+            test_nearest(first - 600 + test_random(last - first + 1200));
+        }
+    }
+
+    // a visitor can end the query early
+    dgr_query_range(&cursor, &log, &archive, 0, UINT32_MAX);
+    TEST_EQUAL(dgr_query_visit(&cursor, test_count_visit, &limit), 7);
+    TEST_CHECK(test_same(dgr_query_next(&cursor), &all[7]));
+
+    return test_result("query");
+}
@@ -0,0 +1,270 @@
+#include <string.h>
+#include "reading_log.h"
+#include "test.h"
+
+#define TEST_CAPACITY               52
+#define TEST_RANDOM_INSERTS         20000
+
+static reading records[TEST_CAPACITY];
+static reading
+test_reading(uint32_t timestamp) {
+    reading r = {.timestamp = timestamp, .glucose = timestamp % 400, .calibration_state = 6, .trend = 0x80};
+
+    return r;
+}
+
+/**
+ * Checks that a log holds the readings first, first + step, ... in this order.
+ */
+static void
+test_check_contents(const reading_log *log, uint32_t first, uint32_t step, uint16_t count) {
+    TEST_EQUAL(dgr_reading_log_count(log), count);
+    for(uint16_t i = 0; i < count; i++) {
+        const reading *r = dgr_reading_log_get(log, i);
+
+        if(!TEST_CHECK(r != NULL && r->timestamp == first + i * step && r->glucose == r->timestamp % 400)) {
+            return;
+        }
+    }
+    TEST_CHECK(dgr_reading_log_get(log, count) == NULL);
+}
+
+static void
+test_append_wrap(void) {
+    reading_log log;
+
+    dgr_reading_log_init(&log, records, TEST_CAPACITY, reading_log_overwrite_oldest);
+    TEST_CHECK(dgr_reading_log_valid(&log, records, TEST_CAPACITY));
+    TEST_CHECK(dgr_reading_log_latest(&log) == NULL);
+    TEST_CHECK(dgr_reading_log_get(&log, 0) == NULL);
+    TEST_CHECK(!dgr_reading_log_full(&log));
+
+    for(uint32_t n = 0; n < TEST_CAPACITY; n++) {
+        reading r = test_reading(1000 + n * 300);
+
+        TEST_CHECK(dgr_reading_log_append(&log, &r));
+    }
+    TEST_CHECK(dgr_reading_log_full(&log));
+    test_check_contents(&log, 1000, 300, TEST_CAPACITY);
+
+    // every further record overwrites the oldest one, the head goes around more than once
+    for(uint32_t n = TEST_CAPACITY; n < 3 * TEST_CAPACITY + 7; n++) {
+        reading r = test_reading(1000 + n * 300);
+
+        TEST_CHECK(dgr_reading_log_append(&log, &r));
+        test_check_contents(&log, 1000 + (n + 1 - TEST_CAPACITY) * 300, 300, TEST_CAPACITY);
+        TEST_EQUAL(dgr_reading_log_latest(&log)->timestamp, r.timestamp);
+    }
+    TEST_EQUAL(log.overwritten, 2 * TEST_CAPACITY + 7);
+    TEST_EQUAL(log.head, 7);
+    TEST_CHECK(dgr_reading_log_valid(&log, records, TEST_CAPACITY));
+
+    dgr_reading_log_clear(&log);
+    TEST_EQUAL(dgr_reading_log_count(&log), 0);
+    TEST_EQUAL(log.overwritten, 0);
+    TEST_CHECK(dgr_reading_log_latest(&log) == NULL);
+}
+
+static void
+test_drop_newest(void) {
+    reading_log log;
+    reading r;
+
+    dgr_reading_log_init(&log, records, TEST_CAPACITY, reading_log_drop_newest);
+    for(uint32_t n = 0; n < TEST_CAPACITY + 10; n++) {
+        r = test_reading(1000 + n * 300);
+        TEST_EQUAL(dgr_reading_log_append(&log, &r), n < TEST_CAPACITY);
+    }
+    test_check_contents(&log, 1000, 300, TEST_CAPACITY);
+    TEST_EQUAL(log.overwritten, 0);
+
+    // insert rejects newer records as well
+    r = test_reading(1000 + (TEST_CAPACITY + 20) * 300);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, NULL), reading_log_rejected);
+    test_check_contents(&log, 1000, 300, TEST_CAPACITY);
+}
+
+static void
+test_bounds(void) {
+    reading_log log;
+    reading one[1];
+    reading r = test_reading(500);
+    reading evicted;
+
+    // a log without records holds nothing
+    dgr_reading_log_init(&log, NULL, 0, reading_log_overwrite_oldest);
+    TEST_CHECK(!dgr_reading_log_append(&log, &r));
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted), reading_log_rejected);
+    TEST_EQUAL(dgr_reading_log_lower_bound(&log, 500), 0);
+    TEST_CHECK(dgr_reading_log_find(&log, 500) == NULL);
+
+    // a single record is replaced by every newer one
+    dgr_reading_log_init(&log, one, 1, reading_log_overwrite_oldest);
+    TEST_CHECK(dgr_reading_log_append(&log, &r));
+    r = test_reading(800);
+    TEST_CHECK(dgr_reading_log_append(&log, &r));
+    TEST_EQUAL(dgr_reading_log_latest(&log)->timestamp, 800);
+    r = test_reading(1100);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted), reading_log_overwrote);
+    TEST_EQUAL(evicted.timestamp, 800);
+    TEST_EQUAL(dgr_reading_log_latest(&log)->timestamp, 1100);
+
+    // management data that does not fit the storage is detected after a wakeup
+    dgr_reading_log_init(&log, records, TEST_CAPACITY, reading_log_overwrite_oldest);
+    TEST_CHECK(!dgr_reading_log_valid(&log, one, TEST_CAPACITY));
+    TEST_CHECK(!dgr_reading_log_valid(&log, records, TEST_CAPACITY - 1));
+    log.head = TEST_CAPACITY;
+    TEST_CHECK(!dgr_reading_log_valid(&log, records, TEST_CAPACITY));
+    log.head = 0;
+    log.count = TEST_CAPACITY + 1;
+    TEST_CHECK(!dgr_reading_log_valid(&log, records, TEST_CAPACITY));
+}
+
+static void
+test_insert_order(void) {
+    reading_log log;
+    reading r;
+    reading evicted;
+
+    dgr_reading_log_init(&log, records, TEST_CAPACITY, reading_log_overwrite_oldest);
+
+    // backfilled readings land before the live one
+    r = test_reading(1000 + 10 * 300);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, NULL), reading_log_inserted);
+    for(uint32_t n = 0; n < 10; n++) {
+        r = test_reading(1000 + n * 300);
+        TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_keep, NULL), reading_log_inserted);
+    }
+    test_check_contents(&log, 1000, 300, 11);
+    TEST_EQUAL(dgr_reading_log_lower_bound(&log, 1000 + 5 * 300), 5);
+    TEST_EQUAL(dgr_reading_log_lower_bound(&log, 1000 + 5 * 300 + 1), 6);
+    TEST_EQUAL(dgr_reading_log_lower_bound(&log, UINT32_MAX), 11);
+    TEST_CHECK(dgr_reading_log_find(&log, 1000 + 4 * 300) == dgr_reading_log_get(&log, 4));
+    TEST_CHECK(dgr_reading_log_find(&log, 1000 + 4 * 300 + 1) == NULL);
+
+    // equal timestamps are kept or replaced
+    r = test_reading(1000 + 3 * 300);
+    r.glucose = 999;
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_keep, NULL), reading_log_duplicate);
+    TEST_EQUAL(dgr_reading_log_get(&log, 3)->glucose, (1000 + 3 * 300) % 400);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, NULL), reading_log_replaced);
+    TEST_EQUAL(dgr_reading_log_get(&log, 3)->glucose, 999);
+    TEST_EQUAL(dgr_reading_log_count(&log), 11);
+
+    // a full log evicts its oldest record for a newer one and rejects an older one
+    dgr_reading_log_clear(&log);
+    for(uint32_t n = 0; n < TEST_CAPACITY; n++) {
+        r = test_reading(2000 + n * 600);
+        dgr_reading_log_insert(&log, &r, reading_conflict_replace, NULL);
+    }
+    r = test_reading(1900);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted), reading_log_rejected);
+    r = test_reading(2000 + 300);
+    TEST_EQUAL(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted), reading_log_overwrote);
+    TEST_EQUAL(evicted.timestamp, 2000);
+    TEST_EQUAL(dgr_reading_log_get(&log, 0)->timestamp, 2300);
+    TEST_EQUAL(dgr_reading_log_get(&log, 1)->timestamp, 2600);
+    TEST_EQUAL(dgr_reading_log_count(&log), TEST_CAPACITY);
+}
+
+/**
+ * Inserts a record into a sorted array that models the log.
+ *
+ * @return                  Expected result of dgr_reading_log_insert
+ */
+static reading_log_result
+test_model_insert(reading *model, uint16_t *count, reading_log_policy policy, const reading *r,
+                  reading_conflict_policy conflict, reading *evicted) {
+    uint16_t index = 0;
+    reading_log_result result = reading_log_inserted;
+
+    while(index < *count && model[index].timestamp < r->timestamp) {
+        index++;
+    }
+    if(index < *count && model[index].timestamp == r->timestamp) {
+        if(conflict == reading_conflict_keep) {
+            return reading_log_duplicate;
+        }
+        model[index] = *r;
+        return reading_log_replaced;
+    }
+
+    if(*count == TEST_CAPACITY) {
+        if(policy == reading_log_drop_newest || index == 0) {
+            return reading_log_rejected;
+        }
+        *evicted = model[0];
+        memmove(model, &model[1], --*count * sizeof *model);
+        index--;
+        result = reading_log_overwrote;
+    }
+
+    memmove(&model[index + 1], &model[index], (*count - index) * sizeof *model);
+    model[index] = *r;
+    ++*count;
+    return result;
+}
+
+static void
+test_random_inserts(reading_log_policy policy) {
+    reading model[TEST_CAPACITY];
+    uint16_t model_count = 0;
+    reading_log log;
+    uint32_t newest = 100000;
+
+    dgr_reading_log_init(&log, records, TEST_CAPACITY, policy);
+
+    // live readings with backfilled ones between them, some of them again
+    for(uint32_t n = 0; n < TEST_RANDOM_INSERTS; n++) {
+        reading_conflict_policy conflict = test_random(2) ? reading_conflict_keep : reading_conflict_replace;
+        reading_log_result expected;
+        reading_log_result result;
+        reading expected_evicted = {0};
+        reading evicted = {0};
+        reading r;
+
+        if(test_random(3) == 0) {
+            newest += 300;
+            r = test_reading(newest);
+        } else {
+            r = test_reading(newest - 300 * test_random(2 * TEST_CAPACITY));
+        }
+        r.glucose = test_random(400);
+
+        expected = test_model_insert(model, &model_count, policy, &r, conflict, &expected_evicted);
+        result = dgr_reading_log_insert(&log, &r, conflict, &evicted);
+        if(!TEST_EQUAL(result, expected)) {
+            return;
+        }
+        if(result == reading_log_overwrote) {
+            TEST_EQUAL(evicted.timestamp, expected_evicted.timestamp);
+        }
+
+        TEST_EQUAL(dgr_reading_log_count(&log), model_count);
+        for(uint16_t i = 0; i < model_count; i++) {
+            const reading *stored = dgr_reading_log_get(&log, i);
+
+            if(!TEST_CHECK(stored->timestamp == model[i].timestamp && stored->glucose == model[i].glucose)) {
+                return;
+            }
+        }
+        if(result != reading_log_rejected) {
+            const reading *found = dgr_reading_log_find(&log, r.timestamp);
+
+            TEST_CHECK(found != NULL && (result == reading_log_duplicate || found->glucose == r.glucose));
+        }
+        TEST_CHECK(dgr_reading_log_find(&log, newest + 1) == NULL);
+    }
+    TEST_CHECK(policy == reading_log_drop_newest || log.overwritten > 0);
+}
+
+int
+main(void) {
+    test_append_wrap();
+    test_drop_newest();
+    test_bounds();
+    test_insert_order();
+    test_random_inserts(reading_log_overwrite_oldest);
+    test_random_inserts(reading_log_drop_newest);
+    return test_result("reading_log");
+}
@@ -0,0 +1,207 @@
+#include "scheduler.h"
+#include "test.h"
+
+/* Wake cycles of several days against a simulated transmitter. The RTC runs
+ * off by a drift, the transmitter reports its time in whole seconds and the
+ * reader connects a few seconds after each reading. Every wakeup has to land
+ * shortly before the reading it waits for.
+ */
+
+#define TEST_LEAD_TIME              2000 // in milliseconds
+#define TEST_CYCLES_PER_DAY         288
+
+typedef struct test_clock {
+    double drift_ppm;               // of the rtc
+    double offset_ms;               // rtc time at transmitter time 0
+} test_clock;
+
+static int64_t
+test_rtc(const test_clock *clock, double tx) {
+    return (int64_t) (clock->offset_ms + tx * 1000 * (1 + clock->drift_ppm / 1e6));
+}
+
+static double
+test_tx(const test_clock *clock, int64_t rtc) {
+    return (rtc - clock->offset_ms) / (1000 * (1 + clock->drift_ppm / 1e6));
+}
+
+/**
+ * Connects after a reading: TimeRx arrives, then the reading.
+ *
+ * @return                  RTC time after the connection
+ */
+static int64_t
+test_connect(dgr_schedule *schedule, const test_clock *clock, uint32_t reading) {
+    double tx = reading + 1 + 4 * test_random_unit();
+
+    dgr_schedule_time_sync(schedule, (uint32_t) tx, test_rtc(clock, tx));
+    dgr_schedule_reading(schedule, reading);
+    return test_rtc(clock, tx + 1);
+}
+
+/**
+ * Runs wake cycles and checks the lead of every wakeup before its reading.
+ *
+ * @return                  Transmitter timestamp of the last reading
+ */
+static uint32_t
+test_run_cycles(dgr_schedule *schedule, const test_clock *clock, uint32_t reading, uint32_t cycles,
+                int64_t *worst_lead_error) {
+    int64_t now = test_connect(schedule, clock, reading);
+
+    for(uint32_t cycle = 0; cycle < cycles; cycle++) {
+        int64_t sleep = dgr_schedule_next_wakeup(schedule, now, 1, TEST_LEAD_TIME);
+        int64_t lead_error;
+
+        if(!TEST_CHECK(sleep > 0)) {
+            break;
+        }
+        now += sleep;
+        reading += READING_INTERVAL;
+
+        // the transmitter time is only known to a second, the drift to a few hundred ppm
+        lead_error = llabs((int64_t) ((reading - test_tx(clock, now)) * 1000) - TEST_LEAD_TIME);
+        if(lead_error > *worst_lead_error) {
+            *worst_lead_error = lead_error;
+        }
+
+        now = test_connect(schedule, clock, reading);
+    }
+
+    return reading;
+}
+
+static void
+test_drift(double drift_ppm) {
+    test_clock clock = {.drift_ppm = drift_ppm, .offset_ms = 123456};
+    dgr_schedule schedule;
+    int64_t worst_lead_error = 0;
+    uint32_t reading;
+
+    dgr_schedule_reset(&schedule);
+    TEST_EQUAL(dgr_schedule_next_wakeup(&schedule, 0, 1, TEST_LEAD_TIME), -1);
+
+    reading = test_run_cycles(&schedule, &clock, 50000, TEST_CYCLES_PER_DAY, &worst_lead_error);
+    TEST_CHECK(worst_lead_error < 1500);
+    if(!TEST_CHECK(schedule.drift_known)) {
+        return;
+    }
+
+    // once the drift is known the wakeups only suffer from the whole seconds of the transmitter time
+    worst_lead_error = 0;
+    test_run_cycles(&schedule, &clock, reading, 3 * TEST_CYCLES_PER_DAY, &worst_lead_error);
+    TEST_CHECK(worst_lead_error < 1100);
+    if(!TEST_CHECK(schedule.drift_ppm > drift_ppm - 150 && schedule.drift_ppm < drift_ppm + 150)) {
+        printf("drift %.0f ppm estimated as %d ppm\n", drift_ppm, schedule.drift_ppm);
+    }
+}
+
+static void
+test_restart(void) {
+    test_clock clock = {.drift_ppm = 800, .offset_ms = 5000000};
+    dgr_schedule schedule;
+    int64_t worst_lead_error = 0;
+    int32_t drift_ppm;
+    uint32_t reading;
+
+    dgr_schedule_reset(&schedule);
+    reading = test_run_cycles(&schedule, &clock, 90000, TEST_CYCLES_PER_DAY, &worst_lead_error);
+    TEST_CHECK(schedule.drift_known);
+    drift_ppm = schedule.drift_ppm;
+
+    // a reset restarts the rtc, the schedule starts over but keeps the drift
+    clock.offset_ms = -test_rtc(&clock, reading) + 1000 + clock.offset_ms;
+    dgr_schedule_time_sync(&schedule, reading + 310, test_rtc(&clock, reading + 310));
+    TEST_CHECK(schedule.drift_known);
+    TEST_EQUAL(schedule.drift_ppm, drift_ppm);
+    TEST_EQUAL(schedule.last_reading, 0);
+    TEST_EQUAL(dgr_schedule_next_wakeup(&schedule, test_rtc(&clock, reading + 311), 1, TEST_LEAD_TIME), -1);
+
+    worst_lead_error = 0;
+    reading = test_run_cycles(&schedule, &clock, reading + 600, TEST_CYCLES_PER_DAY, &worst_lead_error);
+    TEST_CHECK(worst_lead_error < 1100);
+
+    // a new transmitter starts its clock at 0
+    drift_ppm = schedule.drift_ppm;
+    clock.offset_ms = test_rtc(&clock, reading + 100);
+    dgr_schedule_time_sync(&schedule, 20, test_rtc(&clock, 20));
+    TEST_EQUAL(schedule.sync_tx_time, 20);
+    TEST_EQUAL(schedule.anchor_tx_time, 20);
+    TEST_EQUAL(schedule.last_reading, 0);
+    TEST_EQUAL(schedule.drift_ppm, drift_ppm);
+
+    worst_lead_error = 0;
+    test_run_cycles(&schedule, &clock, 300, TEST_CYCLES_PER_DAY, &worst_lead_error);
+    TEST_CHECK(worst_lead_error < 1100);
+}
+
+static void
+test_max_drift(void) {
+    dgr_schedule schedule;
+
+    // measured drifts beyond DRIFT_MAX_PPM are clock jumps and do not change the estimate
+    dgr_schedule_reset(&schedule);
+    dgr_schedule_time_sync(&schedule, 1000, 0);
+    dgr_schedule_time_sync(&schedule, 1000 + DRIFT_MIN_BASELINE, DRIFT_MIN_BASELINE * 1000 + 360);
+    TEST_CHECK(schedule.drift_known);
+    TEST_EQUAL(schedule.drift_ppm, 100);
+
+    dgr_schedule_time_sync(&schedule, 1000 + 2 * DRIFT_MIN_BASELINE,
+                           2 * DRIFT_MIN_BASELINE * 1000 + 360 + DRIFT_MAX_PPM * DRIFT_MIN_BASELINE / 1000 + 1000);
+    TEST_EQUAL(schedule.drift_ppm, 100);
+    dgr_schedule_time_sync(&schedule, 1000 + 3 * DRIFT_MIN_BASELINE,
+                           3 * DRIFT_MIN_BASELINE * 1000 - 60000);
+    TEST_EQUAL(schedule.drift_ppm, 100);
+
+    // the anchor moved on, the next baseline is measured from the jump
+    TEST_EQUAL(schedule.anchor_tx_time, 1000 + 3 * DRIFT_MIN_BASELINE);
+
+    // shorter baselines do not measure
+    dgr_schedule_time_sync(&schedule, 1000 + 4 * DRIFT_MIN_BASELINE - 1, 4 * DRIFT_MIN_BASELINE * 1000);
+    TEST_EQUAL(schedule.drift_ppm, 100);
+    TEST_EQUAL(schedule.anchor_tx_time, 1000 + 3 * DRIFT_MIN_BASELINE);
+
+    // accepted measurements are smoothed
+    dgr_schedule_time_sync(&schedule, 1000 + 5 * DRIFT_MIN_BASELINE,
+                           5 * DRIFT_MIN_BASELINE * 1000 - 60000 + 2 * DRIFT_MIN_BASELINE * 500 / 1000);
+    TEST_EQUAL(schedule.drift_ppm, (3 * 100 + 500) / 4);
+}
+
+static void
+test_missed(void) {
+    dgr_schedule schedule;
+    int64_t sleep;
+
+    dgr_schedule_reset(&schedule);
+    dgr_schedule_time_sync(&schedule, 10000, 1000000);
+    dgr_schedule_reading(&schedule, 9998);
+
+    TEST_EQUAL(dgr_schedule_next_wakeup(&schedule, 1000000, 1, 0), 298000);
+    TEST_EQUAL(dgr_schedule_next_wakeup(&schedule, 1000000, 3, TEST_LEAD_TIME), 898000 - TEST_LEAD_TIME);
+
+    // readings that passed during a long connection are skipped
+    sleep = dgr_schedule_next_wakeup(&schedule, 1000000 + 1000000, 1, TEST_LEAD_TIME);
+    TEST_EQUAL(sleep, (9998 + 4 * 300 - 10000) * 1000 - TEST_LEAD_TIME - 1000000);
+    sleep = dgr_schedule_next_wakeup(&schedule, 1000000 + 1000000, 2, TEST_LEAD_TIME);
+    TEST_EQUAL(sleep, (9998 + 4 * 300 - 10000) * 1000 - TEST_LEAD_TIME - 1000000);
+
+    // a wakeup that would be due right now is also skipped
+    sleep = dgr_schedule_next_wakeup(&schedule, 1000000 + 298000 - TEST_LEAD_TIME, 1, TEST_LEAD_TIME);
+    TEST_EQUAL(sleep, 300000);
+
+    // an older reading does not move the schedule back
+    dgr_schedule_reading(&schedule, 9000);
+    TEST_EQUAL(schedule.last_reading, 9998);
+}
+
+int
+main(void) {
+    test_drift(0);
+    test_drift(150);
+    test_drift(-450);
+    test_drift(1500);
+    test_restart();
+    test_max_drift();
+    test_missed();
+    return test_result("scheduler");
+}
@@ -0,0 +1,328 @@
+#include <string.h>
+#include "session.h"
+#include "test.h"
+
+/* The state machine is driven with the events of the firmware. The entry
+ * actions record the entered states and can post events of their own, like
+ * the ones in main.c do.
+ */
+
+#define TEST_MAX_ENTRIES            32
+
+typedef struct test_log {
+    session *s;
+    session_state entered[TEST_MAX_ENTRIES];
+    uint8_t entries;
+    session_event posted_on_entry[SESSION_STATE_COUNT];    // SESSION_EVENT_COUNT for none
+    session_event last_event;
+    uint8_t transitions;
+} test_log;
+
+static test_log tl;
+
+static void
+test_record(session_state state) {
+    if(tl.entries < TEST_MAX_ENTRIES) {
+        tl.entered[tl.entries++] = state;
+    }
+    if(tl.posted_on_entry[state] != SESSION_EVENT_COUNT) {
+        dgr_session_post(tl.s, tl.posted_on_entry[state]);
+        // like dgr_post_event, which runs the state machine right away
+        dgr_session_run(tl.s, 0);
+    }
+}
+
+#define TEST_ENTER(name) static void test_enter_##name(void *arg) { (void) arg; test_record(session_##name); }
+TEST_ENTER(scan) TEST_ENTER(connect) TEST_ENTER(discover) TEST_ENTER(auth) TEST_ENTER(bond)
+TEST_ENTER(encrypt) TEST_ENTER(time) TEST_ENTER(glucose) TEST_ENTER(backfill) TEST_ENTER(teardown)
+TEST_ENTER(done) TEST_ENTER(failed)
+#undef TEST_ENTER
+
+static session_action_fn *const test_enter[SESSION_STATE_COUNT] = {
+    [session_scan] = test_enter_scan,
+    [session_connect] = test_enter_connect,
+    [session_discover] = test_enter_discover,
+    [session_auth] = test_enter_auth,
+    [session_bond] = test_enter_bond,
+    [session_encrypt] = test_enter_encrypt,
+    [session_time] = test_enter_time,
+    [session_glucose] = test_enter_glucose,
+    [session_backfill] = test_enter_backfill,
+    [session_teardown] = test_enter_teardown,
+    [session_done] = test_enter_done,
+    [session_failed] = test_enter_failed,
+};
+
+static void
+test_on_transition(session_state from, session_state to, session_event event, int64_t now, void *arg) {
+    (void) from;
+    (void) to;
+    (void) now;
+    (void) arg;
+    tl.last_event = event;
+    tl.transitions++;
+}
+
+static void
+test_init(session *s) {
+    memset(&tl, 0, sizeof tl);
+    tl.s = s;
+    for(int state = 0; state < SESSION_STATE_COUNT; state++) {
+        tl.posted_on_entry[state] = SESSION_EVENT_COUNT;
+    }
+    dgr_session_init(s, test_enter, test_on_transition, NULL);
+}
+
+static void
+test_event(session *s, session_event event, int64_t now) {
+    TEST_CHECK(dgr_session_post(s, event));
+    dgr_session_run(s, now);
+}
+
+/**
+ * Brings a new state machine into a state along the authentication path.
+ */
+static void
+test_walk_to(session *s, session_state state) {
+    static const session_event path[] = {
+        session_ev_start, session_ev_adv_found, session_ev_connected, session_ev_handles_known,
+        session_ev_authenticated, session_ev_bonded, session_ev_encrypted, session_ev_time_rx,
+        session_ev_glucose_rx, session_ev_backfill_done, session_ev_teardown_done
+    };
+
+    test_init(s);
+    for(size_t i = 0; i < sizeof path / sizeof path[0] && s->state != state; i++) {
+        test_event(s, path[i], 0);
+    }
+    TEST_EQUAL(s->state, state);
+}
+
+static void
+test_full_cycle(void) {
+    static const session_state expected[] = {
+        session_scan, session_connect, session_discover, session_auth, session_bond, session_encrypt,
+        session_time, session_glucose, session_backfill, session_teardown, session_done
+    };
+    session s;
+
+    test_walk_to(&s, session_done);
+    TEST_EQUAL(tl.entries, sizeof expected / sizeof expected[0]);
+    for(uint8_t i = 0; i < tl.entries; i++) {
+        TEST_EQUAL(tl.entered[i], expected[i]);
+    }
+    TEST_EQUAL(tl.transitions, tl.entries);
+    TEST_EQUAL(tl.last_event, session_ev_teardown_done);
+}
+
+static void
+test_alternatives(void) {
+    session s;
+
+    // a remembered transmitter is connected to without an advertisement
+    test_walk_to(&s, session_scan);
+    test_event(&s, session_ev_connected, 0);
+    TEST_EQUAL(s.state, session_discover);
+
+    // bonded reconnect and its fallback to the authentication exchange
+    test_walk_to(&s, session_auth);
+    test_event(&s, session_ev_bond_rejected, 0);
+    TEST_EQUAL(s.state, session_auth);
+    TEST_EQUAL(tl.entered[tl.entries - 1], session_auth);
+    TEST_EQUAL(tl.entered[tl.entries - 2], session_auth);
+    test_event(&s, session_ev_encrypted, 0);
+    TEST_EQUAL(s.state, session_time);
+
+    // the transmitter closes the link after the backfill
+    test_walk_to(&s, session_backfill);
+    test_event(&s, session_ev_disconnected, 0);
+    TEST_EQUAL(s.state, session_teardown);
+    test_event(&s, session_ev_disconnected, 0);
+    TEST_EQUAL(s.state, session_done);
+
+    // events without a row are dropped
+    test_walk_to(&s, session_auth);
+    test_event(&s, session_ev_time_rx, 0);
+    test_event(&s, session_ev_backfill_done, 0);
+    TEST_EQUAL(s.state, session_auth);
+}
+
+static void
+test_defer(void) {
+    session s;
+
+    // GlucoseRx can overtake TimeRx, it is handled once the time is known
+    test_walk_to(&s, session_time);
+    test_event(&s, session_ev_glucose_rx, 0);
+    TEST_EQUAL(s.state, session_time);
+    test_event(&s, session_ev_time_rx, 0);
+    TEST_EQUAL(s.state, session_backfill);
+    TEST_EQUAL(tl.entered[tl.entries - 2], session_glucose);
+    TEST_EQUAL(s.deferred, 0);
+
+    // events posted by the entry action come before the deferred ones
+    test_walk_to(&s, session_time);
+    tl.posted_on_entry[session_glucose] = session_ev_error;
+    test_event(&s, session_ev_glucose_rx, 0);
+    test_event(&s, session_ev_time_rx, 0);
+    TEST_EQUAL(s.state, session_failed);
+    TEST_EQUAL(s.deferred, 0);
+    TEST_EQUAL(s.queue_length, 0);
+}
+
+static void
+test_wildcards(void) {
+    static const session_state active[] = {
+        session_scan, session_connect, session_discover, session_auth, session_bond, session_encrypt,
+        session_time, session_glucose, session_backfill
+    };
+    session s;
+
+    for(size_t i = 0; i < sizeof active / sizeof active[0]; i++) {
+        test_walk_to(&s, active[i]);
+        test_event(&s, session_ev_error, 0);
+        TEST_EQUAL(s.state, session_failed);
+
+        test_walk_to(&s, active[i]);
+        test_event(&s, session_ev_timeout, 0);
+        TEST_EQUAL(s.state, session_failed);
+
+        // the specific row of the backfill wins over the wildcard
+        test_walk_to(&s, active[i]);
+        test_event(&s, session_ev_disconnected, 0);
+        TEST_EQUAL(s.state, active[i] == session_backfill ? session_teardown : session_failed);
+    }
+
+    // the inactive states ignore the wildcard rows
+    test_init(&s);
+    test_event(&s, session_ev_error, 0);
+    TEST_EQUAL(s.state, session_idle);
+    test_walk_to(&s, session_done);
+    test_event(&s, session_ev_error, 0);
+    test_event(&s, session_ev_handles_invalid, 0);
+    TEST_EQUAL(s.state, session_done);
+    test_walk_to(&s, session_discover);
+    test_event(&s, session_ev_error, 0);
+    test_event(&s, session_ev_timeout, 0);
+    test_event(&s, session_ev_handles_invalid, 0);
+    TEST_EQUAL(s.state, session_failed);
+}
+
+static void
+test_handles_invalid(void) {
+    static const session_state open_link[] = {
+        session_discover, session_auth, session_bond, session_encrypt, session_time, session_glucose,
+        session_backfill, session_teardown
+    };
+    session s;
+
+    // a rejected cached handle sends the session back to the discovery on the open link
+    for(size_t i = 0; i < sizeof open_link / sizeof open_link[0]; i++) {
+        test_walk_to(&s, open_link[i]);
+        test_event(&s, session_ev_handles_invalid, 100);
+        TEST_EQUAL(s.state, session_discover);
+        TEST_EQUAL(tl.entered[tl.entries - 1], session_discover);
+        TEST_EQUAL(s.deadline, 100 + dgr_session_deadline_of(session_discover));
+
+        // and the session goes on from there
+        test_event(&s, session_ev_handles_known, 200);
+        TEST_EQUAL(s.state, session_auth);
+    }
+
+    // the discovery that runs from the cache posts the result from its entry action
+    test_walk_to(&s, session_time);
+    tl.posted_on_entry[session_discover] = session_ev_handles_known;
+    test_event(&s, session_ev_handles_invalid, 0);
+    TEST_EQUAL(s.state, session_auth);
+}
+
+static void
+test_deadlines(void) {
+    session s;
+
+    test_init(&s);
+    TEST_EQUAL(s.deadline, 0);
+    test_event(&s, session_ev_start, 1000);
+    TEST_EQUAL(s.state_entered, 1000);
+    TEST_EQUAL(s.deadline, 1000 + dgr_session_deadline_of(session_scan));
+
+    test_event(&s, session_ev_adv_found, 2000);
+    TEST_EQUAL(s.deadline, 2000 + dgr_session_deadline_of(session_connect));
+    dgr_session_check_deadline(&s, 2000 + dgr_session_deadline_of(session_connect) - 1);
+    TEST_EQUAL(s.state, session_connect);
+    dgr_session_check_deadline(&s, 2000 + dgr_session_deadline_of(session_connect));
+    TEST_EQUAL(s.state, session_failed);
+    TEST_EQUAL(tl.last_event, session_ev_timeout);
+    TEST_EQUAL(s.deadline, 0);
+
+    // a long backfill keeps its state alive, but never shortens the deadline
+    test_walk_to(&s, session_backfill);
+    TEST_EQUAL(s.deadline, dgr_session_deadline_of(session_backfill));
+    dgr_session_extend_deadline(&s, 15000, 30000);
+    TEST_EQUAL(s.deadline, 45000);
+    dgr_session_extend_deadline(&s, 16000, 1000);
+    TEST_EQUAL(s.deadline, 45000);
+    dgr_session_check_deadline(&s, 44999);
+    TEST_EQUAL(s.state, session_backfill);
+
+    // the wait for the disconnect is bounded, a missed deadline is no error
+    test_event(&s, session_ev_backfill_done, 50000);
+    dgr_session_check_deadline(&s, 50000 + dgr_session_deadline_of(session_teardown));
+    TEST_EQUAL(s.state, session_done);
+
+    // states without deadline keep none
+    test_init(&s);
+    dgr_session_extend_deadline(&s, 0, 1000);
+    TEST_EQUAL(s.deadline, 0);
+    dgr_session_check_deadline(&s, INT64_MAX);
+    TEST_EQUAL(s.state, session_idle);
+    TEST_EQUAL(dgr_session_deadline_of(session_done), 0);
+    TEST_EQUAL(dgr_session_deadline_of(SESSION_STATE_COUNT), 0);
+}
+
+static void
+test_queue(void) {
+    session s;
+
+    test_init(&s);
+    for(int i = 0; i < SESSION_QUEUE_SIZE; i++) {
+        TEST_CHECK(dgr_session_post(&s, session_ev_timeout));
+    }
+    TEST_CHECK(!dgr_session_post(&s, session_ev_start));
+    dgr_session_run(&s, 0);
+    TEST_EQUAL(s.queue_length, 0);
+    TEST_EQUAL(s.state, session_idle);
+
+    // events are handled in order
+    TEST_CHECK(dgr_session_post(&s, session_ev_start));
+    TEST_CHECK(dgr_session_post(&s, session_ev_adv_found));
+    TEST_CHECK(dgr_session_post(&s, session_ev_connected));
+    dgr_session_run(&s, 0);
+    TEST_EQUAL(s.state, session_discover);
+}
+
+static void
+test_names(void) {
+    for(int state = 0; state < SESSION_STATE_COUNT; state++) {
+        TEST_CHECK(dgr_session_state_name((session_state) state) != NULL);
+    }
+    for(int event = 0; event < SESSION_EVENT_COUNT; event++) {
+        TEST_CHECK(dgr_session_event_name((session_event) event) != NULL);
+    }
+    TEST_CHECK(strcmp(dgr_session_state_name(session_failed), "failed") == 0);
+    TEST_CHECK(strcmp(dgr_session_event_name(session_ev_handles_invalid), "handles_invalid") == 0);
+    TEST_CHECK(strcmp(dgr_session_event_name(session_ev_timeout), "timeout") == 0);
+    TEST_CHECK(strcmp(dgr_session_state_name(SESSION_STATE_COUNT), "unknown") == 0);
+}
+
+int
+main(void) {
+    test_full_cycle();
+    test_alternatives();
+    test_defer();
+    test_wildcards();
+    test_handles_invalid();
+    test_deadlines();
+    test_queue();
+    test_names();
+    return test_result("session");
+}
@@ -0,0 +1,475 @@
+#include <stddef.h>
+#include <string.h>
+#include "scheduler.h"
+#include "ts_compress.h"
+
+// a bit writer that only counts the bits if data is NULL
+typedef struct bit_writer {
+    uint8_t *data;
+    uint16_t pos;
+} bit_writer;
+
+static void
+dgr_ts_put_bits(bit_writer *w, uint32_t value, uint8_t bits) {
+    while(bits > 0) {
+        bits--;
+        if(w->data != NULL) {
+            uint8_t mask = 0x80U >> (w->pos & 7U);
+
+            if((value >> bits) & 1U) {
+                w->data[w->pos >> 3U] |= mask;
+            } else {
+                w->data[w->pos >> 3U] &= ~mask;
+            }
+        }
+        w->pos++;
+    }
+}
+
+static uint32_t
+dgr_ts_get_bits(const uint8_t *data, uint16_t *pos, uint8_t bits) {
+    uint32_t value = 0;
+
+    while(bits > 0) {
+        bits--;
+        value = value << 1U | ((data[*pos >> 3U] >> (7U - (*pos & 7U))) & 1U);
+        (*pos)++;
+    }
+
+    return value;
+}
+
+static uint32_t
+dgr_ts_zigzag(int32_t value) {
+    return ((uint32_t) value << 1U) ^ (uint32_t) (value >> 31);
+}
+
+static int32_t
+dgr_ts_unzigzag(uint32_t value) {
+    return (int32_t) (value >> 1U) ^ -(int32_t) (value & 1U);
+}
+
+// width of the run length of each field
+static const uint8_t ts_run_bits[TS_FIELDS] = {TS_RUN_BITS_TIMESTAMP, TS_RUN_BITS_GLUCOSE, TS_RUN_BITS_STATE,
+                                               TS_RUN_BITS_TREND};
+
+/**
+ * Writes an Exp-Golomb code: as many zeros as value + 1 has bits after the
+ * leading one, then value + 1.
+ */
+static void
+dgr_ts_put_golomb(bit_writer *w, uint32_t value) {
+    uint8_t bits = 0;
+
+    while((value + 1) >> (bits + 1U) != 0) {
+        bits++;
+    }
+    dgr_ts_put_bits(w, 0x0, bits);
+    dgr_ts_put_bits(w, value + 1, bits + 1);
+}
+
+static uint32_t
+dgr_ts_get_golomb(const uint8_t *data, uint16_t *pos) {
+    uint8_t bits = 0;
+
+    while(bits < 31 && dgr_ts_get_bits(data, pos, 1) == 0) {
+        bits++;
+    }
+    return ((1U << bits) | dgr_ts_get_bits(data, pos, bits)) - 1;
+}
+
+/**
+ * Writes that a field is unchanged. An open run of the field grows by
+ * rewriting its length in place, which costs no bits; a full run or a
+ * changed value before starts a new run.
+ */
+static void
+dgr_ts_put_unchanged(bit_writer *w, ts_run *run, uint8_t bits) {
+    if(run->open && run->length < (1U << bits) - 1) {
+        bit_writer length = {w->data, run->bit_pos};
+
+        run->length++;
+        dgr_ts_put_bits(&length, run->length, bits);
+        return;
+    }
+
+    dgr_ts_put_bits(w, 0x0, 1);
+    run->open = true;
+    run->length = 0;
+    run->bit_pos = w->pos;
+    dgr_ts_put_bits(w, 0x0, bits);
+}
+
+static void
+dgr_ts_put_changed(bit_writer *w, ts_run *run) {
+    dgr_ts_put_bits(w, 0x1, 1);
+    run->open = false;
+}
+
+/**
+ * Writes the timestamp relative to the slot of the previous reading. The
+ * slot advances by the reading interval, so jitter of a reading does not
+ * carry over to the next one.
+ */
+static void
+dgr_ts_encode_timestamp(bit_writer *w, ts_archive *archive, const reading *r) {
+    int32_t offset = (int32_t) (r->timestamp - archive->slot);
+    uint32_t slots = offset >= READING_INTERVAL / 2 ? (offset + READING_INTERVAL / 2) / READING_INTERVAL : 0;
+    uint32_t jitter = dgr_ts_zigzag(offset - (int32_t) (slots * READING_INTERVAL));
+
+    if(slots == 1 && jitter == 0) {
+        dgr_ts_put_unchanged(w, &archive->runs[ts_field_timestamp], ts_run_bits[ts_field_timestamp]);
+        archive->slot += READING_INTERVAL;
+        return;
+    }
+
+    dgr_ts_put_changed(w, &archive->runs[ts_field_timestamp]);
+    if(slots == 1 && jitter <= 2) {
+        dgr_ts_put_bits(w, 0x0, 1);
+        dgr_ts_put_bits(w, jitter - 1, 1);
+    } else if(slots == 1 && jitter < (1U << 6U)) {
+        dgr_ts_put_bits(w, 0x2, 2);
+        dgr_ts_put_bits(w, jitter, 6);
+    } else if(slots >= 2 && slots <= 17 && jitter < (1U << 6U)) {
+        dgr_ts_put_bits(w, 0x6, 3);
+        dgr_ts_put_bits(w, slots - 2, 4);
+        dgr_ts_put_bits(w, jitter, 6);
+    } else {
+        dgr_ts_put_bits(w, 0x7, 3);
+        dgr_ts_put_bits(w, r->timestamp - archive->last.timestamp, 32);
+        archive->slot = r->timestamp;
+        return;
+    }
+    archive->slot += slots * READING_INTERVAL;
+}
+
+/**
+ * Writes the difference of a reading to the previous one and updates the
+ * runs, the slot and the last reading of the archive.
+ *
+ * @param w                 Bit writer
+ * @param archive           Archive with the state of the open block
+ * @param r                 Reading to encode
+ */
+static void
+dgr_ts_encode(bit_writer *w, ts_archive *archive, const reading *r) {
+    const reading *last = &archive->last;
+    uint32_t glucose = dgr_ts_zigzag((int32_t) r->glucose - last->glucose);
+    uint32_t trend = dgr_ts_zigzag((int32_t) r->trend - last->trend);
+
+    dgr_ts_encode_timestamp(w, archive, r);
+
+    if(glucose == 0) {
+        dgr_ts_put_unchanged(w, &archive->runs[ts_field_glucose], ts_run_bits[ts_field_glucose]);
+    } else {
+        dgr_ts_put_changed(w, &archive->runs[ts_field_glucose]);
+        dgr_ts_put_golomb(w, glucose - 1);
+    }
+
+    if(r->calibration_state == last->calibration_state) {
+        dgr_ts_put_unchanged(w, &archive->runs[ts_field_state], ts_run_bits[ts_field_state]);
+    } else {
+        dgr_ts_put_changed(w, &archive->runs[ts_field_state]);
+        dgr_ts_put_bits(w, r->calibration_state, 8);
+    }
+
+    if(trend == 0) {
+        dgr_ts_put_unchanged(w, &archive->runs[ts_field_trend], ts_run_bits[ts_field_trend]);
+    } else {
+        dgr_ts_put_changed(w, &archive->runs[ts_field_trend]);
+        dgr_ts_put_golomb(w, trend - 1);
+    }
+
+    archive->last = *r;
+}
+
+static uint8_t*
+dgr_ts_block_data(const ts_archive *archive, uint16_t index) {
+    uint32_t pos = (uint32_t) archive->first + index;
+
+    if(pos >= archive->block_count) {
+        pos -= archive->block_count;
+    }
+    return archive->blocks[pos].data;
+}
+
+/**
+ * Opens a new block with the given reading in its header. A full archive
+ * drops its oldest block. The bit stream starts with the offset of the
+ * reading to the slots of the previous block, so a first reading with
+ * jitter does not shift the slots of the whole block.
+ */
+static void
+dgr_ts_open_block(ts_archive *archive, const reading *r) {
+    int32_t offset = (int32_t) (r->timestamp - archive->slot);
+    uint32_t slots = offset >= READING_INTERVAL / 2 ? (offset + READING_INTERVAL / 2) / READING_INTERVAL : 0;
+    uint32_t jitter = dgr_ts_zigzag(offset - (int32_t) (slots * READING_INTERVAL));
+    bool on_slots = archive->used > 0 && slots > 0 && jitter != 0 && jitter < (1U << 6U);
+    bit_writer w;
+    uint8_t *data;
+
+    if(archive->used == archive->block_count) {
+        archive->first = archive->first + 1 == archive->block_count ? 0 : archive->first + 1;
+        archive->used--;
+    }
+    archive->used++;
+
+    data = dgr_ts_block_data(archive, archive->used - 1);
+    memset(data, 0, TS_BLOCK_SIZE);
+    data[0] = r->timestamp;
+    data[1] = r->timestamp >> 8U;
+    data[2] = r->timestamp >> 16U;
+    data[3] = r->timestamp >> 24U;
+    data[4] = r->glucose;
+    data[5] = r->glucose >> 8U;
+    data[6] = r->calibration_state;
+    data[7] = r->trend;
+    data[8] = 1; // number of readings
+
+    w.data = &data[TS_HEADER_SIZE];
+    w.pos = 0;
+    if(on_slots) {
+        dgr_ts_put_bits(&w, 0x1, 1);
+        dgr_ts_put_bits(&w, jitter, 6);
+        archive->slot = r->timestamp - dgr_ts_unzigzag(jitter);
+    } else {
+        dgr_ts_put_bits(&w, 0x0, 1);
+        archive->slot = r->timestamp;
+    }
+    archive->bit_pos = w.pos;
+    memset(archive->runs, 0, sizeof archive->runs);
+}
+
+/**
+ * Initializes an empty archive.
+ *
+ * @param archive           Archive
+ * @param blocks            Storage for the blocks
+ * @param block_count       Number of blocks in the storage
+ */
+void
+dgr_ts_archive_init(ts_archive *archive, ts_block *blocks, uint16_t block_count) {
+    memset(archive, 0, sizeof *archive);
+    archive->blocks = blocks;
+    archive->block_count = block_count;
+}
+
+/**
+ * Checks the management data of an archive that survived a deep sleep.
+ */
+bool
+dgr_ts_archive_valid(const ts_archive *archive, const ts_block *blocks, uint16_t block_count) {
+    if(archive->blocks != blocks || archive->block_count != block_count || archive->first >= block_count ||
+       archive->used > block_count || archive->bit_pos > TS_PAYLOAD_BITS) {
+        return false;
+    }
+    for(int field = 0; field < TS_FIELDS; field++) {
+        const ts_run *run = &archive->runs[field];
+
+        if(run->open && (run->bit_pos + ts_run_bits[field] > archive->bit_pos ||
+                         run->length >= 1U << ts_run_bits[field])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Appends a reading to the open block, or to a new block if it does not fit.
+ *
+ * @param archive           Archive
+ * @param r                 Reading, must be newer than the last appended one
+ * @return                  false if the reading is not newer than the last one
+ */
+bool
+dgr_ts_archive_append(ts_archive *archive, const reading *r) {
+    bit_writer w;
+    uint8_t *data;
+
+    if(archive->block_count == 0) {
+        return false;
+    }
+    if(archive->used > 0 && r->timestamp <= archive->last.timestamp) {
+        archive->dropped++;
+        return false;
+    }
+
+    if(archive->used > 0) {
+        ts_archive trial = *archive;
+
+        data = dgr_ts_block_data(archive, archive->used - 1);
+
+        // measure the encoded size first, on a copy of the runs
+        w.data = NULL;
+        w.pos = archive->bit_pos;
+        dgr_ts_encode(&w, &trial, r);
+
+        if(w.pos <= TS_PAYLOAD_BITS && data[8] < UINT8_MAX) {
+            w.data = &data[TS_HEADER_SIZE];
+            w.pos = archive->bit_pos;
+            dgr_ts_encode(&w, archive, r);
+
+            archive->bit_pos = w.pos;
+            data[8]++;
+            return true;
+        }
+    }
+
+    dgr_ts_open_block(archive, r);
+    archive->last = *r;
+    return true;
+}
+
+uint16_t
+dgr_ts_archive_blocks(const ts_archive *archive) {
+    return archive->used;
+}
+
+/**
+ * Returns the number of readings in a block.
+ *
+ * @param archive           Archive
+ * @param index             0 for the oldest block
+ */
+uint8_t
+dgr_ts_archive_block_readings(const ts_archive *archive, uint16_t index) {
+    return index < archive->used ? dgr_ts_block_data(archive, index)[8] : 0;
+}
+
+/**
+ * Returns the timestamp of the first reading in a block, the blocks are
+ * ordered by time.
+ *
+ * @param archive           Archive
+ * @param index             0 for the oldest block
+ */
+uint32_t
+dgr_ts_archive_block_start(const ts_archive *archive, uint16_t index) {
+    const uint8_t *data;
+
+    if(index >= archive->used) {
+        return 0;
+    }
+
+    data = dgr_ts_block_data(archive, index);
+    return data[0] | (uint32_t) data[1] << 8U | (uint32_t) data[2] << 16U | (uint32_t) data[3] << 24U;
+}
+
+uint32_t
+dgr_ts_archive_readings(const ts_archive *archive) {
+    uint32_t readings = 0;
+
+    for(uint16_t i = 0; i < archive->used; i++) {
+        readings += dgr_ts_archive_block_readings(archive, i);
+    }
+
+    return readings;
+}
+
+/**
+ * Prepares the decoding of a block.
+ *
+ * @param decoder           Decoder
+ * @param archive           Archive
+ * @param index             0 for the oldest block
+ * @return                  false if there is no such block
+ */
+bool
+dgr_ts_decoder_init(ts_decoder *decoder, const ts_archive *archive, uint16_t index) {
+    const uint8_t *data;
+
+    if(index >= archive->used) {
+        return false;
+    }
+
+    data = dgr_ts_block_data(archive, index);
+    decoder->data = &data[TS_HEADER_SIZE];
+    decoder->bit_pos = 0;
+    decoder->remaining = data[8];
+    decoder->first = true;
+    decoder->last.timestamp = dgr_ts_archive_block_start(archive, index);
+    decoder->last.glucose = data[4] | (uint16_t) data[5] << 8U;
+    decoder->last.calibration_state = data[6];
+    decoder->last.trend = data[7];
+    decoder->slot = decoder->last.timestamp;
+    if(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) == 1) {
+        decoder->slot -= dgr_ts_unzigzag(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 6));
+    }
+    memset(decoder->runs, 0, sizeof decoder->runs);
+    return true;
+}
+
+/**
+ * Reads whether a field changed, the readings of a run are counted down.
+ */
+static bool
+dgr_ts_get_changed(ts_decoder *decoder, ts_field field) {
+    if(decoder->runs[field] > 0) {
+        decoder->runs[field]--;
+        return false;
+    }
+    if(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) == 0) {
+        decoder->runs[field] = dgr_ts_get_bits(decoder->data, &decoder->bit_pos, ts_run_bits[field]);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Decodes the next reading of a block.
+ *
+ * @param decoder           Decoder
+ * @param out               The reading is written to this variable
+ * @return                  false if all readings of the block were decoded
+ */
+bool
+dgr_ts_decoder_next(ts_decoder *decoder, reading *out) {
+    reading *last = &decoder->last;
+    uint32_t slots = 1;
+    int32_t jitter = 0;
+
+    if(decoder->remaining == 0) {
+        return false;
+    }
+    decoder->remaining--;
+
+    if(decoder->first) {
+        decoder->first = false;
+        *out = *last;
+        return true;
+    }
+
+    if(dgr_ts_get_changed(decoder, ts_field_timestamp)) {
+        if(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) == 0) {
+            jitter = dgr_ts_unzigzag(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) + 1);
+        } else if(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) == 0) {
+            jitter = dgr_ts_unzigzag(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 6));
+        } else if(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 1) == 0) {
+            slots = dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 4) + 2;
+            jitter = dgr_ts_unzigzag(dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 6));
+        } else {
+            slots = 0;
+            last->timestamp += dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 32);
+            decoder->slot = last->timestamp;
+        }
+    }
+    if(slots > 0) {
+        decoder->slot += slots * READING_INTERVAL;
+        last->timestamp = decoder->slot + jitter;
+    }
+
+    if(dgr_ts_get_changed(decoder, ts_field_glucose)) {
+        last->glucose += dgr_ts_unzigzag(dgr_ts_get_golomb(decoder->data, &decoder->bit_pos) + 1);
+    }
+
+    if(dgr_ts_get_changed(decoder, ts_field_state)) {
+        last->calibration_state = dgr_ts_get_bits(decoder->data, &decoder->bit_pos, 8);
+    }
+
+    if(dgr_ts_get_changed(decoder, ts_field_trend)) {
+        last->trend += dgr_ts_unzigzag(dgr_ts_get_golomb(decoder->data, &decoder->bit_pos) + 1);
+    }
+
+    *out = *last;
+    return true;
+}
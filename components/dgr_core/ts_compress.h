@@ -0,0 +1,96 @@
+#ifndef DGR_TS_COMPRESS_H
+#define DGR_TS_COMPRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "reading_log.h"
+
+/* Compressed archive of readings. The archive is a ring of fixed size blocks,
+ * every block starts with an uncompressed header holding its first reading and
+ * continues with a bit stream of the following readings. Every field of a
+ * reading starts with one bit:
+ *
+ *  '0' + n bits        unchanged, and so are the next 0 to 2^n - 1 readings (a run)
+ *  '1' + value         changed
+ *
+ * Within a run the field takes no bits. The length of the newest run is
+ * rewritten in place as readings are appended, so the encoder never has to
+ * look ahead. The changed values are:
+ *
+ *  timestamp           offset to the slot of the previous reading plus 300 s, zig-zag encoded
+ *                      '0' + 1 bit (1 s), '10' + 6 bits (up to 31 s),
+ *                      '110' + 4 bits missed readings (1 to 16) + 6 bits offset, '111' + 32 bits raw delta
+ *  glucose             delta to the previous value, zig-zag encoded, Exp-Golomb code of the delta - 1
+ *  calibration state   8 bits
+ *  trend               delta to the previous value like the glucose
+ *
+ * A timestamp is unchanged if it is on its slot, the slots advance by the
+ * reading interval no matter the jitter of a reading. The bit stream starts
+ * with '0', or with '1' + 6 bits of the offset of the first reading to the
+ * slots of the previous block. Blocks
+ * are decoded independently, so they can be accessed by index. The archive
+ * only accepts readings in increasing time order, a full archive drops its
+ * oldest block.
+ */
+
+#define TS_BLOCK_SIZE               60 // in bytes
+#define TS_HEADER_SIZE              9 // first reading and number of readings
+#define TS_PAYLOAD_BITS             ((TS_BLOCK_SIZE - TS_HEADER_SIZE) * 8)
+#define TS_RUN_BITS_TIMESTAMP       3 // width of the run lengths
+#define TS_RUN_BITS_GLUCOSE         1
+#define TS_RUN_BITS_STATE           6
+#define TS_RUN_BITS_TREND           1
+
+typedef enum {
+    ts_field_timestamp,
+    ts_field_glucose,
+    ts_field_state,
+    ts_field_trend,
+    TS_FIELDS
+} ts_field;
+
+// the newest run of unchanged values of a field in the open block
+typedef struct ts_run {
+    uint16_t bit_pos;               // position of the run length in the bit stream
+    uint8_t length;                 // readings in the run after the first one
+    bool open;                      // the run can still grow
+} ts_run;
+
+typedef struct ts_block {
+    uint8_t data[TS_BLOCK_SIZE];
+} ts_block;
+
+typedef struct ts_archive {
+    ts_block *blocks;
+    uint16_t block_count;
+    uint16_t first;                 // index of the oldest block
+    uint16_t used;                  // blocks in use, the newest one is open for appending
+    uint16_t bit_pos;               // end of the bit stream in the open block
+    reading last;                   // last appended reading
+    uint32_t slot;                  // slot of the last appended reading, without its jitter
+    ts_run runs[TS_FIELDS];
+    uint32_t dropped;               // readings rejected because they were out of order
+} ts_archive;
+
+typedef struct ts_decoder {
+    const uint8_t *data;
+    uint16_t bit_pos;
+    uint8_t remaining;              // readings left in the block
+    bool first;                     // next reading is the one in the header
+    reading last;
+    uint32_t slot;
+    uint8_t runs[TS_FIELDS];        // readings left in the run of each field
+} ts_decoder;
+
+void dgr_ts_archive_init(ts_archive *archive, ts_block *blocks, uint16_t block_count);
+bool dgr_ts_archive_valid(const ts_archive *archive, const ts_block *blocks, uint16_t block_count);
+bool dgr_ts_archive_append(ts_archive *archive, const reading *r);
+uint16_t dgr_ts_archive_blocks(const ts_archive *archive);
+uint8_t dgr_ts_archive_block_readings(const ts_archive *archive, uint16_t index);
+uint32_t dgr_ts_archive_block_start(const ts_archive *archive, uint16_t index);
+uint32_t dgr_ts_archive_readings(const ts_archive *archive);
+bool dgr_ts_decoder_init(ts_decoder *decoder, const ts_archive *archive, uint16_t index);
+bool dgr_ts_decoder_next(ts_decoder *decoder, reading *out);
+
+#endif
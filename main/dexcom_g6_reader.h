@@ -3,42 +3,66 @@
 #include "host/ble_hs_adv.h"
 #include "os/os.h"
 #include "sys/queue.h"
-#include "freertos/ringbuf.h"
 #include "freertos/semphr.h"
 #include <sys/time.h>
 
-#define SLEEP_BETWEEN_READINGS      600 // in seconds (240)
+#include "scheduler.h"
+#include "session.h"
+#include "metrics.h"
+#include "energy.h"
+#include "reading_log.h"
+#include "ts_compress.h"
+#include "journal.h"
+#include "query.h"
+#include "export.h"
+#include "backfill.h"
+#include "coverage.h"
+#include "crc16.h"
+#include "msg_table.h"
+#include "codec.h"
+#include "auth.h"
+
+#define SLEEP_BETWEEN_READINGS      600 // in seconds (240), used until the reading schedule is known
 #define SLEEP_AFTER_ERROR           30 // in seconds
+#define READING_EVERY_NTH           1 // wake up for every n-th reading of the transmitter
+#define WAKEUP_LEAD_TIME            3000 // in milliseconds, wake up before the expected reading
+#define TARGETED_DISCOVERY          1 // 0 discovers all attributes of the transmitter
+#define STORAGE_FULL_POLICY         reading_log_overwrite_oldest // or reading_log_drop_newest
+#define BACKFILL_CONFLICT_POLICY    reading_conflict_keep // or reading_conflict_replace to prefer backfilled values
+#define BACKFILL_GAP_TIMEOUT        200 // in milliseconds, wait for a missing backfill notification before requesting it again
+#define BACKFILL_IDLE_TIMEOUT       2000 // in milliseconds, a backfill request without new notifications is finished
+#define BACKFILL_CHUNK_READINGS     72 // readings per backfill request, longer holes take several requests
+#define BACKFILL_KEEP_ALIVE         25 // in seconds, keep the connection while more backfill requests follow
+#define BACKFILL_RETRIES            2 // repeated backfill requests per connection
+#define JOURNAL_PARTITION           "journal" // label in partitions.csv
+#define JOURNAL_PARTITION_SUBTYPE   0x40
+#define EXPORT_UART                 UART_NUM_0 // the console
+#define EXPORT_UART_RX_BUFFER       256
+#define EXPORT_PROBE                300 // in milliseconds, listen for an export request after a reset, 0 never listens
+#define EXPORT_WINDOW               3000 // in milliseconds, wait for the next request once a host is connected
+#define JOURNAL_REPLAY_PAGES        16 // newest journal pages copied to RTC memory after a reset
+
+// connecting to a transmitter remembered from an earlier wake cycle
+#define DIRECT_CONNECT_TIMEOUT      15000 // in milliseconds, open scan afterwards
+#define ADV_PERIOD                  300 // in seconds, transmitter advertises once per reading
+#define ADV_EXPECTED_WINDOW         15 // in seconds around the expected advertisement
+// scan interval and window in units of 0.625 ms
+#define SCAN_ITVL_EXPECTED          0x0060 // 60 ms
+#define SCAN_WINDOW_EXPECTED        0x0060 // 60 ms, continuous scan
+#define SCAN_ITVL_DUTY_CYCLED       0x0200 // 320 ms
+#define SCAN_WINDOW_DUTY_CYCLED     0x0030 // 30 ms
 
-// values for the calibration state
-#define CALIB_STATE_STOPPED                     0x01
-#define CALIB_STATE_WARMUP                      0x02
-#define CALIB_STATE_OK                          0x06
-#define CALIB_STATE_NEED_CALIBRATION            0x07
-#define CALIB_STATE_NEED_FIRST_CALIBRATION      0x04
-#define CALIB_STATE_NEED_SECOND_CALIBRATION     0x05
-#define CALIB_STATE_SENSOR_FAILED               0x0b
-
-// values for the transmitter state
-#define TRANSMITTER_STATE_OK                    0x0
-#define TRANSMITTER_STATE_BATT_LOW              0x81
-#define TRANSMITTER_STATE_BRICKED               0x83
-
-// Opcodes
-#define AUTH_REQUEST_TX_OPCODE                  0x1
-#define AUTH_CHALLENGE_RX_OPCODE                0x3
-#define AUTH_CHALLENGE_TX_OPCODE                0x4
-#define AUTH_STATUS_RX_OPCODE                   0x5
-#define KEEP_ALIVE_TX_OPCODE                    0x6
-#define BOND_REQUEST_TX_OPCODE                  0x7
-#define BOND_REQUEST_RX_OPCODE                  0x8
-#define DISCONNECT_TX_OPCODE                    0x9
-#define TIME_TX_OPCODE                          0x24
-#define TIME_RX_OPCODE                          0x25
-#define GLUCOSE_TX_OPCODE                       0x4e
-#define GLUCOSE_RX_OPCODE                       0x4f
-#define BACKFILL_TX_OPCODE                      0x50
-#define BACKFILL_RX_OPCODE                      0x51
+// currents of the power states in uA for the energy accounting, measure them for your board
+#if CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ == 240
+#define CURRENT_CPU                 50000
+#elif CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ == 160
+#define CURRENT_CPU                 40000
+#else
+#define CURRENT_CPU                 30000 // 80 MHz
+#endif
+#define CURRENT_SCAN                100000
+#define CURRENT_CONNECTED           95000
+#define CURRENT_DEEP_SLEEP          10
 
 extern const char *transmitter_id;
 
@@ -48,8 +72,6 @@ extern const ble_uuid128_t control_uuid;
 extern const ble_uuid128_t authentication_uuid;
 extern const ble_uuid128_t backfill_uuid;
 
-extern bool expecting_backfill;
-
 /** mbuf **/
 #define MBUF_PKTHDR_OVERHEAD        sizeof(struct os_mbuf_pkthdr)
 #define MBUF_MEMBLOCK_OVERHEAD      sizeof(struct os_mbuf) + MBUF_PKTHDR_OVERHEAD
@@ -90,20 +112,63 @@ list services;
 list characteristics;
 list descriptors;
 
+/** handles of the CGM service, kept in RTC memory across deep sleep */
+typedef struct handle_cache {
+    bool valid;
+    ble_addr_t peer_addr;
+    char transmitter_id[6];
+    uint16_t svc_start_handle;
+    uint16_t svc_end_handle;
+    uint16_t control_val_handle;
+    uint16_t control_cccd_handle;
+    uint16_t auth_val_handle;
+    uint16_t backfill_val_handle;
+    uint16_t backfill_cccd_handle;
+} handle_cache;
+
+/** transmitter connected in an earlier wake cycle, kept in RTC memory */
+typedef struct known_transmitter {
+    bool valid;
+    ble_addr_t addr;
+    char transmitter_id[6];
+    int64_t last_adv_time; // rtc time of the last advertisement in milliseconds
+} known_transmitter;
+
 /** main.c**/
+extern dgr_schedule schedule;
+extern dgr_metrics metrics;
+extern dgr_energy energy;
 void dgr_error();
+void dgr_dump_metrics();
+void dgr_sleep_until_next_reading();
+void dgr_post_event(session_event event);
+void dgr_extend_deadline(uint32_t duration);
+void dgr_connect();
+void dgr_terminate_connection(uint16_t conn_handle);
 bool dgr_check_bond_state(uint16_t conn_handle);
+bool dgr_has_stored_bond(uint16_t conn_handle);
+void dgr_start_bonded_reconnect(uint16_t conn_handle);
+void dgr_remember_transmitter(uint16_t conn_handle);
 
 /** storage.c **/
 extern uint32_t last_sequence;
-void dgr_init_ringbuffer();
-void dgr_save_to_ringbuffer(uint32_t timestamp, uint16_t glucose, uint8_t calibration_state, uint8_t trend);
-void dgr_check_for_backfill_and_sleep(uint16_t conn_handle, uint32_t sequence);
-void dgr_parse_backfill();
-void dgr_print_rbuf(bool keep_items);
+void dgr_init_storage(bool keep_readings);
+void dgr_save_reading(uint32_t timestamp, uint16_t glucose, uint8_t calibration_state, uint8_t trend,
+                      bool backfilled);
+void dgr_flush_storage();
+uint32_t dgr_query_readings(uint32_t from, uint32_t to, reading_visitor visit, void *arg);
+uint32_t dgr_query_latest_readings(uint32_t n, reading_visitor visit, void *arg);
+bool dgr_query_nearest_reading(uint32_t timestamp, reading *out);
+void dgr_serve_export(uint32_t probe, uint32_t window);
+void dgr_check_for_backfill(uint16_t conn_handle, uint32_t sequence);
+bool dgr_find_missing_readings(uint32_t from, uint32_t to, uint16_t max_readings, coverage_range *hole);
+void dgr_resolve_missing_readings(const coverage_range *range);
+void dgr_print_storage();
 
 /**  util.c **/
 char* addr_to_string(const void *addr);
+const uint8_t* dgr_find_adv_field(const uint8_t *data, uint8_t length, uint8_t type, uint8_t *field_len);
+int64_t dgr_rtc_time_ms();
 void print_adv_fields(struct ble_hs_adv_fields *adv_fields);
 void dgr_print_rx_packet(struct os_mbuf *om);
 void dgr_print_conn_sec_state(struct ble_gap_sec_state conn_sec);
@@ -111,14 +176,27 @@ uint32_t make_u32_from_bytes_le(const uint8_t *bytes);
 uint16_t make_u16_from_bytes_le(const uint8_t *bytes);
 void write_u32_le(uint8_t *bytes, uint32_t in);
 void write_u16_le(uint8_t *bytes, uint32_t in);
+uint16_t dgr_crc16_mbuf(uint16_t crc, const struct os_mbuf *om, uint16_t off, uint16_t len);
 char* translate_transmitter_state(uint8_t state);
 char* translate_calibration_state(uint8_t state);
 
 /**  gatt.c **/
 void dgr_discover_services(uint16_t conn_handle);
+void dgr_discovery_finished(uint16_t conn_handle);
 void dgr_handle_rx(struct os_mbuf *om, uint16_t attr_handle, uint16_t conn_handle);
 void dgr_send_glucose_tx_msg(uint16_t conn_handle);
+void dgr_send_time_tx_msg(uint16_t conn_handle);
+void dgr_send_backfill_tx_msg(uint16_t conn_handle);
+void dgr_send_disconnect_msg(uint16_t conn_handle);
+void dgr_reset_pipeline();
+void dgr_start_pipeline(uint16_t conn_handle);
+void dgr_pipeline_next(uint16_t conn_handle);
+void dgr_pipeline_time_received(uint16_t conn_handle);
+void dgr_pipeline_glucose_received(uint16_t conn_handle);
+void dgr_pipeline_request_backfill(uint16_t conn_handle);
+void dgr_pipeline_try_backfill(uint16_t conn_handle);
 void dgr_send_auth_challenge_msg(uint16_t conn_handle);
+void dgr_send_auth_request_msg(uint16_t conn_handle);
 void dgr_send_keep_alive_msg(uint16_t conn_handle, uint8_t time);
 
 // callbacks
@@ -134,6 +212,14 @@ int dgr_discover_service_cb(uint16_t conn_handle, const struct ble_gatt_error *e
 int dgr_discover_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
     const struct ble_gatt_chr *chr, void *arg);
 
+// targeted discovery of the CGM service
+int dgr_discover_cgm_service_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+    const struct ble_gatt_svc *service, void *arg);
+int dgr_discover_cgm_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+    const struct ble_gatt_chr *chr, void *arg);
+int dgr_discover_cgm_dsc_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+    uint16_t chr_val_handle, const struct ble_gatt_dsc *dsc, void *arg);
+
 // ble_gatt_attr_fn
 int dgr_write_attr_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct ble_gatt_attr *attr, void *arg);
@@ -149,6 +235,8 @@ int dgr_send_keep_alive_cb(uint16_t conn_handle, const struct ble_gatt_error *er
     struct ble_gatt_attr *attr, void *arg);
 int dgr_send_bond_request_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct ble_gatt_attr *attr, void *arg);
+int dgr_send_disconnect_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr, void *arg);
 int dgr_send_glucose_tx_msg_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
     struct ble_gatt_attr *attr, void *arg);
 int dgr_send_control_enable_notif_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
@@ -167,27 +255,49 @@ list_elm* dgr_create_dsc_list_elm(struct ble_gatt_dsc dsc);
 list_elm* dgr_create_chr_list_elm(struct ble_gatt_chr chr);
 void dgr_add_to_list(list *l, list_elm *le);
 int dgr_find_chr_by_uuid(const ble_uuid_t *uuid, struct ble_gatt_chr *out);
+int dgr_find_svc_by_uuid(const ble_uuid_t *uuid, struct ble_gatt_svc *out);
+uint16_t dgr_find_cccd(uint16_t val_handle, uint16_t end_handle);
 void dgr_print_list(list *l);
 void dgr_print_list_elm(list_elm *le);
 
+/**  gatt_cache.c */
+extern handle_cache cached_handles;
+extern bool handles_from_cache;
+void dgr_invalidate_handle_cache();
+bool dgr_handle_cache_matches(const ble_addr_t *peer_addr);
+void dgr_use_handle_cache();
+void dgr_fill_handle_cache(uint16_t conn_handle);
+void dgr_finish_handle_cache(uint16_t conn_handle);
+uint16_t dgr_get_val_handle(const ble_uuid_t *uuid);
+uint16_t dgr_get_cccd_handle(const ble_uuid_t *uuid);
+void dgr_print_handle_cache();
+
 /**  messages.c **/
-extern uint8_t backfill_buffer[500];
-extern uint32_t backfill_buffer_pos;
+extern backfill_parser backfill;
+extern struct ble_npl_callout backfill_callout;
+extern uint32_t glucose_sequence;
 void dgr_enable_server_side_updates_msg(uint16_t conn_handle, const ble_uuid_t *uuid,
                                         ble_gatt_attr_fn *cb, uint8_t type);
 void dgr_build_auth_request_msg(struct os_mbuf *om);
 void dgr_build_auth_challenge_msg(struct os_mbuf *om);
 void dgr_build_keep_alive_msg(struct os_mbuf *om, uint8_t time);
 void dgr_build_bond_request_msg(struct os_mbuf *om);
+void dgr_build_disconnect_msg(struct os_mbuf *om);
 void dgr_build_glucose_tx_msg(struct os_mbuf *om);
 void dgr_build_backfill_tx_msg(struct os_mbuf *om);
 void dgr_build_time_tx_msg(struct os_mbuf *om);
-void dgr_parse_auth_challenge_msg(const uint8_t *data, uint8_t length, bool *correct_token);
-void dgr_parse_auth_status_msg(const uint8_t *data, uint8_t length);
-void dgr_parse_glucose_msg(const uint8_t *data, uint8_t length, uint8_t conn_handle);
-void dgr_parse_backfill_status_msg(const uint8_t *data, uint8_t length);
-void dgr_parse_backfill_data_msg(const uint8_t *data, uint8_t length);
-void dgr_parse_time_msg(const uint8_t *data, uint8_t length, uint16_t conn_handle);
+bool dgr_view_msg(const struct os_mbuf *om, uint8_t *buf, msg_view *msg);
+void dgr_dispatch_msg(const struct os_mbuf *om, msg_characteristic chr, uint16_t conn_handle);
+void dgr_parse_auth_challenge_msg(const msg_view *msg, bool *correct_token);
+void dgr_parse_auth_status_msg(const msg_view *msg);
+void dgr_parse_glucose_msg(const msg_view *msg, uint16_t conn_handle);
+void dgr_parse_backfill_status_msg(const msg_view *msg, uint16_t conn_handle);
+void dgr_parse_backfill_data_msg(const msg_view *msg, uint16_t conn_handle);
+void dgr_backfill_timeout_cb(struct ble_npl_event *ev);
+bool dgr_request_missing_readings(uint16_t conn_handle, uint32_t from);
+void dgr_backfill_tx_written(uint16_t conn_handle);
+void dgr_parse_time_msg(const msg_view *msg, uint16_t conn_handle);
 void dgr_create_mbuf_pool();
 void dgr_create_crypto_context();
+void dgr_stage_auth_token();
 void dgr_print_token_details();
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <host/ble_hs.h>
+#include "esp_timer.h"
 #include "dexcom_g6_reader.h"
 
 const char* tag_gatt = "[Dexcom-G6-Reader][gatt]";
@@ -29,9 +30,52 @@ list services = {NULL, NULL, 0};
 list characteristics = {NULL, NULL, 0};
 list descriptors = {NULL, NULL, 0};
 
+// statistics of the running discovery, used to compare both discovery modes
+int64_t discovery_start_time = 0;
+uint16_t discovery_procedures = 0;
+uint16_t discovery_attributes = 0;
+// set when the targeted discovery stopped a procedure early
+bool cgm_chrs_resolved = false;
+bool cgm_cccds_resolved = false;
+
+// ATT operations of the session setup, issued back-to-back without waiting
+// for the indications of the transmitter
+typedef enum {
+    pipeline_control_cccd,
+    pipeline_time_tx,
+    pipeline_glucose_tx,
+    pipeline_backfill_cccd
+} pipeline_op;
+
+const pipeline_op pipeline_ops[] = {
+    pipeline_control_cccd,
+    pipeline_time_tx,
+    pipeline_glucose_tx,
+    pipeline_backfill_cccd
+};
+#define PIPELINE_LENGTH     (sizeof pipeline_ops / sizeof pipeline_ops[0])
+
+bool pipeline_started = false;
+unsigned int pipeline_pos = 0;
+// set when the write of the last operation completed, pipeline_pos counts issued operations
+bool pipeline_done = false;
+int64_t pipeline_start_time = 0;
+// operations issued while an indication of the transmitter was still outstanding
+uint8_t pipeline_overlaps = 0;
+bool time_rx_received = false;
+bool glucose_rx_received = false;
+bool backfill_requested = false;
+
+void
+dgr_print_discovery_stats() {
+    ESP_LOGI(tag_gatt, "Discovery (%s) finished: procedures = %d, attributes = %d, time = %lld ms",
+        TARGETED_DISCOVERY ? "targeted" : "full", discovery_procedures, discovery_attributes,
+        (esp_timer_get_time() - discovery_start_time) / 1000);
+}
 
 void
 dgr_discover_characteristics(uint16_t conn_handle) {
+    discovery_procedures++;
     int rc = ble_gattc_disc_all_chrs(conn_handle, 1, 65535, dgr_discover_chr_cb, NULL);
 
     if (rc != 0) {
@@ -42,6 +86,7 @@ dgr_discover_characteristics(uint16_t conn_handle) {
 
 void
 dgr_discover_descriptors(uint16_t conn_handle) {
+    discovery_procedures++;
     int rc = ble_gattc_disc_all_dscs(conn_handle, 1, 65535, dgr_discover_dsc_cb, NULL);
 
     if(rc != 0) {
@@ -52,8 +97,27 @@ dgr_discover_descriptors(uint16_t conn_handle) {
 
 void
 dgr_discover_services(uint16_t conn_handle) {
+    // a rediscovery after rejected cached handles starts with empty lists
+    dgr_clear_list(&services);
+    dgr_clear_list(&characteristics);
+    dgr_clear_list(&descriptors);
+    handles_from_cache = false;
+
+    discovery_start_time = esp_timer_get_time();
+    discovery_procedures = 1;
+    discovery_attributes = 0;
+
+#if TARGETED_DISCOVERY
+    // only the CGM service is discovered, see dgr_discover_cgm_service_cb
+    dgr_invalidate_handle_cache();
+    cgm_chrs_resolved = false;
+    cgm_cccds_resolved = false;
+    int rc = ble_gattc_disc_svc_by_uuid(conn_handle, &cgm_service_uuid.u,
+                                        dgr_discover_cgm_service_cb, NULL);
+#else
     //rc = ble_gattc_disc_all_chrs(conn_handle, 1, 65535, dgr_discover_chr_cb, NULL);
     int rc = ble_gattc_disc_all_svcs(conn_handle, dgr_discover_service_cb, NULL);
+#endif
 
     if (rc != 0) {
         ESP_LOGE(tag_gatt, "Error calling service discovery. rc = 0x%04x", rc);
@@ -69,6 +133,92 @@ dgr_discover_services(uint16_t conn_handle) {
     }
 }
 
+/**
+ * Discovers the characteristics inside of the CGM service.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_discover_cgm_characteristics(uint16_t conn_handle) {
+    discovery_procedures++;
+    int rc = ble_gattc_disc_all_chrs(conn_handle, cached_handles.svc_start_handle,
+                                     cached_handles.svc_end_handle, dgr_discover_cgm_chr_cb, NULL);
+
+    if(rc != 0) {
+        ESP_LOGE(tag_gatt, "Error calling CGM characteristics discovery. rc = 0x%04x", rc);
+        dgr_error();
+    }
+}
+
+/**
+ * Discovers the descriptors behind the control and backfill characteristics.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_discover_cgm_cccds(uint16_t conn_handle) {
+    uint16_t start_handle = cached_handles.control_val_handle < cached_handles.backfill_val_handle ?
+                            cached_handles.control_val_handle : cached_handles.backfill_val_handle;
+
+    discovery_procedures++;
+    int rc = ble_gattc_disc_all_dscs(conn_handle, start_handle, cached_handles.svc_end_handle,
+                                     dgr_discover_cgm_dsc_cb, NULL);
+
+    if(rc != 0) {
+        ESP_LOGE(tag_gatt, "Error calling CGM descriptor discovery. rc = 0x%04x", rc);
+        dgr_error();
+    }
+}
+
+/**
+ * Finds the characteristic of the CGM service a descriptor belongs to.
+ *
+ * @param handle            Handle of the descriptor
+ * @return                  Value handle of the characteristic
+ */
+uint16_t
+dgr_cgm_chr_before(uint16_t handle) {
+    uint16_t val_handles[3] = {cached_handles.control_val_handle, cached_handles.auth_val_handle,
+                               cached_handles.backfill_val_handle};
+    uint16_t owner = 0;
+
+    for(int i = 0; i < 3; i++) {
+        if(val_handles[i] < handle && val_handles[i] > owner) {
+            owner = val_handles[i];
+        }
+    }
+
+    return owner;
+}
+
+/**
+ * Continues after the handles of the CGM service are known, either from a
+ * discovery or from the handle cache.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_discovery_finished(uint16_t conn_handle) {
+    dgr_post_event(session_ev_handles_known);
+}
+
+/**
+ * Returns the characteristic of a value handle.
+ *
+ * @param attr_handle       The handle of the relevant ATT attribute
+ */
+static msg_characteristic
+dgr_msg_characteristic(uint16_t attr_handle) {
+    if(attr_handle == cached_handles.control_val_handle) {
+        return msg_control;
+    } else if(attr_handle == cached_handles.backfill_val_handle) {
+        return msg_backfill;
+    } else if(attr_handle == cached_handles.auth_val_handle) {
+        return msg_auth;
+    }
+    return msg_unknown;
+}
+
 /**
  *  Call corresponding functions that handle received server-side updates.
  *
@@ -79,40 +229,17 @@ dgr_discover_services(uint16_t conn_handle) {
 void
 dgr_handle_rx(struct os_mbuf *om, uint16_t attr_handle, uint16_t conn_handle) {
     if(om && om->om_len > 0) {
-        uint8_t op = om->om_data[0];
+        msg_characteristic chr = dgr_msg_characteristic(attr_handle);
 
+        dgr_metrics_count(&metrics, metrics_packets_rx, 1);
+        dgr_metrics_count(&metrics, metrics_bytes_rx, om->om_len);
         dgr_print_rx_packet(om);
 
-        if(expecting_backfill) {
-            // backfill data starts with a sequence number
-            // and has no opcode
-            dgr_parse_backfill_data_msg(om->om_data, om->om_len);
-        } else {
-            switch (op) {
-                case BACKFILL_RX_OPCODE: {
-                    ESP_LOGI(tag_gatt, "Received backfill message.");
-
-                    dgr_parse_backfill_status_msg(om->om_data, om->om_len);
-                    break;
-                }
-                case TIME_RX_OPCODE: {
-                    ESP_LOGI(tag_gatt, "Received time message.");
-
-                    dgr_parse_time_msg(om->om_data, om->om_len, conn_handle);
-                    break;
-                }
-                case GLUCOSE_RX_OPCODE: {
-                    ESP_LOGI(tag_gatt, "Received glucose message.");
-
-                    dgr_parse_glucose_msg(om->om_data, om->om_len, conn_handle);
-                    break;
-                }
-
-                default:
-                    ESP_LOGE(tag_gatt, "Unhandled message with opcode = %02x", op);
-                    break;
-            }
+        if(chr == msg_unknown) {
+            ESP_LOGE(tag_gatt, "Message from unknown attribute. handle = 0x%04x", attr_handle);
+            return;
         }
+        dgr_dispatch_msg(om, chr, conn_handle);
     } else {
         ESP_LOGE(tag_gatt, "Received message buffer empty.");
     }
@@ -147,15 +274,11 @@ dgr_enable_server_side_updates_msg(uint16_t conn_handle, const ble_uuid_t *uuid,
         // both
         data[0] = 0x3;
     }
-    struct ble_gatt_chr uh;
-    uint16_t handle = 0;
+    uint16_t handle = dgr_get_cccd_handle(uuid);
     char buf[BLE_UUID_STR_LEN];
     int rc;
 
-    dgr_find_chr_by_uuid(uuid, &uh);
-    if(uh.val_handle != 0) {
-        handle = uh.val_handle + 1; // cccd lies directly after the corresponding characteristic
-
+    if(handle != 0) {
         ble_uuid_to_str(uuid, buf);
         ESP_LOGI(tag_gatt, "Enabling notifications for: %s.", buf);
         rc = ble_gattc_write_flat(conn_handle, handle, data, sizeof data, cb, NULL);
@@ -165,7 +288,7 @@ dgr_enable_server_side_updates_msg(uint16_t conn_handle, const ble_uuid_t *uuid,
             dgr_error();
         }
     } else {
-        ESP_LOGE(tag_gatt, "Could not find val_handle for control uuid.");
+        ESP_LOGE(tag_gatt, "Could not find cccd handle for uuid.");
         dgr_error();
     }
 }
@@ -180,14 +303,9 @@ dgr_enable_server_side_updates_msg(uint16_t conn_handle, const ble_uuid_t *uuid,
 void
 dgr_write_auth_char(uint16_t conn_handle, ble_gatt_attr_fn *cb, struct os_mbuf *om) {
     int rc;
-    uint16_t auth_attr_handle;
-    struct ble_gatt_chr uh;
-
-    dgr_find_chr_by_uuid(&authentication_uuid.u, &uh);
-
-    if(uh.val_handle != 0) {
-        auth_attr_handle = uh.val_handle;
+    uint16_t auth_attr_handle = dgr_get_val_handle(&authentication_uuid.u);
 
+    if(auth_attr_handle != 0) {
         rc = ble_gattc_write(conn_handle, auth_attr_handle, om, cb, NULL);
         if(rc != 0) {
             ESP_LOGE(tag_gatt, "Error while writing characteristic. handle = 0x%04x, rc = 0x%04x",
@@ -210,14 +328,9 @@ dgr_write_auth_char(uint16_t conn_handle, ble_gatt_attr_fn *cb, struct os_mbuf *
 void
 dgr_write_control_char(uint16_t conn_handle, ble_gatt_attr_fn *cb, struct os_mbuf *om) {
     int rc;
-    uint16_t cont_attr_handle;
-    struct ble_gatt_chr uh;
-
-    rc = dgr_find_chr_by_uuid(&control_uuid.u, &uh);
-
-    if(rc == 0) {
-        cont_attr_handle = uh.val_handle;
+    uint16_t cont_attr_handle = dgr_get_val_handle(&control_uuid.u);
 
+    if(cont_attr_handle != 0) {
         rc = ble_gattc_write(conn_handle, cont_attr_handle, om, cb, NULL);
         if(rc != 0) {
             ESP_LOGE(tag_gatt, "Error while writing characteristic. handle = 0x%04x, rc = 0x%04x",
@@ -307,6 +420,162 @@ dgr_send_backfill_tx_msg(uint16_t conn_handle) {
     }
 }
 
+/**
+ * Asks the transmitter to end the connection. Errors are not fatal here, the
+ * connection is terminated from our side in any case.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_send_disconnect_msg(uint16_t conn_handle) {
+    struct os_mbuf *om = os_mbuf_get_pkthdr(&dgr_mbuf_pool, 0);
+    uint16_t cont_attr_handle = dgr_get_val_handle(&control_uuid.u);
+    int rc;
+
+    if(om == NULL || cont_attr_handle == 0) {
+        os_mbuf_free_chain(om);
+        dgr_terminate_connection(conn_handle);
+        return;
+    }
+
+    dgr_build_disconnect_msg(om);
+    ESP_LOGI(tag_gatt, "DisconnectTx: sending message");
+    rc = ble_gattc_write(conn_handle, cont_attr_handle, om, dgr_send_disconnect_cb, NULL);
+    if(rc != 0) {
+        ESP_LOGW(tag_gatt, "DisconnectTx: write failed. rc = 0x%04x", rc);
+        dgr_terminate_connection(conn_handle);
+    }
+}
+
+
+/*****************************************************************************
+ * pipelined session setup                                                   *
+ *****************************************************************************/
+
+/**
+ * Forgets the progress of the session setup, so it runs again after a
+ * rediscovery of the handles.
+ */
+void
+dgr_reset_pipeline() {
+    pipeline_started = false;
+    pipeline_pos = 0;
+    pipeline_done = false;
+    pipeline_overlaps = 0;
+    time_rx_received = false;
+    glucose_rx_received = false;
+    backfill_requested = false;
+}
+
+/**
+ * Starts the session setup after the link is encrypted. The CCCDs and the
+ * TimeTx and GlucoseTx messages are written back-to-back, every operation is
+ * issued from the write callback of the previous one.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_start_pipeline(uint16_t conn_handle) {
+    if(pipeline_started) {
+        // encryption change and bond check can both start the setup
+        return;
+    }
+
+    pipeline_started = true;
+    pipeline_pos = 0;
+    pipeline_done = false;
+    pipeline_start_time = esp_timer_get_time();
+    dgr_pipeline_next(conn_handle);
+}
+
+/**
+ * Issues the next operation of the session setup.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_pipeline_next(uint16_t conn_handle) {
+    if(pipeline_pos >= PIPELINE_LENGTH) {
+        ESP_LOGI(tag_gatt, "Session setup finished. overlapped operations = %d", pipeline_overlaps);
+        dgr_pipeline_try_backfill(conn_handle);
+        return;
+    }
+
+    switch(pipeline_ops[pipeline_pos++]) {
+        case pipeline_control_cccd:
+            dgr_enable_server_side_updates_msg(conn_handle, &control_uuid.u,
+                                               dgr_send_control_enable_notif_cb, 1);
+            break;
+        case pipeline_time_tx:
+            dgr_send_time_tx_msg(conn_handle);
+            break;
+        case pipeline_glucose_tx:
+            if(!time_rx_received) {
+                pipeline_overlaps++;
+            }
+            dgr_send_glucose_tx_msg(conn_handle);
+            break;
+        case pipeline_backfill_cccd:
+            if(!glucose_rx_received) {
+                pipeline_overlaps++;
+            }
+            dgr_enable_server_side_updates_msg(conn_handle, &backfill_uuid.u,
+                                               dgr_send_backfill_enable_notif_cb, 2);
+            break;
+    }
+}
+
+/**
+ * Called after the TimeRx message was parsed.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_pipeline_time_received(uint16_t conn_handle) {
+    time_rx_received = true;
+    dgr_pipeline_try_backfill(conn_handle);
+}
+
+/**
+ * Called after the GlucoseRx message was parsed. Logs how many connection
+ * events the session setup took.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_pipeline_glucose_received(uint16_t conn_handle) {
+    struct ble_gap_conn_desc conn_desc;
+    int64_t elapsed = esp_timer_get_time() - pipeline_start_time;
+
+    glucose_rx_received = true;
+    if(ble_gap_conn_find(conn_handle, &conn_desc) == 0 && conn_desc.conn_itvl != 0) {
+        // connection interval is in units of 1.25 ms
+        ESP_LOGI(tag_gatt, "GlucoseRx after %lld ms = %lld connection events, saved round trips = %d",
+            elapsed / 1000, elapsed / (conn_desc.conn_itvl * 1250), pipeline_overlaps);
+    }
+}
+
+/**
+ * Requests backfill data. The BackfillTx message needs the transmitter time and
+ * an enabled backfill CCCD, so it is sent once the write of the backfill CCCD
+ * completed. Until then a GlucoseRx can already have moved the session on.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_pipeline_request_backfill(uint16_t conn_handle) {
+    backfill_requested = true;
+    dgr_pipeline_try_backfill(conn_handle);
+}
+
+void
+dgr_pipeline_try_backfill(uint16_t conn_handle) {
+    if(backfill_requested && time_rx_received && pipeline_done) {
+        backfill_requested = false;
+        dgr_send_backfill_tx_msg(conn_handle);
+    }
+}
+
 
 /*****************************************************************************
  * reading                                                                   *
@@ -314,15 +583,13 @@ dgr_send_backfill_tx_msg(uint16_t conn_handle) {
 void
 dgr_read_auth_char(uint16_t conn_handle, ble_gatt_attr_fn *cb) {
     int rc;
-    struct ble_gatt_chr uh;
-
-    rc = dgr_find_chr_by_uuid(&authentication_uuid.u, &uh);
+    uint16_t auth_attr_handle = dgr_get_val_handle(&authentication_uuid.u);
 
-    if(rc == 0) {
-        rc = ble_gattc_read(conn_handle, uh.val_handle, cb, NULL);
+    if(auth_attr_handle != 0) {
+        rc = ble_gattc_read(conn_handle, auth_attr_handle, cb, NULL);
         if(rc != 0) {
             ESP_LOGE(tag_gatt, "Error while reading characteristic. handle = %d, rc = 0x%04x",
-                uh.val_handle, rc);
+                auth_attr_handle, rc);
             dgr_error();
         }
     } else {
@@ -359,6 +626,142 @@ dgr_print_cb_info(const struct ble_gatt_error *error, struct ble_gatt_attr *attr
     }
 }
 
+/**
+ * Validates cached handles with the result of the ATT procedure that used them.
+ * If the transmitter rejects a handle, the cache is dropped and the session
+ * goes back to the discovery on the current connection.
+ *
+ * @param conn_handle       Connection to the transmitter
+ * @param error             Result of the ATT procedure
+ * @return                  true if the callback chain can continue
+ */
+bool
+dgr_check_cached_handles(uint16_t conn_handle, const struct ble_gatt_error *error) {
+    if(!handles_from_cache || error == NULL) {
+        return true;
+    }
+
+    switch(error->status) {
+        case BLE_HS_ATT_ERR(BLE_ATT_ERR_INVALID_HANDLE):
+        case BLE_HS_ATT_ERR(BLE_ATT_ERR_ATTR_NOT_FOUND):
+        case BLE_HS_ATT_ERR(BLE_ATT_ERR_READ_NOT_PERMITTED):
+        case BLE_HS_ATT_ERR(BLE_ATT_ERR_WRITE_NOT_PERMITTED):
+            ESP_LOGE(tag_gatt, "Cached handle 0x%04x rejected. status = 0x%x",
+                error->att_handle, error->status);
+            dgr_invalidate_handle_cache();
+            dgr_post_event(session_ev_handles_invalid);
+            return false;
+        default:
+            return true;
+    }
+}
+
+int
+dgr_discover_cgm_service_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+        const struct ble_gatt_svc *service, void *arg) {
+    if(error->status == 0 && service != NULL) {
+        discovery_attributes++;
+        cached_handles.svc_start_handle = service->start_handle;
+        cached_handles.svc_end_handle = service->end_handle;
+    } else if(error->status == BLE_HS_EDONE && cached_handles.svc_start_handle != 0) {
+        ESP_LOGI(tag_gatt, "CGM service discovery: finished. handles = 0x%04x - 0x%04x",
+            cached_handles.svc_start_handle, cached_handles.svc_end_handle);
+        dgr_discover_cgm_characteristics(conn_handle);
+    } else {
+        ESP_LOGE(tag_gatt, "CGM service discovery: service not found. status = %d", error->status);
+        dgr_error();
+    }
+
+    return 0;
+}
+
+int
+dgr_discover_cgm_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+        const struct ble_gatt_chr *chr, void *arg) {
+    if(cgm_chrs_resolved) {
+        // procedure was already stopped
+        return BLE_HS_EDONE;
+    }
+
+    if(error->status == 0 && chr != NULL) {
+        discovery_attributes++;
+
+        if(ble_uuid_cmp(&chr->uuid.u, &control_uuid.u) == 0) {
+            cached_handles.control_val_handle = chr->val_handle;
+        } else if(ble_uuid_cmp(&chr->uuid.u, &authentication_uuid.u) == 0) {
+            cached_handles.auth_val_handle = chr->val_handle;
+        } else if(ble_uuid_cmp(&chr->uuid.u, &backfill_uuid.u) == 0) {
+            cached_handles.backfill_val_handle = chr->val_handle;
+        }
+
+        if(cached_handles.control_val_handle != 0 && cached_handles.auth_val_handle != 0 &&
+           cached_handles.backfill_val_handle != 0) {
+            ESP_LOGI(tag_gatt, "CGM characteristics discovery: all characteristics resolved.");
+            // a non-zero return value stops the procedure
+            cgm_chrs_resolved = true;
+            dgr_discover_cgm_cccds(conn_handle);
+            return BLE_HS_EDONE;
+        }
+    } else {
+        // the procedure only ends by itself if a characteristic is missing
+        ESP_LOGE(tag_gatt, "CGM characteristics discovery: characteristic missing. status = %d",
+            error->status);
+        dgr_error();
+    }
+
+    return 0;
+}
+
+int
+dgr_discover_cgm_dsc_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+        uint16_t chr_val_handle, const struct ble_gatt_dsc *dsc, void *arg) {
+    const ble_uuid16_t cccd_uuid = BLE_UUID16_INIT(BLE_GATT_DSC_CLT_CFG_UUID16);
+
+    if(cgm_cccds_resolved) {
+        // procedure was already stopped
+        return BLE_HS_EDONE;
+    }
+
+    if(error->status == 0 && dsc != NULL) {
+        discovery_attributes++;
+
+        if(ble_uuid_cmp(&dsc->uuid.u, &cccd_uuid.u) == 0) {
+            uint16_t owner = dgr_cgm_chr_before(dsc->handle);
+
+            if(owner == cached_handles.control_val_handle) {
+                cached_handles.control_cccd_handle = dsc->handle;
+            } else if(owner == cached_handles.backfill_val_handle) {
+                cached_handles.backfill_cccd_handle = dsc->handle;
+            }
+        }
+
+        if(cached_handles.control_cccd_handle == 0 || cached_handles.backfill_cccd_handle == 0) {
+            return 0;
+        }
+    } else if(error->status != BLE_HS_EDONE) {
+        ESP_LOGE(tag_gatt, "CGM descriptor discovery: status = %d, att_handle = %d",
+            error->status, error->att_handle);
+        dgr_error();
+    } else {
+        // cccd lies directly after the corresponding characteristic
+        if(cached_handles.control_cccd_handle == 0) {
+            cached_handles.control_cccd_handle = cached_handles.control_val_handle + 1;
+        }
+        if(cached_handles.backfill_cccd_handle == 0) {
+            cached_handles.backfill_cccd_handle = cached_handles.backfill_val_handle + 1;
+        }
+    }
+
+    ESP_LOGI(tag_gatt, "CGM descriptor discovery: finished.");
+    cgm_cccds_resolved = true;
+    dgr_print_discovery_stats();
+    dgr_finish_handle_cache(conn_handle);
+    dgr_discovery_finished(conn_handle);
+
+    // stops the procedure if it is still running
+    return BLE_HS_EDONE;
+}
+
 // count nr of services, if 0 -> goto error
 int
 dgr_discover_service_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
@@ -371,6 +774,7 @@ dgr_discover_service_cb(uint16_t conn_handle, const struct ble_gatt_error *error
                  error->status, error->att_handle);
 
         if (service != NULL) {
+            discovery_attributes++;
             list_elm *le = dgr_create_svc_list_elm(*service);
             //dgr_print_list_elm(le);
 
@@ -408,20 +812,14 @@ dgr_discover_chr_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
         //dgr_print_list(&characteristics);
         //dgr_print_list(&descriptors);
 
-        if(dgr_check_bond_state(conn_handle)) {
-            // already bonded, start cgm reading
-            ESP_LOGI(tag_gatt, "Already bonded with transmitter.");
-            dgr_enable_server_side_updates_msg(conn_handle, &control_uuid.u,
-                                               dgr_send_control_enable_notif_cb, 1);
-        } else {
-            // not bonded, start authentication
-            ESP_LOGI(tag_gatt, "Not bonded with transmitter. Starting authentication.");
-            dgr_send_auth_request_msg(conn_handle);
-        }
+        dgr_print_discovery_stats();
+        dgr_fill_handle_cache(conn_handle);
+        dgr_discovery_finished(conn_handle);
     } else {
         ESP_LOGI(tag_gatt, "Characteristics discovery: status = %d, att_handle = %d",
                  error->status, error->att_handle);
         if (chr != NULL) {
+            discovery_attributes++;
             list_elm *le = dgr_create_chr_list_elm(*chr);
             //dgr_print_list_elm(le);
 
@@ -446,6 +844,7 @@ dgr_discover_dsc_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
                 error->status, error->att_handle);
 
         if(dsc != NULL) {
+            discovery_attributes++;
             list_elm *le = dgr_create_dsc_list_elm(*dsc);
             //dgr_print_list_elm(le);
 
@@ -474,6 +873,9 @@ dgr_send_auth_request_cb(uint16_t conn_handle, const struct ble_gatt_error *erro
     ESP_LOGI(tag_gatt, "[01] AuthRequest: write callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
     dgr_read_auth_challenge_msg(conn_handle);
     return 0;
 }
@@ -484,11 +886,20 @@ dgr_read_auth_challenge_cb(uint16_t conn_handle, const struct ble_gatt_error *er
     ESP_LOGI(tag_gatt, "[02] AuthChallenge: read callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
     if(attr && attr->om) {
+        uint8_t buf[MSG_MAX_LENGTH];
         bool correct_token = true;
+        msg_view msg;
 
         dgr_print_rx_packet(attr->om);
-        dgr_parse_auth_challenge_msg(attr->om->om_data, attr->om->om_len, &correct_token);
+        if(!dgr_view_msg(attr->om, buf, &msg)) {
+            ESP_LOGE(tag_gatt, "[02] AuthChallenge: message is empty or too long.");
+            dgr_error();
+        }
+        dgr_parse_auth_challenge_msg(&msg, &correct_token);
 
         if(correct_token) {
             dgr_send_auth_challenge_msg(conn_handle);
@@ -510,6 +921,9 @@ dgr_send_auth_challenge_cb(uint16_t conn_handle, const struct ble_gatt_error *er
     ESP_LOGI(tag_gatt, "[03] AuthChallenge: write callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
     dgr_read_auth_status_msg(conn_handle);
     return 0;
 }
@@ -520,10 +934,20 @@ dgr_read_auth_status_cb(uint16_t conn_handle, const struct ble_gatt_error *error
     ESP_LOGI(tag_gatt, "[04] AuthStatus: read callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
     if(attr && attr->om) {
+        uint8_t buf[MSG_MAX_LENGTH];
+        msg_view msg;
+
         dgr_print_rx_packet(attr->om);
-        dgr_parse_auth_status_msg(attr->om->om_data, attr->om->om_len);
-        dgr_send_keep_alive_msg(conn_handle, 25);
+        if(!dgr_view_msg(attr->om, buf, &msg)) {
+            ESP_LOGE(tag_gatt, "[04] AuthStatus: message is empty or too long.");
+            dgr_error();
+        }
+        dgr_parse_auth_status_msg(&msg);
+        dgr_post_event(session_ev_authenticated);
     } else {
         ESP_LOGE(tag_gatt, "[04] AuthStatus: read callback: mbuf not initialized");
         dgr_error();
@@ -538,7 +962,13 @@ dgr_send_keep_alive_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
     ESP_LOGI(tag_gatt, "[05] KeepAlive: write callback.");
 
     dgr_print_cb_info(error, attr);
-    dgr_send_bond_request_msg(conn_handle);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    // the keep alive of the bond state is followed by the bond request, the one of a long backfill is not
+    if(!dgr_check_bond_state(conn_handle)) {
+        dgr_send_bond_request_msg(conn_handle);
+    }
     return 0;
 }
 
@@ -548,6 +978,22 @@ dgr_send_bond_request_cb(uint16_t conn_handle, const struct ble_gatt_error *erro
     ESP_LOGI(tag_gatt, "[06] BondRequest: write callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    // pairing is started by the transmitter and ends with an encryption change
+    dgr_post_event(session_ev_bonded);
+    return 0;
+}
+
+int
+dgr_send_disconnect_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+        struct ble_gatt_attr *attr, void *arg) {
+    ESP_LOGI(tag_gatt, "DisconnectTx: write callback.");
+
+    dgr_print_cb_info(error, attr);
+    // the transmitter may already have closed the link
+    dgr_terminate_connection(conn_handle);
     return 0;
 }
 
@@ -557,6 +1003,10 @@ dgr_send_glucose_tx_msg_cb(uint16_t conn_handle, const struct ble_gatt_error *er
     ESP_LOGI(tag_gatt, "[08] GlucoseTx: write callback");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    dgr_pipeline_next(conn_handle);
     return 0;
 }
 
@@ -566,7 +1016,10 @@ dgr_send_control_enable_notif_cb(uint16_t conn_handle, const struct ble_gatt_err
     ESP_LOGI(tag_gatt, "[07] Enabling control notifications: write callback.");
 
     dgr_print_cb_info(error, attr);
-    dgr_send_time_tx_msg(conn_handle);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    dgr_pipeline_next(conn_handle);
     return 0;
 }
 
@@ -576,6 +1029,10 @@ dgr_send_time_tx_msg_cb(uint16_t conn_handle, const struct ble_gatt_error *error
     ESP_LOGI(tag_gatt, "TransmitterTime: write callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    dgr_pipeline_next(conn_handle);
     return 0;
 }
 
@@ -585,6 +1042,10 @@ dgr_send_backfill_tx_msg_cb(uint16_t conn_handle, const struct ble_gatt_error *e
     ESP_LOGI(tag_gatt, "Backfill: write callback.");
 
     dgr_print_cb_info(error, attr);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    dgr_backfill_tx_written(conn_handle);
     return 0;
 }
 
@@ -594,6 +1055,11 @@ dgr_send_backfill_enable_notif_cb(uint16_t conn_handle, const struct ble_gatt_er
     ESP_LOGI(tag_gatt, "Enabling backfill notifications: write callback.");
 
     dgr_print_cb_info(error, attr);
-    dgr_send_backfill_tx_msg(conn_handle);
+    if(!dgr_check_cached_handles(conn_handle, error)) {
+        return 0;
+    }
+    // no operation of the setup is outstanding anymore
+    pipeline_done = true;
+    dgr_pipeline_next(conn_handle);
     return 0;
 }
\ No newline at end of file
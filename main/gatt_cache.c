@@ -0,0 +1,147 @@
+#include "esp_attr.h"
+#include <host/ble_hs.h>
+#include "dexcom_g6_reader.h"
+
+const char* tag_cache = "[Dexcom-G6-Reader][cache]";
+
+/* This file contains the handle cache. The handles of the CGM service are kept
+ * in RTC memory, so that a connection after a timer wakeup can skip the GATT
+ * discovery completely. The cache is keyed by the transmitter address and id
+ * and is only dropped when the transmitter rejects one of the cached handles.
+ */
+
+RTC_DATA_ATTR handle_cache cached_handles;
+// true if the handles of the current connection came from the cache
+bool handles_from_cache = false;
+
+void
+dgr_invalidate_handle_cache() {
+    ESP_LOGI(tag_cache, "Invalidating handle cache.");
+    memset(&cached_handles, 0, sizeof cached_handles);
+}
+
+/**
+ * Checks if the cache holds the handles of the given transmitter.
+ *
+ * @param peer_addr         Address of the connected transmitter
+ * @return                  true if the cached handles can be used
+ */
+bool
+dgr_handle_cache_matches(const ble_addr_t *peer_addr) {
+    return cached_handles.valid &&
+           ble_addr_cmp(&cached_handles.peer_addr, peer_addr) == 0 &&
+           memcmp(cached_handles.transmitter_id, transmitter_id, sizeof cached_handles.transmitter_id) == 0;
+}
+
+/**
+ * Marks the cached handles as used by the current connection. They are
+ * validated by the first ATT procedure that uses them.
+ */
+void
+dgr_use_handle_cache() {
+    ESP_LOGI(tag_cache, "Using cached handles, skipping discovery.");
+    handles_from_cache = true;
+    dgr_print_handle_cache();
+}
+
+/**
+ * Fills the cache with the results of a full discovery.
+ *
+ * @param conn_handle       Connection on which the discovery was executed
+ */
+void
+dgr_fill_handle_cache(uint16_t conn_handle) {
+    struct ble_gatt_svc svc;
+    struct ble_gatt_chr control_chr;
+    struct ble_gatt_chr auth_chr;
+    struct ble_gatt_chr backfill_chr;
+
+    dgr_find_svc_by_uuid(&cgm_service_uuid.u, &svc);
+    dgr_find_chr_by_uuid(&control_uuid.u, &control_chr);
+    dgr_find_chr_by_uuid(&authentication_uuid.u, &auth_chr);
+    dgr_find_chr_by_uuid(&backfill_uuid.u, &backfill_chr);
+
+    cached_handles.svc_start_handle = svc.start_handle;
+    cached_handles.svc_end_handle = svc.end_handle;
+    cached_handles.control_val_handle = control_chr.val_handle;
+    cached_handles.control_cccd_handle = dgr_find_cccd(control_chr.val_handle, svc.end_handle);
+    cached_handles.auth_val_handle = auth_chr.val_handle;
+    cached_handles.backfill_val_handle = backfill_chr.val_handle;
+    cached_handles.backfill_cccd_handle = dgr_find_cccd(backfill_chr.val_handle, svc.end_handle);
+
+    dgr_finish_handle_cache(conn_handle);
+}
+
+/**
+ * Marks the cache as valid for the connected transmitter after all handles
+ * were written by a discovery.
+ *
+ * @param conn_handle       Connection on which the discovery was executed
+ */
+void
+dgr_finish_handle_cache(uint16_t conn_handle) {
+    struct ble_gap_conn_desc conn_desc;
+    int rc;
+
+    rc = ble_gap_conn_find(conn_handle, &conn_desc);
+    if(rc != 0) {
+        ESP_LOGE(tag_cache, "Could not find connection. rc = 0x%04x", rc);
+        dgr_error();
+    }
+
+    cached_handles.peer_addr = conn_desc.peer_id_addr;
+    memcpy(cached_handles.transmitter_id, transmitter_id, sizeof cached_handles.transmitter_id);
+    cached_handles.valid = true;
+    handles_from_cache = false;
+
+    dgr_print_handle_cache();
+}
+
+/**
+ * Returns the value handle of a CGM service characteristic.
+ *
+ * @param uuid              UUID of the characteristic
+ * @return                  The value handle, 0 if unknown
+ */
+uint16_t
+dgr_get_val_handle(const ble_uuid_t *uuid) {
+    if(ble_uuid_cmp(uuid, &control_uuid.u) == 0) {
+        return cached_handles.control_val_handle;
+    } else if(ble_uuid_cmp(uuid, &authentication_uuid.u) == 0) {
+        return cached_handles.auth_val_handle;
+    } else if(ble_uuid_cmp(uuid, &backfill_uuid.u) == 0) {
+        return cached_handles.backfill_val_handle;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the handle of the CCCD of a CGM service characteristic.
+ *
+ * @param uuid              UUID of the characteristic
+ * @return                  The CCCD handle, 0 if unknown
+ */
+uint16_t
+dgr_get_cccd_handle(const ble_uuid_t *uuid) {
+    if(ble_uuid_cmp(uuid, &control_uuid.u) == 0) {
+        return cached_handles.control_cccd_handle;
+    } else if(ble_uuid_cmp(uuid, &backfill_uuid.u) == 0) {
+        return cached_handles.backfill_cccd_handle;
+    }
+
+    return 0;
+}
+
+void
+dgr_print_handle_cache() {
+    ESP_LOGI(tag_cache, "[=========== handle cache ===========]");
+    ESP_LOGI(tag_cache, "\ttransmitter     = %s", addr_to_string(cached_handles.peer_addr.val));
+    ESP_LOGI(tag_cache, "\tservice         = 0x%04x - 0x%04x",
+        cached_handles.svc_start_handle, cached_handles.svc_end_handle);
+    ESP_LOGI(tag_cache, "\tcontrol         = 0x%04x (cccd = 0x%04x)",
+        cached_handles.control_val_handle, cached_handles.control_cccd_handle);
+    ESP_LOGI(tag_cache, "\tauthentication  = 0x%04x", cached_handles.auth_val_handle);
+    ESP_LOGI(tag_cache, "\tbackfill        = 0x%04x (cccd = 0x%04x)",
+        cached_handles.backfill_val_handle, cached_handles.backfill_cccd_handle);
+}
@@ -97,6 +97,56 @@ dgr_find_chr_by_uuid(const ble_uuid_t *uuid, struct ble_gatt_chr *out) {
     }
 }
 
+/**
+ * Searches for a service by UUID in the list of discovered services.
+ *
+ * @param uuid          UUID of the wanted service
+ * @param out           If found the wanted service is written to this variable
+ * @return              0 on success
+ */
+int
+dgr_find_svc_by_uuid(const ble_uuid_t *uuid, struct ble_gatt_svc *out) {
+    list_elm *le = services.head;
+
+    while(le != NULL) {
+        if(ble_uuid_cmp(uuid, &(le->svc.uuid.u)) == 0) {
+            *out = le->svc;
+            return 0;
+        }
+        le = le->next;
+    }
+
+    char buf[BLE_UUID_STR_LEN];
+    ble_uuid_to_str(uuid, buf);
+    ESP_LOGE(tag_chrs, "Could not find uuid = %s in services list.", buf);
+    dgr_error();
+    return 1;
+}
+
+/**
+ * Searches the list of discovered descriptors for the CCCD of a characteristic.
+ *
+ * @param val_handle    Value handle of the characteristic
+ * @param end_handle    Last handle that may belong to the characteristic
+ * @return              Handle of the CCCD, val_handle + 1 if it was not discovered
+ */
+uint16_t
+dgr_find_cccd(uint16_t val_handle, uint16_t end_handle) {
+    const ble_uuid16_t cccd_uuid = BLE_UUID16_INIT(BLE_GATT_DSC_CLT_CFG_UUID16);
+    list_elm *le = descriptors.head;
+
+    while(le != NULL) {
+        if(le->dsc.handle > val_handle && le->dsc.handle <= end_handle &&
+           ble_uuid_cmp(&cccd_uuid.u, &(le->dsc.uuid.u)) == 0) {
+            return le->dsc.handle;
+        }
+        le = le->next;
+    }
+
+    // cccd lies directly after the corresponding characteristic
+    return val_handle + 1;
+}
+
 /*****************************************************************************
  *  debug  functions                                                         *
  *****************************************************************************/
@@ -1,6 +1,7 @@
 #include "nvs_flash.h"
 #include <esp_sleep.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 
 // BLE
 #include <host/ble_gap.h>
@@ -9,6 +10,7 @@
 #include "esp_nimble_hci.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
+#include "nimble/nimble_npl.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 
@@ -17,10 +19,35 @@
 
 RTC_DATA_ATTR int boot_count = 0;
 RTC_DATA_ATTR int error_count = 0;
+RTC_DATA_ATTR known_transmitter known_tx;
+RTC_DATA_ATTR dgr_schedule schedule;
+RTC_DATA_ATTR dgr_metrics metrics;
+RTC_DATA_ATTR dgr_energy energy;
+const energy_profile esp32_profile = {
+    .current = {
+        [energy_cpu]        = CURRENT_CPU,
+        [energy_scan]       = CURRENT_SCAN,
+        [energy_connected]  = CURRENT_CONNECTED,
+        [energy_sleep]      = CURRENT_DEEP_SLEEP,
+    }
+};
+// true while connecting directly to the remembered transmitter
+bool direct_connect = false;
+int64_t connect_start_time = 0;
+// transmitter found by the open scan
+ble_addr_t candidate_addr;
+uint16_t session_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+session cycle;
+// true while the encryption with a stored bond is running
+bool bonded_reconnect_pending = false;
+struct ble_npl_callout deadline_callout;
 static const char *tag = "[Dexcom-G6-Reader][main]";
 const char *transmitter_id = "812345";
 
 int dgr_gap_event(struct ble_gap_event *event, void *arg);
+void dgr_finish_cycle(uint32_t sleep_time, bool completed);
+void dgr_start_scan(void);
+void dgr_start_connect(void);
 
 /**
  * Counts error and goes to a shorter deep sleep after they happen.
@@ -28,21 +55,314 @@ int dgr_gap_event(struct ble_gap_event *event, void *arg);
 void
 dgr_error() {
     error_count++;
-    ESP_LOGE(tag, "Error count = %d", error_count);
+    ESP_LOGE(tag, "Error count = %d, session state = %s", error_count,
+        dgr_session_state_name(cycle.state));
 
     ESP_LOGE(tag, "Going to deep sleep after error for %d seconds", SLEEP_AFTER_ERROR);
-    dgr_print_rbuf(true);
+    dgr_flush_storage();
+    dgr_print_storage();
+    dgr_metrics_error(&metrics, cycle.state);
+    dgr_finish_cycle(SLEEP_AFTER_ERROR * 1000, false);
     esp_deep_sleep(SLEEP_AFTER_ERROR * 1000000); // time is in microseconds
 }
 
+/**
+ * Goes to deep sleep until shortly before the next wanted reading of the transmitter.
+ */
+void
+dgr_sleep_until_next_reading() {
+    int64_t sleep_time = dgr_schedule_next_wakeup(&schedule, dgr_rtc_time_ms(), READING_EVERY_NTH,
+                                                  WAKEUP_LEAD_TIME);
+
+    if(sleep_time < 0) {
+        ESP_LOGI(tag, "Reading schedule unknown.");
+        sleep_time = SLEEP_BETWEEN_READINGS * 1000;
+    }
+
+    ESP_LOGI(tag, "Going to deep sleep for %lld ms. drift = %d ppm", sleep_time, schedule.drift_ppm);
+    dgr_finish_cycle(sleep_time, true);
+    esp_deep_sleep(sleep_time * 1000); // time is in microseconds
+}
+
+/**
+ * Writes the metrics as a single line of hex, which is decoded by tools/dgr_metrics.py.
+ */
+void
+dgr_dump_metrics() {
+    static uint8_t dump[METRICS_DUMP_SIZE];
+    static char hex[2 * METRICS_DUMP_SIZE + 1];
+    size_t length = dgr_metrics_serialize(&metrics, dump, sizeof dump);
+
+    for(size_t i = 0; i < length; i++) {
+        sprintf(&hex[2 * i], "%02x", dump[i]);
+    }
+    hex[2 * length] = '\0';
+
+    ESP_LOGI(tag, "Awake for %d ms, cycles = %d, completed = %d", metrics.milestones[metrics_sleep],
+        metrics.cycles, metrics.completed_cycles);
+    ESP_LOGI(tag, "METRICS %s", hex);
+}
+
+/**
+ * Closes the metrics and the energy accounting of the cycle before going to sleep.
+ * The times of the power states are logged as a trace line for tools/dgr_energy.py.
+ *
+ * @param sleep_time        Duration of the following deep sleep in milliseconds
+ * @param completed         true if the cycle received a reading
+ */
+void
+dgr_finish_cycle(uint32_t sleep_time, bool completed) {
+    uint32_t now = esp_timer_get_time() / 1000;
+
+    dgr_metrics_end_cycle(&metrics, now, completed);
+    dgr_energy_end_cycle(&energy, &esp32_profile, now, sleep_time);
+    dgr_dump_metrics();
+
+    ESP_LOGI(tag, "Cycle charge = %llu uAh, consumption = %d uAh per day",
+        dgr_energy_cycle_charge(&energy, &esp32_profile) / ENERGY_UAMS_PER_UAH, dgr_energy_uah_per_day(&energy));
+    ESP_LOGI(tag, "ENERGY %d %d %d %d %d", energy.cycle_time[energy_cpu], energy.cycle_time[energy_scan],
+        energy.cycle_time[energy_connected], energy.cycle_time[energy_sleep], completed);
+}
+
+/*****************************************************************************
+ * session state machine                                                     *
+ *****************************************************************************/
+
+/**
+ * Arms the callout for the deadline of the current session state.
+ */
+void
+dgr_arm_deadline() {
+    int64_t remaining;
+
+    if(cycle.deadline == 0) {
+        ble_npl_callout_stop(&deadline_callout);
+        return;
+    }
+
+    remaining = cycle.deadline - esp_timer_get_time() / 1000;
+    ble_npl_callout_reset(&deadline_callout, ble_npl_time_ms_to_ticks32(remaining > 0 ? remaining : 0));
+}
+
+/**
+ * Posts an event to the session state machine and processes it. Must be called
+ * from the NimBLE host task.
+ *
+ * @param event             Event to post
+ */
+void
+dgr_post_event(session_event event) {
+    if(!dgr_session_post(&cycle, event)) {
+        ESP_LOGE(tag, "Session event queue full, dropped event %s.", dgr_session_event_name(event));
+        dgr_error();
+    }
+
+    dgr_session_run(&cycle, esp_timer_get_time() / 1000);
+    dgr_arm_deadline();
+}
+
+/**
+ * Gives the current session state at least some more time.
+ *
+ * @param duration          Time from now in milliseconds
+ */
+void
+dgr_extend_deadline(uint32_t duration) {
+    dgr_session_extend_deadline(&cycle, esp_timer_get_time() / 1000, duration);
+    dgr_arm_deadline();
+}
+
+void
+dgr_deadline_cb(struct ble_npl_event *ev) {
+    ESP_LOGD(tag, "Deadline callout, session state = %s", dgr_session_state_name(cycle.state));
+    dgr_session_check_deadline(&cycle, esp_timer_get_time() / 1000);
+    dgr_arm_deadline();
+}
+
+void
+dgr_on_transition(session_state from, session_state to, session_event event, int64_t now, void *arg) {
+    // milestones reached by entering a state
+    static const int8_t milestones[SESSION_STATE_COUNT] = {
+        [session_idle] = -1, [session_scan] = -1, [session_connect] = -1,
+        [session_discover] = metrics_connected,
+        [session_auth] = metrics_handles_known,
+        [session_bond] = -1,
+        [session_encrypt] = metrics_authenticated,
+        [session_time] = metrics_encrypted,
+        [session_glucose] = -1,
+        [session_backfill] = metrics_glucose_rx,
+        [session_teardown] = metrics_backfill_done,
+        [session_done] = -1, [session_failed] = -1,
+    };
+
+    if(event == session_ev_timeout) {
+        ESP_LOGE(tag, "Session: deadline of state %s passed.", dgr_session_state_name(from));
+        dgr_metrics_count(&metrics, metrics_timeouts, 1);
+    }
+    if(to == session_done) {
+        // the link is closed unless the wait for the disconnect timed out
+        dgr_metrics_teardown(&metrics, event != session_ev_timeout);
+    }
+    if(milestones[to] >= 0) {
+        dgr_metrics_milestone(&metrics, (metrics_milestone) milestones[to], now);
+    }
+
+    // the radio scans while looking for the transmitter and while initiating the connection
+    if(to == session_scan || to == session_connect) {
+        dgr_energy_enter(&energy, energy_scan, now);
+    } else if(to >= session_discover && to <= session_teardown) {
+        dgr_energy_enter(&energy, energy_connected, now);
+    } else {
+        dgr_energy_enter(&energy, energy_cpu, now);
+    }
+    ESP_LOGI(tag, "Session: %s -> %s (%s) at %lld ms", dgr_session_state_name(from),
+        dgr_session_state_name(to), dgr_session_event_name(event), now);
+}
+
+void
+dgr_enter_scan(void *arg) {
+    dgr_start_connect();
+    // the host is idle until the transmitter advertises
+    dgr_stage_auth_token();
+}
+
+void
+dgr_enter_connect(void *arg) {
+    dgr_connect();
+}
+
+void
+dgr_enter_discover(void *arg) {
+    struct ble_gap_conn_desc conn_desc;
+
+    // also entered again after a rejected cached handle, the setup starts over
+    dgr_reset_pipeline();
+    ble_gap_conn_find(session_conn_handle, &conn_desc);
+    if(dgr_handle_cache_matches(&conn_desc.peer_id_addr)) {
+        // handles are known from an earlier wake cycle
+        dgr_use_handle_cache();
+        dgr_discovery_finished(session_conn_handle);
+    } else {
+        // start discovery of service
+        dgr_discover_services(session_conn_handle);
+    }
+}
+
+void
+dgr_enter_auth(void *arg) {
+    struct ble_gap_conn_desc conn_desc;
+
+    if(!bonded_reconnect_pending && ble_gap_conn_find(session_conn_handle, &conn_desc) == 0 &&
+       !conn_desc.sec_state.encrypted) {
+        // the stored bond is tried before the authentication exchange, a rejected bond
+        // re-enters this state with the bond deleted
+        dgr_start_bonded_reconnect(session_conn_handle);
+    }
+
+    if(bonded_reconnect_pending) {
+        ESP_LOGI(tag, "Waiting for encryption with stored bond.");
+    } else if(dgr_check_bond_state(session_conn_handle)) {
+        // the encryption with the stored bond finished during the discovery
+        ESP_LOGI(tag, "Already bonded with transmitter.");
+        dgr_post_event(session_ev_encrypted);
+    } else {
+        ESP_LOGI(tag, "Not bonded with transmitter. Starting authentication.");
+        dgr_send_auth_request_msg(session_conn_handle);
+    }
+}
+
+void
+dgr_enter_bond(void *arg) {
+    if(dgr_check_bond_state(session_conn_handle)) {
+        dgr_post_event(session_ev_bonded);
+    } else {
+        // keep alive is followed by the bond request
+        dgr_send_keep_alive_msg(session_conn_handle, 25);
+    }
+}
+
+void
+dgr_enter_encrypt(void *arg) {
+    struct ble_gap_conn_desc conn_desc;
+
+    // a bonded transmitter may have encrypted the link already
+    if(ble_gap_conn_find(session_conn_handle, &conn_desc) == 0 && conn_desc.sec_state.encrypted) {
+        dgr_post_event(session_ev_encrypted);
+    }
+}
+
+void
+dgr_enter_time(void *arg) {
+    dgr_start_pipeline(session_conn_handle);
+}
+
+void
+dgr_enter_backfill(void *arg) {
+    dgr_check_for_backfill(session_conn_handle, glucose_sequence);
+}
+
+void
+dgr_enter_teardown(void *arg) {
+    struct ble_gap_conn_desc conn_desc;
+
+    // backfilled readings were saved as they arrived, a hole left now can not be requested again
+    ble_npl_callout_stop(&backfill_callout);
+    if(backfill.pending > 0) {
+        ESP_LOGW(tag, "Backfill ended with %d notifications waiting for a missing one.", backfill.pending);
+    }
+    dgr_print_storage();
+
+    if(ble_gap_conn_find(session_conn_handle, &conn_desc) == 0) {
+        // without a proper disconnect the transmitter keeps the link until the supervision timeout
+        dgr_send_disconnect_msg(session_conn_handle);
+    } else {
+        dgr_post_event(session_ev_teardown_done);
+    }
+}
+
+void
+dgr_enter_done(void *arg) {
+    dgr_sleep_until_next_reading();
+}
+
+void
+dgr_enter_failed(void *arg) {
+    dgr_error();
+}
+
+session_action_fn *const session_actions[SESSION_STATE_COUNT] = {
+    [session_scan]          = dgr_enter_scan,
+    [session_connect]       = dgr_enter_connect,
+    [session_discover]      = dgr_enter_discover,
+    [session_auth]          = dgr_enter_auth,
+    [session_bond]          = dgr_enter_bond,
+    [session_encrypt]       = dgr_enter_encrypt,
+    [session_time]          = dgr_enter_time,
+    [session_backfill]      = dgr_enter_backfill,
+    [session_teardown]      = dgr_enter_teardown,
+    [session_done]          = dgr_enter_done,
+    [session_failed]        = dgr_enter_failed,
+};
+
+/*****************************************************************************
+ * scanning and connecting                                                   *
+ *****************************************************************************/
+
 bool
-dgr_check_conn_candidate(struct ble_hs_adv_fields *adv_fields) {
+dgr_check_conn_candidate(const struct ble_gap_disc_desc *disc) {
+    const uint8_t *name;
+    uint8_t name_len = 0;
+
     // sensor name is DexcomXX, where XX are the last 2 digits of
     // the transmitter id
-    if(adv_fields->name != NULL) {
-        int name_len = adv_fields->name_len;
-        if(adv_fields->name[name_len - 1] == transmitter_id[5] &&
-           adv_fields->name[name_len - 2] == transmitter_id[4]) {
+    name = dgr_find_adv_field(disc->data, disc->length_data, BLE_HS_ADV_TYPE_COMP_NAME, &name_len);
+    if(name == NULL) {
+        name = dgr_find_adv_field(disc->data, disc->length_data, BLE_HS_ADV_TYPE_INCOMP_NAME, &name_len);
+    }
+
+    if(name != NULL && name_len >= 2) {
+        if(name[name_len - 1] == transmitter_id[5] &&
+           name[name_len - 2] == transmitter_id[4]) {
 
             ESP_LOGD(tag, "Found a connection candidate.");
             return true;
@@ -53,6 +373,56 @@ dgr_check_conn_candidate(struct ble_hs_adv_fields *adv_fields) {
     return false;
 }
 
+/**
+ * @param conn_handle       Connection to the transmitter
+ * @return                  true if a bond with the transmitter is stored
+ */
+bool
+dgr_has_stored_bond(uint16_t conn_handle) {
+    struct ble_store_key_sec key_sec;
+    struct ble_store_value_sec value_sec;
+    struct ble_gap_conn_desc conn_desc;
+
+    if(ble_gap_conn_find(conn_handle, &conn_desc) != 0) {
+        return false;
+    }
+
+    memset(&key_sec, 0, sizeof key_sec);
+    key_sec.peer_addr = conn_desc.peer_id_addr;
+    if(ble_store_read_peer_sec(&key_sec, &value_sec) != 0) {
+        ESP_LOGI(tag, "No stored bond for %s.", addr_to_string(conn_desc.peer_id_addr.val));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Starts the encryption right after the connection if a bond with the
+ * transmitter is stored. The authentication exchange is only needed if
+ * the transmitter rejects the bond.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_start_bonded_reconnect(uint16_t conn_handle) {
+    int rc;
+
+    if(!dgr_has_stored_bond(conn_handle)) {
+        return;
+    }
+
+    rc = ble_gap_security_initiate(conn_handle);
+    if(rc != 0) {
+        ESP_LOGW(tag, "Failed to start encryption with stored bond. rc = 0x%04x", rc);
+        return;
+    }
+
+    ESP_LOGI(tag, "Starting encryption with stored bond.");
+    bonded_reconnect_pending = true;
+    dgr_metrics_bonded_reconnect(&metrics);
+}
+
 bool
 dgr_check_bond_state(uint16_t conn_handle) {
     struct ble_gap_conn_desc conn_desc;
@@ -61,8 +431,86 @@ dgr_check_bond_state(uint16_t conn_handle) {
     return (conn_desc.sec_state.bonded == 1U);
 }
 
+/**
+ * Remembers the address of the transmitter after a successful reading, so the
+ * next wake cycle can connect without an open scan.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
+void
+dgr_remember_transmitter(uint16_t conn_handle) {
+    struct ble_gap_conn_desc conn_desc;
+
+    if(ble_gap_conn_find(conn_handle, &conn_desc) == 0) {
+        known_tx.addr = conn_desc.peer_ota_addr;
+        memcpy(known_tx.transmitter_id, transmitter_id, sizeof known_tx.transmitter_id);
+        known_tx.valid = true;
+    }
+}
+
+/**
+ * Chooses scan interval and window from the advertising phase observed in earlier
+ * wake cycles. The scan is continuous around the expected advertisement and
+ * duty-cycled in between.
+ *
+ * @param itvl              Scan interval is written to this variable
+ * @param window            Scan window is written to this variable
+ */
+void
+dgr_choose_scan_params(uint16_t *itvl, uint16_t *window) {
+    if(known_tx.last_adv_time != 0) {
+        int64_t since_adv = dgr_rtc_time_ms() - known_tx.last_adv_time;
+
+        if(since_adv >= 0) {
+            since_adv %= ADV_PERIOD * 1000;
+
+            if(since_adv > ADV_EXPECTED_WINDOW * 1000 &&
+               since_adv < (ADV_PERIOD - ADV_EXPECTED_WINDOW) * 1000) {
+                *itvl = SCAN_ITVL_DUTY_CYCLED;
+                *window = SCAN_WINDOW_DUTY_CYCLED;
+                return;
+            }
+        }
+    }
+
+    // advertisement expected or phase unknown
+    *itvl = SCAN_ITVL_EXPECTED;
+    *window = SCAN_WINDOW_EXPECTED;
+}
+
+/**
+ * Connects to the remembered transmitter without an open scan. The controller
+ * only reacts to advertisements of this address. Falls back to an open scan
+ * after DIRECT_CONNECT_TIMEOUT.
+ */
+void
+dgr_connect_direct() {
+    int rc;
+    struct ble_gap_conn_params conn_params = {
+        .itvl_min = BLE_GAP_INITIAL_CONN_ITVL_MIN,
+        .itvl_max = BLE_GAP_INITIAL_CONN_ITVL_MAX,
+        .latency = BLE_GAP_INITIAL_CONN_LATENCY,
+        .supervision_timeout = BLE_GAP_INITIAL_SUPERVISION_TIMEOUT,
+        .min_ce_len = BLE_GAP_INITIAL_CONN_MIN_CE_LEN,
+        .max_ce_len = BLE_GAP_INITIAL_CONN_MAX_CE_LEN,
+    };
+
+    dgr_choose_scan_params(&conn_params.scan_itvl, &conn_params.scan_window);
+    ESP_LOGI(tag, "Connecting directly to %s. scan itvl = 0x%04x, window = 0x%04x",
+        addr_to_string(known_tx.addr.val), conn_params.scan_itvl, conn_params.scan_window);
+
+    direct_connect = true;
+    rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &known_tx.addr, DIRECT_CONNECT_TIMEOUT, &conn_params,
+            dgr_gap_event, NULL);
+    if(rc != 0) {
+        ESP_LOGE(tag, "Direct connection attempt failed. rc = 0x%04x", rc);
+        direct_connect = false;
+        dgr_start_scan();
+    }
+}
+
 void
-dgr_connect(const struct ble_gap_disc_desc *disc) {
+dgr_connect() {
     int rc;
 
     // scanning must be stopped before a connection
@@ -73,32 +521,42 @@ dgr_connect(const struct ble_gap_disc_desc *disc) {
     }
 
     // connection attempt
-    rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &disc->addr, 30000, NULL,
+    // the deadline of the connect state ends the attempt earlier
+    rc = ble_gap_connect(BLE_OWN_ADDR_PUBLIC, &candidate_addr, 30000, NULL,
             dgr_gap_event, NULL);
     if(rc != 0) {
         ESP_LOGE(tag, "Connection attempt failed: addr_type: %d, addr: %s",
-            disc->addr.type, addr_to_string(disc->addr.val));
+            candidate_addr.type, addr_to_string(candidate_addr.val));
         dgr_error();
     }
 }
 
+/**
+ * Terminates the connection, completion is signaled by the disconnect event.
+ *
+ * @param conn_handle       Connection to terminate
+ */
 void
-dgr_evaluate_adv_report(const struct ble_gap_disc_desc *disc) {
-    int rc;
-    struct ble_hs_adv_fields adv_fields;
-
-    rc = ble_hs_adv_parse_fields(&adv_fields, disc->data, disc->length_data);
-    if(rc != 0) {
-        ESP_LOGE(tag, "Error parsing advertisement data. rc = 0x%04x", rc);
-        dgr_error();
+dgr_terminate_connection(uint16_t conn_handle) {
+    int rc = ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+
+    if(rc == BLE_HS_ENOTCONN || rc == BLE_HS_EALREADY) {
+        ESP_LOGI(tag, "Connection already closed. rc = 0x%04x", rc);
+    } else if(rc != 0) {
+        // the deadline of the teardown state bounds the wait
+        ESP_LOGW(tag, "Failed to terminate connection. rc = 0x%04x", rc);
     }
+}
 
-    // log advertisement
-    //print_adv_fields(&adv_fields);
-
+void
+dgr_evaluate_adv_report(const struct ble_gap_disc_desc *disc) {
+    // the remembered transmitter is recognized by its address alone,
     // connect if connection candidate is desired device
-    if(dgr_check_conn_candidate(&adv_fields)) {
-        dgr_connect(disc);
+    if((known_tx.valid && ble_addr_cmp(&known_tx.addr, &disc->addr) == 0) ||
+       dgr_check_conn_candidate(disc)) {
+        candidate_addr = disc->addr;
+        dgr_metrics_milestone(&metrics, metrics_first_adv, esp_timer_get_time() / 1000);
+        dgr_post_event(session_ev_adv_found);
     }
 }
 
@@ -117,9 +575,8 @@ dgr_start_scan(void) {
     disc_params.filter_duplicates = 1;
     disc_params.passive = 0;
 
+    dgr_choose_scan_params(&disc_params.itvl, &disc_params.window);
     // default values
-    disc_params.itvl = 0;
-    disc_params.window = 0;
     disc_params.filter_policy = 0;
     disc_params.limited = 0;
 
@@ -131,28 +588,58 @@ dgr_start_scan(void) {
     }
 }
 
+/**
+ * Starts a direct connection to the remembered transmitter or an open scan
+ * if no transmitter is known yet.
+ */
+void
+dgr_start_connect(void) {
+    connect_start_time = esp_timer_get_time();
+
+    if(known_tx.valid && memcmp(known_tx.transmitter_id, transmitter_id, sizeof known_tx.transmitter_id) == 0) {
+        dgr_connect_direct();
+    } else {
+        dgr_start_scan();
+    }
+}
+
 int
 dgr_gap_event(struct ble_gap_event *event, void *arg) {
+    struct ble_gap_conn_desc conn_desc;
+
 	switch(event->type) {
 	    case BLE_GAP_EVENT_CONNECT:
 	        // new connection established or connection attempt failed
-	        if(event->connect.status != 0) {
+	        if(event->connect.status == BLE_HS_ETIMEOUT && direct_connect) {
+	            // remembered transmitter did not show up, fall back to an open scan
+	            ESP_LOGI(tag, "Direct connection timed out. Starting open scan.");
+	            direct_connect = false;
+	            dgr_start_scan();
+	        } else if(event->connect.status != 0) {
 	            // connection attempt failed
 	            ESP_LOGE(tag, "Connection attempt failed. error code: 0x%04x",
 	                event->connect.status);
 
-                dgr_error();
+                dgr_post_event(session_ev_error);
 	        } else {
 	            // connection successfully
-	            ESP_LOGI(tag, "Connection successfull. handle = %d",
-	                event->connect.conn_handle);
+	            ESP_LOGI(tag, "Connection successfull. handle = %d, time to connect = %lld ms",
+	                event->connect.conn_handle, (esp_timer_get_time() - connect_start_time) / 1000);
+	            // the transmitter accepts connections right after its advertisement
+	            known_tx.last_adv_time = dgr_rtc_time_ms();
+	            if(direct_connect) {
+	                // the controller connected on the first advertisement it saw
+	                dgr_metrics_milestone(&metrics, metrics_first_adv, esp_timer_get_time() / 1000);
+	            }
+	            session_conn_handle = event->connect.conn_handle;
 	            // TODO: remove or make debug output?
-                struct ble_gap_conn_desc conn_desc;
-                ble_gap_conn_find(event->enc_change.conn_handle, &conn_desc);
+                ble_gap_conn_find(event->connect.conn_handle, &conn_desc);
                 dgr_print_conn_sec_state(conn_desc.sec_state);
 
-                // start discovery of service
-                dgr_discover_services(event->connect.conn_handle);
+                // encryption with a stored bond runs in parallel to the discovery, it has to be
+                // pending before the session can reach the authentication with cached handles
+                dgr_start_bonded_reconnect(event->connect.conn_handle);
+                dgr_post_event(session_ev_connected);
 	        }
 
 	        return 0;
@@ -191,23 +678,37 @@ dgr_gap_event(struct ble_gap_event *event, void *arg) {
 	        ESP_LOGI(tag, "Disconnect: handle = %d, reason = 0x%04x",
 	            event->disconnect.conn.conn_handle, event->disconnect.reason);
 
-	        dgr_parse_backfill();
-            dgr_print_rbuf(true);
-            ESP_LOGI(tag, "Going to deep sleep for %d seconds.", SLEEP_BETWEEN_READINGS);
-            esp_deep_sleep(SLEEP_BETWEEN_READINGS * 1000000); // time is in microseconds
-
+	        session_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+	        dgr_post_event(session_ev_disconnected);
+	        return 0;
 
 	    case BLE_GAP_EVENT_ENC_CHANGE:
 	        ESP_LOGI(tag, "Encryption changed: handle = %d, status = 0x%04x",
 	            event->enc_change.conn_handle, event->enc_change.status);
-	        struct ble_gap_conn_desc conn_desc;
 	        ble_gap_conn_find(event->enc_change.conn_handle, &conn_desc);
             dgr_print_conn_sec_state(conn_desc.sec_state);
 
-            dgr_enable_server_side_updates_msg(event->enc_change.conn_handle,
-                                               &control_uuid.u, dgr_send_control_enable_notif_cb, 1);
+            if(bonded_reconnect_pending) {
+                bonded_reconnect_pending = false;
+                if(event->enc_change.status != 0) {
+                    // the transmitter lost the bond, pair again after the authentication
+                    ESP_LOGW(tag, "Transmitter rejected the stored bond. Deleting it.");
+                    ble_store_util_delete_peer(&conn_desc.peer_id_addr);
+                    dgr_post_event(session_ev_bond_rejected);
+                    return 0;
+                }
+            }
+
+            dgr_post_event(event->enc_change.status == 0 ? session_ev_encrypted : session_ev_error);
 	        return 0;
 
+	    case BLE_GAP_EVENT_REPEAT_PAIRING:
+	        // the transmitter wants to pair although a bond is stored, replace the old bond
+	        ESP_LOGI(tag, "Repeated pairing. Deleting the old bond.");
+	        ble_gap_conn_find(event->repeat_pairing.conn_handle, &conn_desc);
+	        ble_store_util_delete_peer(&conn_desc.peer_id_addr);
+	        return BLE_GAP_REPEAT_PAIRING_RETRY;
+
 		default:
 			ESP_LOGI(tag, "Not processed event with type: %d", event->type);
 			return 0;
@@ -224,7 +725,8 @@ dgr_sync_callback(void) {
 
 	// start device scan
 	ESP_LOGI(tag, "Host and Controller synced. Starting device scan.");
-	dgr_start_scan();
+	dgr_metrics_milestone(&metrics, metrics_sync, esp_timer_get_time() / 1000);
+	dgr_post_event(session_ev_start);
 }
 
 void
@@ -245,6 +747,8 @@ void
 app_main(void) {
     esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
     boot_count++;
+    dgr_metrics_begin_cycle(&metrics, esp_timer_get_time() / 1000);
+    dgr_energy_begin_cycle(&energy, esp_timer_get_time() / 1000);
 
 	// initialize NVS flash
 	esp_err_t ret = nvs_flash_init();
@@ -254,21 +758,31 @@ app_main(void) {
 	}
 	ESP_ERROR_CHECK(ret);
 
+    // the reading log is in RTC memory so we dont need to initialize it when waking up
+    dgr_init_storage(wakeup_cause == ESP_SLEEP_WAKEUP_TIMER);
+    if(wakeup_cause != ESP_SLEEP_WAKEUP_TIMER) {
+        // cached handles are only trusted after a timer wakeup
+        dgr_invalidate_handle_cache();
+        // a reset gives a connected host the chance to pull the stored readings, the radio is
+        // still off and the time is booked as cpu time of the cycle
+        dgr_serve_export(EXPORT_PROBE, EXPORT_WINDOW);
+    }
+
 	// initialize ESP controller and transport layer
 	ESP_ERROR_CHECK(esp_nimble_hci_and_controller_init());
 
 	// initialize host stack
 	nimble_port_init();
 
+	// initialize session state machine, its deadlines are handled in the host task
+	dgr_session_init(&cycle, session_actions, dgr_on_transition, NULL);
+	ble_npl_callout_init(&deadline_callout, nimble_port_get_dflt_eventq(), dgr_deadline_cb, NULL);
+	ble_npl_callout_init(&backfill_callout, nimble_port_get_dflt_eventq(), dgr_backfill_timeout_cb, NULL);
+
 	// initialize mbuf pool
     dgr_create_mbuf_pool();
     // initialize aes context
     dgr_create_crypto_context();
-    if(wakeup_cause != ESP_SLEEP_WAKEUP_TIMER) {
-        // create ringbuffer
-        // ringbuffer is in RTC memory so we dont need to initialize it when waking up
-        dgr_init_ringbuffer();
-    }
 
 	// initialize NimBLE host configuration and callbacks
 	// sync callback (controller and host sync, executed at startup/reset)
@@ -1,93 +1,99 @@
 #include <stdint-gcc.h>
+#include <string.h>
+#include "esp_attr.h"
 #include "host/ble_uuid.h"
-#include "esp_system.h"
-#include "mbedtls/aes.h"
-#include "esp32/rom/crc.h"
 
 #include "dexcom_g6_reader.h"
 
 
 
 const char* tag_msg = "[Dexcom-G6-Reader][msg]";
-unsigned char token_bytes[8];
-unsigned char enc_token_bytes[8];
-unsigned char challenge_bytes[8];
+uint8_t token_bytes[AUTH_TOKEN_SIZE];
+uint8_t enc_token_bytes[AUTH_TOKEN_SIZE];
+uint8_t challenge_bytes[AUTH_TOKEN_SIZE];
+// token of the next AuthRequestTx, a token that was not sent is kept for the next wake cycle
+RTC_DATA_ATTR auth_token next_token;
 uint8_t authentication_status = 0;
 uint8_t bond_status = 0;
-mbedtls_aes_context aes_ecb_ctx;
-unsigned char key[16];
+uint8_t key[AUTH_KEY_SIZE];
+// time range sent with BackfillTx
 uint32_t backfill_start_time;
 uint32_t backfill_end_time;
-uint8_t next_backfill_sequence = 1;
-uint8_t backfill_buffer[500];
-uint32_t backfill_buffer_pos = 0;
-bool expecting_backfill = false;
+// time range that can be backfilled in this connection
+uint32_t backfill_window_start;
+uint32_t backfill_window_end;
+// missing readings of the running request
+coverage_range backfill_range;
+backfill_parser backfill;
+uint8_t backfill_retries = 0;
+// KeepAlive to send once the running BackfillTx write completed
+bool backfill_keep_alive = false;
+uint16_t backfill_conn_handle;
+struct ble_npl_callout backfill_callout;
+// sequence number of the last received GlucoseRx message
+uint32_t glucose_sequence = 0;
 
 /**
- * Encrypts input bytes with aes-128-ecb.
+ * Hashes a token or challenge for the authentication.
  *
  * @param in_bytes      Input bytes
  * @param out_bytes     Output bytes
  */
-void
-dgr_encrypt(const unsigned char in_bytes[8], unsigned char out_bytes[8]) {
-    unsigned char aes_in[16];
-    unsigned char aes_out[16];
-    int rc;
-
-    for(int i = 0; i < 8; i++) {
-        aes_in[i] = in_bytes[i];
-        aes_in[i + 8] = in_bytes[i];
+static void
+dgr_encrypt(const uint8_t in_bytes[AUTH_TOKEN_SIZE], uint8_t out_bytes[AUTH_TOKEN_SIZE]) {
+    if(!dgr_auth_hash(in_bytes, out_bytes)) {
+        ESP_LOGE(tag_msg, "Error while encrypting.");
+        dgr_error();
     }
+}
 
-    rc = mbedtls_aes_crypt_ecb(&aes_ecb_ctx, MBEDTLS_AES_ENCRYPT, aes_in, aes_out);
-    if(rc != 0) {
-        ESP_LOGE(tag_msg, "Error while encrypting. rc = 0x%04x", rc);
+/*****************************************************************************
+ *  outgoing message building                                                *
+ *****************************************************************************/
+
+/**
+ * Reserves a message in the mbuf, the codec encodes it in place.
+ *
+ * @param om                Empty mbuf of the request
+ * @param length            Length of the message with CRC
+ * @return                  The message in the mbuf
+ */
+static uint8_t*
+dgr_reserve_msg(struct os_mbuf *om, uint8_t length) {
+    uint8_t *msg = os_mbuf_extend(om, length);
+
+    if(msg == NULL) {
+        ESP_LOGE(tag_msg, "Error while extending mbuf. length = %d", length);
         dgr_error();
     }
 
-    //ESP_LOGI(tag_msg, "AES INPUT:");
-    //ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, aes_in, 16, ESP_LOG_INFO);
-    //ESP_LOGI(tag_msg, "AES_OUTPUT:");
-    //ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, aes_out, 16, ESP_LOG_INFO);
+    return msg;
+}
+
+static void
+dgr_append_frame(struct os_mbuf *om, const uint8_t *frame, uint8_t length) {
+    int rc;
 
-    for(int i = 0; i < 8; i++) {
-        out_bytes[i] = aes_out[i];
+    rc = os_mbuf_append(om, frame, length);
+    if(rc != 0) {
+        ESP_LOGE(tag_msg, "Error while appending to mbuf. rc = 0x%04x", rc);
+        dgr_error();
     }
 }
 
-/*****************************************************************************
- *  outgoing message building                                                *
- *****************************************************************************/
-
 void
 dgr_build_auth_request_msg(struct os_mbuf *om) {
-    uint8_t msg[10];
-    uint8_t rnd;
-    unsigned int i;
-    int rc;
+    uint8_t *msg;
 
     if(om) {
-        for(i = 0; i < 8; i++) {
-            rnd = esp_random() % 256;
-
-            msg[i + 1] = rnd;
-            token_bytes[i] = rnd;
-        }
-
-        dgr_encrypt(token_bytes, enc_token_bytes);
+        // usually staged during the scan already
+        dgr_stage_auth_token();
+        memcpy(token_bytes, next_token.token, AUTH_TOKEN_SIZE);
+        memcpy(enc_token_bytes, next_token.hash, AUTH_TOKEN_SIZE);
+        next_token.ready = false;
 
-        msg[0] = AUTH_REQUEST_TX_OPCODE;
-        // alt bt channel
-        msg[9] = 0x1;
-        // std bt channel
-        //msg[0] = 0x2;
-
-        rc = os_mbuf_copyinto(om, 0, msg, 10);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        msg = dgr_reserve_msg(om, AUTH_REQUEST_TX_LENGTH);
+        dgr_encode_auth_request(msg, token_bytes);
 
         ESP_LOGI(tag_msg, "AuthRequest message: %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x",
             msg[0], msg[1], msg[2], msg[3], msg[4], msg[5], msg[6], msg[7], msg[8], msg[9]);
@@ -96,134 +102,61 @@ dgr_build_auth_request_msg(struct os_mbuf *om) {
 
 void
 dgr_build_auth_challenge_msg(struct os_mbuf *om) {
-    uint8_t msg[9];
-    unsigned char enc_challenge[8];
-    int rc;
+    uint8_t enc_challenge[AUTH_TOKEN_SIZE];
 
     if(om) {
-        msg[0] = AUTH_CHALLENGE_TX_OPCODE;
-
         dgr_encrypt(challenge_bytes, enc_challenge);
-
-        for(int i = 0; i < 8; i++) {
-            msg[i + 1]  = enc_challenge[i];
-        }
+        dgr_encode_auth_challenge(dgr_reserve_msg(om, AUTH_CHALLENGE_TX_LENGTH), enc_challenge);
 
         ESP_LOGI(tag_msg, "challenge           :");
         ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, challenge_bytes, 8, ESP_LOG_INFO);
         ESP_LOGI(tag_msg, "encrypted challenge :");
         ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, enc_challenge, 8, ESP_LOG_INFO);
-        rc = os_mbuf_copyinto(om, 0, msg, 9);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
     }
 }
 
 void
 dgr_build_keep_alive_msg(struct os_mbuf *om, uint8_t time) {
-    uint8_t msg[2];
-    int rc;
-
     if(om) {
-        msg[0] = KEEP_ALIVE_TX_OPCODE;
-        msg[1] = time;
-
-        rc = os_mbuf_copyinto(om, 0, msg, 2);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        dgr_encode_keep_alive(dgr_reserve_msg(om, KEEP_ALIVE_TX_LENGTH), time);
     }
 }
 
 void
 dgr_build_bond_request_msg(struct os_mbuf *om) {
-    uint8_t msg[1] = {BOND_REQUEST_TX_OPCODE};
-    int rc;
+    if(om) {
+        dgr_append_frame(om, dgr_bond_request_tx_frame, BOND_REQUEST_TX_LENGTH);
+    }
+}
 
+void
+dgr_build_disconnect_msg(struct os_mbuf *om) {
     if(om) {
-        rc = os_mbuf_copyinto(om, 0, msg, 1);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        dgr_append_frame(om, dgr_disconnect_tx_frame, DISCONNECT_TX_LENGTH);
     }
 }
 
 void
 dgr_build_glucose_tx_msg(struct os_mbuf *om) {
-    uint8_t msg[3];
-    uint16_t crc;
-    int rc;
-
-    msg[0] = GLUCOSE_TX_OPCODE;
-    crc = ~crc16_be((uint16_t)~0x0000, msg, 1);
-    // write crc as little-endian
-    msg[1] = crc;
-    msg[2] = crc >> 8U;
-
     if(om) {
-        rc = os_mbuf_copyinto(om, 0, msg, 3);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        dgr_append_frame(om, dgr_glucose_tx_frame, GLUCOSE_TX_LENGTH);
     }
 }
 
 void
 dgr_build_backfill_tx_msg(struct os_mbuf *om) {
-    uint8_t msg[20] = {0};
-    uint16_t crc;
-    int rc;
-
-    msg[0] = BACKFILL_TX_OPCODE;
-    msg[1] = 0x5;
-    msg[2] = 0x2;
-    msg[3] = 0x0;
-
-    // start time
-    write_u32_le(&msg[4], backfill_start_time);
-
-    // end time
-    write_u32_le(&msg[8], backfill_end_time);
-
-    // crc
-    crc = ~crc16_be((uint16_t)~0x0000, msg, 18);
-    write_u16_le(&msg[18], crc);
-
     ESP_LOGI(tag_msg, "BackfillTx : requesting backfill from %x to %x",
         backfill_start_time, backfill_end_time);
 
     if(om) {
-        rc = os_mbuf_copyinto(om, 0, msg, 20);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        dgr_encode_backfill_tx(dgr_reserve_msg(om, BACKFILL_TX_LENGTH), backfill_start_time, backfill_end_time);
     }
 }
 
 void
 dgr_build_time_tx_msg(struct os_mbuf *om) {
-    uint8_t msg[3];
-    uint16_t crc;
-    int rc;
-
-    msg[0] = TIME_TX_OPCODE;
-    crc = ~crc16_be((uint16_t)~0x0000, msg, 1);
-    // crc as little endian
-    msg[1] = crc;
-    msg[2] = crc >> 8U;
-
     if(om) {
-        rc = os_mbuf_copyinto(om, 0, msg, 3);
-        if(rc != 0) {
-            ESP_LOGE(tag_msg, "Error while copying into mbuf. rc = 0x%04x", rc);
-            dgr_error();
-        }
+        dgr_append_frame(om, dgr_time_tx_frame, TIME_TX_LENGTH);
     }
 }
 
@@ -231,169 +164,370 @@ dgr_build_time_tx_msg(struct os_mbuf *om) {
  *  incoming message parsing                                                 *
  *****************************************************************************/
 
+// handlers of the notifications, in the order of dgr_msg_descs
+#define MSG_HANDLER(name, opcode, chr, length, flags, handler) (handler),
+static const msg_handler msg_handlers[] = { DGR_MESSAGES(MSG_HANDLER) };
+#undef MSG_HANDLER
+
+/**
+ * Decodes a received message in place. A message in a single mbuf is read
+ * where it is, only a chain of mbufs is copied into the buffer.
+ *
+ * @param om                Received message
+ * @param buf               Buffer of MSG_MAX_LENGTH bytes for a chained message
+ * @param msg               View of the message
+ * @return                  false if the message is empty or longer than MSG_MAX_LENGTH
+ */
+bool
+dgr_view_msg(const struct os_mbuf *om, uint8_t *buf, msg_view *msg) {
+    const struct os_mbuf *seg;
+    uint16_t length = 0;
+    int rc;
+
+    for(seg = om; seg != NULL; seg = SLIST_NEXT(seg, om_next)) {
+        length += seg->om_len;
+    }
+    if(length == 0 || length > MSG_MAX_LENGTH) {
+        return false;
+    }
+
+    msg->length = length;
+    msg->crc_ok = true;
+    if(length == om->om_len) {
+        msg->data = om->om_data;
+        return true;
+    }
+
+    rc = os_mbuf_copydata(om, 0, length, buf);
+    msg->data = buf;
+    return rc == 0;
+}
+
+/**
+ * Passes a notification to the handler of its characteristic and opcode.
+ * Length and CRC are checked against the message table, the CRC over the
+ * mbufs themselves.
+ *
+ * @param om                Received notification
+ * @param chr               Characteristic that sent it
+ * @param conn_handle       Connection to the transmitter
+ */
 void
-dgr_parse_auth_challenge_msg(const uint8_t *data, uint8_t length, bool *correct_token) {
-    if(length == 17) {
-        for(int i = 0; i < 8; i++) {
-            challenge_bytes[i] = data[i + 9];
+dgr_dispatch_msg(const struct os_mbuf *om, msg_characteristic chr, uint16_t conn_handle) {
+    uint8_t buf[MSG_MAX_LENGTH];
+    const msg_desc *desc;
+    msg_handler handler = NULL;
+    msg_view msg;
+
+    if(!dgr_view_msg(om, buf, &msg)) {
+        ESP_LOGE(tag_msg, "Received message is empty or too long.");
+        dgr_error();
+        return;
+    }
 
-            *correct_token = *correct_token && (data[i + 1] == enc_token_bytes[i]);
+    if(chr == msg_backfill) {
+        // backfill data starts with a sequence number and has no opcode
+        dgr_parse_backfill_data_msg(&msg, conn_handle);
+        return;
+    }
+
+    desc = dgr_msg_find(chr, msg.data[0]);
+    if(desc != NULL) {
+        handler = msg_handlers[desc - dgr_msg_descs];
+    }
+    if(handler == NULL) {
+        ESP_LOGE(tag_msg, "Unhandled message with opcode = %02x", msg.data[0]);
+        return;
+    }
+
+    ESP_LOGI(tag_msg, "Received %s message.", desc->name);
+    if(!dgr_msg_length_ok(desc, msg.length)) {
+        ESP_LOGE(tag_msg, "Received %s message has wrong length(%d).", desc->name, msg.length);
+        dgr_error();
+        return;
+    }
+
+    if(desc->flags & MSG_CRC) {
+        uint16_t crc = make_u16_from_bytes_le(&msg.data[msg.length - 2]);
+        uint16_t crc_calc = dgr_crc16_mbuf(CRC16_INIT, om, 0, msg.length - 2);
+
+        msg.crc_ok = crc == crc_calc;
+        if(!msg.crc_ok) {
+            ESP_LOGW(tag_msg, "%s : Calculated CRC (0x%04x) does not match received CRC (0x%04x).",
+                desc->name, crc_calc, crc);
+            dgr_metrics_count(&metrics, metrics_crc_mismatches, 1);
         }
+    }
+
+    handler(&msg, conn_handle);
+}
+
+void
+dgr_parse_auth_challenge_msg(const msg_view *msg, bool *correct_token) {
+    uint8_t token_hash[AUTH_TOKEN_SIZE];
+
+    if(msg->length == AUTH_CHALLENGE_RX_LENGTH) {
+        dgr_decode_auth_challenge(msg->data, token_hash, challenge_bytes);
+
+        *correct_token = *correct_token && memcmp(token_hash, enc_token_bytes, AUTH_TOKEN_SIZE) == 0;
     } else {
-        ESP_LOGE(tag_msg, "Received AuthChallenge message has wrong length(%d).", length);
+        ESP_LOGE(tag_msg, "Received AuthChallenge message has wrong length(%d).", msg->length);
         dgr_error();
     }
 }
 
 void
-dgr_parse_auth_status_msg(const uint8_t *data, uint8_t length) {
-    if(length == 3) {
-        authentication_status = data[1];
-        bond_status = data[2];
+dgr_parse_auth_status_msg(const msg_view *msg) {
+    if(msg->length == AUTH_STATUS_RX_LENGTH) {
+        authentication_status = msg->data[AUTH_STATUS_RX_AUTHENTICATED];
+        bond_status = msg->data[AUTH_STATUS_RX_BONDED];
 
         ESP_LOGI(tag_msg, "[04] AuthStatus: auth = %d, bond = %d", authentication_status, bond_status);
     } else {
-        ESP_LOGE(tag_msg, "Received AuthStatus message has wrong length(%d).", length);
+        ESP_LOGE(tag_msg, "Received AuthStatus message has wrong length(%d).", msg->length);
         dgr_error();
     }
 }
 
 void
-dgr_parse_glucose_msg(const uint8_t *data, uint8_t length, uint8_t conn_handle) {
-    if(length >= 16) {
-        uint8_t transmitter_state = data[1];
-        uint32_t sequence = make_u32_from_bytes_le(&data[2]);
-        uint32_t timestamp = make_u32_from_bytes_le(&data[6]);
-        uint16_t glucose = make_u16_from_bytes_le(&data[10]) & 0xfffU;
-        uint8_t calibration_state = data[12];
-        uint8_t trend = data[13];
-        uint16_t crc = make_u16_from_bytes_le(&data[length - 2]);
-        uint16_t crc_calc = ~crc16_be((uint16_t)~0x0000, data, length - 2);
-
-        ESP_LOGI(tag_msg, "[=========== GlucoseRx ===========]");
-        ESP_LOGI(tag_msg, "\ttransmitter state = %s (0x%x)", translate_transmitter_state(transmitter_state),
-            transmitter_state);
-        ESP_LOGI(tag_msg, "\tcalibration state = %s (0x%x)", translate_calibration_state(calibration_state),
-                 calibration_state);
-        ESP_LOGI(tag_msg, "\tsequence  = 0x%x", sequence);
-        ESP_LOGI(tag_msg, "\ttimestamp = 0x%x", timestamp);
-        ESP_LOGI(tag_msg, "\tglucose   = %d", glucose);
-        ESP_LOGI(tag_msg, "\ttrend     = 0x%x", trend);
-        ESP_LOGI(tag_msg, "\treceived crc = 0x%02x, calculated crc = 0x%02x", crc, crc_calc);
-
-        if(last_sequence - sequence == 0) {
+dgr_parse_glucose_msg(const msg_view *msg, uint16_t conn_handle) {
+    glucose_rx rx;
+
+    dgr_decode_glucose_rx(msg->data, &rx);
+
+    ESP_LOGI(tag_msg, "[=========== GlucoseRx ===========]");
+    ESP_LOGI(tag_msg, "\ttransmitter state = %s (0x%x)", translate_transmitter_state(rx.transmitter_state),
+        rx.transmitter_state);
+    ESP_LOGI(tag_msg, "\tcalibration state = %s (0x%x)", translate_calibration_state(rx.calibration_state),
+             rx.calibration_state);
+    ESP_LOGI(tag_msg, "\tsequence  = 0x%x", rx.sequence);
+    ESP_LOGI(tag_msg, "\ttimestamp = 0x%x", rx.timestamp);
+    ESP_LOGI(tag_msg, "\tglucose   = %d", rx.glucose);
+    ESP_LOGI(tag_msg, "\ttrend     = 0x%x", rx.trend);
+
+    switch(dgr_check_glucose_rx(&rx, last_sequence, msg->crc_ok)) {
+        case reading_valid:
+            break;
+        case reading_duplicate:
             ESP_LOGE(tag_msg, "Duplicate Reading.");
+            dgr_metrics_count(&metrics, metrics_duplicate_readings, 1);
             dgr_error();
-        } else if(sequence < last_sequence) {
+            break;
+        case reading_out_of_band:
             ESP_LOGE(tag_msg, "Out of Band Reading. last_sequence = %d, sequence = %d",
-                     last_sequence, sequence);
+                     last_sequence, rx.sequence);
+            dgr_metrics_count(&metrics, metrics_out_of_band_readings, 1);
             dgr_error();
-        }
-
-        if(crc != crc_calc) {
-            ESP_LOGE(tag_msg, "GlucoseRx : Calculated CRC does not match received CRC.");
+            break;
+        case reading_bad_crc:
             dgr_error();
-        }
-
-        if(calibration_state != CALIB_STATE_OK) {
+            break;
+        case reading_not_calibrated:
             ESP_LOGE(tag_msg, "GlucoseRx : Transmitter is not in OK state. state = %s (0x%02x)",
-                translate_calibration_state(calibration_state), calibration_state);
+                translate_calibration_state(rx.calibration_state), rx.calibration_state);
             dgr_error();
-        }
+            break;
+    }
 
-        dgr_save_to_ringbuffer(timestamp, glucose, calibration_state, trend);
-        dgr_check_for_backfill_and_sleep(conn_handle, sequence);
-    } else {
-        ESP_LOGE(tag_msg, "Received GlucoseRx message has wrong length(%d).", length);
-        dgr_error();
+    dgr_remember_transmitter(conn_handle);
+    dgr_schedule_reading(&schedule, rx.timestamp);
+    dgr_pipeline_glucose_received(conn_handle);
+    dgr_save_reading(rx.timestamp, rx.glucose, rx.calibration_state, rx.trend, false);
+    glucose_sequence = rx.sequence;
+    dgr_post_event(session_ev_glucose_rx);
+}
+
+void
+dgr_parse_backfill_status_msg(const msg_view *msg, uint16_t conn_handle) {
+    backfill_rx rx;
+
+    dgr_decode_backfill_rx(msg->data, &rx);
+
+    ESP_LOGI(tag_msg, "[=========== BackfillRx ===========]");
+    ESP_LOGI(tag_msg, "\tstatus = 0x%x", rx.status);
+    ESP_LOGI(tag_msg, "\tstart_time   = 0x%x", rx.start_time);
+    ESP_LOGI(tag_msg, "\tend_time     = 0x%x", rx.end_time);
+
+    // notifications of the backfill characteristic from here on answer this request
+    dgr_backfill_resume(&backfill);
+    ble_npl_callout_reset(&backfill_callout, ble_npl_time_ms_to_ticks32(BACKFILL_IDLE_TIMEOUT));
+}
+
+void
+dgr_parse_time_msg(const msg_view *msg, uint16_t conn_handle) {
+    time_rx rx;
+
+    dgr_decode_time_rx(msg->data, &rx);
+
+    ESP_LOGI(tag_msg, "TransmitterTimeRx (state = %d)", rx.state);
+    ESP_LOGI(tag_msg, "\tcurrent time       = 0x%x", rx.current_time);
+    ESP_LOGI(tag_msg, "\tsession start time = 0x%x", rx.session_start);
+
+    dgr_schedule_time_sync(&schedule, rx.current_time, dgr_rtc_time_ms());
+
+    // readings of the last COVERAGE_HORIZON can be backfilled, but not from before the sensor session
+    backfill_window_start = rx.current_time > COVERAGE_HORIZON ? rx.current_time - COVERAGE_HORIZON : 0;
+    if(rx.session_start <= rx.current_time && rx.session_start > backfill_window_start) {
+        backfill_window_start = rx.session_start;
+    }
+    backfill_window_end = rx.current_time - 60; // one minute before
+    dgr_backfill_init(&backfill);
+
+    dgr_pipeline_time_received(conn_handle);
+    dgr_post_event(session_ev_time_rx);
+}
+
+static void
+dgr_save_backfilled_reading(const reading *r, void *arg) {
+    dgr_save_reading(r->timestamp, r->glucose, r->calibration_state, r->trend, true);
+}
+
+/**
+ * Requests the oldest missing readings of the backfill window. A long hole is
+ * requested in chunks of BACKFILL_CHUNK_READINGS. While more chunks follow,
+ * the transmitter is asked to keep the connection and the deadline of the
+ * backfill is extended. The KeepAlive follows the write of the BackfillTx,
+ * so only one write is outstanding at a time.
+ *
+ * @param conn_handle       Connection to the transmitter
+ * @param from              Readings before this timestamp are not requested
+ * @return                  false if no reading is missing
+ */
+bool
+dgr_request_missing_readings(uint16_t conn_handle, uint32_t from) {
+    coverage_range rest;
+
+    if(!dgr_find_missing_readings(from > backfill_window_start ? from : backfill_window_start,
+                                  backfill_window_end, BACKFILL_CHUNK_READINGS, &backfill_range)) {
+        return false;
+    }
+
+    backfill_conn_handle = conn_handle;
+    backfill_start_time = backfill_range.start;
+    backfill_end_time = backfill_range.end;
+    dgr_backfill_restart(&backfill);
+    dgr_pipeline_request_backfill(conn_handle);
+
+    if(dgr_find_missing_readings(backfill_range.end + 1, backfill_window_end, 1, &rest)) {
+        ESP_LOGI(tag_msg, "Backfill : more readings missing from %x, keeping the connection.", rest.start);
+        backfill_keep_alive = true;
+        dgr_extend_deadline(BACKFILL_KEEP_ALIVE * 1000);
     }
+    return true;
 }
 
+/**
+ * Called when the write of a BackfillTx completed.
+ *
+ * @param conn_handle       Connection to the transmitter
+ */
 void
-dgr_parse_backfill_status_msg(const uint8_t *data, uint8_t length) {
-    if(length == 20) {
-        uint8_t status = data[1];
-        uint8_t unknown_1 = data[2];
-        uint8_t unknown_2 = data[3];
-        uint32_t start_time = make_u32_from_bytes_le(&data[4]);
-        uint32_t end_time = make_u32_from_bytes_le(&data[8]);
-        uint16_t crc = make_u16_from_bytes_le(&data[18]);
-        uint16_t crc_calc = ~crc16_be((uint16_t)~0x0000, data, length - 2);
-
-        ESP_LOGI(tag_msg, "[=========== BackfillRx ===========]");
-        ESP_LOGI(tag_msg, "\tstatus = 0x%x", status);
-        ESP_LOGI(tag_msg, "\tstart_time   = 0x%x", start_time);
-        ESP_LOGI(tag_msg, "\tend_time     = 0x%x", end_time);
-        ESP_LOGI(tag_msg, "\treceived crc = 0x%x", crc);
-        ESP_LOGI(tag_msg, "\tcalculated crc = 0x%x", crc_calc);
-
-        expecting_backfill = true;
-    } else {
-        ESP_LOGE(tag_msg, "Received Backfill status message has wrong length(%d).", length);
-        dgr_error();
+dgr_backfill_tx_written(uint16_t conn_handle) {
+    if(backfill_keep_alive) {
+        backfill_keep_alive = false;
+        dgr_send_keep_alive_msg(conn_handle, BACKFILL_KEEP_ALIVE);
+    }
+}
+
+/**
+ * Finishes a request after the transmitter sent all it had for it and
+ * continues with the next hole.
+ */
+static void
+dgr_finish_backfill_request() {
+    ble_npl_callout_stop(&backfill_callout);
+    dgr_resolve_missing_readings(&backfill_range);
+
+    if(!dgr_request_missing_readings(backfill_conn_handle, backfill_range.end + 1)) {
+        ESP_LOGI(tag_msg, "Backfill : done, %d readings received.", backfill.records);
+        dgr_post_event(session_ev_backfill_done);
     }
 }
 
+/**
+ * Requests the readings after the last received record again, the data after
+ * a gap cannot be aligned to the records.
+ */
+static void
+dgr_repeat_backfill() {
+    ble_npl_callout_stop(&backfill_callout);
+    dgr_backfill_restart(&backfill);
+
+    if(backfill_retries >= BACKFILL_RETRIES) {
+        // the holes stay in the coverage map for the next wake cycle
+        ESP_LOGW(tag_msg, "Backfill : gap after %d retries, keeping %d readings.", backfill_retries, backfill.records);
+        dgr_post_event(session_ev_backfill_done);
+        return;
+    }
+    backfill_retries++;
+
+    if(backfill.records > 0 && backfill.last_timestamp + 1 > backfill_start_time) {
+        backfill_start_time = backfill.last_timestamp + 1;
+    }
+    ESP_LOGW(tag_msg, "Backfill : gap after %d readings, requesting the rest again.", backfill.records);
+    dgr_metrics_count(&metrics, metrics_backfill_gaps, 1);
+    dgr_send_backfill_tx_msg(backfill_conn_handle);
+}
+
+/**
+ * Called when no backfill notification arrived for a while. With buffered
+ * notifications the missing one is lost, otherwise the request is finished.
+ */
 void
-dgr_parse_time_msg(const uint8_t *data, uint8_t length, uint16_t conn_handle) {
-    if(length == 16) {
-        uint8_t state = data[1];
-        // seconds since transmitter start
-        uint32_t current_time = make_u32_from_bytes_le(&data[2]);
-        // seconds since session start
-        uint32_t session_start_time = make_u32_from_bytes_le(&data[6]);
-
-        ESP_LOGI(tag_msg, "TransmitterTimeRx (state = %d)", state);
-        ESP_LOGI(tag_msg, "\tcurrent time       = 0x%x", current_time);
-        ESP_LOGI(tag_msg, "\tsession start time = 0x%x", session_start_time);
-
-        // set backfill related times
-        backfill_start_time = current_time - (60*30); // 30 mins before
-        backfill_end_time = current_time - 60; // one minute before
-
-        dgr_send_glucose_tx_msg(conn_handle);
-    } else {
-        ESP_LOGE(tag_msg, "Received Time message has wrong length(%d).", length);
-        dgr_error();
+dgr_backfill_timeout_cb(struct ble_npl_event *ev) {
+    if(backfill.pending > 0) {
+        dgr_repeat_backfill();
+    } else if(!backfill.stale) {
+        dgr_finish_backfill_request();
     }
 }
 
 void
-dgr_parse_backfill_data_msg(const uint8_t *data, const uint8_t length) {
-    if(length > 2) {
-        uint8_t sequence = data[0];
-        uint8_t identifier = data[1];
+dgr_parse_backfill_data_msg(const msg_view *msg, uint16_t conn_handle) {
+    const uint8_t *data = msg->data;
+    uint32_t records = backfill.records;
 
-        if(sequence == next_backfill_sequence) {
-            next_backfill_sequence++;
+    backfill_conn_handle = conn_handle;
 
-            if(sequence == 1) {
-                uint16_t request_counter = make_u16_from_bytes_le(&data[2]);
-                uint16_t unknown = make_u16_from_bytes_le(&data[4]);
+    // every record is saved as soon as it is complete, a dropped link keeps the ones received so far
+    switch(dgr_backfill_feed(&backfill, data, msg->length, dgr_save_backfilled_reading, NULL)) {
+        case backfill_ok:
+            if(data[0] == 1) {
                 ESP_LOGI(tag_msg, "Backfill:");
-                ESP_LOGI(tag_msg, "\trequest counter = %d", request_counter);
-
-                ESP_LOGI(tag_msg, "Added these bytes to the backfill buffer:");
-                ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, &data[6], length - 6, ESP_LOG_INFO);
-                memcpy(&backfill_buffer[backfill_buffer_pos], &data[6], length - 6);
-                backfill_buffer_pos += length - 6;
+                ESP_LOGI(tag_msg, "\trequest counter = %d", backfill.request_counter);
+            }
+            ESP_LOGI(tag_msg, "Backfill data %d : %d readings saved, %d bytes carried.",
+                data[0], backfill.records - records, backfill.carried);
+            if(backfill.pending == 0 && backfill.records > records &&
+               backfill.last_timestamp + READING_INTERVAL > backfill_range.end) {
+                // the last slot of the request arrived
+                dgr_finish_backfill_request();
             } else {
-                ESP_LOGI(tag_msg, "Added these bytes to the backfill buffer:");
-                ESP_LOG_BUFFER_HEX_LEVEL(tag_msg, &data[2], length - 2, ESP_LOG_INFO);
-                memcpy(&backfill_buffer[backfill_buffer_pos], &data[2], length - 2);
-                backfill_buffer_pos += length - 2;
+                ble_npl_callout_reset(&backfill_callout, ble_npl_time_ms_to_ticks32(
+                    backfill.pending > 0 ? BACKFILL_GAP_TIMEOUT : BACKFILL_IDLE_TIMEOUT));
+            }
+            break;
+        case backfill_buffered:
+            ESP_LOGI(tag_msg, "Backfill data %d : waiting for %d.", data[0], backfill.next_sequence);
+            dgr_metrics_count(&metrics, metrics_backfill_reordered, 1);
+            if(backfill.pending == 1) {
+                ble_npl_callout_reset(&backfill_callout, ble_npl_time_ms_to_ticks32(BACKFILL_GAP_TIMEOUT));
             }
-        } else {
-            ESP_LOGE(tag_msg, "Received out-of-order Backfill data which is not supported.");
+            break;
+        case backfill_duplicate:
+        case backfill_stale:
+            ESP_LOGD(tag_msg, "Backfill data %d : dropped.", data[0]);
+            break;
+        case backfill_gap:
+            dgr_repeat_backfill();
+            break;
+        case backfill_bad_length:
+            ESP_LOGE(tag_msg, "Received Backfill data message has wrong length(%d).", msg->length);
             dgr_error();
-        }
-    } else {
-        ESP_LOGE(tag_msg, "Received Backfill data message has wrong length(%d).", length);
-        dgr_error();
+            break;
     }
 }
 
-
 /*****************************************************************************
  *  message util functions                                                   *
  *****************************************************************************/
@@ -419,22 +553,26 @@ dgr_create_mbuf_pool() {
 
 void
 dgr_create_crypto_context() {
-    key[0] = 0x30;
-    key[1] = 0x30;
-    key[8] = 0x30;
-    key[9] = 0x30;
-
-    for(int i = 0; i < 6; i++) {
-        key[i + 2] = transmitter_id[i];
-        key[i + 10] = transmitter_id[i];
-    }
+    dgr_auth_make_key(transmitter_id, key);
 
     ESP_LOGI(tag_msg, "AES key :");
     ESP_LOG_BUFFER_HEXDUMP(tag_msg, key, 16, ESP_LOG_INFO);
 
-    mbedtls_aes_init(&aes_ecb_ctx);
-    mbedtls_aes_setkey_enc(&aes_ecb_ctx, key, 128);
-    mbedtls_aes_setkey_dec(&aes_ecb_ctx, key, 128);
+    if(!dgr_platform_aes_set_key(key)) {
+        dgr_error();
+    }
+}
+
+/**
+ * Draws and hashes the token of the next AuthRequestTx. Called while the radio
+ * scans, so the authentication can start right after the discovery.
+ */
+void
+dgr_stage_auth_token() {
+    if(!dgr_auth_stage_token(&next_token)) {
+        ESP_LOGE(tag_msg, "Error while encrypting.");
+        dgr_error();
+    }
 }
 
 void
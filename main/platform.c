@@ -0,0 +1,42 @@
+#include "esp_system.h"
+#include "mbedtls/aes.h"
+
+#include "dexcom_g6_reader.h"
+
+/* Platform services of the core library on the ESP32. */
+
+const char* tag_platform = "[Dexcom-G6-Reader][platform]";
+// only the encryption key is set, the authentication never decrypts
+static mbedtls_aes_context aes_ecb_ctx;
+
+void
+dgr_platform_random(uint8_t *data, size_t len) {
+    esp_fill_random(data, len);
+}
+
+bool
+dgr_platform_aes_set_key(const uint8_t key[PLATFORM_AES_BLOCK]) {
+    int rc;
+
+    mbedtls_aes_init(&aes_ecb_ctx);
+    rc = mbedtls_aes_setkey_enc(&aes_ecb_ctx, key, 128);
+    if(rc != 0) {
+        ESP_LOGE(tag_platform, "Error while setting the AES key. rc = 0x%04x", rc);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+dgr_platform_aes_encrypt(const uint8_t in[PLATFORM_AES_BLOCK], uint8_t out[PLATFORM_AES_BLOCK]) {
+    int rc;
+
+    rc = mbedtls_aes_crypt_ecb(&aes_ecb_ctx, MBEDTLS_AES_ENCRYPT, in, out);
+    if(rc != 0) {
+        ESP_LOGE(tag_platform, "Error while encrypting. rc = 0x%04x", rc);
+        return false;
+    }
+
+    return true;
+}
@@ -1,152 +1,446 @@
 #include <esp_sleep.h>
+#include <esp_partition.h>
+#include <driver/uart.h>
 #include "dexcom_g6_reader.h"
-#include "esp32/rom/crc.h"
 
-#define BUFFER_SIZE         420     // 28 bytes * 15
-#define BUFFER_TYPE         RINGBUF_TYPE_NOSPLIT
-RTC_DATA_ATTR StaticRingbuffer_t buffer_struct;
-RTC_DATA_ATTR uint8_t buffer_storage[BUFFER_SIZE];
-RTC_DATA_ATTR RingbufHandle_t rbuf_handle;
+#define BUFFER_SIZE         420     // bytes of RTC memory for the readings
+#define LOG_CAPACITY        (BUFFER_SIZE / sizeof(reading))
+RTC_DATA_ATTR reading log_records[LOG_CAPACITY];
+RTC_DATA_ATTR reading_log readings;
+#define ARCHIVE_BLOCKS      (BUFFER_SIZE / sizeof(ts_block))
+RTC_DATA_ATTR ts_block archive_blocks[ARCHIVE_BLOCKS];
+RTC_DATA_ATTR ts_archive archive;
+RTC_DATA_ATTR journal history;
 RTC_DATA_ATTR uint32_t last_sequence = 0;
+RTC_DATA_ATTR coverage_map coverage;
+static const esp_partition_t *journal_partition = NULL;
+// guards the stores, the queries may run on other tasks than the nimble host
+static SemaphoreHandle_t storage_mutex = NULL;
+static StaticSemaphore_t storage_mutex_buffer;
+// export buffers are static to keep them off the task stack
+static export_batch export_readings;
+static uint8_t export_frame[EXPORT_MAX_FRAME];
+static uint16_t export_max;
+// oldest reading saved in this wake cycle, the debug output starts there
+static uint32_t cycle_oldest = UINT32_MAX;
 
 static const char *tag_stg = "[Dexcom-G6-Reader][storage]";
 
+static int
+dgr_flash_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    return esp_partition_read(ctx, offset, buf, len);
+}
+
+static int
+dgr_flash_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+    return esp_partition_write(ctx, offset, buf, len);
+}
+
+static int
+dgr_flash_erase(void *ctx, uint32_t offset, size_t len) {
+    return esp_partition_erase_range(ctx, offset, len);
+}
+
+static flash_ops journal_flash = {
+    .read = dgr_flash_read,
+    .write = dgr_flash_write,
+    .erase = dgr_flash_erase,
+    .sector_size = SPI_FLASH_SEC_SIZE
+};
+
+/**
+ * Inserts a reading into the reading log in timestamp order. When the log
+ * drops its oldest reading, that reading is moved to the compressed archive.
+ * A reading older than the whole log can still go to the archive if it is
+ * newer than the archived ones.
+ *
+ * @param r                     Reading
+ * @param conflict              What to do with a stored reading of the same timestamp
+ * @return                      true if the reading was stored
+ */
+static bool
+dgr_store_reading(const reading *r, reading_conflict_policy conflict) {
+    reading evicted;
+
+    switch(dgr_reading_log_insert(&readings, r, conflict, &evicted)) {
+    case reading_log_overwrote:
+        if(!dgr_ts_archive_append(&archive, &evicted)) {
+            ESP_LOGW(tag_stg, "Oldest reading is out of order, not archived.");
+        }
+        break;
+    case reading_log_duplicate:
+        ESP_LOGI(tag_stg, "Reading 0x%x is already stored.", r->timestamp);
+        return false;
+    case reading_log_rejected:
+        if(readings.policy == reading_log_overwrite_oldest && dgr_ts_archive_append(&archive, r)) {
+            break;
+        }
+        ESP_LOGW(tag_stg, "Reading log is full, dropping reading 0x%x.", r->timestamp);
+        return false;
+    default:
+        break;
+    }
+
+    dgr_coverage_mark(&coverage, r->timestamp);
+    return true;
+}
+
+static bool
+dgr_cover_reading(const reading *r, void *arg) {
+    dgr_coverage_mark(&coverage, r->timestamp);
+    return true;
+}
+
+/**
+ * Refills the reading log and the archive with the newest pages of the journal
+ * after they were lost with the RTC memory.
+ */
+static void
+dgr_replay_journal() {
+    reading page[JOURNAL_PAGE_READINGS];
+    uint32_t pages = dgr_journal_pages(&history);
+    uint8_t count;
+
+    for(uint32_t i = pages > JOURNAL_REPLAY_PAGES ? pages - JOURNAL_REPLAY_PAGES : 0; i < pages; i++) {
+        if(dgr_journal_read_page(&history, i, page, &count) != 0) {
+            ESP_LOGW(tag_stg, "Skipping unreadable journal page %d.", i);
+            continue;
+        }
+        for(int k = 0; k < count; k++) {
+            dgr_store_reading(&page[k], reading_conflict_keep);
+        }
+    }
+}
+
+/**
+ * Opens the journal partition. The journal is kept in RTC memory after a
+ * timer wakeup, otherwise its end is searched in the flash.
+ *
+ * @param keep_journal          true to keep the journal of an earlier wake cycle
+ */
+static void
+dgr_init_journal(bool keep_journal) {
+    journal_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE,
+                                                 JOURNAL_PARTITION);
+    if(journal_partition == NULL) {
+        ESP_LOGW(tag_stg, "No journal partition, readings are lost on reset.");
+        return;
+    }
+    journal_flash.ctx = (void *) journal_partition;
+    journal_flash.size = journal_partition->size / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+
+    if(keep_journal && dgr_journal_valid(&history, &journal_flash)) {
+        return;
+    }
+
+    if(dgr_journal_recover(&history, &journal_flash) != 0) {
+        ESP_LOGE(tag_stg, "Journal recovery failed.");
+    }
+    ESP_LOGI(tag_stg, "Recovered journal with %d pages after %d header reads.",
+             dgr_journal_pages(&history), history.recovery_reads);
+}
+
+/**
+ * Initializes the reading log, the compressed archive of older readings, the
+ * coverage of the timeline and the journal. All but the journal are in RTC
+ * memory, so they are kept after a timer wakeup unless their management data
+ * is corrupted. A new reading log is refilled from the journal, a new
+ * coverage map from the stored readings.
+ *
+ * @param keep_readings         true to keep the readings of an earlier wake cycle
+ */
 void
-dgr_init_ringbuffer() {
-    rbuf_handle = xRingbufferCreateStatic(BUFFER_SIZE, BUFFER_TYPE, (uint8_t*)&buffer_storage, &buffer_struct);
+dgr_init_storage(bool keep_readings) {
+    bool replay = false;
+    bool rebuild_coverage = false;
+    reading_cursor cursor;
+
+    storage_mutex = xSemaphoreCreateMutexStatic(&storage_mutex_buffer);
+
+    if(!keep_readings || !dgr_coverage_valid(&coverage)) {
+        dgr_coverage_init(&coverage);
+        rebuild_coverage = true;
+    }
+
+    if(keep_readings && dgr_reading_log_valid(&readings, log_records, LOG_CAPACITY)) {
+        ESP_LOGI(tag_stg, "Keeping %d stored readings.", dgr_reading_log_count(&readings));
+    } else {
+        dgr_reading_log_init(&readings, log_records, LOG_CAPACITY, STORAGE_FULL_POLICY);
+        replay = true;
+    }
+
+    if(keep_readings && dgr_ts_archive_valid(&archive, archive_blocks, ARCHIVE_BLOCKS)) {
+        ESP_LOGI(tag_stg, "Keeping %d archived readings.", dgr_ts_archive_readings(&archive));
+    } else {
+        dgr_ts_archive_init(&archive, archive_blocks, ARCHIVE_BLOCKS);
+    }
+
+    dgr_init_journal(keep_readings);
+    if(replay && journal_partition != NULL) {
+        dgr_replay_journal();
+    }
+
+    if(rebuild_coverage) {
+        dgr_query_range(&cursor, &readings, &archive, 0, UINT32_MAX);
+        dgr_query_visit(&cursor, dgr_cover_reading, NULL);
+        ESP_LOGI(tag_stg, "Rebuilt coverage, %d of %d slots covered.", dgr_coverage_count(&coverage), COVERAGE_SLOTS);
+    }
 }
 
 /**
- * Saves the given values in the ringbuffer
+ * Saves a reading in the reading log and stages it for the journal. The
+ * journal page is written once it is full. A live reading replaces a stored
+ * one with the same timestamp, for a backfilled reading BACKFILL_CONFLICT_POLICY
+ * decides.
  *
  * @param timestamp             Timestamp of a glucose reading
  * @param glucose               Glucose value of a reading
  * @param calibration_state     Calibration state of a reading
  * @param trend                 Trend value of a reading
+ * @param backfilled            true if the reading was received by backfill
  */
 void
-dgr_save_to_ringbuffer(uint32_t timestamp, uint16_t glucose, uint8_t calibration_state, uint8_t trend) {
-    size_t free_size = xRingbufferGetCurFreeSize(rbuf_handle);
-    // 8 bytes data + 8 byte header
-    if(free_size >= 16) {
-        uint8_t in[8];
-        write_u32_le(in, timestamp);
-        write_u16_le(&in[4], glucose);
-        in[6] = calibration_state;
-        in[7] = trend;
-
-        UBaseType_t res = xRingbufferSend(rbuf_handle, in, 8, pdMS_TO_TICKS(5000));
-
-        if (res != pdTRUE) {
-            ESP_LOGE(tag_stg, "Error while writing into ringbuffer. rc = 0x%04x", res);
-            dgr_error();
-        }
-    } else {
-        ESP_LOGE(tag_stg, "Ringbuffer is full. Printing debug info.");
-        dgr_print_rbuf(false);
-        //TODO: maybe do something more useful
+dgr_save_reading(uint32_t timestamp, uint16_t glucose, uint8_t calibration_state, uint8_t trend, bool backfilled) {
+    reading r = {
+        .timestamp = timestamp,
+        .glucose = glucose,
+        .calibration_state = calibration_state,
+        .trend = trend
+    };
+    bool stored;
+
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    if(timestamp < cycle_oldest) {
+        cycle_oldest = timestamp;
+    }
+    stored = dgr_store_reading(&r, backfilled ? BACKFILL_CONFLICT_POLICY : reading_conflict_replace);
+    if(stored && journal_partition != NULL && dgr_journal_append(&history, &r) != 0) {
+        ESP_LOGW(tag_stg, "Writing the journal failed, the reading is only kept in RTC memory.");
+    }
+    xSemaphoreGive(storage_mutex);
+}
+
+/**
+ * Writes the staged readings to the journal before they could be lost, e.g.
+ * on error paths. The page is written even if it is not full.
+ */
+void
+dgr_flush_storage() {
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    if(journal_partition != NULL && history.staged > 0 && dgr_journal_flush(&history) != 0) {
+        ESP_LOGW(tag_stg, "Flushing the journal failed.");
     }
+    xSemaphoreGive(storage_mutex);
+}
+
+/**
+ * Passes the stored readings of a time range to a function, oldest first.
+ * The function runs with the storage locked and must not save readings.
+ *
+ * @param from                  First timestamp of the range
+ * @param to                    Last timestamp of the range
+ * @param visit                 Function called for every reading, returns false to stop
+ * @param arg                   Argument of the function
+ * @return                      Number of visited readings
+ */
+uint32_t
+dgr_query_readings(uint32_t from, uint32_t to, reading_visitor visit, void *arg) {
+    reading_cursor cursor;
+    uint32_t visited;
+
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    dgr_query_range(&cursor, &readings, &archive, from, to);
+    visited = dgr_query_visit(&cursor, visit, arg);
+    xSemaphoreGive(storage_mutex);
+
+    return visited;
+}
+
+/**
+ * Passes the newest stored readings to a function, oldest first.
+ *
+ * @param n                     Number of readings
+ * @param visit                 Function called for every reading, returns false to stop
+ * @param arg                   Argument of the function
+ * @return                      Number of visited readings
+ */
+uint32_t
+dgr_query_latest_readings(uint32_t n, reading_visitor visit, void *arg) {
+    reading_cursor cursor;
+    uint32_t visited;
+
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    dgr_query_latest(&cursor, &readings, &archive, n);
+    visited = dgr_query_visit(&cursor, visit, arg);
+    xSemaphoreGive(storage_mutex);
+
+    return visited;
+}
+
+/**
+ * Finds the stored reading closest in time to a timestamp.
+ *
+ * @param timestamp             Timestamp
+ * @param out                   The reading is written to this variable
+ * @return                      false if there are no readings
+ */
+bool
+dgr_query_nearest_reading(uint32_t timestamp, reading *out) {
+    bool found;
+
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    found = dgr_query_nearest(&readings, &archive, timestamp, out);
+    xSemaphoreGive(storage_mutex);
+
+    return found;
+}
+
+/**
+ * Finds the oldest missing readings in a time range.
+ *
+ * @param from                  First timestamp of the range
+ * @param to                    Last timestamp of the range
+ * @param max_readings          Longer holes are cut to this number of readings
+ * @param hole                  The time range of the missing readings is written to this variable
+ * @return                      false if no reading is missing
+ */
+bool
+dgr_find_missing_readings(uint32_t from, uint32_t to, uint16_t max_readings, coverage_range *hole) {
+    bool found;
+
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    found = dgr_coverage_next_chunk(&coverage, from, to, max_readings, hole);
+    xSemaphoreGive(storage_mutex);
+
+    return found;
 }
 
 /**
- * After a glucose reading was received, this function checks if backfill is needed.
+ * Marks a time range as complete after the transmitter sent all readings it
+ * had for it, so its remaining holes are not requested again.
+ *
+ * @param range                 Time range of a finished backfill request
+ */
+void
+dgr_resolve_missing_readings(const coverage_range *range) {
+    xSemaphoreTake(storage_mutex, portMAX_DELAY);
+    dgr_coverage_mark_range(&coverage, range);
+    xSemaphoreGive(storage_mutex);
+}
+
+/**
+ * After a glucose reading was received, this function checks if backfill is
+ * needed. The coverage of the timeline decides, not the sequence numbers, so
+ * holes older than the last wake cycle are repaired as well.
  *
  * @param conn_handle           Connection handle
  * @param sequence              Sequence number of the last glucose reading
  */
 void
-dgr_check_for_backfill_and_sleep(uint16_t conn_handle, uint32_t sequence) {
-    // dont do backfill after the first reading
+dgr_check_for_backfill(uint16_t conn_handle, uint32_t sequence) {
     uint32_t sequence_diff = last_sequence == 0 ? 0 : sequence - last_sequence;
     last_sequence = sequence;
 
+    ESP_LOGI(tag_stg, "Sequence difference is : %d, %d of %d slots covered.", sequence_diff,
+             dgr_coverage_count(&coverage), COVERAGE_SLOTS);
+    // backfill notifications are already enabled by the session setup
+    if(!dgr_request_missing_readings(conn_handle, 0)) {
+        ESP_LOGI(tag_stg, "No Backfill necessary.");
+        dgr_post_event(session_ev_backfill_done);
+    }
+}
 
-    if(sequence_diff == 1) {
-        // tear down bt?
-        ESP_LOGI(tag_stg, "No Backfill necessary. Going to deep sleep for %d seconds", SLEEP_BETWEEN_READINGS);
-        dgr_print_rbuf(true);
-        esp_deep_sleep(SLEEP_BETWEEN_READINGS * 1000000); // time is in microseconds
-    } else if(sequence_diff > 1 || sequence_diff == 0) {
-        // enable backfill notifications
-        ESP_LOGI(tag_stg, "Sequence difference is : %d. Starting backfill.", sequence_diff);
-        dgr_enable_server_side_updates_msg(conn_handle, &backfill_uuid.u, dgr_send_backfill_enable_notif_cb, 2);
-    } else {
-        ESP_LOGE(tag_stg, "Unexpected difference between sequences : %d", sequence_diff);
-        dgr_error();
+static bool
+dgr_export_reading(const reading *r, void *arg) {
+    if(dgr_export_add(&export_readings, r)) {
+        uart_write_bytes(EXPORT_UART, (const char *) export_frame, dgr_export_data_frame(&export_readings, export_frame));
     }
 
+    return export_max == 0 || export_readings.sent + export_readings.count < export_max;
 }
 
 /**
- * After all backfill data is received, parse and save all of it in the ringbuffer.
+ * Sends the stored readings from a timestamp on as DATA frames, followed by an END frame.
+ *
+ * @param from                  First timestamp
+ * @param max                   Maximum number of readings, 0 for all
  */
-void
-dgr_parse_backfill() {
-    int i = 0;
+static void
+dgr_export_from(uint32_t from, uint16_t max) {
+    size_t len;
 
-    ESP_LOGI(tag_stg, "Starting to parse Backfill data.");
-    while(i < backfill_buffer_pos) {
-        uint32_t timestamp = make_u32_from_bytes_le(&backfill_buffer[i]);
-        uint16_t glucose = make_u16_from_bytes_le(&backfill_buffer[i + 4]);
-        uint8_t calibration_state = backfill_buffer[i + 6];
-        uint8_t trend = backfill_buffer[i + 7];
+    dgr_export_begin(&export_readings, from);
+    export_max = max;
+    dgr_query_readings(from, UINT32_MAX, dgr_export_reading, NULL);
 
-        ESP_LOGI(tag_stg, "[=========== Backfill Data ===========]");
-        ESP_LOGI(tag_stg, "\ttimestamp         = 0x%x", timestamp);
-        ESP_LOGI(tag_stg, "\tglucose           = %d", glucose);
-        ESP_LOGI(tag_stg, "\tcalibration state = %s (0x%x)",
-            translate_calibration_state(calibration_state), calibration_state);
-        ESP_LOGI(tag_stg, "\ttrend             = 0x%x", trend);
-        i += 8;
-
-        dgr_save_to_ringbuffer(timestamp, glucose, calibration_state, trend);
+    len = dgr_export_data_frame(&export_readings, export_frame);
+    if(len > 0) {
+        uart_write_bytes(EXPORT_UART, (const char *) export_frame, len);
     }
+    uart_write_bytes(EXPORT_UART, (const char *) export_frame, dgr_export_end_frame(&export_readings, export_frame));
+    uart_wait_tx_done(EXPORT_UART, portMAX_DELAY);
 }
 
 /**
- * Prints content of the ringbuffer for debug purposes.
+ * Answers the GET frames of a host on the console UART until no byte arrives
+ * for a while. Without a byte within the probe time the boot goes on right
+ * away, the host repeats its request until the reader answers.
  *
- * @param keep_items            true if all ringbuffer items should be kept in the ringbuffer,
- *                              false if ringbuffer items should be discarded after output
+ * @param probe                 Time to wait for the first byte in milliseconds, 0 skips the export
+ * @param window                Time to wait for the next byte in milliseconds
  */
 void
-dgr_print_rbuf(bool keep_items) {
-    uint8_t buffer_save[BUFFER_SIZE];
-    int i = 0;
-
-    size_t item_size;
-    uint8_t *data = (uint8_t *)xRingbufferReceive(rbuf_handle, &item_size, pdMS_TO_TICKS(1000));
-
-    xRingbufferPrintInfo(rbuf_handle);
-    while(data != NULL) {
-        uint32_t timestamp = make_u32_from_bytes_le(data);
-        uint16_t glucose = make_u16_from_bytes_le(&data[4]);
-        uint8_t calibration_state = data[6];
-        uint8_t trend = data[7];
-
-        ESP_LOGI(tag_stg, "[=========== RingbufItem (size=%d) ===========]", item_size);
-        ESP_LOGI(tag_stg, "\ttimestamp = 0x%x", timestamp);
-        ESP_LOGI(tag_stg, "\tglucose   = %d", glucose);
-        ESP_LOGI(tag_stg, "\tcalibration state = %s",
-                 translate_calibration_state(calibration_state));
-        ESP_LOGI(tag_stg, "\ttrend             = 0x%x", trend);
-
-        if(keep_items) {
-            memcpy(&buffer_save[i++ * item_size], data, item_size);
-        }
-        vRingbufferReturnItem(rbuf_handle, data);
-        data = (uint8_t *)xRingbufferReceive(rbuf_handle, &item_size, pdMS_TO_TICKS(1000));
-    }
+dgr_serve_export(uint32_t probe, uint32_t window) {
+    uint8_t request[16];
+    size_t len = 0;
+    uint32_t wait = probe;
+    uint32_t from;
+    uint16_t max;
+    uint8_t c;
 
-    // resave items
-    if(keep_items) {
-        for (int j = 0; j < i; j++) {
-            UBaseType_t res = xRingbufferSend(rbuf_handle, &buffer_save[j * item_size], 8, pdMS_TO_TICKS(5000));
+    if(probe == 0) {
+        return;
+    }
+    if(!uart_is_driver_installed(EXPORT_UART) &&
+       uart_driver_install(EXPORT_UART, EXPORT_UART_RX_BUFFER, 0, 0, NULL, 0) != ESP_OK) {
+        ESP_LOGW(tag_stg, "Can not install the UART driver for the export.");
+        return;
+    }
 
-            if (res != pdTRUE) {
-                ESP_LOGE(tag_stg, "Error while writing into ringbuffer. rc = 0x%04x", res);
-                dgr_error();
+    while(uart_read_bytes(EXPORT_UART, &c, 1, pdMS_TO_TICKS(wait)) == 1) {
+        // a host is connected
+        wait = window;
+        if(c != 0) {
+            if(len < sizeof request) {
+                request[len] = c;
+            }
+            len++;
+        } else {
+            if(len > 0 && len <= sizeof request && dgr_export_parse_get(request, len, &from, &max)) {
+                dgr_export_from(from, max);
             }
+            len = 0;
         }
     }
-}
\ No newline at end of file
+}
+
+static bool
+dgr_print_reading(const reading *r, void *arg) {
+    ESP_LOGI(tag_stg, "\t0x%08x glucose %3d trend 0x%02x %s", r->timestamp, r->glucose, r->trend,
+             translate_calibration_state(r->calibration_state));
+    return true;
+}
+
+/**
+ * Prints the fill level of the stores and the readings saved in this wake
+ * cycle for debug purposes. The readings are walked in place and are kept.
+ */
+void
+dgr_print_storage() {
+    ESP_LOGI(tag_stg, "[=========== Storage (log %d/%d, archive %d in %d blocks, journal %d pages + %d, "
+             "coverage %d/%d) ===========]",
+             dgr_reading_log_count(&readings), readings.capacity, dgr_ts_archive_readings(&archive),
+             dgr_ts_archive_blocks(&archive), dgr_journal_pages(&history), history.staged,
+             dgr_coverage_count(&coverage), COVERAGE_SLOTS);
+    dgr_query_readings(cycle_oldest, UINT32_MAX, dgr_print_reading, NULL);
+}
@@ -18,6 +18,48 @@ addr_to_string(const void *addr) {
     return buf;
 }
 
+/**
+ * Searches an advertisement for a single AD structure without parsing all fields.
+ *
+ * @param data          Advertisement data
+ * @param length        Length of the advertisement data
+ * @param type          Wanted AD type
+ * @param field_len     Length of the found field is written to this variable
+ * @return              Pointer to the field data, NULL if not found
+ */
+const uint8_t*
+dgr_find_adv_field(const uint8_t *data, uint8_t length, uint8_t type, uint8_t *field_len) {
+    uint8_t pos = 0;
+
+    while(pos + 1 < length) {
+        uint8_t len = data[pos];
+
+        if(len == 0 || pos + 1 + len > length) {
+            break;
+        }
+        if(data[pos + 1] == type) {
+            *field_len = len - 1;
+            return &data[pos + 2];
+        }
+        pos += len + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns the time of the RTC, which keeps running during deep sleep.
+ *
+ * @return              Time in milliseconds
+ */
+int64_t
+dgr_rtc_time_ms() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 void
 print_adv_fields(struct ble_hs_adv_fields *adv_fields) {
     register int i;
@@ -125,6 +167,29 @@ dgr_print_conn_sec_state(struct ble_gap_sec_state conn_sec) {
     ESP_LOGI(tag_util, "key size = %d", conn_sec.key_size);
 }
 
+static const void*
+dgr_mbuf_segment(const void *segment, const uint8_t **data, uint16_t *len) {
+    const struct os_mbuf *om = segment;
+
+    *data = om->om_data;
+    *len = om->om_len;
+    return SLIST_NEXT(om, om_next);
+}
+
+/**
+ * Updates a CRC-16 over a part of an mbuf chain without copying it.
+ *
+ * @param crc           CRC so far, CRC16_INIT to start
+ * @param om            First mbuf of the chain
+ * @param off           Offset of the part in the chain
+ * @param len           Length of the part
+ * @return              Updated CRC
+ */
+uint16_t
+dgr_crc16_mbuf(uint16_t crc, const struct os_mbuf *om, uint16_t off, uint16_t len) {
+    return dgr_crc16_chain(crc, om, dgr_mbuf_segment, off, len);
+}
+
 uint32_t
 make_u32_from_bytes_le(const uint8_t *bytes) {
     return bytes[0] | (uint32_t) bytes[1] << 8U
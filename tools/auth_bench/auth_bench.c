@@ -0,0 +1,299 @@
+/* Benchmark and check of the authentication path of the core library.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/auth_bench [iterations]
+ *
+ * The platform services are implemented here with a plain AES-128 after
+ * FIPS-197, checked against the example vector of the standard. The setup
+ * is timed with the encryption and decryption key schedule, like the
+ * firmware set it up before, and with the encryption schedule only. The
+ * encrypt path covers dgr_auth_hash and the staging of the next AuthRequestTx
+ * token.
+ *
+ * The numbers are those of this software AES on the host. The firmware is
+ * built with CONFIG_MBEDTLS_HARDWARE_AES, where mbedtls hands the key to the
+ * AES peripheral and computes no key schedule at all, so the setup rows say
+ * nothing about the ESP32.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "auth.h"
+
+#define BENCH_ROUNDS                10
+#define BENCH_ROUND_KEYS            (4 * (BENCH_ROUNDS + 1))
+
+static uint8_t sbox[256];
+// InvMixColumns factors 0x09, 0x0b, 0x0d and 0x0e
+static uint8_t inv_mul[4][256];
+static uint32_t rk[BENCH_ROUND_KEYS];
+// inverse round keys, only computed to time the schedule the firmware dropped
+static uint32_t drk[BENCH_ROUND_KEYS];
+static volatile uint32_t sink;
+
+static const uint8_t fips_key[PLATFORM_AES_BLOCK] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                                     0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t fips_in[PLATFORM_AES_BLOCK] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                                    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+static const uint8_t fips_out[PLATFORM_AES_BLOCK] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+                                                     0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t
+bench_xtime(uint8_t x) {
+    return (uint8_t) (x << 1U) ^ ((x & 0x80U) ? 0x1bU : 0);
+}
+
+static uint8_t
+bench_mul(uint8_t a, uint8_t b) {
+    uint8_t product = 0;
+
+    while(b) {
+        if(b & 1U) {
+            product ^= a;
+        }
+        a = bench_xtime(a);
+        b >>= 1U;
+    }
+
+    return product;
+}
+
+/**
+ * Builds the S-box from the multiplicative inverse in GF(2^8) and the affine
+ * transformation, and the tables of the inverse key schedule.
+ */
+static void
+bench_init_sbox() {
+    for(int x = 0; x < 256; x++) {
+        uint8_t inv = 0;
+        uint8_t s;
+
+        for(int y = 1; x != 0 && y < 256; y++) {
+            if(bench_mul(x, y) == 1) {
+                inv = y;
+                break;
+            }
+        }
+        s = inv;
+        for(int i = 1; i < 5; i++) {
+            s ^= (uint8_t) (inv << i) | (uint8_t) (inv >> (8 - i));
+        }
+        sbox[x] = s ^ 0x63U;
+        inv_mul[0][x] = bench_mul(x, 0x09);
+        inv_mul[1][x] = bench_mul(x, 0x0b);
+        inv_mul[2][x] = bench_mul(x, 0x0d);
+        inv_mul[3][x] = bench_mul(x, 0x0e);
+    }
+}
+
+static uint32_t
+bench_sub_word(uint32_t w) {
+    return (uint32_t) sbox[w >> 24U] << 24U | (uint32_t) sbox[(w >> 16U) & 0xffU] << 16U |
+           (uint32_t) sbox[(w >> 8U) & 0xffU] << 8U | sbox[w & 0xffU];
+}
+
+static void
+bench_expand_key(const uint8_t *key, uint32_t *rk) {
+    uint8_t rcon = 1;
+
+    for(int i = 0; i < 4; i++) {
+        rk[i] = (uint32_t) key[4 * i] << 24U | (uint32_t) key[4 * i + 1] << 16U |
+                (uint32_t) key[4 * i + 2] << 8U | key[4 * i + 3];
+    }
+    for(int i = 4; i < BENCH_ROUND_KEYS; i++) {
+        uint32_t t = rk[i - 1];
+
+        if(i % 4 == 0) {
+            t = bench_sub_word(t << 8U | t >> 24U) ^ (uint32_t) rcon << 24U;
+            rcon = bench_xtime(rcon);
+        }
+        rk[i] = rk[i - 4] ^ t;
+    }
+}
+
+/**
+ * Key schedule of the equivalent inverse cipher like mbedtls_aes_setkey_dec:
+ * the encryption schedule in reverse order with InvMixColumns applied to the
+ * inner round keys.
+ */
+static void
+bench_expand_dec_key(const uint8_t *key, uint32_t *rk) {
+    uint32_t enc[BENCH_ROUND_KEYS];
+
+    bench_expand_key(key, enc);
+    for(int round = 0; round <= BENCH_ROUNDS; round++) {
+        for(int i = 0; i < 4; i++) {
+            uint32_t w = enc[4 * (BENCH_ROUNDS - round) + i];
+            uint8_t b[4] = {w >> 24U, w >> 16U, w >> 8U, w};
+
+            if(round > 0 && round < BENCH_ROUNDS) {
+                uint8_t m[4];
+
+                for(int r = 0; r < 4; r++) {
+                    m[r] = inv_mul[3][b[r]] ^ inv_mul[1][b[(r + 1) % 4]] ^
+                           inv_mul[2][b[(r + 2) % 4]] ^ inv_mul[0][b[(r + 3) % 4]];
+                }
+                memcpy(b, m, sizeof b);
+            }
+            rk[4 * round + i] = (uint32_t) b[0] << 24U | (uint32_t) b[1] << 16U | (uint32_t) b[2] << 8U | b[3];
+        }
+    }
+}
+
+static void
+bench_encrypt(const uint32_t *rk, const uint8_t *in, uint8_t *out) {
+    uint8_t s[PLATFORM_AES_BLOCK];
+
+    for(int i = 0; i < PLATFORM_AES_BLOCK; i++) {
+        s[i] = in[i] ^ (uint8_t) (rk[i / 4] >> (24U - 8U * (i % 4)));
+    }
+    for(int round = 1; round <= BENCH_ROUNDS; round++) {
+        uint8_t t[PLATFORM_AES_BLOCK];
+
+        // SubBytes and ShiftRows, the state is stored column by column
+        for(int c = 0; c < 4; c++) {
+            for(int r = 0; r < 4; r++) {
+                t[4 * c + r] = sbox[s[4 * ((c + r) % 4) + r]];
+            }
+        }
+        for(int c = 0; c < 4; c++) {
+            uint8_t *col = &t[4 * c];
+
+            if(round < BENCH_ROUNDS) {
+                uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+                uint8_t first = col[0];
+
+                col[0] ^= all ^ bench_xtime(col[0] ^ col[1]);
+                col[1] ^= all ^ bench_xtime(col[1] ^ col[2]);
+                col[2] ^= all ^ bench_xtime(col[2] ^ col[3]);
+                col[3] ^= all ^ bench_xtime(col[3] ^ first);
+            }
+            for(int r = 0; r < 4; r++) {
+                s[4 * c + r] = col[r] ^ (uint8_t) (rk[4 * round + c] >> (24U - 8U * r));
+            }
+        }
+    }
+    memcpy(out, s, PLATFORM_AES_BLOCK);
+}
+
+void
+dgr_platform_random(uint8_t *data, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        data[i] = rand();
+    }
+}
+
+// like main/platform.c, only the encryption key is set
+bool
+dgr_platform_aes_set_key(const uint8_t key[PLATFORM_AES_BLOCK]) {
+    bench_expand_key(key, rk);
+    return true;
+}
+
+bool
+dgr_platform_aes_encrypt(const uint8_t in[PLATFORM_AES_BLOCK], uint8_t out[PLATFORM_AES_BLOCK]) {
+    bench_encrypt(rk, in, out);
+    return true;
+}
+
+static int
+bench_check() {
+    uint8_t out[PLATFORM_AES_BLOCK];
+    uint8_t key[AUTH_KEY_SIZE];
+    uint8_t block[PLATFORM_AES_BLOCK];
+    uint8_t hash[AUTH_TOKEN_SIZE];
+    auth_token next = {0};
+    int errors = 0;
+
+    dgr_platform_aes_set_key(fips_key);
+    dgr_platform_aes_encrypt(fips_in, out);
+    errors += memcmp(out, fips_out, sizeof out) != 0;
+
+    // first and last inverse round key are the last and first encryption round key
+    bench_expand_dec_key(fips_key, drk);
+    errors += memcmp(&drk[0], &rk[4 * BENCH_ROUNDS], 4 * sizeof drk[0]) != 0;
+    errors += memcmp(&drk[4 * BENCH_ROUNDS], &rk[0], 4 * sizeof drk[0]) != 0;
+
+    dgr_auth_make_key("8G1234", key);
+    errors += memcmp(key, "008G1234008G1234", AUTH_KEY_SIZE) != 0;
+
+    // the hash is the first half of the encryption of the token written twice
+    dgr_platform_aes_set_key(key);
+    errors += !dgr_auth_stage_token(&next) || !next.ready;
+    memcpy(block, next.token, AUTH_TOKEN_SIZE);
+    memcpy(&block[AUTH_TOKEN_SIZE], next.token, AUTH_TOKEN_SIZE);
+    dgr_platform_aes_encrypt(block, out);
+    errors += memcmp(out, next.hash, AUTH_TOKEN_SIZE) != 0;
+    // a staged token stays until it was sent
+    memcpy(hash, next.hash, AUTH_TOKEN_SIZE);
+    dgr_auth_stage_token(&next);
+    errors += memcmp(hash, next.hash, AUTH_TOKEN_SIZE) != 0;
+
+    return errors;
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    uint8_t key[AUTH_KEY_SIZE];
+    uint8_t hash[AUTH_TOKEN_SIZE];
+    auth_token next = {0};
+    double start;
+    int errors;
+
+    bench_init_sbox();
+    errors = bench_check();
+    printf("%s\n", errors == 0 ? "auth checks ok" : "auth checks FAILED");
+    dgr_auth_make_key("8G1234", key);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        key[AUTH_KEY_SIZE - 1] = i;
+        bench_expand_key(key, rk);
+        bench_expand_dec_key(key, drk);
+        sink += rk[BENCH_ROUND_KEYS - 1] ^ drk[BENCH_ROUND_KEYS - 1];
+    }
+    printf("setup, enc and dec schedule           %7.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        key[AUTH_KEY_SIZE - 1] = i;
+        dgr_platform_aes_set_key(key);
+        sink += rk[BENCH_ROUND_KEYS - 1];
+    }
+    printf("setup, enc schedule                   %7.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        hash[0] = i;
+        dgr_auth_hash(hash, hash);
+    }
+    sink += hash[0];
+    printf("dgr_auth_hash                         %7.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        next.ready = false;
+        dgr_auth_stage_token(&next);
+        sink += next.hash[0];
+    }
+    printf("stage token, draw and hash            %7.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        dgr_auth_stage_token(&next);
+        sink += next.hash[0];
+    }
+    printf("stage token, already staged           %7.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/* Benchmark of the backfill of a long gap over a simulated link.
+ *
+ *  gcc -O2 -I components/dgr_core -o backfill_bench tools/backfill_sim/backfill_bench.c \
+ *      components/dgr_core/backfill.c components/dgr_core/coverage.c
+ *  ./backfill_bench [missing readings, at most 287] [connection interval in ms] [notifications per event] \
+ *      [loss in percent]
+ *
+ * The transmitter holds a reading every 5 minutes, the reader misses the
+ * newest ones, e.g. all 287 readings of the 24 h horizon before the live one
+ * after a day without power. The reader plans its requests with the coverage
+ * map and parses the notifications with the streaming parser like the
+ * firmware does. The link is modeled by connection
+ * events: a request takes a write and its response, the BackfillRx status
+ * arrives in the next event, then the data follows with a number of 20 byte
+ * notifications per event. Lost notifications are found by the reassembly
+ * window or the gap timeout and requested again.
+ *
+ * Without keep alive the backfill ends at the 20 s deadline of the session
+ * state, the rest is left for the next wake cycle. Chunked transfers keep the
+ * connection with a keep alive per request. The default link finishes a
+ * single request well within the deadline, so without a link given the
+ * benchmark also runs a slow link of 200 ms with one notification per event,
+ * where a single request and chunks without keep alive hit the deadline.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backfill.h"
+#include "coverage.h"
+
+#define NOW                         2000000
+#define DEADLINE                    20000 // in ms, of the backfill state
+#define KEEP_ALIVE                  25000 // in ms
+#define GAP_TIMEOUT                 200
+#define IDLE_TIMEOUT                2000
+#define RETRIES                     2
+#define PAYLOAD                     18 // record bytes in a 20 byte notification
+
+typedef struct bench_result {
+    uint32_t requests;
+    uint32_t notifications;
+    uint32_t records;
+    uint32_t retries;
+    double ms;
+    bool complete;
+} bench_result;
+
+static coverage_map map;
+
+static void
+bench_save(const reading *r, void *arg) {
+    (void) arg;
+    dgr_coverage_mark(&map, r->timestamp);
+}
+
+/**
+ * Builds the notifications the transmitter sends for a request.
+ *
+ * @return                  Number of notifications
+ */
+static uint32_t
+bench_stream(uint32_t start, uint32_t end, uint8_t packets[][20], uint8_t *lengths) {
+    uint8_t records[COVERAGE_SLOTS * BACKFILL_RECORD_SIZE];
+    uint32_t size = 0;
+    uint32_t pos = 0;
+    uint32_t count = 0;
+
+    for(uint32_t ts = NOW - (COVERAGE_SLOTS - 1) * READING_INTERVAL; ts <= NOW; ts += READING_INTERVAL) {
+        if(ts >= start && ts <= end) {
+            uint8_t *r = &records[size];
+
+            r[0] = ts; r[1] = ts >> 8U; r[2] = ts >> 16U; r[3] = ts >> 24U;
+            r[4] = 120; r[5] = 0; r[6] = 6; r[7] = 0x80;
+            size += BACKFILL_RECORD_SIZE;
+        }
+    }
+
+    do {
+        uint8_t header = count == 0 ? BACKFILL_FIRST_HEADER : BACKFILL_HEADER;
+        uint32_t take = size - pos < 20U - header ? size - pos : 20U - header;
+
+        memset(packets[count], 0, 20);
+        packets[count][0] = count + 1;
+        memcpy(&packets[count][header], &records[pos], take);
+        lengths[count] = header + take;
+        pos += take;
+        count++;
+    } while(pos < size);
+
+    return count;
+}
+
+/**
+ * Drains the gap in one connection.
+ *
+ * @param chunk             Readings per request, COVERAGE_SLOTS for a single request
+ * @param keep_alive        true to keep the connection while more requests follow
+ */
+static bench_result
+bench_run(uint32_t missing, double interval, uint32_t per_event, int loss, uint16_t chunk, bool keep_alive) {
+    static uint8_t packets[COVERAGE_SLOTS * BACKFILL_RECORD_SIZE / PAYLOAD + 2][20];
+    uint8_t lengths[COVERAGE_SLOTS * BACKFILL_RECORD_SIZE / PAYLOAD + 2];
+    bench_result result = {0};
+    backfill_parser parser;
+    coverage_range range;
+    uint32_t from = NOW - COVERAGE_HORIZON + 1;
+    uint32_t to = NOW;
+    double deadline = DEADLINE;
+    double t = 0;
+
+    srand(1);
+    dgr_coverage_init(&map);
+    for(uint32_t ts = NOW - (COVERAGE_SLOTS - 1) * READING_INTERVAL; ts + missing * READING_INTERVAL < NOW;
+        ts += READING_INTERVAL) {
+        dgr_coverage_mark(&map, ts);
+    }
+    // the reading of this wake cycle came with GlucoseRx
+    dgr_coverage_mark(&map, NOW);
+    dgr_backfill_init(&parser);
+
+    while(dgr_coverage_next_chunk(&map, from, to, chunk, &range)) {
+        uint32_t start = range.start;
+        uint32_t count;
+        coverage_range rest;
+        bool finished = false;
+
+        result.requests++;
+        if(keep_alive && dgr_coverage_next_chunk(&map, range.end + 1, to, 1, &rest)) {
+            deadline = t + KEEP_ALIVE > deadline ? t + KEEP_ALIVE : deadline;
+        }
+
+        while(!finished && t < deadline) {
+            uint32_t i = 0;
+
+            // BackfillTx and its write response, BackfillRx in the next event
+            t += 3 * interval;
+            dgr_backfill_restart(&parser);
+            dgr_backfill_resume(&parser);
+            count = bench_stream(start, range.end, packets, lengths);
+
+            while(i < count && t < deadline) {
+                backfill_result fed = backfill_ok;
+
+                t += interval;
+                for(uint32_t k = 0; k < per_event && i < count; k++, i++) {
+                    result.notifications++;
+                    if(rand() % 100 < loss) {
+                        continue;
+                    }
+                    fed = dgr_backfill_feed(&parser, packets[i], lengths[i], bench_save, NULL);
+                    if(fed == backfill_gap) {
+                        break;
+                    }
+                }
+                if(fed == backfill_gap) {
+                    break;
+                }
+            }
+            if(t >= deadline) {
+                break;
+            }
+
+            if(parser.pending == 0 && parser.carried == 0 && i == count && parser.records > 0 &&
+               parser.last_timestamp + READING_INTERVAL > range.end) {
+                finished = true;
+            } else if(parser.pending == 0 && i == count && parser.carried == 0) {
+                // the last slot has no reading, the idle timeout finishes the request
+                t += IDLE_TIMEOUT;
+                finished = true;
+            } else if(result.retries < RETRIES) {
+                // a notification is missing, found by the window or after the gap timeout
+                t += parser.pending > 0 || i == count ? GAP_TIMEOUT : 0;
+                if(parser.records > 0 && parser.last_timestamp + 1 > start) {
+                    start = parser.last_timestamp + 1;
+                }
+                result.retries++;
+            } else {
+                deadline = t;
+            }
+        }
+        if(!finished) {
+            break;
+        }
+        dgr_coverage_mark_range(&map, &range);
+    }
+
+    result.records = parser.records;
+    result.ms = t;
+    result.complete = !dgr_coverage_next_chunk(&map, from, to, 1, &range);
+    return result;
+}
+
+static void
+bench_print(const char *name, bench_result r) {
+    printf("%-22s %3u requests %4u notifications %3u retries %4u readings in %7.0f ms, %6.1f readings/s%s\n",
+           name, r.requests, r.notifications, r.retries, r.records, r.ms,
+           r.ms > 0 ? r.records * 1000.0 / r.ms : 0, r.complete ? "" : ", incomplete");
+}
+
+static void
+bench_link(uint32_t missing, double interval, uint32_t per_event, int loss) {
+    printf("%u missing readings, connection interval %.1f ms, %u notifications per event, %d%% loss\n",
+           missing, interval, per_event, loss);
+    bench_print("single request", bench_run(missing, interval, per_event, loss, COVERAGE_SLOTS, false));
+    bench_print("chunks of 72", bench_run(missing, interval, per_event, loss, 72, true));
+    bench_print("chunks of 24", bench_run(missing, interval, per_event, loss, 24, true));
+    bench_print("chunks of 72, no keep", bench_run(missing, interval, per_event, loss, 72, false));
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t missing = argc > 1 ? atoi(argv[1]) : COVERAGE_SLOTS - 1;
+    double interval = argc > 2 ? atof(argv[2]) : 30;
+    uint32_t per_event = argc > 3 ? atoi(argv[3]) : 4;
+    int loss = argc > 4 ? atoi(argv[4]) : 0;
+
+    // the newest slot of the horizon is the reading of this wake cycle
+    if(missing > COVERAGE_SLOTS - 1) {
+        printf("%u missing readings clamped to %d, the newest slot of the horizon is the live reading\n", missing,
+               COVERAGE_SLOTS - 1);
+        missing = COVERAGE_SLOTS - 1;
+    }
+
+    bench_link(missing, interval, per_event, loss);
+    if(argc <= 2) {
+        // a slow link, where a single request runs into the deadline
+        printf("\n");
+        bench_link(missing, 200, 1, loss);
+    }
+    return 0;
+}
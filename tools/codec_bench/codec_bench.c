@@ -0,0 +1,146 @@
+/* Benchmark and check of the message codec of the core library.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/codec_bench [iterations]
+ *
+ * A recorded TimeRx message and generated GlucoseRx messages are looked up in
+ * the message table, checked and decoded like the firmware does with a
+ * notification. BackfillTx is encoded and its CRC checked. The time per
+ * message shows the cost of the codec without the BLE stack.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "codec.h"
+#include "crc16.h"
+
+static const uint8_t recorded_time_rx[] = {0x25, 0x00, 0x47, 0x02, 0x72, 0x00, 0x7c, 0xff,
+                                           0x71, 0x00, 0x01, 0x00, 0x00, 0x00, 0xfa, 0x1d};
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_glucose_rx(uint8_t *msg, uint32_t sequence, uint32_t timestamp, uint16_t glucose) {
+    uint16_t crc;
+
+    memset(msg, 0, GLUCOSE_RX_LENGTH);
+    msg[0] = GLUCOSE_RX_OPCODE;
+    for(int i = 0; i < 4; i++) {
+        msg[GLUCOSE_RX_SEQUENCE + i] = sequence >> (8U * i);
+        msg[GLUCOSE_RX_TIMESTAMP + i] = timestamp >> (8U * i);
+    }
+    msg[GLUCOSE_RX_GLUCOSE] = glucose;
+    msg[GLUCOSE_RX_GLUCOSE + 1] = glucose >> 8U;
+    msg[GLUCOSE_RX_CALIBRATION_STATE] = CALIB_STATE_OK;
+    crc = dgr_crc16(msg, GLUCOSE_RX_LENGTH - 2);
+    msg[GLUCOSE_RX_LENGTH - 2] = crc;
+    msg[GLUCOSE_RX_LENGTH - 1] = crc >> 8U;
+}
+
+static bool
+bench_crc_ok(const uint8_t *data, uint8_t length) {
+    return dgr_crc16(data, length - 2) == (data[length - 2] | (uint16_t) data[length - 1] << 8U);
+}
+
+/**
+ * Handles a notification of the control characteristic like the firmware.
+ *
+ * @return                  Decoded glucose value, 0 for other messages
+ */
+static uint32_t
+bench_receive(const uint8_t *data, uint8_t length, uint32_t last_sequence) {
+    const msg_desc *desc = dgr_msg_find(msg_control, data[0]);
+    bool crc_ok;
+
+    if(desc == NULL || !dgr_msg_length_ok(desc, length)) {
+        return 0;
+    }
+    crc_ok = !(desc->flags & MSG_CRC) || bench_crc_ok(data, length);
+
+    if(desc->opcode == GLUCOSE_RX_OPCODE) {
+        glucose_rx rx;
+
+        dgr_decode_glucose_rx(data, &rx);
+        return dgr_check_glucose_rx(&rx, last_sequence, crc_ok) == reading_valid ? rx.glucose : 0;
+    } else if(desc->opcode == TIME_RX_OPCODE) {
+        time_rx rx;
+
+        dgr_decode_time_rx(data, &rx);
+        return crc_ok ? rx.state : 0;
+    }
+
+    return 0;
+}
+
+static int
+bench_check() {
+    uint8_t msg[MSG_MAX_LENGTH];
+    time_rx time;
+    glucose_rx glucose;
+    int errors = 0;
+
+    dgr_decode_time_rx(recorded_time_rx, &time);
+    errors += time.current_time != 0x720247 || time.session_start != 0x71ff7c;
+    errors += dgr_msg_find(msg_control, TIME_RX_OPCODE) == NULL;
+    errors += dgr_msg_find(msg_backfill, TIME_RX_OPCODE) != NULL;
+
+    bench_glucose_rx(msg, 1000, 600300, 0x1234);
+    dgr_decode_glucose_rx(msg, &glucose);
+    errors += glucose.sequence != 1000 || glucose.timestamp != 600300 || glucose.glucose != 0x234;
+    errors += dgr_check_glucose_rx(&glucose, 1000, true) != reading_duplicate;
+    errors += dgr_check_glucose_rx(&glucose, 1001, true) != reading_out_of_band;
+    errors += dgr_check_glucose_rx(&glucose, 999, false) != reading_bad_crc;
+    errors += dgr_check_glucose_rx(&glucose, 999, true) != reading_valid;
+    errors += !dgr_msg_length_ok(dgr_msg_find(msg_control, GLUCOSE_RX_OPCODE), GLUCOSE_RX_LENGTH + 3);
+    errors += dgr_msg_length_ok(dgr_msg_find(msg_control, TIME_RX_OPCODE), TIME_RX_LENGTH + 1);
+
+    dgr_encode_backfill_tx(msg, 0x1000, 0x2000);
+    errors += msg[0] != BACKFILL_TX_OPCODE || msg[BACKFILL_TX_START_TIME + 1] != 0x10 ||
+              !bench_crc_ok(msg, BACKFILL_TX_LENGTH);
+    errors += !bench_crc_ok(dgr_glucose_tx_frame, GLUCOSE_TX_LENGTH) || !bench_crc_ok(dgr_time_tx_frame, TIME_TX_LENGTH);
+    errors += !bench_crc_ok(recorded_time_rx, sizeof recorded_time_rx);
+
+    return errors;
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 2000000;
+    uint8_t glucose[GLUCOSE_RX_LENGTH];
+    uint8_t backfill_tx[BACKFILL_TX_LENGTH];
+    volatile uint32_t sink = 0;
+    int errors = bench_check();
+    double start;
+
+    printf("%s\n", errors == 0 ? "codec checks ok" : "codec checks FAILED");
+
+    bench_glucose_rx(glucose, 1000, 600300, 120);
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        sink += bench_receive(glucose, GLUCOSE_RX_LENGTH, 999);
+    }
+    printf("GlucoseRx  find, check, decode %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        sink += bench_receive(recorded_time_rx, sizeof recorded_time_rx, 0);
+    }
+    printf("TimeRx     find, check, decode %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        dgr_encode_backfill_tx(backfill_tx, i, i + 3600);
+        sink += backfill_tx[BACKFILL_TX_LENGTH - 1];
+    }
+    printf("BackfillTx encode              %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    (void) sink;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/* Benchmark and check of the CRC-16 variants.
+ *
+ *  gcc -O2 -DDGR_CRC16_ALL -I components/dgr_core -o crc16_bench tools/crc16_bench/crc16_bench.c \
+ *      components/dgr_core/crc16.c
+ *  ./crc16_bench [iterations]
+ *
+ * Every variant is compared with a bit by bit reference on random data, also
+ * when the CRC is updated over random pieces like the segments of an mbuf
+ * chain, and CRC16_CONST_BYTE for every byte. The recorded G6 packets are
+ * checked against a model of the ESP32 ROM call the firmware used before,
+ * ~crc16_be(~0, data, len), and against the CRC the transmitter sent. The
+ * timing covers the message sizes of the transmitter (up to 20 bytes) and a
+ * journal page.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc16.h"
+
+typedef uint16_t (*crc16_fn)(uint16_t crc, const uint8_t *data, size_t len);
+
+typedef struct crc16_variant {
+    const char *name;
+    crc16_fn fn;
+} crc16_variant;
+
+typedef struct g6_packet {
+    const char *name;
+    const char *hex;
+} g6_packet;
+
+static const crc16_variant variants[] = {
+    {"bytewise", dgr_crc16_bytewise},
+    {"table", dgr_crc16_table},
+    {"slice4", dgr_crc16_slice4},
+    {"slice8", dgr_crc16_slice8},
+};
+
+// packets with their CRC in the last two bytes, little-endian
+static const g6_packet packets[] = {
+    {"GlucoseTx", "4e0aa9"},
+    {"TimeTx", "24e664"},
+    {"TimeRx", "2500470272007cff710001000000fa1d"},
+};
+
+static uint16_t
+bench_reference(uint16_t crc, const uint8_t *data, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        for(int bit = 7; bit >= 0; bit--) {
+            uint16_t top = (crc >> 15U) ^ ((data[i] >> bit) & 1U);
+
+            crc = (uint16_t) (crc << 1U) ^ (top ? 0x1021U : 0);
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * Model of the ROM crc16_be: it complements the CRC before and after the
+ * update, so ~crc16_be(~0, ...) starts at 0 and returns the plain CRC.
+ */
+static uint16_t
+bench_rom_crc16_be(uint16_t crc, const uint8_t *data, size_t len) {
+    return ~bench_reference(~crc, data, len);
+}
+
+static size_t
+bench_parse_hex(const char *hex, uint8_t *out) {
+    size_t len = strlen(hex) / 2;
+
+    for(size_t i = 0; i < len; i++) {
+        unsigned int byte;
+
+        sscanf(&hex[2 * i], "%2x", &byte);
+        out[i] = byte;
+    }
+
+    return len;
+}
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench_check_random(uint32_t runs) {
+    uint8_t data[600];
+    int errors = 0;
+
+    srand(1);
+    for(uint32_t run = 0; run < runs; run++) {
+        size_t len = rand() % sizeof data;
+        uint16_t expected;
+
+        for(size_t i = 0; i < len; i++) {
+            data[i] = rand();
+        }
+        expected = bench_reference(CRC16_INIT, data, len);
+
+        for(size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+            uint16_t crc = CRC16_INIT;
+            size_t pos = 0;
+
+            if(variants[v].fn(CRC16_INIT, data, len) != expected) {
+                printf("%s: wrong CRC over %zu bytes\n", variants[v].name, len);
+                errors++;
+            }
+            // random segments of an mbuf chain
+            while(pos < len) {
+                size_t take = 1 + rand() % 32;
+
+                take = take > len - pos ? len - pos : take;
+                crc = variants[v].fn(crc, &data[pos], take);
+                pos += take;
+            }
+            if(crc != expected) {
+                printf("%s: wrong incremental CRC over %zu bytes\n", variants[v].name, len);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+static int
+bench_check_const() {
+    int errors = 0;
+
+    for(unsigned int byte = 0; byte < 256; byte++) {
+        uint8_t data[1] = {byte};
+
+        errors += CRC16_CONST_BYTE(byte) != bench_reference(CRC16_INIT, data, 1);
+    }
+    if(errors > 0) {
+        printf("CRC16_CONST_BYTE: %d wrong CRCs\n", errors);
+    }
+
+    return errors;
+}
+
+static int
+bench_check_packets() {
+    int errors = 0;
+
+    for(size_t p = 0; p < sizeof packets / sizeof packets[0]; p++) {
+        uint8_t data[20];
+        size_t len = bench_parse_hex(packets[p].hex, data);
+        uint16_t sent = data[len - 2] | (uint16_t) data[len - 1] << 8U;
+        uint16_t rom = ~bench_rom_crc16_be((uint16_t) ~0x0000, data, len - 2);
+        bool ok = rom == sent && dgr_crc16(data, len - 2) == sent;
+
+        for(size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+            ok = ok && variants[v].fn(CRC16_INIT, data, len - 2) == sent;
+        }
+        printf("%-10s crc 0x%04x, rom 0x%04x, %s\n", packets[p].name, sent, rom, ok ? "ok" : "MISMATCH");
+        errors += !ok;
+    }
+
+    return errors;
+}
+
+static void
+bench_time(size_t len, uint32_t iterations) {
+    static uint8_t data[1024];
+    volatile uint16_t sink = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        data[i] = i * 7 + 3;
+    }
+
+    printf("%4zu bytes:", len);
+    for(size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+        double start = bench_now();
+
+        for(uint32_t i = 0; i < iterations; i++) {
+            data[0] = i;
+            sink ^= variants[v].fn(CRC16_INIT, data, len);
+        }
+        printf("  %s %6.1f ns", variants[v].name, (bench_now() - start) * 1e9 / iterations);
+    }
+    printf("\n");
+    (void) sink;
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 2000000;
+    static const size_t sizes[] = {3, 10, 18, 20, 256, 1024};
+    int errors;
+
+    errors = bench_check_packets();
+    errors += bench_check_random(20000);
+    errors += bench_check_const();
+    printf("%s\n\n", errors == 0 ? "all variants match the reference" : "variants differ from the reference");
+
+    for(size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        bench_time(sizes[i], sizes[i] > 100 ? iterations / 20 : iterations);
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Estimates the battery life of the dexcom-g6-reader from recorded cycles.
+
+Before every deep sleep the reader logs a trace line
+"ENERGY <cpu ms> <scan ms> <connected ms> <sleep ms> <completed>".
+This script replays the recorded cycles of a monitor log under different
+policies and compares the consumption and the readings per battery charge.
+
+    python3 tools/dgr_energy.py monitor.log
+    python3 tools/dgr_energy.py monitor.log --policy nth3:every_nth=3 \\
+        --policy fixed600:fixed_sleep=600 --policy err60:sleep_after_error=60
+
+Policy parameters:
+    every_nth           wake up for every n-th reading, the others are fetched by backfill
+    fixed_sleep         sleep a fixed time in seconds instead of following the reading schedule
+    sleep_after_error   sleep after a failed cycle in seconds
+    backfill_ms         connected time per backfilled reading in milliseconds
+
+The model is simple: awake times of successful and failed cycles are averaged
+over the trace, failed cycles are retried after sleep_after_error. With a fixed
+sleep the wakeup is not aligned to the advertisement of the transmitter, so the
+reader scans on average half an advertising period with the duty cycled scan
+parameters of dexcom_g6_reader.h.
+"""
+
+import argparse
+import re
+import sys
+
+DAY = 86400.0                   # in seconds
+READING_INTERVAL = 300          # in seconds
+SCAN_DUTY_CYCLE = 0x30 / 0x200  # SCAN_WINDOW_DUTY_CYCLED / SCAN_ITVL_DUTY_CYCLED
+
+# currents in mA, see CURRENT_* in dexcom_g6_reader.h
+CPU_CURRENT = {80: 30.0, 160: 40.0, 240: 50.0}
+DEFAULTS = {"scan": 100.0, "connected": 95.0, "sleep": 0.010}
+
+DEFAULT_POLICY = {"every_nth": 1, "fixed_sleep": 0, "sleep_after_error": 30, "backfill_ms": 40}
+
+
+def parse_trace(text):
+    cycles = []
+    for m in re.finditer(r"ENERGY (\d+) (\d+) (\d+) (\d+) ([01])", text):
+        cpu, scan, connected, sleep, completed = (int(v) for v in m.groups())
+        cycles.append({"cpu": cpu / 1000.0, "scan": scan / 1000.0, "connected": connected / 1000.0,
+                       "sleep": sleep / 1000.0, "completed": completed == 1})
+    return cycles
+
+
+def parse_policy(spec):
+    name, _, params = spec.partition(":")
+    policy = dict(DEFAULT_POLICY)
+    for param in filter(None, params.split(",")):
+        key, _, value = param.partition("=")
+        if key not in policy:
+            sys.exit("unknown policy parameter %s" % key)
+        policy[key] = float(value)
+    return name, policy
+
+
+def mean(cycles, state):
+    return sum(c[state] for c in cycles) / len(cycles) if cycles else 0.0
+
+
+def estimate(cycles, policy, currents):
+    """Returns the charge per day in mAh and the readings per day."""
+    ok = [c for c in cycles if c["completed"]]
+    failed = [c for c in cycles if not c["completed"]]
+    if not ok:
+        sys.exit("the trace contains no successful cycle")
+
+    # failed attempts per successful cycle
+    retries = len(failed) / len(ok)
+    every_nth = max(1, int(policy["every_nth"]))
+
+    awake_ok = {s: mean(ok, s) for s in ("cpu", "scan", "connected")}
+    awake_failed = {s: mean(failed, s) for s in ("cpu", "scan", "connected")}
+    awake_ok["connected"] += (every_nth - 1) * policy["backfill_ms"] / 1000.0
+
+    if policy["fixed_sleep"] > 0:
+        period = policy["fixed_sleep"]
+        # the scan of a fixed wakeup waits half an advertising period on average
+        wait = READING_INTERVAL / 2.0
+        awake_ok["scan"] += wait * SCAN_DUTY_CYCLE
+        awake_ok["cpu"] += wait * (1 - SCAN_DUTY_CYCLE)
+        # every reading is fetched, most of them by backfill
+        readings = DAY / READING_INTERVAL
+    else:
+        period = READING_INTERVAL * every_nth
+        readings = DAY / period * every_nth
+
+    cycles_per_day = DAY / (period + retries * policy["sleep_after_error"])
+    charge = 0.0
+    awake = 0.0
+    for state in ("cpu", "scan", "connected"):
+        per_cycle = awake_ok[state] + retries * awake_failed[state]
+        charge += cycles_per_day * per_cycle * currents[state]
+        awake += cycles_per_day * per_cycle
+    charge += max(0.0, DAY - awake) * currents["sleep"]
+
+    return charge / 3600.0, readings
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog="\n".join(__doc__.splitlines()[2:]))
+    parser.add_argument("log", nargs="?", help="log file, stdin if omitted")
+    parser.add_argument("--policy", action="append", default=[], metavar="NAME:KEY=VALUE,...",
+                        help="policy to compare, can be given several times")
+    parser.add_argument("--battery", type=float, default=1000.0, help="battery capacity in mAh")
+    parser.add_argument("--cpu-mhz", type=int, default=160, choices=sorted(CPU_CURRENT),
+                        help="CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ")
+    for state, current in DEFAULTS.items():
+        parser.add_argument("--%s-ma" % state, type=float, default=current,
+                            help="current in %s state in mA (default %g)" % (state, current))
+    args = parser.parse_args()
+
+    text = open(args.log).read() if args.log else sys.stdin.read()
+    cycles = parse_trace(text)
+    if not cycles:
+        sys.exit("no ENERGY trace lines found")
+
+    currents = {"cpu": CPU_CURRENT[args.cpu_mhz], "scan": args.scan_ma,
+                "connected": args.connected_ma, "sleep": args.sleep_ma}
+    policies = [("recorded", dict(DEFAULT_POLICY))] + [parse_policy(p) for p in args.policy]
+
+    completed = sum(c["completed"] for c in cycles)
+    print("%d cycles, %d completed" % (len(cycles), completed))
+    print("mean awake time: cpu %.2f s, scan %.2f s, connected %.2f s\n" % (
+        mean(cycles, "cpu"), mean(cycles, "scan"), mean(cycles, "connected")))
+
+    print("%-12s %10s %10s %10s %16s" % ("policy", "mAh/day", "days", "readings", "readings/charge"))
+    for name, policy in policies:
+        mah, readings = estimate(cycles, policy, currents)
+        days = args.battery / mah
+        print("%-12s %10.2f %10.1f %10.0f %16.0f" % (name, mah, days, readings, days * readings))
+
+
+if __name__ == "__main__":
+    main()
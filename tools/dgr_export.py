@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""Pulls the stored readings of the dexcom-g6-reader over its console UART.
+
+After a reset the reader listens EXPORT_PROBE milliseconds for an export request,
+see components/dgr_core/export.h for the frame format. The script sends a GET frame, decodes
+the answer and prints the readings as CSV. With --state the cursor of the last
+export is kept in a file, so the next run only pulls new readings.
+
+    python3 tools/dgr_export.py /dev/ttyUSB0 --state readings.cursor >> readings.csv
+    python3 tools/dgr_export.py capture.bin      # decode frames recorded to a file
+
+Press the reset button of the board right before starting the script.
+"""
+
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+GET = 0x01
+DATA = 0x81
+END = 0x82
+RECORD = struct.Struct("<IHBB")         # layout of the reading log
+
+
+def crc16(data):
+    """CRC-16/XMODEM."""
+    crc = 0
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_pos = 0
+    code = 1
+    for byte in data:
+        if byte == 0:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+        else:
+            out.append(byte)
+            code += 1
+            if code == 0xff:
+                out[code_pos] = code
+                code_pos = len(out)
+                out.append(0)
+                code = 1
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        code = data[pos]
+        pos += 1
+        if code == 0 or pos + code - 1 > len(data):
+            return None
+        out += data[pos:pos + code - 1]
+        pos += code - 1
+        if code != 0xff and pos < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def get_frame(start, count):
+    payload = struct.pack("<BIH", GET, start, count)
+    return b"\0" + cobs_encode(payload + struct.pack("<H", crc16(payload))) + b"\0"
+
+
+class FrameDecoder:
+    """Splits a byte stream at the zero delimiters and checks the frames."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.bad_frames = 0
+
+    def feed(self, data):
+        self.buffer += data
+        *chunks, self.buffer = self.buffer.split(b"\0")
+        for chunk in filter(None, chunks):
+            payload = cobs_decode(bytes(chunk))
+            if payload is None or len(payload) < 3 or \
+                    crc16(payload[:-2]) != struct.unpack_from("<H", payload, len(payload) - 2)[0]:
+                # log output of the reader between frames ends up here
+                self.bad_frames += 1
+                continue
+            yield payload[:-2]
+
+
+def parse_frame(payload):
+    """Returns (type, next timestamp, readings or sent count)."""
+    if payload[0] == DATA and len(payload) >= 6:
+        count, cursor = struct.unpack_from("<BI", payload, 1)
+        readings = [RECORD.unpack_from(payload, 6 + i * RECORD.size) for i in range(count)]
+        return DATA, cursor, readings
+    if payload[0] == END and len(payload) == 9:
+        cursor, sent = struct.unpack_from("<II", payload, 1)
+        return END, cursor, sent
+    return None, None, None
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        attrs = termios.tcgetattr(fd)
+        speed = getattr(termios, "B%d" % baud)
+        attrs[4] = attrs[5] = speed
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def export(fd, start, count, timeout, out, interactive=True):
+    """Runs one export and returns (next timestamp, readings, seconds)."""
+    decoder = FrameDecoder()
+    received = 0
+    cursor = start
+    begin = time.monotonic()
+    last_request = 0.0
+
+    while True:
+        # the reader only listens for a moment after a reset, repeat the request until it answers
+        if interactive and received == 0 and time.monotonic() - last_request > 0.1:
+            os.write(fd, get_frame(start, count))
+            last_request = time.monotonic()
+        if interactive:
+            ready, _, _ = select.select([fd], [], [], 0.1)
+            if not ready:
+                if time.monotonic() - begin > timeout:
+                    sys.exit("no answer from the reader")
+                continue
+        data = os.read(fd, 4096)
+        if not data:
+            break
+        for payload in decoder.feed(data):
+            kind, cursor, content = parse_frame(payload)
+            if kind == DATA:
+                for timestamp, glucose, calibration, trend in content:
+                    out.write("%d,%d,%d,%d\n" % (timestamp, glucose, calibration, trend))
+                received += len(content)
+            elif kind == END:
+                if content != received:
+                    print("lost %d readings, repeat the export" % (content - received), file=sys.stderr)
+                return cursor, received, time.monotonic() - begin
+    return cursor, received, time.monotonic() - begin
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog="\n".join(__doc__.splitlines()[2:]))
+    parser.add_argument("port", help="serial port, pty or file with recorded frames")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--from", dest="start", type=int, default=0, help="first transmitter timestamp")
+    parser.add_argument("--max", type=int, default=0, help="maximum number of readings, 0 for all")
+    parser.add_argument("--state", help="file with the cursor of the last export")
+    parser.add_argument("--timeout", type=float, default=30.0, help="seconds to wait for the reader")
+    args = parser.parse_args()
+
+    start = args.start
+    if args.state and os.path.exists(args.state):
+        start = int(open(args.state).read())
+
+    fd = open_port(args.port, args.baud)
+    cursor, received, seconds = export(fd, start, args.max, args.timeout, sys.stdout,
+                                       interactive=os.isatty(fd))
+    os.close(fd)
+
+    if args.state:
+        with open(args.state, "w") as f:
+            f.write("%d\n" % cursor)
+    print("%d readings in %.3f s (%.0f readings/s), next timestamp %d"
+          % (received, seconds, received / seconds if seconds > 0 else 0, cursor), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
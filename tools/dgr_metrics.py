@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Decodes the metrics dump of the dexcom-g6-reader.
+
+The reader logs the dump as a line "METRICS <hex>" before every deep sleep.
+Pass a log file (e.g. saved from `make monitor`) or pipe the log into this
+script, the last dump found is decoded.
+
+    python3 tools/dgr_metrics.py monitor.log
+    python3 tools/dgr_metrics.py --hex 4447524d01...
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = b"DGRM"
+VERSION = 4
+
+# must match the enums in components/dgr_core/metrics.h and session.h
+MILESTONES = ["boot", "sync", "first_adv", "connected", "handles_known", "authenticated",
+              "encrypted", "glucose_rx", "backfill_done", "sleep"]
+PHASES = MILESTONES + ["awake"]
+COUNTERS = ["packets_rx", "bytes_rx", "crc_mismatches", "duplicate_readings",
+            "out_of_band_readings", "timeouts", "links_left_open", "backfill_reordered",
+            "backfill_gaps"]
+STATES = ["idle", "scan", "connect", "discover", "auth", "bond", "encrypt", "time",
+          "glucose", "backfill", "teardown", "done", "failed"]
+NOT_REACHED = 0xffffffff
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, fmt):
+        values = struct.unpack_from("<" + fmt, self.data, self.pos)
+        self.pos += struct.calcsize("<" + fmt)
+        return values if len(values) > 1 else values[0]
+
+
+def decode(data):
+    if data[:4] != MAGIC:
+        raise ValueError("not a metrics dump")
+
+    r = Reader(data)
+    r.take("4s")
+    version, n_milestones, n_states, n_counters, n_phases, n_buckets = r.take("6B")
+    r.take("H")  # reserved
+    if version != VERSION:
+        raise ValueError("unsupported version %d" % version)
+
+    metrics = {"cycles": r.take("I"), "completed_cycles": r.take("I")}
+    metrics["counters"] = {name(COUNTERS, i): r.take("I") for i in range(n_counters)}
+    metrics["errors"] = {name(STATES, i): r.take("H") for i in range(n_states)}
+    metrics["milestones"] = {name(MILESTONES, i): r.take("I") for i in range(n_milestones)}
+    metrics["phases"] = {}
+    for i in range(n_phases):
+        metrics["phases"][name(PHASES, i)] = histogram(r, n_buckets)
+    metrics["connect_after"] = {"link_left_open": histogram(r, n_buckets),
+                                "link_closed": histogram(r, n_buckets)}
+    metrics["connect_to_glucose"] = {"authentication": histogram(r, n_buckets),
+                                     "stored_bond": histogram(r, n_buckets)}
+    return metrics
+
+
+def histogram(r, n_buckets):
+    count, total, maximum = r.take("HII")
+    return {"count": count, "sum": total, "max": maximum,
+            "buckets": [r.take("H") for _ in range(n_buckets)]}
+
+
+def name(names, i):
+    return names[i] if i < len(names) else "#%d" % i
+
+
+def bucket_range(k):
+    """Bucket 0 holds durations below 1 ms, bucket k durations in [2^(k-1), 2^k) ms."""
+    return (0, 1) if k == 0 else (1 << (k - 1), 1 << k)
+
+
+def percentile(buckets, fraction):
+    """Upper bound of the bucket that holds the given fraction of all samples."""
+    total = sum(buckets)
+    if total == 0:
+        return None
+    seen = 0
+    for k, n in enumerate(buckets):
+        seen += n
+        if seen >= fraction * total:
+            return bucket_range(k)[1]
+    return None
+
+
+def print_report(metrics, show_buckets):
+    print("cycles: %d, completed: %d" % (metrics["cycles"], metrics["completed_cycles"]))
+
+    print("\nlast cycle (ms since boot):")
+    for milestone, t in metrics["milestones"].items():
+        print("  %-16s %s" % (milestone, "-" if t == NOT_REACHED else t))
+
+    print("\nphases (ms):")
+    print_histograms(metrics["phases"], show_buckets)
+
+    print("\ntime from sync to connected after the previous teardown (ms):")
+    print_histograms(metrics["connect_after"], show_buckets)
+
+    print("\ntime from connected to GlucoseRx (ms):")
+    print_histograms(metrics["connect_to_glucose"], show_buckets)
+
+    print("\ncounters:")
+    for counter, value in metrics["counters"].items():
+        print("  %-22s %d" % (counter, value))
+
+    errors = {state: n for state, n in metrics["errors"].items() if n}
+    print("\nerrors by session state:")
+    for state, n in errors.items():
+        print("  %-22s %d" % (state, n))
+    if not errors:
+        print("  none")
+
+
+def print_histograms(histograms, show_buckets):
+    print("  %-16s %8s %10s %8s %8s %8s" % ("", "count", "mean", "p50<", "p90<", "max"))
+    for label, h in histograms.items():
+        if h["count"] == 0:
+            continue
+        mean = h["sum"] / h["count"]
+        print("  %-16s %8d %10.1f %8s %8s %8d" % (label, h["count"], mean,
+              percentile(h["buckets"], 0.5), percentile(h["buckets"], 0.9), h["max"]))
+        if show_buckets:
+            for k, n in enumerate(h["buckets"]):
+                if n:
+                    lo, hi = bucket_range(k)
+                    print("      [%7d, %7d) %d" % (lo, hi, n))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="log file, stdin if omitted")
+    parser.add_argument("--hex", help="decode this hex dump instead of a log")
+    parser.add_argument("--buckets", action="store_true", help="print the histogram buckets")
+    args = parser.parse_args()
+
+    if args.hex:
+        dump = args.hex
+    else:
+        text = open(args.log).read() if args.log else sys.stdin.read()
+        dumps = re.findall(r"METRICS ([0-9a-fA-F]+)", text)
+        if not dumps:
+            sys.exit("no metrics dump found")
+        dump = dumps[-1]
+
+    print_report(decode(bytes.fromhex(dump)), args.buckets)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,258 @@
+/* Model of the two GATT discovery procedures of main/gatt.c.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/discovery_model
+ *
+ * The ATT requests of both procedures are replayed against an attribute
+ * table of the transmitter with the default ATT MTU of 23. The table has
+ * the layout of a G6 transmitter as listed by open-source readers (GAP,
+ * GATT, device information and the CGM service with four characteristics);
+ * the handle numbers are assumptions. Responses carry as many entries as
+ * fit the MTU, all of the same length, like the ATT server of the
+ * transmitter has to build them.
+ *
+ *  full        all services, all descriptors from handle 1, all characteristics
+ *  targeted    CGM service by UUID, its characteristics until control,
+ *              authentication and backfill are known, its descriptors from the
+ *              first of the control and backfill values until both CCCDs are known
+ *
+ * The time assumes one ATT round trip per connection interval: the request
+ * goes out in one connection event, the response comes back in the next one.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MODEL_MTU                   23
+#define MODEL_LAST_HANDLE           0xffff
+
+// attribute types
+#define UUID_PRIMARY_SERVICE        0x2800
+#define UUID_CHARACTERISTIC         0x2803
+#define UUID_CCCD                   0x2902
+#define UUID_128                    0 // a characteristic value with a 128 bit UUID
+
+typedef struct model_attr {
+    uint16_t handle;
+    uint16_t type;
+    uint16_t value;                 // UUID of a service or of the characteristic a declaration announces
+    bool value_128;                 // the UUID in the value has 128 bits
+} model_attr;
+
+typedef struct model_stats {
+    uint32_t procedures;
+    uint32_t round_trips;
+    uint32_t attributes;
+} model_stats;
+
+// CGM characteristics, the low 16 bits of the 128 bit UUIDs F808353x-...
+#define CGM_SERVICE                 0x3532
+#define CGM_COMMUNICATION           0x3533
+#define CGM_CONTROL                 0x3534
+#define CGM_AUTHENTICATION          0x3535
+#define CGM_BACKFILL                0x3536
+#define CONTROL_VALUE_HANDLE        24
+#define CONTROL_CCCD_HANDLE         25
+#define BACKFILL_CCCD_HANDLE        31
+
+static const model_attr table[] = {
+    {1, UUID_PRIMARY_SERVICE, 0x1800, false},
+    {2, UUID_CHARACTERISTIC, 0x2a00, false}, {3, 0x2a00, 0, false},
+    {4, UUID_CHARACTERISTIC, 0x2a01, false}, {5, 0x2a01, 0, false},
+    {6, UUID_CHARACTERISTIC, 0x2a04, false}, {7, 0x2a04, 0, false},
+    {8, UUID_PRIMARY_SERVICE, 0x1801, false},
+    {9, UUID_CHARACTERISTIC, 0x2a05, false}, {10, 0x2a05, 0, false}, {11, UUID_CCCD, 0, false},
+    {12, UUID_PRIMARY_SERVICE, 0x180a, false},
+    {13, UUID_CHARACTERISTIC, 0x2a29, false}, {14, 0x2a29, 0, false},
+    {15, UUID_CHARACTERISTIC, 0x2a24, false}, {16, 0x2a24, 0, false},
+    {17, UUID_CHARACTERISTIC, 0x2a26, false}, {18, 0x2a26, 0, false},
+    {19, UUID_PRIMARY_SERVICE, CGM_SERVICE, true},
+    {20, UUID_CHARACTERISTIC, CGM_COMMUNICATION, true}, {21, UUID_128, 0, false}, {22, UUID_CCCD, 0, false},
+    {23, UUID_CHARACTERISTIC, CGM_CONTROL, true}, {24, UUID_128, 0, false}, {25, UUID_CCCD, 0, false},
+    {26, UUID_CHARACTERISTIC, CGM_AUTHENTICATION, true}, {27, UUID_128, 0, false}, {28, UUID_CCCD, 0, false},
+    {29, UUID_CHARACTERISTIC, CGM_BACKFILL, true}, {30, UUID_128, 0, false}, {31, UUID_CCCD, 0, false},
+};
+#define TABLE_LENGTH                (sizeof table / sizeof table[0])
+
+static uint16_t
+model_service_end(uint32_t index) {
+    for(uint32_t i = index + 1; i < TABLE_LENGTH; i++) {
+        if(table[i].type == UUID_PRIMARY_SERVICE) {
+            return table[i].handle - 1;
+        }
+    }
+    return MODEL_LAST_HANDLE;
+}
+
+/**
+ * Read By Group Type over all primary services.
+ */
+static void
+model_all_services(model_stats *stats) {
+    uint16_t start = 1;
+
+    stats->procedures++;
+    for(;;) {
+        uint32_t entries = 0;
+        uint32_t entry_length = 0;
+        uint16_t end = 0;
+
+        stats->round_trips++;
+        for(uint32_t i = 0; i < TABLE_LENGTH; i++) {
+            uint32_t length = table[i].value_128 ? 20 : 6;
+
+            if(table[i].handle < start || table[i].type != UUID_PRIMARY_SERVICE) {
+                continue;
+            }
+            if(entries > 0 && (length != entry_length || (entries + 1) * length > MODEL_MTU - 2)) {
+                break;
+            }
+            entry_length = length;
+            entries++;
+            end = model_service_end(i);
+        }
+        if(entries == 0) {
+            return;                 // Attribute Not Found
+        }
+        stats->attributes += entries;
+        if(end == MODEL_LAST_HANDLE) {
+            return;
+        }
+        start = end + 1;
+    }
+}
+
+/**
+ * Find By Type Value of the CGM service.
+ *
+ * @return                  Index of the service in the table
+ */
+static uint32_t
+model_cgm_service(model_stats *stats, uint16_t *end) {
+    uint32_t found = 0;
+
+    stats->procedures++;
+    stats->round_trips++;
+    for(uint32_t i = 0; i < TABLE_LENGTH; i++) {
+        if(table[i].type == UUID_PRIMARY_SERVICE && table[i].value == CGM_SERVICE) {
+            found = i;
+            stats->attributes++;
+        }
+    }
+    *end = model_service_end(found);
+    if(*end != MODEL_LAST_HANDLE) {
+        stats->round_trips++;       // the next request ends with Attribute Not Found
+    }
+    return found;
+}
+
+/**
+ * Read By Type of the characteristic declarations in a range.
+ *
+ * @param stop_after_cgm    Stop once control, authentication and backfill are known
+ */
+static void
+model_characteristics(model_stats *stats, uint16_t start, uint16_t end, bool stop_after_cgm) {
+    uint32_t cgm_found = 0;
+
+    stats->procedures++;
+    while(start <= end) {
+        uint32_t entries = 0;
+        uint32_t entry_length = 0;
+
+        stats->round_trips++;
+        for(uint32_t i = 0; i < TABLE_LENGTH; i++) {
+            uint32_t length = table[i].value_128 ? 21 : 7;
+
+            if(table[i].handle < start || table[i].handle > end || table[i].type != UUID_CHARACTERISTIC) {
+                continue;
+            }
+            if(entries > 0 && (length != entry_length || (entries + 1) * length > MODEL_MTU - 2)) {
+                break;
+            }
+            entry_length = length;
+            entries++;
+            start = table[i].handle + 1;
+            cgm_found += table[i].value == CGM_CONTROL || table[i].value == CGM_AUTHENTICATION ||
+                         table[i].value == CGM_BACKFILL;
+        }
+        if(entries == 0) {
+            return;
+        }
+        stats->attributes += entries;
+        if(stop_after_cgm && cgm_found == 3) {
+            return;
+        }
+    }
+}
+
+/**
+ * Find Information in a range, NimBLE starts after the given value handle.
+ *
+ * @param stop_after_cccds  Stop once the CCCDs of control and backfill are known
+ */
+static void
+model_descriptors(model_stats *stats, uint16_t after, uint16_t end, bool stop_after_cccds) {
+    uint16_t start = after + 1;
+    uint32_t cccds = 0;
+
+    stats->procedures++;
+    while(start <= end) {
+        uint32_t entries = 0;
+        uint32_t entry_length = 0;
+
+        stats->round_trips++;
+        for(uint32_t i = 0; i < TABLE_LENGTH; i++) {
+            uint32_t length = table[i].type == UUID_128 ? 18 : 4;
+
+            if(table[i].handle < start || table[i].handle > end) {
+                continue;
+            }
+            if(entries > 0 && (length != entry_length || (entries + 1) * length > MODEL_MTU - 2)) {
+                break;
+            }
+            entry_length = length;
+            entries++;
+            start = table[i].handle + 1;
+            cccds += table[i].type == UUID_CCCD && (table[i].handle == CONTROL_CCCD_HANDLE ||
+                                                        table[i].handle == BACKFILL_CCCD_HANDLE);
+        }
+        if(entries == 0) {
+            return;
+        }
+        stats->attributes += entries;
+        if(stop_after_cccds && cccds == 2) {
+            return;
+        }
+    }
+}
+
+static void
+model_print(const char *name, const model_stats *stats) {
+    printf("%-9s %u procedures, %2u ATT round trips, %2u attributes, %4.0f / %4.0f / %5.0f ms\n", name,
+           stats->procedures, stats->round_trips, stats->attributes, stats->round_trips * 7.5,
+           stats->round_trips * 30.0, stats->round_trips * 100.0);
+}
+
+int
+main(void) {
+    model_stats full = {0};
+    model_stats targeted = {0};
+    uint32_t service;
+    uint16_t service_end;
+
+    // dgr_discover_services without TARGETED_DISCOVERY, then the descriptors and the characteristics
+    model_all_services(&full);
+    model_descriptors(&full, 1, MODEL_LAST_HANDLE, false);
+    model_characteristics(&full, 1, MODEL_LAST_HANDLE, false);
+
+    // dgr_discover_cgm_characteristics and dgr_discover_cgm_cccds start at the control value
+    service = model_cgm_service(&targeted, &service_end);
+    model_characteristics(&targeted, table[service].handle, service_end, true);
+    model_descriptors(&targeted, CONTROL_VALUE_HANDLE, service_end, true);
+
+    printf("MTU %d, time at connection intervals of 7.5 / 30 / 100 ms\n", MODEL_MTU);
+    model_print("full", &full);
+    model_print("targeted", &targeted);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/* Benchmark of the storage dump the reader logs before every deep sleep.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/dump_bench [iterations]
+ *
+ * The dump of main/storage.c is rebuilt on the core library, with ESP_LOGI
+ * replaced by formatting into a buffer with the prefix of the ESP-IDF log
+ * (without colors). The former dump printed five lines for every reading in
+ * the log and six lines for every backfilled reading. The current one prints
+ * a summary line and walks the readings of this wake cycle with the query
+ * cursor. Two more rows walk the readings the former dump printed, the
+ * reading log, and all stored readings with the cursor, so the gain of the
+ * one line format shows apart from the smaller set of readings. The UART
+ * time is the line time of the formatted bytes at the baud rate of the
+ * console.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "coverage.h"
+#include "query.h"
+
+#define BENCH_LOG_CAPACITY          52
+#define BENCH_ARCHIVE_BLOCKS        7
+#define BENCH_BAUD_RATE             115200
+#define BENCH_OUTPUT_SIZE           65536
+
+static reading log_records[BENCH_LOG_CAPACITY];
+static ts_block archive_blocks[BENCH_ARCHIVE_BLOCKS];
+static reading_log readings;
+static ts_archive archive;
+static coverage_map coverage;
+static const char *tag_stg = "dgr_stg";
+static const char *tag_msg = "dgr_msg";
+
+static char output[BENCH_OUTPUT_SIZE];
+static size_t output_pos;
+static uint32_t output_lines;
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Formats a log line like ESP_LOGI does.
+ */
+static void
+bench_log(const char *tag, const char *format, ...) {
+    va_list args;
+
+    if(output_pos > BENCH_OUTPUT_SIZE - 256) {
+        output_pos = 0;
+    }
+    output_pos += snprintf(&output[output_pos], BENCH_OUTPUT_SIZE - output_pos, "I (%u) %s: ", 123456, tag);
+    va_start(args, format);
+    output_pos += vsnprintf(&output[output_pos], BENCH_OUTPUT_SIZE - output_pos, format, args);
+    va_end(args);
+    output[output_pos++] = '\n';
+    output_lines++;
+}
+
+static const char*
+translate_calibration_state(uint8_t state) {
+    return state == 6 ? "OK" : state == 7 ? "NEED CALIBRATION" : "UNKNOWN";
+}
+
+/**
+ * The dump before it was reduced to the readings of the wake cycle.
+ *
+ * @param backfilled        Number of backfilled readings, which were logged by the parse
+ */
+static void
+bench_dump_before(uint32_t backfilled) {
+    if(backfilled > 0) {
+        bench_log(tag_stg, "Starting to parse Backfill data.");
+    }
+    for(uint32_t i = 0; i < backfilled; i++) {
+        const reading *r = dgr_reading_log_get(&readings, BENCH_LOG_CAPACITY - 1 - backfilled + i);
+
+        bench_log(tag_stg, "[=========== Backfill Data ===========]");
+        bench_log(tag_stg, "\ttimestamp         = 0x%x", r->timestamp);
+        bench_log(tag_stg, "\tglucose           = %d", r->glucose);
+        bench_log(tag_stg, "\tcalibration state = %s (0x%x)", translate_calibration_state(r->calibration_state),
+                  r->calibration_state);
+        bench_log(tag_stg, "\ttrend             = 0x%x", r->trend);
+    }
+
+    bench_log(tag_stg, "[=========== Archive (%d readings in %d of %d blocks) ===========]",
+              dgr_ts_archive_readings(&archive), dgr_ts_archive_blocks(&archive), archive.block_count);
+    for(uint16_t i = 0; i < dgr_ts_archive_blocks(&archive); i++) {
+        bench_log(tag_stg, "\tblock %d: %d readings from 0x%x", i, dgr_ts_archive_block_readings(&archive, i),
+                  dgr_ts_archive_block_start(&archive, i));
+    }
+    bench_log(tag_stg, "[=========== Reading log (%d of %d, %d overwritten) ===========]",
+              dgr_reading_log_count(&readings), readings.capacity, readings.overwritten);
+    for(uint16_t i = 0; i < dgr_reading_log_count(&readings); i++) {
+        const reading *r = dgr_reading_log_get(&readings, i);
+
+        bench_log(tag_stg, "[=========== Reading %d ===========]", i);
+        bench_log(tag_stg, "\ttimestamp = 0x%x", r->timestamp);
+        bench_log(tag_stg, "\tglucose   = %d", r->glucose);
+        bench_log(tag_stg, "\tcalibration state = %s", translate_calibration_state(r->calibration_state));
+        bench_log(tag_stg, "\ttrend             = 0x%x", r->trend);
+    }
+}
+
+static bool
+bench_print_reading(const reading *r, void *arg) {
+    (void) arg;
+    bench_log(tag_stg, "\t0x%08x glucose %3d trend 0x%02x %s", r->timestamp, r->glucose, r->trend,
+              translate_calibration_state(r->calibration_state));
+    return true;
+}
+
+static void
+bench_dump_summary(uint32_t backfilled) {
+    if(backfilled > 0) {
+        bench_log(tag_msg, "Backfill : done, %d readings received.", backfilled);
+    }
+    bench_log(tag_stg, "[=========== Storage (log %d/%d, archive %d in %d blocks, journal %d pages + %d, "
+              "coverage %d/%d) ===========]",
+              dgr_reading_log_count(&readings), readings.capacity, dgr_ts_archive_readings(&archive),
+              dgr_ts_archive_blocks(&archive), 180, 12, dgr_coverage_count(&coverage), COVERAGE_SLOTS);
+}
+
+/**
+ * The current dump, dgr_print_storage walks the readings saved in this wake cycle.
+ */
+static void
+bench_dump_after(uint32_t backfilled) {
+    reading_cursor cursor;
+    uint32_t cycle_oldest = dgr_reading_log_get(&readings, BENCH_LOG_CAPACITY - 1 - backfilled)->timestamp;
+
+    bench_dump_summary(backfilled);
+    dgr_query_range(&cursor, &readings, &archive, cycle_oldest, UINT32_MAX);
+    dgr_query_visit(&cursor, bench_print_reading, NULL);
+}
+
+/**
+ * The current dump format over the readings the former dump printed.
+ */
+static void
+bench_dump_log(uint32_t backfilled) {
+    reading_cursor cursor;
+
+    bench_dump_summary(backfilled);
+    dgr_query_range(&cursor, &readings, &archive, dgr_reading_log_get(&readings, 0)->timestamp, UINT32_MAX);
+    dgr_query_visit(&cursor, bench_print_reading, NULL);
+}
+
+/**
+ * The current dump format over all stored readings, archive included.
+ */
+static void
+bench_dump_all(uint32_t backfilled) {
+    reading_cursor cursor;
+
+    bench_dump_summary(backfilled);
+    dgr_query_range(&cursor, &readings, &archive, 0, UINT32_MAX);
+    dgr_query_visit(&cursor, bench_print_reading, NULL);
+}
+
+static void
+bench_run(const char *name, void (*dump)(uint32_t), uint32_t backfilled, uint32_t iterations) {
+    uint32_t lines;
+    size_t bytes;
+    double start;
+
+    output_pos = 0;
+    output_lines = 0;
+    dump(backfilled);
+    bytes = output_pos;
+    lines = output_lines;
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        output_pos = 0;
+        dump(backfilled);
+    }
+    printf("%-28s %4u lines, %6zu bytes, %7.2f us on host, %6.0f ms UART at %d baud\n", name, lines, bytes,
+           (bench_now() - start) * 1e6 / iterations, bytes * 10 * 1000.0 / BENCH_BAUD_RATE, BENCH_BAUD_RATE);
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    uint32_t timestamp = 1000000;
+
+    // a full log after some days, the oldest readings went to the archive
+    dgr_reading_log_init(&readings, log_records, BENCH_LOG_CAPACITY, reading_log_overwrite_oldest);
+    dgr_ts_archive_init(&archive, archive_blocks, BENCH_ARCHIVE_BLOCKS);
+    dgr_coverage_init(&coverage);
+    for(uint32_t n = 0; n < 1000; n++) {
+        reading r = {.timestamp = timestamp, .glucose = 100 + n * 7 % 60, .calibration_state = 6, .trend = 0x80};
+        reading evicted;
+
+        if(dgr_reading_log_insert(&readings, &r, reading_conflict_replace, &evicted) == reading_log_overwrote) {
+            dgr_ts_archive_append(&archive, &evicted);
+        }
+        dgr_coverage_mark(&coverage, timestamp);
+        timestamp += 300;
+    }
+
+    bench_run("before, normal cycle", bench_dump_before, 0, iterations);
+    bench_run("before, 6 backfilled readings", bench_dump_before, 6, iterations);
+    bench_run("after, normal cycle", bench_dump_after, 0, iterations);
+    bench_run("after, 6 backfilled readings", bench_dump_after, 6, iterations);
+    bench_run("cursor, readings of the log", bench_dump_log, 0, iterations);
+    bench_run("cursor, all stored readings", bench_dump_all, 0, iterations);
+    return 0;
+}
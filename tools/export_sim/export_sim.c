@@ -0,0 +1,192 @@
+/* Simulated reader for the export over the console UART, on a pty.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/export_sim python3 tools/dgr_export.py --state /tmp/export.cursor > /tmp/readings.csv
+ *
+ * The simulator fills a reading log and an archive of the sizes of the
+ * firmware, opens a pty and runs the given command with the path of the pty
+ * appended. It answers GET frames with the export code of the core library,
+ * the way dgr_export_from in main/storage.c does, and puts a log line in
+ * front of every answer like the log output of the reader. At the end it
+ * prints what went over the wire and how long the line would need at the
+ * baud rates of the console. Run it twice with the same --state file to see
+ * a resumed export.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include "export.h"
+#include "query.h"
+
+#define SIM_LOG_CAPACITY            52
+#define SIM_ARCHIVE_BLOCKS          7
+#define SIM_READINGS                2000
+
+static reading log_records[SIM_LOG_CAPACITY];
+static ts_block archive_blocks[SIM_ARCHIVE_BLOCKS];
+static reading_log readings;
+static ts_archive archive;
+static export_batch batch;
+static uint8_t frame[EXPORT_MAX_FRAME];
+static uint16_t export_max;
+static int master = -1;
+static uint64_t wire_bytes;
+static uint64_t log_bytes;
+
+static void
+sim_write(const void *data, size_t len) {
+    const uint8_t *pos = data;
+
+    wire_bytes += len;
+    while(len > 0) {
+        ssize_t written = write(master, pos, len);
+
+        if(written < 0 && errno != EINTR && errno != EAGAIN) {
+            return;
+        } else if(written > 0) {
+            pos += written;
+            len -= written;
+        }
+    }
+}
+
+static bool
+sim_export_reading(const reading *r, void *arg) {
+    (void) arg;
+    if(dgr_export_add(&batch, r)) {
+        sim_write(frame, dgr_export_data_frame(&batch, frame));
+    }
+
+    return export_max == 0 || batch.sent + batch.count < export_max;
+}
+
+static void
+sim_export_from(uint32_t from, uint16_t max) {
+    reading_cursor cursor;
+    char line[96];
+    size_t len;
+
+    len = snprintf(line, sizeof line, "I (%u) dgr_stg: Export from 0x%x, at most %u readings.\n", 1234, from, max);
+    sim_write(line, len);
+    log_bytes += len;
+
+    dgr_export_begin(&batch, from);
+    export_max = max;
+    dgr_query_range(&cursor, &readings, &archive, from, UINT32_MAX);
+    dgr_query_visit(&cursor, sim_export_reading, NULL);
+
+    len = dgr_export_data_frame(&batch, frame);
+    if(len > 0) {
+        sim_write(frame, len);
+    }
+    sim_write(frame, dgr_export_end_frame(&batch, frame));
+}
+
+static void
+sim_fill(void) {
+    uint32_t timestamp = 5000000;
+
+    dgr_reading_log_init(&readings, log_records, SIM_LOG_CAPACITY, reading_log_overwrite_oldest);
+    dgr_ts_archive_init(&archive, archive_blocks, SIM_ARCHIVE_BLOCKS);
+    for(uint32_t n = 0; n < SIM_READINGS; n++) {
+        reading r = {.timestamp = timestamp, .glucose = 100 + n * 7 % 60, .calibration_state = 6,
+                     .trend = 0x80 + n % 3 - 1};
+        reading evicted;
+
+        if(dgr_reading_log_insert(&readings, &r, reading_conflict_replace, &evicted) == reading_log_overwrote) {
+            dgr_ts_archive_append(&archive, &evicted);
+        }
+        timestamp += 300;
+    }
+}
+
+int
+main(int argc, char **argv) {
+    uint8_t request[16];
+    size_t len = 0;
+    uint32_t requests = 0;
+    struct termios attrs;
+    char **command;
+    int slave;
+    int status = 1;
+    pid_t child;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s command [args], the path of the pty is appended\n", argv[0]);
+        return 2;
+    }
+
+    sim_fill();
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pty");
+        return 1;
+    }
+    // the simulator keeps the slave open, so the master does not hang up between two opens of the host
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    tcgetattr(slave, &attrs);
+    cfmakeraw(&attrs);
+    tcsetattr(slave, TCSANOW, &attrs);
+
+    command = calloc(argc + 1, sizeof *command);
+    memcpy(command, &argv[1], (argc - 1) * sizeof *command);
+    command[argc - 1] = ptsname(master);
+    child = fork();
+    if(child == 0) {
+        close(master);
+        close(slave);
+        execvp(command[0], command);
+        perror(command[0]);
+        _exit(127);
+    }
+
+    // like dgr_serve_export, without the time limits
+    while(waitpid(child, &status, WNOHANG) == 0) {
+        struct pollfd pfd = {.fd = master, .events = POLLIN};
+        uint8_t data[256];
+        ssize_t got;
+
+        if(poll(&pfd, 1, 50) <= 0 || (got = read(master, data, sizeof data)) <= 0) {
+            continue;
+        }
+        for(ssize_t i = 0; i < got; i++) {
+            uint32_t from;
+            uint16_t max;
+
+            if(data[i] != 0) {
+                if(len < sizeof request) {
+                    request[len] = data[i];
+                }
+                len++;
+            } else {
+                if(len > 0 && len <= sizeof request && dgr_export_parse_get(request, len, &from, &max)) {
+                    sim_export_from(from, max);
+                    requests++;
+                }
+                len = 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "%u stored readings, %u requests answered, %u readings in the last answer\n",
+            dgr_ts_archive_readings(&archive) + dgr_reading_log_count(&readings), requests, batch.sent);
+    fprintf(stderr, "%llu bytes on the wire (%llu of log text)", (unsigned long long) wire_bytes,
+            (unsigned long long) log_bytes);
+    if(batch.sent > 0) {
+        fprintf(stderr, ", %.1f B/reading", (double) (wire_bytes - log_bytes) / batch.sent);
+    }
+    fprintf(stderr, "\nUART line time %.0f ms at 115200 baud, %.0f ms at 921600 baud\n",
+            wire_bytes * 10 * 1000.0 / 115200, wire_bytes * 10 * 1000.0 / 921600);
+
+    close(slave);
+    close(master);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include "flash_emu.h"
+
+static int
+flash_emu_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    flash_emu *emu = ctx;
+
+    if(offset + len > emu->ops.size || fseek(emu->file, offset, SEEK_SET) != 0 ||
+       fread(buf, 1, len, emu->file) != len) {
+        return -1;
+    }
+
+    emu->reads++;
+    emu->read_bytes += len;
+    emu->modeled_us += FLASH_EMU_OP_US + len * FLASH_EMU_READ_NS_PER_BYTE / 1000;
+    return 0;
+}
+
+static int
+flash_emu_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+    flash_emu *emu = ctx;
+    const uint8_t *data = buf;
+    uint8_t old[JOURNAL_PAGE_SIZE];
+    bool dirty = false;
+
+    for(size_t done = 0; done < len; ) {
+        size_t chunk = len - done > sizeof old ? sizeof old : len - done;
+
+        if(offset + done + chunk > emu->ops.size || fseek(emu->file, offset + done, SEEK_SET) != 0 ||
+           fread(old, 1, chunk, emu->file) != chunk) {
+            return -1;
+        }
+        for(size_t i = 0; i < chunk; i++) {
+            dirty |= (data[done + i] & ~old[i]) != 0;
+            old[i] &= data[done + i]; // programming only clears bits
+        }
+        if(fseek(emu->file, offset + done, SEEK_SET) != 0 || fwrite(old, 1, chunk, emu->file) != chunk) {
+            return -1;
+        }
+        done += chunk;
+    }
+    fflush(emu->file);
+
+    emu->writes++;
+    emu->write_bytes += len;
+    emu->dirty_writes += dirty;
+    emu->modeled_us += FLASH_EMU_OP_US +
+        ((offset + len - 1) / 256 - offset / 256 + 1) * (uint64_t) FLASH_EMU_PROGRAM_US;
+    return 0;
+}
+
+static int
+flash_emu_erase(void *ctx, uint32_t offset, size_t len) {
+    flash_emu *emu = ctx;
+    uint8_t ff[JOURNAL_PAGE_SIZE];
+
+    if(offset % emu->ops.sector_size != 0 || len % emu->ops.sector_size != 0 || offset + len > emu->ops.size ||
+       fseek(emu->file, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    memset(ff, 0xff, sizeof ff);
+    for(size_t done = 0; done < len; done += sizeof ff) {
+        if(fwrite(ff, 1, sizeof ff, emu->file) != sizeof ff) {
+            return -1;
+        }
+    }
+    fflush(emu->file);
+
+    for(uint32_t sector = offset / emu->ops.sector_size; sector < (offset + len) / emu->ops.sector_size; sector++) {
+        emu->sector_erases[sector]++;
+        emu->erases++;
+        emu->modeled_us += FLASH_EMU_ERASE_US;
+    }
+    return 0;
+}
+
+/**
+ * Opens a flash image, a missing or short file is extended with erased sectors.
+ *
+ * @param emu               Emulator
+ * @param path              Image file
+ * @param size              Size of the flash in bytes
+ * @param sector_size       Size of an erase sector in bytes
+ * @return                  0 on success
+ */
+int
+flash_emu_open(flash_emu *emu, const char *path, uint32_t size, uint32_t sector_size) {
+    long length;
+
+    memset(emu, 0, sizeof *emu);
+    emu->file = fopen(path, "r+b");
+    if(emu->file == NULL) {
+        emu->file = fopen(path, "w+b");
+    }
+    if(emu->file == NULL) {
+        return -1;
+    }
+
+    fseek(emu->file, 0, SEEK_END);
+    length = ftell(emu->file);
+    for(; length < (long) size; length++) {
+        fputc(0xff, emu->file);
+    }
+    fflush(emu->file);
+
+    emu->sector_erases = calloc(size / sector_size, sizeof *emu->sector_erases);
+    emu->ops.read = flash_emu_read;
+    emu->ops.write = flash_emu_write;
+    emu->ops.erase = flash_emu_erase;
+    emu->ops.ctx = emu;
+    emu->ops.size = size;
+    emu->ops.sector_size = sector_size;
+    return 0;
+}
+
+void
+flash_emu_close(flash_emu *emu) {
+    fclose(emu->file);
+    free(emu->sector_erases);
+}
+
+void
+flash_emu_reset_counters(flash_emu *emu) {
+    uint32_t *sector_erases = emu->sector_erases;
+
+    memset(sector_erases, 0, emu->ops.size / emu->ops.sector_size * sizeof *sector_erases);
+    emu->reads = 0;
+    emu->read_bytes = 0;
+    emu->writes = 0;
+    emu->write_bytes = 0;
+    emu->dirty_writes = 0;
+    emu->erases = 0;
+    emu->modeled_us = 0;
+}
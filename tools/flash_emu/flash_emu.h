@@ -0,0 +1,37 @@
+#ifndef DGR_FLASH_EMU_H
+#define DGR_FLASH_EMU_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "journal.h"
+
+/* File-backed emulation of the SPI NOR flash of the ESP32 for the journal.
+ * Like the real flash, an erase sets a whole sector to 0xff and a write can
+ * only clear bits. Every operation is counted and its duration is modeled
+ * with the typical figures of the flash chips used on ESP32 modules.
+ */
+
+#define FLASH_EMU_ERASE_US          45000 // per 4 KB sector
+#define FLASH_EMU_PROGRAM_US        700 // per started 256 byte program page
+#define FLASH_EMU_READ_NS_PER_BYTE  100 // 40 MHz dual i/o
+#define FLASH_EMU_OP_US             20 // per operation, command and address
+
+typedef struct flash_emu {
+    FILE *file;
+    flash_ops ops;
+    uint32_t reads;
+    uint64_t read_bytes;
+    uint32_t writes;
+    uint64_t write_bytes;
+    uint32_t dirty_writes;          // writes that tried to set bits without an erase
+    uint32_t erases;
+    uint32_t *sector_erases;
+    uint64_t modeled_us;            // modeled duration of all operations
+} flash_emu;
+
+int flash_emu_open(flash_emu *emu, const char *path, uint32_t size, uint32_t sector_size);
+void flash_emu_close(flash_emu *emu);
+void flash_emu_reset_counters(flash_emu *emu);
+
+#endif
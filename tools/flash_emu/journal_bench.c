@@ -0,0 +1,155 @@
+/* Benchmark of the reading journal on the flash emulator.
+ *
+ *  gcc -O2 -I components/dgr_core -I tools/flash_emu -o journal_bench tools/flash_emu/journal_bench.c \
+ *      tools/flash_emu/flash_emu.c components/dgr_core/journal.c components/dgr_core/crc16.c
+ *  ./journal_bench [days] [error rate in percent]
+ *
+ * One reading is journaled per wake cycle. The staged strategy of the reader,
+ * which writes full pages and flushes on failed cycles, is compared with
+ * writing every reading through. Afterwards the journal is recovered from the
+ * image like after a reset: intact, after a power loss that interrupted the
+ * next page right after the erase of its sector, and without the first sector.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "flash_emu.h"
+
+#define PARTITION_SIZE              0x10000
+#define SECTOR_SIZE                 4096
+#define CYCLES_PER_DAY              288
+
+static double
+bench_now_us(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static reading
+bench_reading(uint32_t cycle) {
+    reading r = {
+        .timestamp = 1000000 + cycle * 300,
+        .glucose = 100 + cycle % 50,
+        .calibration_state = 6,
+        .trend = 0x80
+    };
+
+    return r;
+}
+
+/**
+ * Journals the readings of some days and prints the flash cost.
+ *
+ * @return                  number of journaled cycles
+ */
+static uint32_t
+bench_run(flash_emu *emu, journal *j, const char *name, uint32_t days, int error_rate, bool write_through) {
+    uint64_t max_cycle_us = 0;
+    uint32_t cycles = days * CYCLES_PER_DAY;
+    uint32_t max_erases = 0;
+
+    emu->ops.erase(emu->ops.ctx, 0, PARTITION_SIZE);
+    dgr_journal_init(j, &emu->ops);
+    flash_emu_reset_counters(emu);
+    srand(1);
+
+    for(uint32_t cycle = 0; cycle < cycles; cycle++) {
+        uint64_t before = emu->modeled_us;
+        reading r = bench_reading(cycle);
+
+        if(dgr_journal_append(j, &r) != 0) {
+            printf("append failed\n");
+            exit(1);
+        }
+        if(write_through || rand() % 100 < error_rate) {
+            dgr_journal_flush(j);
+        }
+        if(emu->modeled_us - before > max_cycle_us) {
+            max_cycle_us = emu->modeled_us - before;
+        }
+    }
+
+    for(uint32_t i = 0; i < PARTITION_SIZE / SECTOR_SIZE; i++) {
+        if(emu->sector_erases[i] > max_erases) {
+            max_erases = emu->sector_erases[i];
+        }
+    }
+
+    printf("%-14s %6u pages, %5u erases, write amplification %5.2f, flash time %7.1f us/cycle (max %6.1f ms), "
+           "sector wear %.1f erases/day, %u dirty writes\n",
+           name, j->pages_written, emu->erases,
+           (double) (emu->write_bytes + (uint64_t) emu->erases * SECTOR_SIZE) / (cycles * JOURNAL_RECORD_SIZE),
+           (double) emu->modeled_us / cycles, max_cycle_us / 1000.0, (double) max_erases / days,
+           emu->dirty_writes);
+    return cycles;
+}
+
+static void
+bench_recover(flash_emu *emu, const journal *live, const char *name, uint32_t cycles, bool intact) {
+    journal j;
+    reading out[JOURNAL_PAGE_READINGS];
+    reading expected;
+    uint8_t count = 0;
+    double start;
+
+    flash_emu_reset_counters(emu);
+    start = bench_now_us();
+    dgr_journal_recover(&j, &emu->ops);
+    printf("%-14s %3u header reads, %6.1f us on host, %6.1f us modeled, %u of %u pages",
+           name, j.recovery_reads, bench_now_us() - start, (double) emu->modeled_us, j.stored, j.pages);
+
+    if(intact && (j.head != live->head || j.tail != live->tail || j.stored != live->stored ||
+                        j.sequence != live->sequence)) {
+        printf(" MISMATCH head %u/%u tail %u/%u stored %u/%u\n", j.head, live->head, j.tail, live->tail,
+               j.stored, live->stored);
+        exit(1);
+    }
+
+    // the newest page ends with the last flushed reading
+    if(j.stored > 0 && dgr_journal_read_page(&j, j.stored - 1, out, &count) != 0) {
+        printf(" unreadable\n");
+        exit(1);
+    }
+    expected = bench_reading(cycles - 1 - live->staged);
+    printf(", newest reading %s\n", count > 0 && out[count - 1].timestamp == expected.timestamp ? "ok" : "lost");
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t days = argc > 1 ? atoi(argv[1]) : 60;
+    int error_rate = argc > 2 ? atoi(argv[2]) : 5;
+    const char *path = "journal_bench.img";
+    flash_emu emu;
+    journal j;
+    uint32_t cycles;
+
+    remove(path);
+    if(flash_emu_open(&emu, path, PARTITION_SIZE, SECTOR_SIZE) != 0) {
+        printf("can not open %s\n", path);
+        return 1;
+    }
+
+    printf("%u days, %d %% failed cycles, %u readings per page, %u KB partition\n\n", days, error_rate,
+           JOURNAL_PAGE_READINGS, PARTITION_SIZE / 1024);
+    bench_run(&emu, &j, "write through", days, error_rate, true);
+    bench_run(&emu, &j, "staged", days, 0, false);
+    cycles = bench_run(&emu, &j, "staged+errors", days, error_rate, false);
+
+    printf("\n");
+    bench_recover(&emu, &j, "recovery", cycles, true);
+
+    // power loss right after erasing the sector of the next page
+    emu.ops.erase(emu.ops.ctx, (j.head + SECTOR_SIZE / JOURNAL_PAGE_SIZE - 1) /
+                  (SECTOR_SIZE / JOURNAL_PAGE_SIZE) * SECTOR_SIZE % PARTITION_SIZE, SECTOR_SIZE);
+    bench_recover(&emu, &j, "after erase", cycles, false);
+
+    // the first page is gone, recovery falls back to reading all headers
+    emu.ops.erase(emu.ops.ctx, 0, SECTOR_SIZE);
+    bench_recover(&emu, &j, "first sector", cycles, false);
+
+    flash_emu_close(&emu);
+    remove(path);
+    return 0;
+}
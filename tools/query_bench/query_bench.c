@@ -0,0 +1,199 @@
+/* Benchmark of the queries over the reading log and the archive.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/query_bench [readings]
+ *
+ * A random trace is stored like storage.c stores live readings: the log
+ * has the capacity of the firmware and passes its oldest readings on to the
+ * archive, which drops its oldest blocks. Every timed query is also run once
+ * against a brute-force scan of the stored readings.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "query.h"
+
+#define BENCH_LOG_CAPACITY          52
+#define BENCH_ARCHIVE_BLOCKS        7
+#define BENCH_RANGE                 12
+#define BENCH_ITERATIONS            1000000
+
+static reading log_records[BENCH_LOG_CAPACITY];
+static ts_block archive_blocks[BENCH_ARCHIVE_BLOCKS];
+static reading_log log;
+static ts_archive archive;
+static reading *stored;             // flat copy of the readings in the log and the archive
+static uint32_t stored_count;
+static uint32_t bench_seed = 1;
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t
+bench_random(uint32_t n) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 8U) % n;
+}
+
+static bool
+bench_same(const reading *a, const reading *b) {
+    return a != NULL && a->timestamp == b->timestamp && a->glucose == b->glucose &&
+           a->calibration_state == b->calibration_state && a->trend == b->trend;
+}
+
+static void
+bench_fill(uint32_t count) {
+    reading *trace = malloc(count * sizeof *trace);
+    uint32_t timestamp = 1000000;
+    int glucose = 120;
+
+    dgr_reading_log_init(&log, log_records, BENCH_LOG_CAPACITY, reading_log_overwrite_oldest);
+    dgr_ts_archive_init(&archive, archive_blocks, BENCH_ARCHIVE_BLOCKS);
+    for(uint32_t n = 0; n < count; n++) {
+        reading r = {.calibration_state = 6, .trend = 0x80};
+        reading evicted;
+
+        timestamp += bench_random(20) == 0 ? 300 * (2 + bench_random(6)) : 298 + bench_random(5);
+        glucose += (int) bench_random(9) - 4;
+        glucose = glucose < 40 ? 40 : glucose > 400 ? 400 : glucose;
+        r.timestamp = timestamp;
+        r.glucose = glucose;
+        trace[n] = r;
+
+        if(dgr_reading_log_insert(&log, &r, reading_conflict_replace, &evicted) == reading_log_overwrote) {
+            dgr_ts_archive_append(&archive, &evicted);
+        }
+    }
+
+    stored_count = dgr_ts_archive_readings(&archive) + dgr_reading_log_count(&log);
+    stored = trace + count - stored_count;
+}
+
+/**
+ * @return                  Number of readings of a range query that differ from the brute-force scan
+ */
+static int
+bench_check_range(uint32_t from, uint32_t to) {
+    reading_cursor cursor;
+    const reading *r;
+    uint32_t i = 0;
+    int errors = 0;
+
+    while(i < stored_count && stored[i].timestamp < from) {
+        i++;
+    }
+    dgr_query_range(&cursor, &log, &archive, from, to);
+    while((r = dgr_query_next(&cursor)) != NULL) {
+        errors += i >= stored_count || stored[i].timestamp > to || !bench_same(r, &stored[i]);
+        i++;
+    }
+    return errors + (i < stored_count && stored[i].timestamp <= to);
+}
+
+static int
+bench_check_nearest(uint32_t timestamp) {
+    uint32_t best = 0;
+    reading out;
+
+    // on a tie the older reading wins
+    for(uint32_t i = 1; i < stored_count; i++) {
+        uint32_t distance = stored[i].timestamp > timestamp ? stored[i].timestamp - timestamp
+                                                            : timestamp - stored[i].timestamp;
+        uint32_t best_distance = stored[best].timestamp > timestamp ? stored[best].timestamp - timestamp
+                                                                    : timestamp - stored[best].timestamp;
+
+        if(distance < best_distance) {
+            best = i;
+        }
+    }
+    return !dgr_query_nearest(&log, &archive, timestamp, &out) || !bench_same(&out, &stored[best]);
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t count = argc > 1 ? atoi(argv[1]) : 5000;
+    uint32_t archived;
+    uint32_t range_from;
+    uint32_t in_log;
+    uint32_t in_archive;
+    volatile uint32_t sink = 0;
+    reading_cursor cursor;
+    const reading *r;
+    reading out;
+    double start;
+    int errors = 0;
+
+    if(count < 1000) {
+        count = 1000;
+    }
+    bench_fill(count);
+    archived = dgr_ts_archive_readings(&archive);
+    printf("%u readings appended, %u in the archive, %u in the log\n", count, archived,
+           dgr_reading_log_count(&log));
+
+    // a range in the middle of the archive, a reading between two log readings and one in the archive
+    range_from = stored[archived / 2].timestamp;
+    in_log = stored[archived + BENCH_LOG_CAPACITY / 2].timestamp + 100;
+    in_archive = stored[archived / 3].timestamp + 100;
+
+    errors += bench_check_range(range_from, stored[archived / 2 + BENCH_RANGE - 1].timestamp);
+    errors += bench_check_nearest(in_log);
+    errors += bench_check_nearest(in_archive);
+    dgr_query_latest(&cursor, &log, &archive, BENCH_RANGE);
+    for(uint32_t i = stored_count - BENCH_RANGE; (r = dgr_query_next(&cursor)) != NULL; i++) {
+        errors += !bench_same(r, &stored[i]);
+    }
+
+    // brute force on random queries over the whole stored span and beyond
+    for(int i = 0; i < 20000; i++) {
+        uint32_t span = stored[stored_count - 1].timestamp - stored[0].timestamp + 2000;
+        uint32_t from = stored[0].timestamp - 1000 + bench_random(span);
+
+        errors += bench_check_range(from, from + bench_random(30000));
+        errors += bench_check_nearest(stored[0].timestamp - 1000 + bench_random(span));
+    }
+
+    start = bench_now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++) {
+        uint32_t n = 0;
+
+        dgr_query_range(&cursor, &log, &archive, range_from, UINT32_MAX);
+        while(n < BENCH_RANGE && (r = dgr_query_next(&cursor)) != NULL) {
+            sink += r->glucose;
+            n++;
+        }
+    }
+    printf("range of %d inside the archive %6.0f ns\n", BENCH_RANGE, (bench_now() - start) * 1e9 / BENCH_ITERATIONS);
+
+    start = bench_now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++) {
+        dgr_query_latest(&cursor, &log, &archive, BENCH_RANGE);
+        while((r = dgr_query_next(&cursor)) != NULL) {
+            sink += r->glucose;
+        }
+    }
+    printf("latest %d                      %6.0f ns\n", BENCH_RANGE, (bench_now() - start) * 1e9 / BENCH_ITERATIONS);
+
+    start = bench_now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++) {
+        dgr_query_nearest(&log, &archive, in_log + i % 64, &out);
+        sink += out.glucose;
+    }
+    printf("nearest in the log             %6.0f ns\n", (bench_now() - start) * 1e9 / BENCH_ITERATIONS);
+
+    start = bench_now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++) {
+        dgr_query_nearest(&log, &archive, in_archive + i % 64, &out);
+        sink += out.glucose;
+    }
+    printf("nearest in the archive         %6.0f ns\n", (bench_now() - start) * 1e9 / BENCH_ITERATIONS);
+
+    printf("%s\n", errors == 0 ? "query checks ok" : "query checks FAILED");
+    (void) sink;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/* Microbenchmark of the reading log of the core library.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/reading_log_bench [iterations]
+ *
+ * The log has the capacity of the firmware (LOG_CAPACITY in main/storage.c)
+ * and is full, so every append overwrites the oldest record like in the
+ * steady state of the reader. The time of an
+ * append followed by a get of the newest record stands for a wake cycle,
+ * the lookups and the backfill insert for the dump and the backfill.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "reading_log.h"
+
+#define BENCH_CAPACITY              52
+#define BENCH_MAX_ITERATIONS        6000000 // the timestamps of two runs stay within 32 bits
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static reading
+bench_reading(uint32_t n) {
+    reading r = {.timestamp = 1000 + n * 300, .glucose = 100 + n % 50, .calibration_state = 6, .trend = 0x80};
+
+    return r;
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : BENCH_MAX_ITERATIONS;
+    reading records[BENCH_CAPACITY];
+    reading_log log;
+    volatile uint32_t sink = 0;
+    uint32_t n;
+    int errors = 0;
+    double start;
+
+    if(iterations == 0 || iterations > BENCH_MAX_ITERATIONS) {
+        iterations = BENCH_MAX_ITERATIONS;
+    }
+
+    dgr_reading_log_init(&log, records, BENCH_CAPACITY, reading_log_overwrite_oldest);
+    for(n = 0; n < BENCH_CAPACITY; n++) {
+        reading r = bench_reading(n);
+
+        dgr_reading_log_append(&log, &r);
+    }
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++, n++) {
+        reading r = bench_reading(n);
+
+        dgr_reading_log_append(&log, &r);
+        sink += dgr_reading_log_get(&log, BENCH_CAPACITY - 1)->glucose;
+    }
+    printf("append + get                %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+    errors += dgr_reading_log_latest(&log)->timestamp != bench_reading(n - 1).timestamp;
+    errors += dgr_reading_log_get(&log, 0)->timestamp != bench_reading(n - BENCH_CAPACITY).timestamp;
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++, n++) {
+        reading r = bench_reading(n);
+
+        dgr_reading_log_insert(&log, &r, reading_conflict_replace, NULL);
+    }
+    printf("insert newest               %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+    errors += dgr_reading_log_latest(&log)->timestamp != bench_reading(n - 1).timestamp;
+
+    // a backfilled reading lands a few records before the live one
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations / 10; i++) {
+        reading r = bench_reading(n - 1 - i % 8);
+
+        r.timestamp -= 150;
+        dgr_reading_log_insert(&log, &r, reading_conflict_keep, NULL);
+        r.timestamp += 300 * 64;
+        dgr_reading_log_insert(&log, &r, reading_conflict_keep, NULL);
+    }
+    printf("insert backfilled + newer   %6.1f ns\n", (bench_now() - start) * 1e9 / (iterations / 10 * 2));
+
+    start = bench_now();
+    for(uint32_t i = 0; i < iterations; i++) {
+        const reading *r = dgr_reading_log_find(&log, dgr_reading_log_get(&log, i % BENCH_CAPACITY)->timestamp);
+
+        sink += r != NULL ? r->glucose : 0;
+    }
+    printf("find                        %6.1f ns\n", (bench_now() - start) * 1e9 / iterations);
+
+    for(uint16_t i = 1; i < dgr_reading_log_count(&log); i++) {
+        errors += dgr_reading_log_get(&log, i - 1)->timestamp >= dgr_reading_log_get(&log, i)->timestamp;
+    }
+    printf("%s, %u bytes of records for %u readings\n", errors == 0 ? "reading log checks ok" : "reading log checks FAILED",
+           (unsigned) sizeof records, BENCH_CAPACITY);
+
+    (void) sink;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/* Benchmark and check of the compressed reading archive of the core library.
+ *
+ *  cmake -S components/dgr_core -B build && cmake --build build
+ *  build/ts_compress_bench [readings]
+ *
+ * Synthetic traces are appended to an archive with the RTC memory of the
+ * firmware (ARCHIVE_BLOCKS in main/storage.c). No recorded traces are
+ * available, so the traces model the cases that matter for the encoding:
+ *
+ *  random walk     readings every 300 s, some a second off, glucose steps of up to 3 mg/dl
+ *  smooth          exact 300 s steps, slow sine of the glucose, steady trend
+ *  gaps+jitter     up to 15 s of jitter, missed readings, occasional calibration prompts
+ *
+ * The readings left in the archive are decoded and compared with the
+ * newest generated readings. The ratio is against the 8 byte records of
+ * the reading log.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ts_compress.h"
+
+#define BENCH_BLOCKS                7 // 420 bytes
+#define BENCH_HISTORY               2048 // newest generated readings, more than the archive can hold
+#define BENCH_DECODE_PASSES         2000
+
+typedef enum {
+    trace_random_walk,
+    trace_smooth,
+    trace_gaps_jitter,
+    TRACE_COUNT
+} trace_kind;
+
+static const char *trace_names[TRACE_COUNT] = {"random walk", "smooth", "gaps+jitter"};
+static uint32_t bench_seed;
+
+static double
+bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench_random(int n) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (int) ((bench_seed >> 8U) % (uint32_t) n);
+}
+
+/**
+ * Generates the next reading of a trace.
+ *
+ * @param n                 Number of the reading
+ * @param slot              Transmitter slot of the previous reading, updated
+ */
+static reading
+bench_next(trace_kind kind, uint32_t n, uint32_t *slot, const reading *previous) {
+    reading r = *previous;
+    int glucose = previous->glucose;
+
+    *slot += 300;
+    switch(kind) {
+    case trace_random_walk:
+        r.timestamp = *slot + (bench_random(4) == 0 ? bench_random(3) - 1 : 0);
+        glucose += bench_random(7) - 3;
+        r.trend = 0x80 + (glucose - previous->glucose) / 3;
+        break;
+    case trace_smooth:
+        r.timestamp = *slot;
+        glucose = 140 + (int) lround(60 * sin(n * 2 * M_PI / 288));
+        r.trend = glucose > previous->glucose ? 0x81 : glucose < previous->glucose ? 0x7f : 0x80;
+        break;
+    case trace_gaps_jitter:
+        if(bench_random(20) == 0) {
+            *slot += 300 * (1 + bench_random(12));
+        }
+        r.timestamp = *slot + bench_random(31) - 15;
+        glucose += bench_random(21) - 10;
+        r.calibration_state = bench_random(100) == 0 ? 7 : 6;
+        r.trend = 0x80 + bench_random(5) - 2;
+        break;
+    default:
+        break;
+    }
+
+    r.glucose = glucose < 40 ? 40 : glucose > 400 ? 400 : glucose;
+    return r;
+}
+
+static int
+bench_trace(trace_kind kind, uint32_t count) {
+    static reading history[BENCH_HISTORY];
+    ts_block blocks[BENCH_BLOCKS];
+    ts_archive archive;
+    reading r = {.timestamp = 0, .glucose = 120, .calibration_state = 6, .trend = 0x80};
+    reading *trace = malloc(count * sizeof *trace);
+    uint32_t slot = 1000000;
+    uint32_t readings;
+    uint32_t least = UINT32_MAX;
+    uint32_t decoded = 0;
+    uint32_t index;
+    volatile uint32_t sink = 0;
+    double encode_ns;
+    double start;
+    int errors = 0;
+
+    // the traces are generated before the timing
+    bench_seed = 1 + kind;
+    for(uint32_t n = 0; n < count; n++) {
+        r = bench_next(kind, n, &slot, &r);
+        trace[n] = r;
+    }
+
+    dgr_ts_archive_init(&archive, blocks, BENCH_BLOCKS);
+    start = bench_now();
+    for(uint32_t n = 0; n < count; n++) {
+        errors += !dgr_ts_archive_append(&archive, &trace[n]);
+    }
+    encode_ns = (bench_now() - start) * 1e9 / count;
+    for(uint32_t n = count > BENCH_HISTORY ? count - BENCH_HISTORY : 0; n < count; n++) {
+        history[n % BENCH_HISTORY] = trace[n];
+    }
+
+    // the fewest readings the full archive held, right after it dropped a block
+    dgr_ts_archive_init(&archive, blocks, BENCH_BLOCKS);
+    for(uint32_t n = 0; n < count; n++) {
+        dgr_ts_archive_append(&archive, &trace[n]);
+        if(dgr_ts_archive_blocks(&archive) == BENCH_BLOCKS && dgr_ts_archive_readings(&archive) < least) {
+            least = dgr_ts_archive_readings(&archive);
+        }
+    }
+    free(trace);
+
+    // the archive holds the newest readings
+    readings = dgr_ts_archive_readings(&archive);
+    index = count - readings;
+    for(uint16_t block = 0; block < dgr_ts_archive_blocks(&archive); block++) {
+        ts_decoder decoder;
+        reading out;
+
+        dgr_ts_decoder_init(&decoder, &archive, block);
+        while(dgr_ts_decoder_next(&decoder, &out)) {
+            const reading *expected = &history[index++ % BENCH_HISTORY];
+
+            errors += memcmp(&out, expected, sizeof out) != 0;
+        }
+    }
+    errors += index != count || readings > BENCH_HISTORY;
+
+    start = bench_now();
+    for(int pass = 0; pass < BENCH_DECODE_PASSES; pass++) {
+        for(uint16_t block = 0; block < dgr_ts_archive_blocks(&archive); block++) {
+            ts_decoder decoder;
+            reading out;
+
+            dgr_ts_decoder_init(&decoder, &archive, block);
+            while(dgr_ts_decoder_next(&decoder, &out)) {
+                sink += out.glucose;
+                decoded++;
+            }
+        }
+    }
+
+    printf("%-12s %4u readings (%4.1f h), at least %4u (%4.1f h), %5.1f bits/reading, %4.1fx, enc %3.0f ns, "
+           "dec %3.0f ns%s\n", trace_names[kind], readings, readings * 5 / 60.0, least, least * 5 / 60.0,
+           BENCH_BLOCKS * TS_BLOCK_SIZE * 8.0 / readings,
+           readings * (double) sizeof(reading) / (BENCH_BLOCKS * TS_BLOCK_SIZE), encode_ns,
+           (bench_now() - start) * 1e9 / decoded, errors == 0 ? "" : ", MISMATCH");
+    (void) sink;
+    return errors;
+}
+
+int
+main(int argc, char **argv) {
+    uint32_t count = argc > 1 ? atoi(argv[1]) : 100000;
+    int errors = 0;
+
+    if(count < BENCH_HISTORY) {
+        count = BENCH_HISTORY;
+    }
+
+    printf("%u readings per trace, %d blocks of %d bytes\n", count, BENCH_BLOCKS, TS_BLOCK_SIZE);
+    for(int kind = 0; kind < TRACE_COUNT; kind++) {
+        errors += bench_trace((trace_kind) kind, count);
+    }
+
+    return errors == 0 ? 0 : 1;
+}